@@ -0,0 +1,197 @@
+/*
+ * Author:      Richard Cornwell (rich@sky-visions.com)
+ *
+ * Copyright (C) 2021 Richard Cornwell.
+ *
+ * This file may be distributed under the terms of the Q Public License
+ * as defined by Trolltech AS of Norway and appearing in the file
+ * LICENSE.QPL included in the packaging of this file.
+ *
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING
+ * THE WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL,
+ * INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING
+ * FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION
+ * WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+#include "Bench.h"
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+namespace core
+{
+
+double BenchStats::min() const
+{
+    if (samples.empty())
+        return 0.0;
+    return *std::min_element(samples.begin(), samples.end());
+}
+
+double BenchStats::max() const
+{
+    if (samples.empty())
+        return 0.0;
+    return *std::max_element(samples.begin(), samples.end());
+}
+
+double BenchStats::mean() const
+{
+    double  total = 0.0;
+    if (samples.empty())
+        return 0.0;
+    for (auto s : samples)
+        total += s;
+    return total / samples.size();
+}
+
+double BenchStats::percentile(double p) const
+{
+    if (samples.empty())
+        return 0.0;
+    std::vector<double> sorted(samples);
+    std::sort(sorted.begin(), sorted.end());
+    size_t rank = (size_t)std::ceil((p / 100.0) * sorted.size());
+    if (rank == 0)
+        rank = 1;
+    if (rank > sorted.size())
+        rank = sorted.size();
+    return sorted[rank - 1];
+}
+
+#ifdef __linux__
+static int perf_open(uint64_t config, int group)
+{
+    struct perf_event_attr attr{};
+
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = config;
+    attr.disabled = (group < 0) ? 1 : 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(__NR_perf_event_open, &attr, 0, -1, group, 0);
+}
+#endif
+
+PerfCounter::PerfCounter()
+{
+#ifdef __linux__
+    ref_fd_ = perf_open(PERF_COUNT_HW_CACHE_REFERENCES, -1);
+    if (ref_fd_ < 0)
+        return;
+    miss_fd_ = perf_open(PERF_COUNT_HW_CACHE_MISSES, ref_fd_);
+    if (miss_fd_ < 0) {
+        close(ref_fd_);
+        ref_fd_ = -1;
+    }
+#endif
+}
+
+PerfCounter::~PerfCounter()
+{
+#ifdef __linux__
+    if (miss_fd_ >= 0)
+        close(miss_fd_);
+    if (ref_fd_ >= 0)
+        close(ref_fd_);
+#endif
+}
+
+void PerfCounter::start()
+{
+    refs_ = misses_ = 0;
+#ifdef __linux__
+    if (!valid())
+        return;
+    ioctl(ref_fd_, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(ref_fd_, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+}
+
+void PerfCounter::stop()
+{
+#ifdef __linux__
+    if (!valid())
+        return;
+    ioctl(ref_fd_, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    if (::read(ref_fd_, &refs_, sizeof(refs_)) != sizeof(refs_))
+        refs_ = 0;
+    if (::read(miss_fd_, &misses_, sizeof(misses_)) != sizeof(misses_))
+        misses_ = 0;
+#endif
+}
+
+std::string json_quote(const std::string &str)
+{
+    std::ostringstream out;
+    out << '"';
+    for (auto c : str) {
+        switch (c) {
+        case '"':  out << "\\\""; break;
+        case '\\': out << "\\\\"; break;
+        case '\n': out << "\\n"; break;
+        case '\t': out << "\\t"; break;
+        default:
+            if ((unsigned char)c < ' ')
+                out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << (int)c;
+            else
+                out << c;
+        }
+    }
+    out << '"';
+    return out.str();
+}
+
+void write_json(std::ostream &out, const std::string &suite,
+                const std::vector<BenchResult> &results,
+                const std::string &unit)
+{
+    // The p95 figures are the slow tail, so MIPS p95 is derived from the
+    // 95th percentile of the time samples.
+    auto mips = [](double ns) {
+        return (ns > 0.0) ? 1000.0 / ns : 0.0;
+    };
+
+    // Rate in millions of units per second, MIPS for instructions.
+    std::string rate = (unit == "insn") ? "mips" : "m" + unit + "_per_sec";
+
+    out << std::fixed << std::setprecision(3);
+    out << "{" << std::endl;
+    out << "  \"suite\": " << json_quote(suite) << "," << std::endl;
+    out << "  \"unit\": " << json_quote(unit) << "," << std::endl;
+    out << "  \"results\": [";
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult &r = results[i];
+        out << ((i == 0) ? "" : ",") << std::endl;
+        out << "    {" << std::endl;
+        out << "      \"name\": " << json_quote(r.name) << "," << std::endl;
+        out << "      \"count\": " << r.count << "," << std::endl;
+        out << "      \"reps\": " << r.ns.size() << "," << std::endl;
+        out << "      \"ns_per_" << unit << "\": { \"median\": " << r.ns.median()
+            << ", \"p95\": " << r.ns.percentile(95.0)
+            << ", \"min\": " << r.ns.min()
+            << ", \"mean\": " << r.ns.mean() << " }," << std::endl;
+        out << "      " << json_quote(rate) << ": { \"median\": " << mips(r.ns.median())
+            << ", \"p95\": " << mips(r.ns.percentile(95.0))
+            << ", \"max\": " << mips(r.ns.min()) << " }";
+        for (auto &e : r.extra)
+            out << "," << std::endl << "      " << json_quote(e.first) << ": " << e.second;
+        out << std::endl << "    }";
+    }
+    out << std::endl << "  ]" << std::endl;
+    out << "}" << std::endl;
+}
+
+}
@@ -0,0 +1,149 @@
+/*
+ * Author:      Richard Cornwell (rich@sky-visions.com)
+ *
+ * Copyright (C) 2021 Richard Cornwell.
+ *
+ * This file may be distributed under the terms of the Q Public License
+ * as defined by Trolltech AS of Norway and appearing in the file
+ * LICENSE.QPL included in the packaging of this file.
+ *
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING
+ * THE WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL,
+ * INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING
+ * FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION
+ * WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <ostream>
+
+namespace core
+{
+
+/**
+ * @class BenchStats
+ * @author rich
+ * @date 18/10/26
+ * @file Bench.h
+ * @brief Collection of timing samples for one benchmark.
+ */
+class BenchStats
+{
+public:
+    /**
+     * @brief Add one sample.
+     * @param value Sample to add.
+     */
+    void add(double value)
+    {
+        samples.push_back(value);
+    }
+
+    size_t size() const
+    {
+        return samples.size();
+    }
+
+    double min() const;
+    double max() const;
+    double mean() const;
+
+    /**
+     * @brief Return the p'th percentile of the samples, using the nearest
+     *     rank method.
+     * @param p Percentile between 0 and 100.
+     */
+    double percentile(double p) const;
+
+    double median() const
+    {
+        return percentile(50.0);
+    }
+
+    std::vector<double> samples;
+};
+
+/**
+ * @class BenchResult
+ * @author rich
+ * @date 18/10/26
+ * @file Bench.h
+ * @brief Results of one benchmark. Each repetition adds a sample of nano
+ *     seconds per unit of work, MIPS figures are derived from those.
+ */
+struct BenchResult
+{
+    std::string                    name;
+    uint64_t                       count = 0;      // Units of work per repetition.
+    BenchStats                     ns;             // Nano seconds per unit.
+    std::map<std::string, double>  extra;          // Additional values to report.
+};
+
+/**
+ * @class PerfCounter
+ * @author rich
+ * @date 18/10/26
+ * @file Bench.h
+ * @brief Hardware cache reference and miss counters for the calling
+ *     thread. On systems without perf events, or when access is denied,
+ *     valid() returns false and all counts read as zero.
+ */
+class PerfCounter
+{
+public:
+    PerfCounter();
+    ~PerfCounter();
+
+    PerfCounter(const PerfCounter&) = delete;
+    PerfCounter& operator=(const PerfCounter&) = delete;
+
+    bool valid() const
+    {
+        return miss_fd_ >= 0;
+    }
+
+    void start();
+    void stop();
+
+    uint64_t references() const
+    {
+        return refs_;
+    }
+
+    uint64_t misses() const
+    {
+        return misses_;
+    }
+
+private:
+    int        ref_fd_ = -1;
+    int        miss_fd_ = -1;
+    uint64_t   refs_ = 0;
+    uint64_t   misses_ = 0;
+};
+
+/**
+ * @brief Write list of results as a JSON document.
+ * @param out Stream to write to.
+ * @param suite Name of benchmark suite.
+ * @param results Results to write.
+ * @param unit Name of unit of work, "insn" for instructions.
+ */
+void write_json(std::ostream &out, const std::string &suite,
+                const std::vector<BenchResult> &results,
+                const std::string &unit = "insn");
+
+/**
+ * @brief Quote a string for JSON output.
+ */
+std::string json_quote(const std::string &str);
+
+}
@@ -45,6 +45,7 @@
 #include <variant>
 #include "Memory.h"
 #include "IO.h"
+#include "State.h"
 #include "ConfigOption.h"
 
 namespace emulator
@@ -315,6 +316,26 @@ public:
 
     virtual void trace() {};
 
+    /**
+     * @brief Save registers, subclasses save theirs after calling this.
+     * @param out Where to write state.
+     */
+    virtual void save(core::StateOut &out)
+    {
+        out.put(running);
+        out.put((uint64_t)pc);
+    }
+
+    /**
+     * @brief Restore registers written by save().
+     * @param in Where to read state.
+     */
+    virtual void load(core::StateIn &in)
+    {
+        in.get(running);
+        pc = (size_t)in.get<uint64_t>();
+    }
+
     /**
      * @brief Return optional settings for this CPU module.
      * @return ConfigOptions object of supported options.
@@ -323,9 +344,25 @@ public:
     core::ConfigOptionParser options()
     {
         core::ConfigOptionParser option("CPU Options");
+        option.add<core::ConfigValue<std::string>>("affinity",
+                  "Host cores to run on, e.g. 0-3,8", "", &affinity);
+        option.add<core::ConfigValue<int>>("numa",
+                  "Host NUMA node for memory", -1, &numa_node);
         return option;
     };
 
+    /**
+     * @brief Host cores the thread running this CPU is pinned to, in the
+     *     form "0-3,8". Empty to let the host choose.
+     */
+    std::string affinity;
+
+    /**
+     * @brief Host NUMA node to place memory of this CPU on, -1 to use the
+     *     node of the first affinity core, or leave it to the host.
+     */
+    int numa_node = -1;
+
 //    virtual void examine(uint64_t& val, size_t addr)
 //    {
 //        mem->read(val, addr);
@@ -379,7 +416,7 @@ private:
     public: \
         model##CPUFactory() \
         { \
-            std::cout << "Registering CPU: " #model << "\n"; \
+            std::cerr << "Registering CPU: " #model << "\n"; \
             systype::registerCPU(#model, this); \
         } \
         virtual CPU_v create() { \
@@ -0,0 +1,425 @@
+/*
+ * Author:      Richard Cornwell (rich@sky-visions.com)
+ *
+ * Copyright (C) 2021 Richard Cornwell.
+ *
+ * This file may be distributed under the terms of the Q Public License
+ * as defined by Trolltech AS of Norway and appearing in the file
+ * LICENSE.QPL included in the packaging of this file.
+ *
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING
+ * THE WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL,
+ * INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING
+ * FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION
+ * WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <map>
+#include <memory>
+#include <algorithm>
+#include "CPU.h"
+#include "Memory.h"
+#include "IO.h"
+
+namespace emulator
+{
+
+/**
+ * @class TravelMem
+ * @author rich
+ * @date 18/10/26
+ * @file Checkpoint.h
+ * @brief Memory wrapper used for reverse execution. Passes all accesses
+ *     on, pages written are tracked by the dirty map of the memory under
+ *     it. Can watch for writes to one address.
+ */
+template <typename T>
+class TravelMem : public Memory<T>
+{
+public:
+    explicit TravelMem(std::shared_ptr<Memory<T>> mem) :
+        Memory<T>(mem->getSize(), 0), mem_(mem)
+    {
+    }
+
+    virtual size_t getSize() const override
+    {
+        return mem_->getSize();
+    }
+
+    virtual void Get(T &val, size_t index) override
+    {
+        mem_->Get(val, index);
+    }
+
+    virtual void Set(T val, size_t index) override
+    {
+        mem_->Set(val, index);
+    }
+
+    virtual bool read(T &val, size_t index) override
+    {
+        return mem_->read(val, index);
+    }
+
+    virtual bool write(T val, size_t index) override
+    {
+        if (watching && index == watch_addr)
+            hit = true;
+        return mem_->write(val, index);
+    }
+
+    virtual size_t read_block(T *buf, size_t index, size_t n) override
+    {
+        return mem_->read_block(buf, index, n);
+    }
+
+    virtual size_t write_block(const T *buf, size_t index, size_t n) override
+    {
+        if (watching && watch_addr >= index && watch_addr - index < n)
+            hit = true;
+        return mem_->write_block(buf, index, n);
+    }
+
+    virtual unsigned pageShift() const override
+    {
+        return mem_->pageShift();
+    }
+
+    virtual void dirty_since(std::vector<uint64_t> &bits,
+                             uint64_t since) const override
+    {
+        mem_->dirty_since(bits, since);
+    }
+
+    virtual void mark_dirty() override
+    {
+        mem_->mark_dirty();
+    }
+
+    /**
+     * @brief When watching, hit is set by any write to watch_addr.
+     */
+    bool                        watching = false;
+    size_t                      watch_addr = 0;
+    bool                        hit = false;
+
+private:
+    std::shared_ptr<Memory<T>>  mem_;
+};
+
+/**
+ * @class TravelIO
+ * @author rich
+ * @date 18/10/26
+ * @file Checkpoint.h
+ * @brief I/O wrapper used for reverse execution. While live, values read
+ *     from each port are saved whenever they change. While replaying
+ *     history the saved values are returned, output is dropped and the
+ *     devices are not stepped, so re-execution is exact and the outside
+ *     world only sees the run once.
+ */
+template <typename T>
+class TravelIO : public IO<T>
+{
+public:
+    explicit TravelIO(std::shared_ptr<IO<T>> io) : io_(io)
+    {
+    }
+
+    virtual void addIo(std::shared_ptr<IO<T>> io) override
+    {
+        io_->addIo(io);
+    }
+
+    virtual void addDevice(std::shared_ptr<Device<T>> dev) override
+    {
+        io_->addDevice(dev);
+    }
+
+    virtual void init() override
+    {
+        io_->init();
+    }
+
+    virtual void start() override
+    {
+        io_->start();
+    }
+
+    virtual void reset() override
+    {
+        io_->reset();
+    }
+
+    virtual void step() override
+    {
+        if (!replay)
+            io_->step();
+    }
+
+    virtual void run() override
+    {
+        io_->run();
+    }
+
+    virtual void stop() override
+    {
+        io_->stop();
+    }
+
+    virtual void shutdown() override
+    {
+        io_->shutdown();
+    }
+
+    virtual bool input(T &val, size_t port) override
+    {
+        if (replay)
+            return lookup(in_, val, port);
+        bool r = io_->input(val, port);
+        save(in_, val, r, port);
+        return r;
+    }
+
+    virtual bool output(T val, size_t port) override
+    {
+        if (replay)
+            return true;
+        return io_->output(val, port);
+    }
+
+    virtual bool status(T &val, size_t port) override
+    {
+        if (replay)
+            return lookup(stat_, val, port);
+        bool r = io_->status(val, port);
+        save(stat_, val, r, port);
+        return r;
+    }
+
+    virtual bool command(T val, size_t port) override
+    {
+        if (replay)
+            return true;
+        return io_->command(val, port);
+    }
+
+    /**
+     * @brief Instruction count, kept up to date by the controller.
+     */
+    uint64_t   now = 0;
+
+    /**
+     * @brief Set while re-executing history.
+     */
+    bool       replay = false;
+
+private:
+    struct change {
+        uint64_t  count;
+        T         val;
+        bool      ok;
+    };
+
+    using port_log = std::map<size_t, std::vector<change>>;
+
+    // Polling a status port returns the same value many times, so only
+    // save values that differ from the last one read.
+    void save(port_log &log, T val, bool ok, size_t port)
+    {
+        auto &l = log[port];
+        if (l.empty() || l.back().val != val || l.back().ok != ok)
+            l.push_back(change{now, val, ok});
+    }
+
+    bool lookup(port_log &log, T &val, size_t port)
+    {
+        auto &l = log[port];
+        auto it = std::upper_bound(l.begin(), l.end(), now,
+                 [](uint64_t c, const change &e) { return c < e.count; });
+        if (it == l.begin()) {
+            val = 0;
+            return false;
+        }
+        --it;
+        val = it->val;
+        return it->ok;
+    }
+
+    std::shared_ptr<IO<T>>  io_;
+    port_log                in_;
+    port_log                stat_;
+};
+
+/**
+ * @class Checkpoints
+ * @author rich
+ * @date 18/10/26
+ * @file Checkpoint.h
+ * @brief List of checkpoints for reverse execution. Each holds CPU state
+ *     S and the memory pages that changed since the one before, the first
+ *     holds all of memory. Changed pages come from the dirty map of the
+ *     memory, followed with an epoch of its own. When the list grows
+ *     past its memory budget every other checkpoint is merged into the
+ *     next and the interval between checkpoints is doubled.
+ */
+template <typename T, class S>
+class Checkpoints
+{
+public:
+    struct Checkpoint {
+        uint64_t                           count;   // Instructions executed.
+        S                                  state;   // CPU state.
+        std::map<size_t, std::vector<T>>   pages;   // Pages changed.
+    };
+
+    /**
+     * @param budget_v Bytes of memory that may be used.
+     * @param interval_v Starting time between checkpoints.
+     */
+    Checkpoints(size_t budget_v, uint64_t interval_v) :
+        budget(budget_v), interval(interval_v)
+    {
+    }
+
+    /**
+     * @brief Add a checkpoint for the current memory. Must be called with
+     *     count greater than the last checkpoint.
+     */
+    void take(uint64_t count, const S &state, Memory<T> &mem)
+    {
+        Checkpoint             cp{count, state, {}};
+        std::vector<uint64_t>  bits;
+        uint64_t               next = core::dirty_epoch();
+
+        // The first checkpoint holds every page. Memory that does not
+        // track writes has every page checked against the last copy.
+        mem.dirty_since(bits, since_);
+        since_ = next;
+        if (list_.empty()) {
+            shift_ = (mem.pageShift() != 0) ? mem.pageShift() : 10;
+            shadow_.resize(mem.getSize());
+        }
+        size_t         psize = (size_t)1 << shift_;
+        size_t         pages = ((shadow_.size() - 1) >> shift_) + 1;
+        std::vector<T> page(psize);
+        for (size_t p = 0; p < pages; p++) {
+            if (!list_.empty() && !bits.empty() &&
+                ((p >> 6) >= bits.size() || (bits[p >> 6] & (1llu << (p & 63))) == 0))
+                continue;
+            size_t base = p << shift_;
+            size_t n = std::min(psize, shadow_.size() - base);
+            for (size_t i = 0; i < n; i++)
+                mem.Get(page[i], base + i);
+            if (!list_.empty() &&
+                std::equal(page.begin(), page.begin() + n, shadow_.begin() + base))
+                continue;
+            std::copy(page.begin(), page.begin() + n, shadow_.begin() + base);
+            cp.pages.emplace(p, std::vector<T>(page.begin(), page.begin() + n));
+            bytes_ += n * sizeof(T);
+        }
+        bytes_ += sizeof(Checkpoint);
+        list_.push_back(std::move(cp));
+        if (bytes_ > budget)
+            thin();
+    }
+
+    /**
+     * @brief Index of the last checkpoint at or before count.
+     */
+    size_t find(uint64_t count) const
+    {
+        auto it = std::upper_bound(list_.begin(), list_.end(), count,
+                 [](uint64_t c, const Checkpoint &cp) { return c < cp.count; });
+        return (it == list_.begin()) ? 0 : (size_t)(it - list_.begin()) - 1;
+    }
+
+    /**
+     * @brief Put memory back as it was at checkpoint idx.
+     */
+    void restore(size_t idx, Memory<T> &mem) const
+    {
+        size_t  pages = ((shadow_.size() - 1) >> shift_) + 1;
+
+        // Set() marks the pages written, so the next checkpoint compares
+        // them with the newest copy.
+        for (size_t p = 0; p < pages; p++) {
+            for (size_t k = idx + 1; k-- > 0; ) {
+                auto pg = list_[k].pages.find(p);
+                if (pg == list_[k].pages.end())
+                    continue;
+                size_t base = p << shift_;
+                for (size_t i = 0; i < pg->second.size(); i++)
+                    mem.Set(pg->second[i], base + i);
+                break;
+            }
+        }
+    }
+
+    const Checkpoint &operator[](size_t idx) const
+    {
+        return list_[idx];
+    }
+
+    size_t size() const
+    {
+        return list_.size();
+    }
+
+    bool empty() const
+    {
+        return list_.empty();
+    }
+
+    /**
+     * @brief Bytes held by the checkpoints.
+     */
+    size_t bytes() const
+    {
+        return bytes_;
+    }
+
+    size_t     budget;
+    uint64_t   interval;
+
+private:
+    // Drop every other checkpoint, keeping the first and last, and double
+    // the interval so the list grows half as fast from now on.
+    void thin()
+    {
+        while (bytes_ > budget && list_.size() > 2) {
+            std::vector<Checkpoint> keep;
+            for (size_t i = 0; i < list_.size(); i++) {
+                if ((i & 1) == 0 || i == list_.size() - 1) {
+                    keep.push_back(std::move(list_[i]));
+                    continue;
+                }
+                // Pages not changed again by the next one move into it.
+                for (auto &pg : list_[i].pages) {
+                    if (!list_[i + 1].pages.try_emplace(pg.first, std::move(pg.second)).second)
+                        bytes_ -= pg.second.size() * sizeof(T);
+                }
+                bytes_ -= sizeof(Checkpoint);
+            }
+            list_ = std::move(keep);
+            interval *= 2;
+        }
+    }
+
+    std::vector<Checkpoint>   list_;
+    std::vector<T>            shadow_;
+    unsigned                  shift_ = 10;
+    uint64_t                  since_ = 1;     // Dirty epoch of last take.
+    size_t                    bytes_ = 0;
+};
+
+}
@@ -53,18 +53,13 @@ void CmdHistory::init()
 
 void CmdHistory::send(const std::string & str)
 {
-    for(const char& c : str) {
-        //     std::cerr << "Sending: " << c << std::endl;
-        send_char->notify((void *)&c);
-        pos++;
-    }
+    send_char->notify_n(str.data(), str.size());
+    pos += (int)str.size();
 }
 
 void CmdHistory::send_esc(const std::string & str)
 {
-    for(const char& c : str) {
-        send_char->notify((void *)&c);
-    }
+    send_char->notify_n(str.data(), str.size());
 }
 
 void CmdHistory::leftChar()
@@ -124,13 +119,11 @@ void CmdHistory::backSpace()
     // Refresh rest of line.
     int count = 0;
     for (size_t i = buf_end; i < (sizeof(buffer)-1); i++) {
-        char c;
-        c = buffer[i];
-        if (c == '\r')      // Stop at end of line
+        if (buffer[i] == '\r')      // Stop at end of line
             break;
-        send_char->notify((void *)&c);  // Echo remainder of line.
         count++;
     }
+    send_char->notify_n(&buffer[buf_end], count);  // Echo remainder of line.
     // Move cursor back to input spot.
     if (count > 0) {
         std::string back = "\033[" + std::to_string(count) + "D";
@@ -162,13 +155,11 @@ void CmdHistory::deleteNext()
     // Refresh the rest of line.
     int count = 0;
     for (size_t i = buf_end; i < (sizeof(buffer)-1); i++) {
-        char c;
-        c = buffer[i];
-        if (c == '\r')          // Stop at end of line
+        if (buffer[i] == '\r')          // Stop at end of line
             break;
-        send_char->notify((void *)&c);  // Echo remainder of line.
         count++;
     }
+    send_char->notify_n(&buffer[buf_end], count);  // Echo remainder of line.
     // Move cursor back to input spot.
     if (count > 0) {
         std::string back = "\033[" + std::to_string(count) + "D";
@@ -201,13 +192,11 @@ void CmdHistory::insertChar(char ch)
     int count = 0;
     // Refresh rest of line
     for (size_t i = buf_end; i < (sizeof(buffer)-1); i++) {
-        char c;
-        c = buffer[i];
-        if (c == '\r')          // Stop at end of line
+        if (buffer[i] == '\r')          // Stop at end of line
             break;
-        send_char->notify((void *)&c);  // Echo remainder of line.
         count++;
     }
+    send_char->notify_n(&buffer[buf_end], count);  // Echo remainder of line.
     // Move cursor back to input spot.
     if (count > 0) {
         std::string back = "\033[" + std::to_string(count) + "D";
@@ -261,10 +250,10 @@ void CmdHistory::moveUp()
     // Copy over to buffer.
     for(size_t i=0; i < len; i++) {
         buffer[buf_ptr] = line[i];
-        send_char->notify((void *)&buffer[buf_ptr]);
         buf_ptr++;
         pos++;
     }
+    send_char->notify_n(buffer, len);
     // Put cursor in about same place.
     while(buf_ptr > cur_pos) {
         leftChar();
@@ -314,10 +303,10 @@ void CmdHistory::searchUp()
     // Copy over to buffer.
     for(size_t i=0; i < len; i++) {
         buffer[buf_ptr] = line[i];
-        send_char->notify((void *)&buffer[buf_ptr]);
         buf_ptr++;
         pos++;
     }
+    send_char->notify_n(buffer, len);
     // Put cursor in about same place.
     while(buf_ptr > cur_pos) {
         leftChar();
@@ -354,10 +343,10 @@ void CmdHistory::moveDown()
     // Copy over to buffer.
     for(size_t i=0; i < len; i++) {
         buffer[buf_ptr] = line[i];
-        send_char->notify((void *)&buffer[buf_ptr]);
         buf_ptr++;
         pos++;
     }
+    send_char->notify_n(buffer, len);
     // Put cursor in about same place.
     while(buf_ptr > cur_pos) {
         leftChar();
@@ -411,10 +400,10 @@ void CmdHistory::searchDown()
     // Copy over to buffer.
     for(size_t i=0; i < len; i++) {
         buffer[buf_ptr] = line[i];
-        send_char->notify((void *)&buffer[buf_ptr]);
         buf_ptr++;
         pos++;
     }
+    send_char->notify_n(buffer, len);
     // Put cursor in about same place.
     while(buf_ptr > cur_pos) {
         leftChar();
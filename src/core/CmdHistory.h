@@ -20,6 +20,7 @@
 #pragma once
 #include <stdio.h>
 #include <string>
+#include <vector>
 #include "Command.h"
 #include "Console.h"
 
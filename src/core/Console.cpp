@@ -26,6 +26,7 @@
  */
 
 #include "config.h"
+#include <algorithm>
 #include <iostream>
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
@@ -38,6 +39,7 @@
 #include <termios.h>
 #endif
 #include <fcntl.h>
+#include <poll.h>
 #include <sys/types.h>
 #include <errno.h>
 #endif
@@ -55,6 +57,7 @@ namespace core
 
 Console::~Console()
 {
+    stop_writer();
     if (running) {
         running = false;
         // Kill running thread.
@@ -71,8 +74,6 @@ Console::~Console()
         }
 #endif
     }
-    delete send_char;
-    delete recv_char;
 }
 
 
@@ -121,64 +122,52 @@ void Console::init()
     // Create a thread.
     if (!running) {
         thrd = new std::thread(&Console::start_reader, this);
+        start_writer();
 
-        // Create send character listener.
-        EventCallback<Console>*callback =
-            new EventCallback<Console>(this, &Console::show_char);
-        send_char = new Event();
-        send_char->addListener(callback);
-        // And create recieve character event handler.
-        recv_char = new Event();
-        EventCallback<Console>*callback2 =
-            new EventCallback<Console>(this, &Console::show_char);
-        cmd_s_char = new Event();
-        cmd_s_char->addListener(callback2);
-        cmd_r_char = new Event();
-        wru_event = new Event();
-        attn_event = new Event();
+        // Characters sent by the system and the command line are shown.
+        Delegate  show = Delegate::bind<Console, &Console::show_char,
+                                        &Console::show_chars>(this);
+        send_char.addListener(show);
+        cmd_s_char.addListener(show);
     }
 };
 
 Event* Console::getSendChar()
 {
-    return send_char;
+    return &send_char;
 };
 
 Event* Console::getCmd_send_char()
 {
-    return cmd_s_char;
+    return &cmd_s_char;
 }
 
 void Console::addCmd_recv_key(Command_reader *rdr)
 {
-    EventCallback<Command_reader>*callback = new
-    EventCallback<Command_reader>(rdr, &Command_reader::recv_key);
-    cmd_r_char->addListener(callback);
+    cmd_r_char.addListener(
+        Delegate::bind<Command_reader, &Command_reader::recv_key>(rdr));
 }
 
 void Console::addReadChar(Console_reader *rdr)
 {
-    EventCallback<Console_reader>*callback = new
-    EventCallback<Console_reader>(rdr, &Console_reader::recv_char);
-    recv_char->addListener(callback);
+    recv_char.addListener(
+        Delegate::bind<Console_reader, &Console_reader::recv_char,
+                       &Console_reader::recv_chars>(rdr));
 };
 
 void Console::addWruEvent(Console_wru *wru_)
 {
-    EventCallback<Console_wru>*callback = new
-    EventCallback<Console_wru>(wru_, &Console_wru::wru);
-    wru_event->addListener(callback);
+    wru_event.addListener(Delegate::bind<Console_wru, &Console_wru::wru>(wru_));
 };
 
 void Console::addAttnEvent(Console_attn *attn_)
 {
-    EventCallback<Console_attn>*callback = new
-    EventCallback<Console_attn>(attn_, &Console_attn::attn);
-    attn_event->addListener(callback);
+    attn_event.addListener(Delegate::bind<Console_attn, &Console_attn::attn>(attn_));
 };
 
 void Console::shutdown()
 {
+    stop_writer();
     if (running) {
         running = false;
         // Kill running thread.
@@ -197,19 +186,134 @@ void Console::shutdown()
 #endif
 }
 
+void Console::start_output(int fd)
+{
+#if (defined(__linux) || defined(__linux__))
+    int  flags = fcntl(fd, F_GETFL);
+    if (flags >= 0)
+        (void)fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+#endif
+    out_fd = fd;
+    start_writer();
+}
+
 void Console::show_char(void *ch)
 {
-    if (running) {
+    show_chars((const char *)ch, 1);
+}
+
+void Console::show_chars(const char *data, size_t n)
+{
+    std::lock_guard<std::mutex> lock(out_lock);
+
+    if (out_thrd == nullptr || out_stop)
+        return;
+    bool    was_empty = out_buf.empty();
+    size_t  len = std::min(out_size - out_buf.size(), n);
+    out_buf.insert(out_buf.end(), data, data + len);
+    if (len != n) {
+        // Terminal is behind, drop the rest rather than hold up the guest.
+        out_dropped.fetch_add(n - len, std::memory_order_relaxed);
+    }
+    // Wake the output thread to start a tick, or at once if half full.
+    if (out_buf.size() >= out_size / 2) {
+        out_now = true;
+        out_ready.notify_one();
+    } else if (was_empty) {
+        out_ready.notify_one();
+    }
+}
+
+void Console::flush()
+{
+    std::lock_guard<std::mutex> lock(out_lock);
+
+    if (!out_buf.empty()) {
+        out_now = true;
+        out_ready.notify_one();
+    }
+}
+
+void Console::start_writer()
+{
+    if (out_thrd != nullptr)
+        return;
+    out_buf.reserve(out_size);
+    out_spare.reserve(out_size);
+    out_stop = false;
+    out_thrd = new std::thread(&Console::writer, this);
+}
+
+void Console::writer()
+{
+    std::unique_lock<std::mutex> lock(out_lock);
+
+    for (;;) {
+        out_ready.wait(lock, [this] { return !out_buf.empty() || out_stop; });
+        // Gather what arrives during the tick into one write.
+        if (!out_now && !out_stop)
+            out_ready.wait_for(lock, out_tick, [this] {
+                return out_now || out_stop;
+            });
+        out_now = false;
+        if (out_buf.empty()) {
+            if (out_stop)
+                return;
+            continue;
+        }
+        out_buf.swap(out_spare);
+        lock.unlock();
+        bool  done = write_out(out_spare.data(), out_spare.size());
+        out_spare.clear();
+        lock.lock();
+        if (!done && out_stop) {
+            // Terminal is not taking output, drop the rest.
+            out_buf.clear();
+            return;
+        }
+    }
+}
+
+void Console::stop_writer()
+{
+    {
+        std::lock_guard<std::mutex> lock(out_lock);
+        if (out_thrd == nullptr)
+            return;
+        out_stop = true;
+        out_ready.notify_one();
+    }
+    // Anything still queued is written before the thread exits.
+    out_thrd->join();
+    delete out_thrd;
+    out_thrd = nullptr;
+}
+
+bool Console::write_out(const char *data, size_t n)
+{
 #if (defined(_WIN32) || defined(_WIN64))
-        std::cout << ch << std::flush;
+    std::cout.write(data, n) << std::flush;
+    return true;
 #else
-        while(1) {
-            int r = write(term, ch, 1);
-            if (r == 1 || (errno != EAGAIN && errno != EINTR))
-                return;
+    int  fd = (out_fd >= 0) ? out_fd : term;
+
+    while (n != 0) {
+        ssize_t r = write(fd, data, n);
+        if (r > 0) {
+            data += r;
+            n -= (size_t)r;
+        } else if (r < 0 && errno == EAGAIN) {
+            // Terminal is non-blocking, wait until it can take more. Give
+            // up if it has not by the time output is stopped.
+            struct pollfd  pfd{fd, POLLOUT, 0};
+            if (poll(&pfd, 1, (int)out_wait.count()) == 0 && out_stop)
+                return false;
+        } else if (r == 0 || errno != EINTR) {
+            return false;
         }
-#endif
     }
+    return true;
+#endif
 }
 
 #define CTRLC(x) x - '@'
@@ -375,7 +479,7 @@ void Console::recv_key(char ch)
         }
         break;
     }
-    cmd_r_char->notify((void *)&key);
+    cmd_r_char.notify((void *)&key);
 }
 #else
 void Console::recv_key(int ch)
@@ -538,7 +642,7 @@ void Console::recv_key(int ch)
         }
         break;
     }
-    cmd_r_char->notify((void *)&key);
+    cmd_r_char.notify((void *)&key);
 }
 #endif
 
@@ -553,30 +657,39 @@ void Console::reader()
     running = true;
     while(running) {
 #if (defined(_WIN32) || defined(_WIN64))
-        int    c = _getch();
+        char   buf[1];
+        int    n = 1;
+        buf[0] = (char)_getch();
 #else
-        char   c;
-        if (read(term, &c, 1) == 1) {
+        char   buf[64];
+        int    n = (int)read(term, buf, sizeof(buf));
 #endif
-        // If we are in quote state accept next char unchecked.
-        if (cmd_state == CmdState::quote) {
-            recv_key(c);
-            cmd_state = CmdState::idle;
-        } else if (c == wru) {
-            mode = !mode;
-            wru_event->notify((void *)&mode);
-        } else if (attn != 0 && c == attn) {
-            attn_event->notify((void *)&c);
-        } else if (mode) {
-            recv_key(c);
-        } else {
-            recv_char->notify((void *)&c);
+        // Characters for the system are passed on as one burst, up to
+        // the next one that needs handling here.
+        int    run = 0;
+        for (int i = 0; i < n; i++) {
+            char  c = buf[i];
+            if (cmd_state != CmdState::quote && c != wru &&
+                !(attn != 0 && c == attn) && !mode)
+                continue;
+            recv_char.notify_n(buf + run, i - run);
+            run = i + 1;
+            // If we are in quote state accept next char unchecked.
+            if (cmd_state == CmdState::quote) {
+                recv_key(c);
+                cmd_state = CmdState::idle;
+            } else if (c == wru) {
+                mode = !mode;
+                wru_event.notify((void *)&mode);
+            } else if (attn != 0 && c == attn) {
+                attn_event.notify((void *)&c);
+            } else {
+                recv_key(c);
+            }
         }
-#if !(defined(_WIN32) || defined(_WIN64))
+        if (n > run)
+            recv_char.notify_n(buf + run, n - run);
     }
-#endif
-}
-return;
 }
 
 }
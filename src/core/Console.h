@@ -43,7 +43,12 @@
 #include <windows.h>
 #include <conio.h>
 #endif
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
 #include <thread>
+#include <vector>
 #include "Event.h"
 
 namespace core
@@ -68,17 +73,29 @@ struct CmdKey {
 class Console_reader
 {
 public:
-    Console_reader(void *obj, void (*function)(void *o, void *ev))
-        : obj(obj), function(function) {}
+    Console_reader(void *obj, void (*function)(void *o, void *ev),
+                   void (*burst)(void *o, const char *data, size_t n) = nullptr)
+        : obj(obj), function(function), burst(burst) {}
 
     void recv_char(void *ev)
     {
         function(obj, ev);
     }
 
+    void recv_chars(const char *data, size_t n)
+    {
+        if (burst != nullptr) {
+            burst(obj, data, n);
+            return;
+        }
+        for (size_t i = 0; i < n; i++)
+            function(obj, const_cast<char *>(data + i));
+    }
+
 private:
     void *obj;
     void (*function)(void *o, void *ev);
+    void (*burst)(void *o, const char *data, size_t n);
 };
 
 class Command_reader
@@ -166,17 +183,66 @@ public:
 
     void show_char(void *ch);
 
+    /**
+     * @brief Start the output thread writing to fd rather than the
+     *     terminal. The fd is made non-blocking, init() does not change it.
+     */
+    void start_output(int fd);
+
+    /**
+     * @brief Queue characters for the terminal. They are written by the
+     *     output thread at the next tick, or sooner once half the buffer
+     *     is used. The caller never waits on the terminal, characters
+     *     that do not fit while it is behind are dropped.
+     */
+    void show_chars(const char *data, size_t n);
+
+    /**
+     * @brief Characters dropped because the terminal fell behind.
+     */
+    uint64_t dropped() const
+    {
+        return out_dropped.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Write out queued characters now rather than at the next
+     *     tick, called when the guest goes idle.
+     */
+    void flush();
+
+    /**
+     * @brief Characters queued before show_chars() starts dropping them.
+     */
+    static constexpr size_t out_size = 16384;
+
+    /**
+     * @brief Longest time characters are held before being written.
+     */
+    static constexpr std::chrono::milliseconds out_tick{10};
+
+    /**
+     * @brief Devices that may read from the console.
+     */
+    static constexpr size_t max_readers = 64;
+
+    /**
+     * @brief Longest wait for the terminal to take more once output is
+     *     being stopped, characters it will not take are dropped.
+     */
+    static constexpr std::chrono::milliseconds out_wait{100};
+
 private:
     /**
      * @brief
      */
     std::thread      *thrd;
-    Event            *send_char;
-    Event            *recv_char;
-    Event            *cmd_s_char;
-    Event            *cmd_r_char;
-    Event            *wru_event;
-    Event            *attn_event;
+    Event            send_char;
+    BasicEvent<max_readers> recv_char;    // One listener per device.
+    Event            cmd_s_char;
+    Event            cmd_r_char;
+    Event            wru_event;
+    Event            attn_event;
 #if (defined(__linux) || defined(__linux__))
     struct termios   save_termios;
     bool             term_saved = false;  // Terminal settings saved.
@@ -201,6 +267,24 @@ private:
     static void start_reader(Console *self);
 
     void reader();
+
+    void start_writer();
+
+    void writer();
+
+    void stop_writer();
+
+    bool write_out(const char *data, size_t n);
+
+    std::thread              *out_thrd = nullptr;
+    std::mutex                out_lock;
+    std::condition_variable   out_ready;    // Output thread waits here.
+    std::vector<char>         out_buf;      // Characters being queued.
+    std::vector<char>         out_spare;    // Characters being written.
+    int                       out_fd = -1;       // Output file handle if not term.
+    bool                      out_now = false;   // Write without waiting.
+    std::atomic<bool>         out_stop{false};   // Output thread to exit.
+    std::atomic<uint64_t>     out_dropped{0};    // Characters not queued.
 };
 
 
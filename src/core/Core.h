@@ -18,9 +18,12 @@
  */
 
 #pragma once
+#include <atomic>
 #include <mutex>
 #include <condition_variable>
+#include <functional>
 #include <memory>
+#include <thread>
 #include <string>
 #include <vector>
 
@@ -137,3 +140,43 @@ private:
     const size_t max_size_;
     bool full_ = false;
 };
+
+/**
+ * @brief Reusable barrier for a fixed number of threads. The last thread
+ *     to arrive runs the completion function before any thread is
+ *     released, so everything it writes is seen by all threads. Waiters
+ *     spin briefly then yield, phases are expected to be short.
+ */
+class Barrier
+{
+public:
+    explicit Barrier(size_t count, std::function<void()> completion = nullptr) :
+        count_(count), completion_(completion)
+    {}
+
+    Barrier(const Barrier&) = delete;
+    Barrier& operator= (const Barrier &) = delete;
+
+    void arrive_and_wait()
+    {
+        size_t gen = gen_.load(std::memory_order_acquire);
+
+        if (waiting_.fetch_add(1, std::memory_order_acq_rel) + 1 == count_) {
+            if (completion_)
+                completion_();
+            waiting_.store(0, std::memory_order_relaxed);
+            gen_.store(gen + 1, std::memory_order_release);
+            return;
+        }
+        for (int spin = 0; gen_.load(std::memory_order_acquire) == gen; spin++) {
+            if (spin > 1000)
+                std::this_thread::yield();
+        }
+    }
+
+private:
+    const size_t          count_;
+    std::function<void()> completion_;
+    std::atomic<size_t>   waiting_{0};
+    std::atomic<size_t>   gen_{0};
+};
@@ -23,12 +23,85 @@
 #include <variant>
 #include <string>
 #include <map>
+#include <functional>
 #include "ConfigOption.h"
 #include "IO.h"
+#include "State.h"
 
 namespace emulator
 {
 
+/**
+ * @class IdlePoll
+ * @author rich
+ * @date 18/10/26
+ * @file Device.h
+ * @brief Spots a guest waiting on input by counting reads of an empty
+ *     status register that come close together. Used by devices to
+ *     answer waiting() and to show output when the guest wants a key.
+ */
+class IdlePoll
+{
+public:
+    /**
+     * @brief Count a read of an empty status register.
+     * @param now Instructions run by the device's CPU.
+     * @return true on the read that makes the guest idle.
+     */
+    bool poll(uint64_t now)
+    {
+        if (now - last_ < gap)
+            count_++;
+        else
+            count_ = 1;
+        last_ = now;
+        return count_ == limit;
+    }
+
+    /**
+     * @brief Guest got input, start counting again.
+     */
+    void reset()
+    {
+        count_ = 0;
+    }
+
+    /**
+     * @brief Return true once the guest has polled for long enough.
+     */
+    bool idle() const
+    {
+        return count_ >= limit;
+    }
+
+    /**
+     * @brief Return number of close reads so far.
+     */
+    uint64_t count() const
+    {
+        return count_;
+    }
+
+    void save(core::StateOut &out) const
+    {
+        out.put(count_);
+        out.put(last_);
+    }
+
+    void load(core::StateIn &in)
+    {
+        in.get(count_);
+        in.get(last_);
+    }
+
+    static constexpr uint64_t gap = 64;       // Instructions between polls.
+    static constexpr uint64_t limit = 256;    // Polls before waiting.
+
+private:
+    uint64_t   last_ = 0;
+    uint64_t   count_ = 0;
+};
+
 /**
  * @class Device
  * @author rich
@@ -109,6 +182,13 @@ public:
     virtual void examine() {}
     virtual void deposit() {}
 
+    /**
+     * @brief Save and restore device registers. Host side connections,
+     *     such as the terminal, are not part of the state.
+     */
+    virtual void save([[maybe_unused]]core::StateOut &out) {}
+    virtual void load([[maybe_unused]]core::StateIn &in) {}
+
     virtual bool input(T &val, [[maybe_unused]]size_t port)
     {
         val = 0;
@@ -138,9 +218,24 @@ public:
         return option;
     }
 
+    /**
+     * @brief Return true when the guest is doing nothing but waiting on
+     *     this device, so the session running it can be parked.
+     */
+    virtual bool waiting() const
+    {
+        return false;
+    }
+
+    /**
+     * @brief Called from any thread when new input arrives, wakes a
+     *     parked session. Set by the session host.
+     */
+    std::function<void()>  wake;
+
 protected:
     size_t addr_;
-    IO<T> *io;
+    IO<T> *io = nullptr;
 private:
 };
 }
@@ -161,18 +256,18 @@ private:
 
 #define REGISTER_DEVICE(systype, type) \
     namespace core { \
-    class systype##DeviceFactory : public DeviceFactory { \
+    class systype##_##type##DeviceFactory : public DeviceFactory { \
     public: \
-        systype##DeviceFactory() \
+        systype##_##type##DeviceFactory() \
         { \
-            std::cout << "Registering Device: " #type << "\n"; \
+            std::cerr << "Registering Device: " #type << "\n"; \
             systype::registerDevice(#type, this); \
         } \
         virtual DEV_v create(const std::string & name) { \
             return std::make_shared<emulator::systype##_##type>(name);  \
         } \
     }; \
-    static systype##DeviceFactory global_##systype##_##type##DeviceFactory; \
+    static systype##_##type##DeviceFactory global_##systype##_##type##DeviceFactory; \
     };
     
 
@@ -0,0 +1,159 @@
+/*
+ * Author:      Richard Cornwell (rich@sky-visions.com)
+ *
+ * Copyright (C) 2021 Richard Cornwell.
+ *
+ * This file may be distributed under the terms of the Q Public License
+ * as defined by Trolltech AS of Norway and appearing in the file
+ * LICENSE.QPL included in the packaging of this file.
+ *
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING
+ * THE WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL,
+ * INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING
+ * FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION
+ * WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+#include "config.h"
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include "DiskImage.h"
+#ifdef HAVE_SYS_MMAN_H
+#define MAPPED_DISKS
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace core
+{
+
+using namespace std;
+
+// Read only images by file, so each is mapped once.
+static mutex                             ro_lock;
+static map<string, weak_ptr<DiskImage>>  ro_images;
+
+DiskImage::~DiskImage()
+{
+    if (!ro_)
+        flush(true);
+#ifdef MAPPED_DISKS
+    if (mapped_)
+        munmap(data_, size_);
+    if (fd_ >= 0)
+        ::close(fd_);
+#endif
+    if (!mapped_)
+        delete[] data_;
+}
+
+shared_ptr<DiskImage> DiskImage::open(const string &path, bool ro)
+{
+    string                 key = path;
+    lock_guard<mutex>      lock(ro_lock);
+
+#ifdef MAPPED_DISKS
+    char                   real[PATH_MAX];
+    if (realpath(path.c_str(), real) != nullptr)
+        key = real;
+#endif
+    if (ro) {
+        auto  it = ro_images.find(key);
+        if (it != ro_images.end()) {
+            if (auto image = it->second.lock())
+                return image;
+            ro_images.erase(it);
+        }
+    }
+
+    shared_ptr<DiskImage>  image(new DiskImage());
+    image->path_ = path;
+    image->ro_ = ro;
+#ifdef MAPPED_DISKS
+    int          fd = ::open(path.c_str(), (ro ? O_RDONLY : O_RDWR) | O_CLOEXEC);
+    struct stat  st;
+    if (fd < 0)
+        throw SystemError{"Unable to open disk image " + path + ": " +
+                          strerror(errno)};
+    image->fd_ = fd;
+    if (flock(fd, (ro ? LOCK_SH : LOCK_EX) | LOCK_NB) != 0)
+        throw SystemError{"Disk image " + path + " is in use"};
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+        throw SystemError{"Disk image " + path + " is empty"};
+    void  *addr = mmap(nullptr, st.st_size,
+                       ro ? PROT_READ : (PROT_READ|PROT_WRITE),
+                       MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED)
+        throw SystemError{"Unable to map disk image " + path + ": " +
+                          strerror(errno)};
+    image->data_ = static_cast<uint8_t *>(addr);
+    image->size_ = st.st_size;
+    image->mapped_ = true;
+#else
+    ifstream     file(path, ios::in|ios::binary|ios::ate);
+    if (!file.is_open())
+        throw SystemError{"Unable to open disk image " + path};
+    image->size_ = file.tellg();
+    if (image->size_ == 0)
+        throw SystemError{"Disk image " + path + " is empty"};
+    image->data_ = new uint8_t[image->size_];
+    file.seekg(0, ios::beg);
+    file.read(reinterpret_cast<char *>(image->data_), image->size_);
+#endif
+    size_t  pages = (image->size_ + (1u << page_shift) - 1) >> page_shift;
+    image->pages_.assign((pages + 63) / 64, 0);
+    if (ro)
+        ro_images[key] = image;
+    return image;
+}
+
+void DiskImage::mark(size_t off, size_t len)
+{
+    if (len == 0 || ro_)
+        return;
+    for (size_t p = off >> page_shift; p <= (off + len - 1) >> page_shift; p++)
+        pages_[p >> 6] |= 1llu << (p & 63);
+    dirty_ = true;
+}
+
+void DiskImage::flush(bool wait)
+{
+    if (!dirty_)
+        return;
+#ifdef MAPPED_DISKS
+    size_t  host = (size_t)sysconf(_SC_PAGESIZE);
+    size_t  pages = pages_.size() * 64;
+
+    // Write back each run of marked pages.
+    for (size_t p = 0; p < pages; p++) {
+        if ((pages_[p >> 6] & (1llu << (p & 63))) == 0)
+            continue;
+        size_t  first = p;
+        while (p + 1 < pages && (pages_[(p + 1) >> 6] & (1llu << ((p + 1) & 63))))
+            p++;
+        size_t  start = (first << page_shift) & ~(host - 1);
+        size_t  end = min(size_, (p + 1) << page_shift);
+        msync(data_ + start, end - start, wait ? MS_SYNC : MS_ASYNC);
+    }
+#else
+    ofstream  file(path_, ios::out|ios::binary|ios::in);
+    file.write(reinterpret_cast<const char *>(data_), size_);
+    (void)wait;
+#endif
+    fill(pages_.begin(), pages_.end(), 0);
+    dirty_ = false;
+}
+
+}
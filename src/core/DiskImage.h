@@ -0,0 +1,126 @@
+/*
+ * Author:      Richard Cornwell (rich@sky-visions.com)
+ *
+ * Copyright (C) 2021 Richard Cornwell.
+ *
+ * This file may be distributed under the terms of the Q Public License
+ * as defined by Trolltech AS of Norway and appearing in the file
+ * LICENSE.QPL included in the packaging of this file.
+ *
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING
+ * THE WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL,
+ * INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING
+ * FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION
+ * WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include "SimError.h"
+
+namespace core
+{
+
+/**
+ * @class DiskImage
+ * @author rich
+ * @date 18/10/26
+ * @file DiskImage.h
+ * @brief A disk image file mapped into memory. The host page cache is
+ *     the sector cache, reads are a copy out of the mapping and writes a
+ *     copy in. Written pages are marked and flush() starts the write back
+ *     without waiting for it.
+ *
+ *     A read only mount takes a shared lock on the file and is shared
+ *     by every drive in the process that mounts it, so sessions running
+ *     the same system disk map one copy. A read write mount takes an
+ *     exclusive lock, so no other mount of the file, here or in another
+ *     process, can see it change underneath. On hosts without mmap() the
+ *     image is read into memory and written back by flush().
+ */
+class DiskImage
+{
+public:
+    ~DiskImage();
+
+    DiskImage(const DiskImage&) = delete;
+    DiskImage& operator=(const DiskImage&) = delete;
+
+    /**
+     * @brief Mount an image file, throws SystemError if it can't be
+     *     opened or is mounted read write elsewhere.
+     * @param path File to mount.
+     * @param ro True to mount read only.
+     * @return The image, an existing one for a read only file already
+     *     mounted.
+     */
+    static std::shared_ptr<DiskImage> open(const std::string &path,
+                                           bool ro);
+
+    const uint8_t *data() const
+    {
+        return data_;
+    }
+
+    /**
+     * @brief Writable contents, nullptr if mounted read only.
+     */
+    uint8_t *writable()
+    {
+        return ro_ ? nullptr : data_;
+    }
+
+    size_t size() const
+    {
+        return size_;
+    }
+
+    bool readOnly() const
+    {
+        return ro_;
+    }
+
+    /**
+     * @brief Note a range of the image was written.
+     */
+    void mark(size_t off, size_t len);
+
+    /**
+     * @brief Start writing back the pages marked since the last flush.
+     * @param wait True to wait for the write to finish.
+     */
+    void flush(bool wait = false);
+
+    /**
+     * @brief Return true if pages are waiting to be written back.
+     */
+    bool dirty() const
+    {
+        return dirty_;
+    }
+
+private:
+    DiskImage() {}
+
+    static constexpr unsigned page_shift = 12;
+
+    std::string            path_;
+    uint8_t               *data_ = nullptr;
+    size_t                 size_ = 0;
+    int                    fd_ = -1;
+    bool                   ro_ = true;
+    bool                   mapped_ = false;
+    bool                   dirty_ = false;
+    std::vector<uint64_t>  pages_;       // Bit per written host page.
+};
+
+}
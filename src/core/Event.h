@@ -18,82 +18,246 @@
  */
 
 #pragma once
-#include <functional>
+#include <stddef.h>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include "SimError.h"
 
 namespace core
 {
 
-class IEventCallback
-{
-    public:
-    virtual ~IEventCallback() = default;
-    virtual void operator() (void *ev) = 0;
-    virtual bool operator == (IEventCallback* other) = 0;
-};
-
-template <class T>
-class EventCallback : public IEventCallback
+/**
+ * @class Delegate
+ * @author rich
+ * @date 18/10/26
+ * @file Event.h
+ * @brief Callback bound to an object. The target is held in a small
+ *     buffer inside the delegate, so binding never allocates, and it is
+ *     called through one plain function pointer rather than a virtual
+ *     call. A delegate may also carry a burst handler, which receives a
+ *     run of characters in one call.
+ */
+class Delegate
 {
 public:
-    EventCallback(T* instance, void (T::*function)(void *ev))
-        : instance(instance), function(function) {}
-    virtual ~EventCallback() = default;
-    void operator () (void *ev)
+    typedef void (*Stub)(const void *buf, void *ev);
+    typedef void (*Burst)(const void *buf, const char *data, size_t n);
+
+    Delegate() {}
+
+    /**
+     * @brief Bind a member function chosen at run time.
+     * @param obj Object to call.
+     * @param fn Member function to call with the event.
+     */
+    template <class T>
+    Delegate(T *obj, void (T::*fn)(void *ev))
+    {
+        Member<T>  m{obj, fn};
+        static_assert(sizeof(m) <= sizeof(buf_), "Delegate buffer too small");
+        memcpy(buf_, &m, sizeof(m));
+        stub_ = [](const void *buf, void *ev) {
+            Member<T>  m;
+            memcpy(&m, buf, sizeof(m));
+            (m.obj->*m.fn)(ev);
+        };
+    }
+
+    /**
+     * @brief Bind a member function known at compile time, only the
+     *     object is stored and the call is made directly from the stub.
+     * @param obj Object to call.
+     * @return Delegate.
+     */
+    template <class T, void (T::*F)(void *ev)>
+    static Delegate bind(T *obj)
+    {
+        Delegate  d;
+        memcpy(d.buf_, &obj, sizeof(obj));
+        d.stub_ = [](const void *buf, void *ev) {
+            T  *o;
+            memcpy(&o, buf, sizeof(o));
+            (o->*F)(ev);
+        };
+        return d;
+    }
+
+    /**
+     * @brief Bind a member function and a burst handler.
+     * @param obj Object to call.
+     * @return Delegate.
+     */
+    template <class T, void (T::*F)(void *ev),
+              void (T::*B)(const char *data, size_t n)>
+    static Delegate bind(T *obj)
+    {
+        Delegate  d = bind<T, F>(obj);
+        d.burst_ = [](const void *buf, const char *data, size_t n) {
+            T  *o;
+            memcpy(&o, buf, sizeof(o));
+            (o->*B)(data, n);
+        };
+        return d;
+    }
+
+    /**
+     * @brief Bind a small callable, such as a lambda capturing a few
+     *     pointers. It must fit in the delegate and be trivially copyable.
+     * @param f Callable taking the event.
+     * @return Delegate.
+     */
+    template <class F>
+    static Delegate from(const F &f)
+    {
+        static_assert(sizeof(F) <= sizeof(buf_), "Callable too large for Delegate");
+        static_assert(std::is_trivially_copyable<F>::value,
+                      "Callable must be trivially copyable");
+        Delegate  d;
+        new (d.buf_) F(f);
+        d.stub_ = [](const void *buf, void *ev) {
+            (*static_cast<const F *>(buf))(ev);
+        };
+        return d;
+    }
+
+    void operator() (void *ev) const
+    {
+        stub_(buf_, ev);
+    }
+
+    /**
+     * @brief Deliver a run of characters, one at a time if there is no
+     *     burst handler.
+     */
+    void burst(const char *data, size_t n) const
+    {
+        if (burst_ != nullptr) {
+            burst_(buf_, data, n);
+            return;
+        }
+        for (size_t i = 0; i < n; i++)
+            stub_(buf_, const_cast<char *>(data + i));
+    }
+
+    explicit operator bool() const
     {
-        (instance->*function)(ev);
+        return stub_ != nullptr;
     }
 
-    bool operator == (IEventCallback *other) override
+    bool operator == (const Delegate &other) const
     {
-        EventCallback<T> *otherEventCallback = dynamic_cast<EventCallback<T> *>(other);
-        if (otherEventCallback == nullptr)
-            return false;
-        return (this->function == otherEventCallback->function) &&
-               (this->instance == otherEventCallback->instance);
+        return stub_ == other.stub_ && burst_ == other.burst_ &&
+               memcmp(buf_, other.buf_, sizeof(buf_)) == 0;
     }
+
 private:
-    T* instance;
-    void (T::*function)(void *ev);
+    struct Dummy {};
+
+    template <class T>
+    struct Member {
+        T     *obj;
+        void (T::*fn)(void *ev);
+    };
+
+    alignas(sizeof(void *)) unsigned char
+              buf_[sizeof(Member<Dummy>)] = {};
+    Stub      stub_ = nullptr;
+    Burst     burst_ = nullptr;
 };
 
-class Event
+/**
+ * @class BasicEvent
+ * @author rich
+ * @date 18/10/26
+ * @file Event.h
+ * @brief List of delegates called when the event fires. Listeners are
+ *     held in place, adding, removing and firing never allocate. The
+ *     number of listeners is fixed by the owner of the event, one that
+ *     has a listener per device should be given room for every device.
+ */
+template <size_t N>
+class BasicEvent
 {
 public:
-    Event()
+    static_assert(N > 0, "Event must hold at least one listener");
+
+    /**
+     * @brief Most listeners the event can hold.
+     */
+    static constexpr size_t max_listeners = N;
+
+    BasicEvent()
     {
     }
-    virtual ~Event()
+    virtual ~BasicEvent()
     {
     }
 
-    void addListener(IEventCallback* action)
+    /**
+     * @brief Add a listener, unless it is already there.
+     */
+    void addListener(const Delegate &action)
     {
-        Callbacks::iterator pos = find(callbackactions_.begin(),
-                                       callbackactions_.end(), action);
-        if (pos != callbackactions_.end()) {
-            return;
+        for (size_t i = 0; i < count_; i++) {
+            if (callbackactions_[i] == action)
+                return;
         }
-        callbackactions_.push_back(action);
+        if (count_ == max_listeners)
+            throw SystemError{"Too many listeners on event"};
+        callbackactions_[count_++] = action;
     }
-    void removeListener(IEventCallback* action)
+
+    /**
+     * @brief Remove a listener, the others keep their order.
+     */
+    void removeListener(const Delegate &action)
     {
-        Callbacks::iterator pos = find(callbackactions_.begin(),
-                                       callbackactions_.end(), action);
-        if (pos != callbackactions_.end()) {
-            return;
+        for (size_t i = 0; i < count_; i++) {
+            if (callbackactions_[i] == action) {
+                for (size_t j = i + 1; j < count_; j++)
+                    callbackactions_[j - 1] = callbackactions_[j];
+                callbackactions_[--count_] = Delegate();
+                return;
+            }
         }
-        callbackactions_.erase(pos);
     }
+
+    /**
+     * @brief Number of listeners.
+     */
+    size_t size() const
+    {
+        return count_;
+    }
+
     void notify(void *ev)
     {
-        for(IEventCallback* action : callbackactions_) {
-            (*action)(ev);
-        }
+        for (size_t i = 0; i < count_; i++)
+            callbackactions_[i](ev);
+    }
+
+    /**
+     * @brief Deliver a run of characters to every listener in one call.
+     * @param data Characters.
+     * @param n Number of characters.
+     */
+    void notify_n(const char *data, size_t n)
+    {
+        if (n == 0)
+            return;
+        for (size_t i = 0; i < count_; i++)
+            callbackactions_[i].burst(data, n);
     }
 
 private:
-    typedef std::vector<IEventCallback*> Callbacks;
-    Callbacks callbackactions_;
+    Delegate  callbackactions_[max_listeners];
+    size_t    count_ = 0;
 };
 
+/**
+ * @brief Event for a handful of listeners.
+ */
+using Event = BasicEvent<4>;
+
 }
@@ -0,0 +1,261 @@
+/*
+ * Author:      Richard Cornwell (rich@sky-visions.com)
+ *
+ * Copyright (C) 2021 Richard Cornwell.
+ *
+ * This file may be distributed under the terms of the Q Public License
+ * as defined by Trolltech AS of Norway and appearing in the file
+ * LICENSE.QPL included in the packaging of this file.
+ *
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING
+ * THE WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL,
+ * INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING
+ * FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION
+ * WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+#include <cctype>
+#include <deque>
+#include <sstream>
+#include "Expect.h"
+
+namespace core
+{
+
+using namespace std;
+
+void Matcher::clear()
+{
+    next_.assign(256, -1);
+    match_.assign(1, -1);
+    state_ = 0;
+    count_ = 0;
+}
+
+int Matcher::add(const string &pattern)
+{
+    int32_t  node = 0;
+
+    for (char c : pattern) {
+        size_t   ix = ((size_t)node << 8) | (uint8_t)c;
+        if (next_[ix] <= 0) {
+            next_[ix] = (int32_t)match_.size();
+            match_.push_back(-1);
+            next_.resize(next_.size() + 256, -1);
+        }
+        node = next_[ix];
+    }
+    if (match_[node] < 0)
+        match_[node] = (int)count_;
+    return (int)count_++;
+}
+
+void Matcher::build()
+{
+    vector<int32_t>  fail(match_.size(), 0);
+    deque<int32_t>   queue;
+
+    // Children of the root fail back to it, missing ones loop on it.
+    for (size_t c = 0; c < 256; c++) {
+        if (next_[c] > 0)
+            queue.push_back(next_[c]);
+        else
+            next_[c] = 0;
+    }
+    // Breadth first, so the node a failure goes to is already complete.
+    while (!queue.empty()) {
+        int32_t  u = queue.front();
+        queue.pop_front();
+        for (size_t c = 0; c < 256; c++) {
+            size_t   ix = ((size_t)u << 8) | c;
+            int32_t  f = next_[((size_t)fail[u] << 8) | c];
+            if (next_[ix] > 0) {
+                int32_t  v = next_[ix];
+                fail[v] = f;
+                if (match_[v] < 0)
+                    match_[v] = match_[f];
+                queue.push_back(v);
+            } else {
+                next_[ix] = f;
+            }
+        }
+    }
+    state_ = 0;
+}
+
+void Expect::load(const string &name)
+{
+    ifstream  file(name);
+
+    if (!file.is_open())
+        throw Script_error{"Unable to open script " + name};
+    parse(file);
+}
+
+// Read a quoted string, the opening quote has been taken.
+static string get_string(istream &in, int line)
+{
+    string  text;
+    int     c;
+
+    while ((c = in.get()) != '"') {
+        if (c == EOF)
+            throw Script_error{"Line " + to_string(line) +
+                               ": unterminated string"};
+        if (c != '\\') {
+            text += (char)c;
+            continue;
+        }
+        c = in.get();
+        switch (c) {
+        case 'r':  text += '\r'; break;
+        case 'n':  text += '\n'; break;
+        case 't':  text += '\t'; break;
+        case 'e':  text += '\033'; break;
+        case '\\': text += '\\'; break;
+        case '"':  text += '"'; break;
+        case 'x': {
+            int  value = 0;
+            for (int i = 0; i < 2 && isxdigit(in.peek()); i++) {
+                int  d = in.get();
+                value = value * 16 + (isdigit(d) ? d - '0' : tolower(d) - 'a' + 10);
+            }
+            text += (char)value;
+            break;
+        }
+        default:
+            throw Script_error{"Line " + to_string(line) +
+                               ": unknown escape"};
+        }
+    }
+    return text;
+}
+
+// Timeouts must be at least one instruction, 0 would end every expect
+// that follows before the guest ran.
+static uint64_t get_timeout(istream &in, int line)
+{
+    uint64_t  value;
+
+    if (!(in >> value))
+        throw Script_error{"Line " + to_string(line) + ": number expected"};
+    if (value == 0)
+        throw Script_error{"Line " + to_string(line) + ": timeout of 0"};
+    return value;
+}
+
+void Expect::parse(istream &is)
+{
+    string  text;
+    int     line = 0;
+
+    while (getline(is, text)) {
+        istringstream  in(text);
+        string         word;
+        Cmd            cmd{Op::send, {}, 0, ++line};
+
+        if (!(in >> word) || word[0] == '#')
+            continue;
+        string         name = word;
+        if (word == "send") {
+            cmd.op = Op::send;
+        } else if (word == "expect") {
+            cmd.op = Op::expect;
+        } else if (word == "timeout") {
+            cmd.op = Op::timeout;
+            cmd.count = get_timeout(in, line);
+        } else if (word == "capture") {
+            cmd.op = Op::capture;
+        } else {
+            throw Script_error{"Line " + to_string(line) +
+                               ": unknown command " + word};
+        }
+        // Strings, and a timeout for expect.
+        while (in >> ws && !in.eof()) {
+            int  c = in.get();
+            if (c == '#')
+                break;
+            if (c == '"') {
+                cmd.text.push_back(get_string(in, line));
+                continue;
+            }
+            in.unget();
+            in >> word;
+            if (cmd.op != Op::expect || word != "timeout")
+                throw Script_error{"Line " + to_string(line) +
+                                   ": unexpected " + word};
+            cmd.count = get_timeout(in, line);
+        }
+        switch (cmd.op) {
+        case Op::send:
+        case Op::expect:
+            if (cmd.text.empty())
+                throw Script_error{"Line " + to_string(line) +
+                                   ": " + name + " needs a string"};
+            for (auto &t : cmd.text) {
+                if (t.empty())
+                    throw Script_error{"Line " + to_string(line) +
+                                       ": empty string"};
+            }
+            break;
+        case Op::timeout:
+            if (!cmd.text.empty())
+                throw Script_error{"Line " + to_string(line) +
+                                   ": timeout takes a number"};
+            break;
+        case Op::capture:
+            if (cmd.text.size() > 1)
+                throw Script_error{"Line " + to_string(line) +
+                                   ": capture takes one file"};
+            break;
+        }
+        cmds_.push_back(cmd);
+    }
+}
+
+void Expect::run(uint64_t now)
+{
+    while (pc_ < cmds_.size()) {
+        Cmd  &cmd = cmds_[pc_];
+        switch (cmd.op) {
+        case Op::send:
+            if (send_pos_ == send_.size()) {
+                send_.clear();
+                send_pos_ = 0;
+            }
+            for (auto &t : cmd.text)
+                send_ += t;
+            break;
+        case Op::expect:
+            matcher_.clear();
+            for (auto &t : cmd.text)
+                matcher_.add(t);
+            matcher_.build();
+            deadline_ = now + ((cmd.count != 0) ? cmd.count : timeout_);
+            armed_ = true;
+            return;
+        case Op::timeout:
+            timeout_ = cmd.count;
+            break;
+        case Op::capture:
+            if (capture_.is_open())
+                capture_.close();
+            if (!cmd.text.empty()) {
+                capture_.open(cmd.text[0], ios::out|ios::binary|ios::trunc);
+                if (!capture_.is_open()) {
+                    failed_ = true;
+                    error_ = "Unable to create capture " + cmd.text[0];
+                    return;
+                }
+            }
+            break;
+        }
+        pc_++;
+    }
+}
+
+}
@@ -0,0 +1,233 @@
+/*
+ * Author:      Richard Cornwell (rich@sky-visions.com)
+ *
+ * Copyright (C) 2021 Richard Cornwell.
+ *
+ * This file may be distributed under the terms of the Q Public License
+ * as defined by Trolltech AS of Norway and appearing in the file
+ * LICENSE.QPL included in the packaging of this file.
+ *
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING
+ * THE WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL,
+ * INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING
+ * FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION
+ * WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <istream>
+#include <string>
+#include <vector>
+#include "SimError.h"
+
+namespace core
+{
+
+using Script_error = SimError<7>;
+
+/**
+ * @class Matcher
+ * @author rich
+ * @date 18/10/26
+ * @file Expect.h
+ * @brief Aho-Corasick matcher over a stream of bytes.
+ *
+ *     Patterns are added then build() turns the trie into a full
+ *     transition table, so each byte fed costs one lookup no matter how
+ *     many patterns are being watched for or where the last match ended.
+ */
+class Matcher
+{
+public:
+    Matcher()
+    {
+        clear();
+    }
+
+    /**
+     * @brief Remove all patterns.
+     */
+    void clear();
+
+    /**
+     * @brief Add a pattern, must not be empty.
+     * @return Index of the pattern, reported by feed() on a match.
+     */
+    int add(const std::string &pattern);
+
+    /**
+     * @brief Fill in the transitions, call after the last add.
+     */
+    void build();
+
+    /**
+     * @brief Forget any partial match.
+     */
+    void reset()
+    {
+        state_ = 0;
+    }
+
+    /**
+     * @brief Advance over one byte of the stream.
+     * @return Index of a pattern ending at this byte, or -1.
+     */
+    int feed(uint8_t ch)
+    {
+        state_ = next_[((size_t)state_ << 8) | ch];
+        return match_[state_];
+    }
+
+    size_t size() const
+    {
+        return count_;
+    }
+
+private:
+    std::vector<int32_t> next_;     // 256 transitions per node.
+    std::vector<int32_t> match_;    // Pattern ending at each node.
+    int32_t              state_ = 0;
+    size_t               count_ = 0;
+};
+
+/**
+ * @class Expect
+ * @author rich
+ * @date 18/10/26
+ * @file Expect.h
+ * @brief Runs a script against a guest terminal, typing commands and
+ *     waiting on the output for prompts.
+ *
+ *     A script has one command per line, # starts a comment:
+ *
+ *         send "text"...               Type the text.
+ *         expect "pat"... [timeout n]  Wait for any of the patterns.
+ *         timeout n                    Default expect timeout.
+ *         capture ["file"]             Copy output to file, or stop.
+ *
+ *     Strings take the escapes \r \n \t \e \\ \" and \xHH. Timeouts are
+ *     counted in guest instructions, so a script behaves the same however
+ *     fast the host runs the guest, and must be greater than 0.
+ */
+class Expect
+{
+public:
+    static constexpr uint64_t default_timeout = 100000000;
+
+    Expect() {}
+
+    /**
+     * @brief Read a script, throws Script_error if it is not valid.
+     */
+    void load(const std::string &name);
+    void parse(std::istream &is);
+
+    /**
+     * @brief Run up to the first expect.
+     * @param now Instruction count.
+     */
+    void start(uint64_t now)
+    {
+        run(now);
+    }
+
+    /**
+     * @brief Called with each byte the guest transmits.
+     */
+    void output(char ch, uint64_t now)
+    {
+        if (capture_.is_open())
+            capture_.put(ch);
+        if (armed_ && matcher_.feed((uint8_t)ch) >= 0) {
+            armed_ = false;
+            pc_++;
+            run(now);
+        }
+    }
+
+    /**
+     * @brief Next character to type.
+     * @return False if there is nothing to type now.
+     */
+    bool input(char &ch)
+    {
+        if (send_pos_ == send_.size())
+            return false;
+        ch = send_[send_pos_++];
+        return true;
+    }
+
+    /**
+     * @brief Check the expect timeout, true once it has passed.
+     */
+    bool expired(uint64_t now)
+    {
+        if (!armed_ || now < deadline_)
+            return false;
+        armed_ = false;
+        failed_ = true;
+        error_ = "Timeout at line " + std::to_string(cmds_[pc_].line) +
+                 " waiting for \"" + cmds_[pc_].text[0] + "\"";
+        return true;
+    }
+
+    /**
+     * @brief True once every command has run and all text was typed.
+     */
+    bool done() const
+    {
+        return !failed_ && pc_ == cmds_.size() && send_pos_ == send_.size();
+    }
+
+    /**
+     * @brief Stop capturing, output after this is not kept.
+     */
+    void close()
+    {
+        if (capture_.is_open())
+            capture_.close();
+    }
+
+    bool failed() const
+    {
+        return failed_;
+    }
+
+    std::string error() const
+    {
+        return error_;
+    }
+
+private:
+    enum class Op { send, expect, timeout, capture };
+
+    struct Cmd {
+        Op                        op;
+        std::vector<std::string>  text;
+        uint64_t                  count;
+        int                       line;
+    };
+
+    void run(uint64_t now);
+
+    std::vector<Cmd>  cmds_;
+    size_t            pc_ = 0;
+    std::string       send_;
+    size_t            send_pos_ = 0;
+    Matcher           matcher_;
+    bool              armed_ = false;
+    uint64_t          deadline_ = 0;
+    uint64_t          timeout_ = default_timeout;
+    bool              failed_ = false;
+    std::string       error_;
+    std::ofstream     capture_;
+};
+
+}
@@ -138,6 +138,14 @@ public:
         mem = mem_v;
     }
 
+    /**
+     * @brief Memory controller devices on this controller do DMA to.
+     */
+    std::shared_ptr<Memory<T>> getMemory() const
+    {
+        return mem;
+    }
+
     /**
     * @brief Called after all I/O controllers and Devices have been added.
     * This should propogate init down to all attached devices and I/O controllers.
@@ -282,7 +290,7 @@ private:
     public: \
         model##IOFactory() \
         { \
-            std::cout << "Registering IO: " #model << "\n"; \
+            std::cerr << "Registering IO: " #model << "\n"; \
             systype::registerIO(#model, this); \
         } \
         virtual IO_v create() { \
@@ -366,7 +374,7 @@ public:
         //  std::cerr << "Adding device: " << dev->GetName() << " " << std::hex << dev->getAddress() << std::endl;
         // Later these will throw an exception.
         size_t first_port = dev->getAddress();
-        if (first_port > max_ports_)
+        if (first_port >= max_ports_)
             return;
         size_t num_ports = dev->getSize();
         if ((first_port + num_ports) > max_ports_)
@@ -458,8 +466,10 @@ public:
      */
     virtual bool input(T &val, size_t port) override
     {
-        if (port > max_ports_)
+        if (port >= max_ports_) {
+            val = 0;
             return false;
+        }
         // std::cerr << "IOInput()" << std::hex << port << std::endl;
         return devices_[port]->input(val, port);
     };
@@ -472,7 +482,7 @@ public:
       */
     virtual bool output(T val, size_t port) override
     {
-        if (port > max_ports_)
+        if (port >= max_ports_)
             return false;
         // std::cerr << "IOOutput()" << std::hex << port << std::endl;
         return devices_[port]->output(val, port);
@@ -486,8 +496,10 @@ public:
      */
     virtual bool status(T &val, size_t port) override
     {
-        if (port > max_ports_)
+        if (port >= max_ports_) {
+            val = 0;
             return false;
+        }
         // std::cerr << "IOInput()" << std::hex << port << std::endl;
         return devices_[port]->status(val, port);
     };
@@ -500,7 +512,7 @@ public:
      */
     virtual bool command(T val, size_t port) override
     {
-        if (port > max_ports_)
+        if (port >= max_ports_)
             return false;
         // std::cerr << "IOOutput()" << std::hex << port << std::endl;
         return devices_[port]->command(val, port);
@@ -0,0 +1,132 @@
+/*
+ * Author:      Richard Cornwell (rich@sky-visions.com)
+ *
+ * Copyright (C) 2021 Richard Cornwell.
+ *
+ * This file may be distributed under the terms of the Q Public License
+ * as defined by Trolltech AS of Norway and appearing in the file
+ * LICENSE.QPL included in the packaging of this file.
+ *
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING
+ * THE WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL,
+ * INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING
+ * FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION
+ * WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+#include "InputLog.h"
+
+namespace core
+{
+
+static const char magic[4] = { 'T', 'S', 'I', 'L' };
+
+void InputLog::open(const std::string &name)
+{
+    file.open(name, std::ios::out|std::ios::binary|std::ios::trunc);
+    if (!file.is_open())
+        throw Log_error{"Unable to create input log " + name};
+    file.write(magic, sizeof(magic));
+    file.put((char)version);
+    last = 0;
+}
+
+void InputLog::put_count(uint64_t count)
+{
+    uint64_t  delta = count - last;
+
+    last = count;
+    while (delta >= 0x80) {
+        file.put((char)((delta & 0x7f) | 0x80));
+        delta >>= 7;
+    }
+    file.put((char)delta);
+}
+
+void InputLog::record(uint64_t count, uint8_t channel, uint8_t value)
+{
+    if (!file.is_open())
+        return;
+    put_count(count);
+    file.put((char)channel);
+    file.put((char)value);
+    // Keep the log usable if the simulator dies.
+    file.flush();
+}
+
+void InputLog::close(uint64_t count)
+{
+    if (!file.is_open())
+        return;
+    put_count(count);
+    file.put((char)end_channel);
+    file.close();
+}
+
+void InputReplay::open(const std::string &name)
+{
+    char   head[sizeof(magic) + 1];
+
+    file.open(name, std::ios::in|std::ios::binary);
+    if (!file.is_open())
+        throw Log_error{"Unable to open input log " + name};
+    if (!file.read(head, sizeof(head)) ||
+        std::string(head, sizeof(magic)) != std::string(magic, sizeof(magic)))
+        throw Log_error{name + " is not an input log"};
+    if ((uint8_t)head[sizeof(magic)] != InputLog::version)
+        throw Log_error{name + " has unknown version"};
+    at_end = false;
+    next.count = 0;
+    read_next();
+}
+
+InputEvent InputReplay::pop()
+{
+    InputEvent  ev = next;
+    read_next();
+    return ev;
+}
+
+void InputReplay::read_next()
+{
+    uint64_t  delta = 0;
+    int       shift = 0;
+    int       c;
+
+    // A log from a run that did not finish has no end marker, so let the
+    // replay carry on past the last event.
+    if (file.peek() == EOF) {
+        at_end = true;
+        end_count = ~0ull;
+        file.close();
+        return;
+    }
+    do {
+        c = file.get();
+        if (c == EOF || shift > 63)
+            throw Log_error{"Input log truncated"};
+        delta |= (uint64_t)(c & 0x7f) << shift;
+        shift += 7;
+    } while (c & 0x80);
+    next.count += delta;
+    c = file.get();
+    if (c == EOF)
+        throw Log_error{"Input log truncated"};
+    next.channel = (uint8_t)c;
+    if (next.channel == InputLog::end_channel) {
+        at_end = true;
+        end_count = next.count;
+        file.close();
+        return;
+    }
+    c = file.get();
+    if (c == EOF)
+        throw Log_error{"Input log truncated"};
+    next.value = (uint8_t)c;
+}
+
+}
@@ -0,0 +1,163 @@
+/*
+ * Author:      Richard Cornwell (rich@sky-visions.com)
+ *
+ * Copyright (C) 2021 Richard Cornwell.
+ *
+ * This file may be distributed under the terms of the Q Public License
+ * as defined by Trolltech AS of Norway and appearing in the file
+ * LICENSE.QPL included in the packaging of this file.
+ *
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING
+ * THE WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL,
+ * INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING
+ * FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION
+ * WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <fstream>
+#include "SimError.h"
+
+namespace core
+{
+
+using Log_error = SimError<5>;
+
+/**
+ * @brief One input seen by the guest.
+ */
+struct InputEvent {
+    uint64_t  count;      // Instruction count when input was delivered.
+    uint8_t   channel;    // Source of input, device defined.
+    uint8_t   value;      // Character or value delivered.
+};
+
+/**
+ * @class InputLog
+ * @author rich
+ * @date 18/10/26
+ * @file InputLog.h
+ * @brief Writes a log of input events for later replay.
+ *
+ *     The log starts with the magic "TSIL" and a version byte. Each event
+ *     is the change in instruction count since the previous event as an
+ *     unsigned LEB128 number, then the channel and the value. The log ends
+ *     with the final count and channel end_channel, with no value.
+ */
+class InputLog
+{
+public:
+    static constexpr uint8_t end_channel = 0xff;
+    static constexpr uint8_t version = 1;
+
+    InputLog() {}
+
+    ~InputLog()
+    {
+        if (file.is_open())
+            file.close();
+    }
+
+    /**
+     * @brief Create log file, throws Log_error if it can't be created.
+     * @param name File to write.
+     */
+    void open(const std::string &name);
+
+    bool is_open() const
+    {
+        return file.is_open();
+    }
+
+    /**
+     * @brief Add an event to the log.
+     * @param count Instruction count when the guest saw the input.
+     * @param channel Source of input, must not be end_channel.
+     * @param value Value seen.
+     */
+    void record(uint64_t count, uint8_t channel, uint8_t value);
+
+    /**
+     * @brief Write end marker and close the log.
+     * @param count Instruction count when run ended.
+     */
+    void close(uint64_t count);
+
+private:
+    void put_count(uint64_t count);
+
+    std::ofstream   file;
+    uint64_t        last = 0;
+};
+
+/**
+ * @class InputReplay
+ * @author rich
+ * @date 18/10/26
+ * @file InputLog.h
+ * @brief Reads back a log written by InputLog.
+ */
+class InputReplay
+{
+public:
+    InputReplay() {}
+
+    /**
+     * @brief Open a log, throws Log_error if it can't be read or is not
+     *     an input log.
+     * @param name File to read.
+     */
+    void open(const std::string &name);
+
+    bool is_open() const
+    {
+        return file.is_open();
+    }
+
+    /**
+     * @brief Return true if the next event is due at count.
+     */
+    bool due(uint64_t count) const
+    {
+        return !at_end && next.count <= count;
+    }
+
+    /**
+     * @brief Return the next event and read the one after.
+     */
+    InputEvent pop();
+
+    /**
+     * @brief Return true once all events have been returned.
+     */
+    bool done() const
+    {
+        return at_end;
+    }
+
+    /**
+     * @brief Instruction count at which the recorded run ended. Only valid
+     *     after done() returns true, all ones if the log has no end marker.
+     */
+    uint64_t end() const
+    {
+        return end_count;
+    }
+
+private:
+    void read_next();
+
+    std::ifstream   file;
+    InputEvent      next{0, 0, 0};
+    bool            at_end = true;
+    uint64_t        end_count = 0;
+};
+
+}
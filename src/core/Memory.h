@@ -20,6 +20,8 @@
 #pragma once
 
 #include "config.h"
+#include <algorithm>
+#include <atomic>
 #include <vector>
 #include <variant>
 #include <string>
@@ -28,6 +30,35 @@
 #endif
 #include "SimError.h"
 #include "ConfigOption.h"
+#include "Numa.h"
+#include "PageStore.h"
+#include "State.h"
+
+namespace core
+{
+
+/**
+ * @brief Clock stamped on memory pages as they are written.
+ */
+inline std::atomic<uint64_t> &dirty_clock()
+{
+    static std::atomic<uint64_t>  clock{1};
+    return clock;
+}
+
+/**
+ * @brief Start a new dirty epoch. Pages written before this call have a
+ *     stamp below the value returned, pages written after have one at or
+ *     above it. Each user of the dirty maps keeps the value it got just
+ *     before it last looked, so users never hide pages from each other.
+ * @return Value to pass as since on the user's next look.
+ */
+inline uint64_t dirty_epoch()
+{
+    return dirty_clock().fetch_add(1, std::memory_order_acq_rel) + 1;
+}
+
+}
 
 namespace emulator
 {
@@ -83,6 +114,16 @@ public:
         return name_;
     }
 
+    /**
+     * @brief Return the model of this memory, as registered with the
+     *     System factories.
+     * @return Model string.
+     */
+    virtual std::string getType() const
+    {
+        return "Memory";
+    }
+
     /**
       * @brief Returns size of memory in T units.
       * @return
@@ -118,6 +159,98 @@ public:
      */
     virtual void addMemory([[maybe_unused]]std::shared_ptr<Memory> mem) {};
 
+    /**
+     * @brief Called when memory is reachable from more than one CPU.
+     *        Storage that holds values must then order accesses so a
+     *        write is seen by other CPUs after the writes before it.
+     * @param shared - true if shared.
+     */
+    virtual void setShared([[maybe_unused]]bool shared) {};
+
+    /**
+     * @brief Place storage on a host NUMA node, moving it if needed.
+     * @param node - Node to place memory on.
+     */
+    virtual void setNode([[maybe_unused]]int node) {};
+
+    /**
+     * @brief Save contents that can change while running.
+     * @param out - Where to write state.
+     */
+    virtual void save([[maybe_unused]]core::StateOut &out) {};
+
+    /**
+     * @brief Restore contents written by save().
+     * @param in - Where to read state.
+     */
+    virtual void load([[maybe_unused]]core::StateIn &in) {};
+
+    /**
+     * @brief Free storage that save() has written out. Nothing may access
+     *     the memory until load() restores it.
+     */
+    virtual void release() {};
+
+    /**
+     * @brief Size of a page in the dirty map as a shift count.
+     * @return 0 if writes to this memory are not tracked.
+     */
+    virtual unsigned pageShift() const { return 0; };
+
+    /**
+     * @brief Build a map of pages written since epoch since, one bit per
+     *     page starting at location 0. The map is not changed, so any
+     *     number of users can follow it. Call it while no CPU is writing,
+     *     between quanta or when stopped; the pages themselves may be
+     *     copied after CPUs run again.
+     * @param bits - Returned map, empty if writes are not tracked.
+     * @param since - Value from core::dirty_epoch() taken before the
+     *     caller last looked, 1 for every page written.
+     */
+    virtual void dirty_since(std::vector<uint64_t> &bits,
+                             [[maybe_unused]]uint64_t since) const
+    {
+        bits.clear();
+    };
+
+    /**
+     * @brief Mark every page as written for all users.
+     */
+    virtual void mark_dirty() {};
+
+    /**
+     * @brief Save pages written since epoch since.
+     * @param out - Where to write state.
+     * @param since - As for dirty_since().
+     */
+    virtual void save_dirty([[maybe_unused]]core::StateOut &out,
+                            [[maybe_unused]]uint64_t since) {};
+
+    /**
+     * @brief Apply pages written by save_dirty() on top of the contents.
+     * @param in - Where to read state.
+     */
+    virtual void load_dirty([[maybe_unused]]core::StateIn &in) {};
+
+    /**
+     * @brief Hand pages that have stopped changing to a store so identical
+     *     pages of other memories share one copy.
+     * @param store - Store of shared pages.
+     * @return Number of pages newly shared.
+     */
+    virtual size_t merge_pages([[maybe_unused]]core::PageStore &store) { return 0; };
+
+    /**
+     * @brief Bytes of this memory read from shared pages.
+     */
+    virtual uint64_t shared_bytes() const { return 0; };
+
+    /**
+     * @brief Bytes of this memory that were found already in the store,
+     *     so sharing them saved host memory.
+     */
+    virtual uint64_t saved_bytes() const { return 0; };
+
     /**
      * @brief Adds options to this CPU module.
      * @return Option parser.
@@ -174,6 +307,36 @@ public:
         return false;
     }
 
+    /**
+     * @brief Copy a block out of memory, for devices doing DMA.
+     * @param buf Where to put the values.
+     * @param index First location to read.
+     * @param n Number of locations.
+     * @return Number copied, fewer than n if the block runs off the end.
+     */
+    virtual size_t read_block(T *buf, size_t index, size_t n)
+    {
+        size_t  i = 0;
+        while (i < n && read(buf[i], index + i))
+            i++;
+        return i;
+    }
+
+    /**
+     * @brief Copy a block into memory, for devices doing DMA.
+     * @param buf Values to store.
+     * @param index First location to write.
+     * @param n Number of locations.
+     * @return Number copied, fewer than n if the block runs off the end.
+     */
+    virtual size_t write_block(const T *buf, size_t index, size_t n)
+    {
+        size_t  i = 0;
+        while (i < n && write(buf[i], index + i))
+            i++;
+        return i;
+    }
+
     /**
      * @brief Total amount of memory in system.
      */
@@ -267,6 +430,38 @@ public:
         this->base_ = mem_->getBase();
     }
 
+    virtual void setShared(bool shared) override
+    {
+        if (mem_ != nullptr)
+            mem_->setShared(shared);
+    }
+
+    virtual void setNode(int node) override
+    {
+        if (mem_ != nullptr)
+            mem_->setNode(node);
+    }
+
+    virtual unsigned pageShift() const override
+    {
+        return (mem_ != nullptr) ? mem_->pageShift() : 0;
+    }
+
+    virtual void dirty_since(std::vector<uint64_t> &bits,
+                             uint64_t since) const override
+    {
+        if (mem_ != nullptr)
+            mem_->dirty_since(bits, since);
+        else
+            bits.clear();
+    }
+
+    virtual void mark_dirty() override
+    {
+        if (mem_ != nullptr)
+            mem_->mark_dirty();
+    }
+
     /**
      * @brief Retrieve a value from memory or throw exception if no location.
      * @param val returned value.
@@ -324,6 +519,22 @@ public:
         return rmem_->write(val, index - this->base_);
     };
 
+    virtual
+    size_t read_block(T *buf, size_t index, size_t n) override
+    {
+        if (index < this->base_)
+            return 0;
+        return rmem_->read_block(buf, index - this->base_, n);
+    }
+
+    virtual
+    size_t write_block(const T *buf, size_t index, size_t n) override
+    {
+        if (index < this->base_)
+            return 0;
+        return rmem_->write_block(buf, index - this->base_, n);
+    }
+
     /**
      *  Pointer to memory device that holds actual values.
      */
@@ -363,14 +574,15 @@ public:
         // Make sure power of two.
         if ((chunk_size & (chunk_size - 1)) != 0)
             throw;
-        // Figure out how many chucks we need.
-        size_t num = size / chunk_size;
+        // Figure out how many chucks we need, a partial chunk at the end
+        // still needs an entry.
+        num_ = (size + chunk_size - 1) / chunk_size;
         // Compute index shift.
         for(shift_ = 0; chunk_size != (1llu << shift_); shift_++);
         // Allocate and initialize the memory.
-        mem_ = new std::shared_ptr<Memory<T>> [num];
+        mem_ = new std::shared_ptr<Memory<T>> [num_];
         // Set all entries to non-existant memory.
-        for (size_t i = 0; i < num; i++) {
+        for (size_t i = 0; i < num_; i++) {
             mem_[i] = empty_;
         }
     }
@@ -414,11 +626,86 @@ public:
     {
         size_t base_address = mem->getBase() >> shift_;
         size_t top_address = (mem->getSize() >> shift_) + base_address;
+        // Ignore any part of the region past the end of the array.
+        if (top_address > num_)
+            top_address = num_;
         for (size_t i = base_address; i < top_address; i++) {
             mem_[i] = mem;
         }
     }
-    
+
+    virtual void setShared(bool shared) override
+    {
+        for (size_t i = 0; i < num_; i++) {
+            if (i == 0 || mem_[i] != mem_[i - 1])
+                mem_[i]->setShared(shared);
+        }
+    }
+
+    /**
+     * @brief Place the chunk table as well as the memory it maps, it is
+     *     read on every access.
+     */
+    virtual void setNode(int node) override
+    {
+        core::Numa::bind_memory(mem_, num_ * sizeof(mem_[0]), node);
+        for (size_t i = 0; i < num_; i++) {
+            if (i == 0 || mem_[i] != mem_[i - 1])
+                mem_[i]->setNode(node);
+        }
+    }
+
+    /**
+     * @brief Pages of the array are its chunks.
+     */
+    virtual unsigned pageShift() const override
+    {
+        return (unsigned)shift_;
+    }
+
+    /**
+     * @brief Build a map of written chunks from the maps of the memory
+     *     they point to.
+     */
+    virtual void dirty_since(std::vector<uint64_t> &bits,
+                             uint64_t since) const override
+    {
+        std::vector<uint64_t> part;
+
+        bits.assign((num_ + 63) / 64, 0);
+        for (size_t i = 0; i < num_; ) {
+            // A module covers a run of chunks, ask it once.
+            size_t     end = i + 1;
+            Memory<T> *mem = mem_[i].get();
+            while (end < num_ && mem_[end].get() == mem)
+                end++;
+            unsigned   page = mem->pageShift();
+            if (page != 0) {
+                mem->dirty_since(part, since);
+                for (size_t c = i; c < end; c++) {
+                    size_t first = (c << shift_) - mem->getBase();
+                    size_t last = ((first + (1llu << shift_) - 1) >> page);
+                    for (size_t p = first >> page; p <= last; p++) {
+                        if ((p >> 6) < part.size() &&
+                            (part[p >> 6] & (1llu << (p & 63))) != 0) {
+                            bits[c >> 6] |= 1llu << (c & 63);
+                            break;
+                        }
+                    }
+                }
+            }
+            i = end;
+        }
+    }
+
+    virtual void mark_dirty() override
+    {
+        for (size_t i = 0; i < num_; i++) {
+            if (i == 0 || mem_[i] != mem_[i - 1])
+                mem_[i]->mark_dirty();
+        }
+    }
+
     /**
      * @brief Retrieve a value from memory or throw exception if no location.
      * @param val returned value.
@@ -486,11 +773,58 @@ public:
         return false;
     };
 
+    /**
+     * @brief Copy a block out, split at each bin.
+     */
+    virtual
+    size_t read_block(T *buf, size_t index, size_t n) override
+    {
+        size_t  done = 0;
+
+        while (done < n && index < this->size_) {
+            size_t  base = index >> shift_;
+            size_t  len = std::min(n - done, ((base + 1) << shift_) - index);
+            size_t  got = mem_[base]->read_block(buf + done,
+                                      index - mem_[base]->getBase(), len);
+            done += got;
+            index += got;
+            if (got != len)
+                break;
+        }
+        return done;
+    }
+
+    /**
+     * @brief Copy a block in, split at each bin.
+     */
+    virtual
+    size_t write_block(const T *buf, size_t index, size_t n) override
+    {
+        size_t  done = 0;
+
+        while (done < n && index < this->size_) {
+            size_t  base = index >> shift_;
+            size_t  len = std::min(n - done, ((base + 1) << shift_) - index);
+            size_t  put = mem_[base]->write_block(buf + done,
+                                      index - mem_[base]->getBase(), len);
+            done += put;
+            index += put;
+            if (put != len)
+                break;
+        }
+        return done;
+    }
+
     /**
      * @brief shift factor for determining bin.
      */
     size_t      shift_;
 
+    /**
+     * @brief Number of entries in mem_.
+     */
+    size_t      num_;
+
     /**
      * @brief Array of memory pointers.
      */
@@ -506,7 +840,7 @@ public:
     public: \
         systype##_##model##_##MemFactory() \
         { \
-            std::cout << "Registering Mem: " #model << "\n"; \
+            std::cerr << "Registering Mem: " #model << "\n"; \
             systype::registerMem(#model, this); \
         } \
         virtual MEM_v create(const size_t size, const size_t base) { \
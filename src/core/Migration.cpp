@@ -0,0 +1,285 @@
+/*
+ * Author:      Richard Cornwell (rich@sky-visions.com)
+ *
+ * Copyright (C) 2021 Richard Cornwell.
+ *
+ * This file may be distributed under the terms of the Q Public License
+ * as defined by Trolltech AS of Norway and appearing in the file
+ * LICENSE.QPL included in the packaging of this file.
+ *
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING
+ * THE WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL,
+ * INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING
+ * FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION
+ * WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+#include "config.h"
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <sstream>
+#include <thread>
+#include "Migration.h"
+#include "State.h"
+#ifdef HAVE_SYS_UN_H
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+namespace core
+{
+
+using namespace std;
+
+#ifdef HAVE_SYS_UN_H
+#ifdef MSG_NOSIGNAL
+static const int send_flags = MSG_NOSIGNAL;
+#else
+static const int send_flags = 0;
+#endif
+
+// Frames are a length followed by that many bytes, the first four of
+// which say what the frame holds.
+static bool write_frame(int fd, const string &frame)
+{
+    uint32_t     len = (uint32_t)frame.size();
+    const char  *parts[2] = { reinterpret_cast<const char *>(&len),
+                              frame.data() };
+    size_t       sizes[2] = { sizeof(len), frame.size() };
+
+    for (int i = 0; i < 2; i++) {
+        size_t  done = 0;
+        while (done < sizes[i]) {
+            ssize_t  n = ::send(fd, parts[i] + done, sizes[i] - done,
+                                send_flags);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return false;
+            done += (size_t)n;
+        }
+    }
+    return true;
+}
+
+static bool read_all(int fd, char *data, size_t len)
+{
+    size_t  done = 0;
+
+    while (done < len) {
+        ssize_t  n = ::read(fd, data + done, len - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        done += (size_t)n;
+    }
+    return true;
+}
+
+static bool read_frame(int fd, string &frame)
+{
+    uint32_t  len;
+
+    if (!read_all(fd, reinterpret_cast<char *>(&len), sizeof(len)) ||
+        len < 4)
+        return false;
+    frame.resize(len);
+    return read_all(fd, &frame[0], len);
+}
+
+static sockaddr_un socket_path(const string &path)
+{
+    sockaddr_un  addr{};
+
+    if (path.size() >= sizeof(addr.sun_path))
+        throw SystemError{"Socket path too long: " + path};
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return addr;
+}
+#endif
+
+void Migration::stream(int fd, const string &frame, MigrateStats &stats)
+{
+#ifdef HAVE_SYS_UN_H
+    atomic<bool>  sent{false};
+    bool          ok = false;
+    thread        writer([fd, &frame, &sent, &ok]() {
+        ok = write_frame(fd, frame);
+        sent.store(true);
+    });
+
+    // Keep the guest going while the frame is on its way.
+    while (!sent.load()) {
+        if (sys.idle())
+            this_thread::sleep_for(chrono::microseconds(100));
+        else
+            (void)sys.run_quantum(quantum);
+    }
+    writer.join();
+    if (!ok)
+        throw SystemError{"Migration target went away"};
+    stats.rounds++;
+    stats.bytes += frame.size();
+#else
+    (void)fd;
+    (void)frame;
+    (void)stats;
+#endif
+}
+
+MigrateStats Migration::send(int fd)
+{
+    MigrateStats  stats;
+#ifdef HAVE_SYS_UN_H
+    {
+        ostringstream  os;
+        StateOut       out(os);
+        out.tag("SYST");
+        sys.save_layout(out);
+        if (!write_frame(fd, os.str()))
+            throw SystemError{"Migration target went away"};
+        stats.bytes += os.str().size();
+    }
+    // Rounds send what changed since the one before, with an epoch of
+    // their own so other users of the dirty maps do not hide pages.
+    uint64_t  since = dirty_epoch();
+    {
+        ostringstream  os;
+        StateOut(os).tag("FULL");
+        sys.save(os);
+        stream(fd, os.str(), stats);
+    }
+    for (;;) {
+        auto           pause = chrono::steady_clock::now();
+        ostringstream  os;
+        StateOut(os).tag("PAGE");
+        sys.save_delta(os, since);
+        string         frame = os.str();
+        if (frame.size() > pause_bytes && stats.rounds < max_rounds) {
+            stream(fd, frame, stats);
+            continue;
+        }
+        // Small enough, this is the last one and the guest stays paused.
+        frame.replace(0, 4, "LAST");
+        string         reply;
+        if (!write_frame(fd, frame) || !read_frame(fd, reply) ||
+                reply.compare(0, 4, "DONE") != 0)
+            throw SystemError{"Migration target went away"};
+        stats.bytes += frame.size();
+        stats.final_bytes = frame.size();
+        stats.downtime_ns = (uint64_t)chrono::duration_cast<chrono::nanoseconds>(
+                    chrono::steady_clock::now() - pause).count();
+        return stats;
+    }
+#else
+    (void)fd;
+    throw SystemError{"Migration is not supported on this host"};
+#endif
+}
+
+shared_ptr<System> Migration::receive(int fd)
+{
+#ifdef HAVE_SYS_UN_H
+    shared_ptr<System>  sys;
+    string              frame;
+
+    for (;;) {
+        if (!read_frame(fd, frame))
+            throw State_error{"Migration ended early"};
+        istringstream  is(frame);
+        StateIn        in(is);
+        char           tag[4];
+        in.get_bytes(tag, 4);
+        string         kind(tag, 4);
+        if (kind == "SYST") {
+            sys = System::build(in);
+            continue;
+        }
+        if (sys == nullptr)
+            throw State_error{"Migration did not start with a layout"};
+        if (kind == "FULL") {
+            sys->restore(is);
+        } else if (kind == "PAGE" || kind == "LAST") {
+            sys->restore_delta(is);
+            if (kind == "LAST") {
+                if (!write_frame(fd, "DONE"))
+                    throw State_error{"Migration sender went away"};
+                return sys;
+            }
+        } else {
+            throw State_error{"Unknown migration frame " + kind};
+        }
+    }
+#else
+    (void)fd;
+    throw SystemError{"Migration is not supported on this host"};
+#endif
+}
+
+int Migration::listen(const string &path)
+{
+#ifdef HAVE_SYS_UN_H
+    sockaddr_un  addr = socket_path(path);
+    int          fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (fd < 0)
+        throw SystemError{string("Unable to create socket: ") + strerror(errno)};
+    (void)::unlink(path.c_str());
+    if (::bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+        ::listen(fd, 1) != 0) {
+        int  err = errno;
+        ::close(fd);
+        throw SystemError{"Unable to listen on " + path + ": " + strerror(err)};
+    }
+    return fd;
+#else
+    throw SystemError{"Migration is not supported on this host: " + path};
+#endif
+}
+
+int Migration::accept(int fd)
+{
+#ifdef HAVE_SYS_UN_H
+    int  conn;
+
+    do {
+        conn = ::accept(fd, nullptr, nullptr);
+    } while (conn < 0 && errno == EINTR);
+    if (conn < 0)
+        throw SystemError{string("Unable to accept: ") + strerror(errno)};
+    return conn;
+#else
+    (void)fd;
+    throw SystemError{"Migration is not supported on this host"};
+#endif
+}
+
+int Migration::connect(const string &path)
+{
+#ifdef HAVE_SYS_UN_H
+    sockaddr_un  addr = socket_path(path);
+    int          fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (fd < 0)
+        throw SystemError{string("Unable to create socket: ") + strerror(errno)};
+    if (::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+        int  err = errno;
+        ::close(fd);
+        throw SystemError{"Unable to connect to " + path + ": " + strerror(err)};
+    }
+    return fd;
+#else
+    throw SystemError{"Migration is not supported on this host: " + path};
+#endif
+}
+
+}
@@ -0,0 +1,127 @@
+/*
+ * Author:      Richard Cornwell (rich@sky-visions.com)
+ *
+ * Copyright (C) 2021 Richard Cornwell.
+ *
+ * This file may be distributed under the terms of the Q Public License
+ * as defined by Trolltech AS of Norway and appearing in the file
+ * LICENSE.QPL included in the packaging of this file.
+ *
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING
+ * THE WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL,
+ * INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING
+ * FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION
+ * WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+#pragma once
+
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include "System.h"
+
+namespace core
+{
+
+/**
+ * @brief What a migration did.
+ */
+struct MigrateStats {
+    uint32_t  rounds = 0;       // Rounds sent while running, the full
+                                // copy included.
+    uint64_t  bytes = 0;        // Total bytes sent.
+    uint64_t  final_bytes = 0;  // Bytes sent while paused.
+    uint64_t  downtime_ns = 0;  // Host time from pause until the target
+                                // has taken over.
+};
+
+/**
+ * @class Migration
+ * @author rich
+ * @date 18/10/26
+ * @file Migration.h
+ * @brief Moves a running System to another process over a stream socket.
+ *
+ *     The sender writes the layout of the System, then all of its state,
+ *     while the guest keeps running. Pages written meanwhile are sent in
+ *     further rounds until a round is small enough, or max_rounds is
+ *     reached. The guest is then paused and the last pages are sent with
+ *     the CPU and device state. The receiver builds the System through
+ *     the registered factories, applies each round and replies once it
+ *     holds the final state.
+ */
+class Migration
+{
+public:
+    /**
+     * @brief Create a migration of a System.
+     * @param sys System to send. While send() runs it is run by the
+     *     calling thread, nothing else may run it.
+     */
+    explicit Migration(System &sys) : sys(sys) {}
+
+    /**
+     * @brief Send the System over a connected socket. On return the
+     *     target has taken over and this System is paused at the state
+     *     it sent, it must not be run again. If the target fails a
+     *     SystemError is thrown and the System can be run on here.
+     * @param fd Connected socket.
+     * @return Statistics of the migration.
+     */
+    MigrateStats send(int fd);
+
+    /**
+     * @brief Receive a System sent by send().
+     * @param fd Connected socket.
+     * @return The System, ready to run.
+     */
+    static std::shared_ptr<System> receive(int fd);
+
+    /**
+     * @brief Create a Unix socket at path to receive on, replacing any
+     *     left there.
+     * @return Listening socket.
+     */
+    static int listen(const std::string &path);
+
+    /**
+     * @brief Wait for a sender to connect to a listening socket.
+     * @return Connected socket.
+     */
+    static int accept(int fd);
+
+    /**
+     * @brief Connect to a receiver listening at path.
+     * @return Connected socket.
+     */
+    static int connect(const std::string &path);
+
+    /**
+     * @brief Most rounds to send while running before pausing anyway.
+     */
+    uint32_t  max_rounds = 30;
+
+    /**
+     * @brief Pause once the pages written during a round fit in this many
+     *     bytes.
+     */
+    size_t    pause_bytes = 64 * 1024;
+
+    /**
+     * @brief Simulated nanoseconds run between checks that a round has
+     *     been sent.
+     */
+    uint64_t  quantum = 100000;
+
+private:
+    void stream(int fd, const std::string &frame, MigrateStats &stats);
+
+    System   &sys;
+};
+
+}
@@ -0,0 +1,172 @@
+/*
+ * Author:      Richard Cornwell (rich@sky-visions.com)
+ *
+ * Copyright (C) 2021 Richard Cornwell.
+ *
+ * This file may be distributed under the terms of the Q Public License
+ * as defined by Trolltech AS of Norway and appearing in the file
+ * LICENSE.QPL included in the packaging of this file.
+ *
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING
+ * THE WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL,
+ * INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING
+ * FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION
+ * WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+#include "config.h"
+#include <stdint.h>
+#include <fstream>
+#include <sstream>
+#include "Numa.h"
+#include "System.h"
+#if defined(__linux__) && defined(HAVE_SCHED_H) && defined(HAVE_SYS_SYSCALL_H)
+#define NUMA_LINUX
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+
+namespace core
+{
+
+using namespace std;
+
+#ifdef NUMA_LINUX
+// From <numaif.h>, which is not always installed.
+static const int MPOL_PREFERRED_ = 1;
+static const unsigned MPOL_MF_MOVE_ = 1u << 1;
+static const unsigned MPOL_F_NODE_ = 1u << 0;
+static const unsigned MPOL_F_ADDR_ = 1u << 1;
+#endif
+
+vector<int> Numa::parse_list(const string &list)
+{
+    vector<int>  cores;
+    stringstream in(list);
+    string       item;
+
+    while (getline(in, item, ',')) {
+        if (item.empty())
+            continue;
+        size_t  dash = item.find('-');
+        try {
+            size_t  used;
+            int     first = stoi(item, &used);
+            int     last = first;
+            if (dash != string::npos) {
+                if (used != dash)
+                    throw SystemError{"Invalid core list: " + list};
+                last = stoi(item.substr(dash + 1), &used);
+                used += dash + 1;
+            }
+            if (used != item.size() || first < 0 || last < first)
+                throw SystemError{"Invalid core list: " + list};
+            for (int c = first; c <= last; c++)
+                cores.push_back(c);
+        } catch (const invalid_argument &) {
+            throw SystemError{"Invalid core list: " + list};
+        } catch (const out_of_range &) {
+            throw SystemError{"Invalid core list: " + list};
+        }
+    }
+    return cores;
+}
+
+bool Numa::pin_thread(const vector<int> &cores)
+{
+#ifdef NUMA_LINUX
+    cpu_set_t  set;
+
+    if (cores.empty())
+        return true;
+    CPU_ZERO(&set);
+    for (int c : cores) {
+        if (c < CPU_SETSIZE)
+            CPU_SET(c, &set);
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    return cores.empty();
+#endif
+}
+
+int Numa::nodes()
+{
+    int  n = 0;
+
+    while (ifstream("/sys/devices/system/node/node" + to_string(n) +
+                    "/cpulist").is_open())
+        n++;
+    return (n == 0) ? 1 : n;
+}
+
+vector<int> Numa::node_cores(int node)
+{
+    ifstream  file("/sys/devices/system/node/node" + to_string(node) +
+                   "/cpulist");
+    string    list;
+
+    if (!file.is_open() || !getline(file, list))
+        return vector<int>{};
+    return parse_list(list);
+}
+
+int Numa::core_node(int core)
+{
+    int  n = nodes();
+
+    for (int node = 0; node < n; node++) {
+        for (int c : node_cores(node)) {
+            if (c == core)
+                return node;
+        }
+    }
+    return 0;
+}
+
+bool Numa::bind_memory(void *addr, size_t len, int node)
+{
+#ifdef NUMA_LINUX
+    size_t     page = (size_t)sysconf(_SC_PAGESIZE);
+    uintptr_t  start = ((uintptr_t)addr + page - 1) & ~(page - 1);
+    uintptr_t  end = ((uintptr_t)addr + len) & ~(page - 1);
+    unsigned long mask[16] = {0};
+
+    if (node < 0 || node >= (int)(sizeof(mask) * 8))
+        return false;
+    // Less than a whole page, nothing worth moving.
+    if (end <= start)
+        return true;
+    mask[node / (8 * sizeof(long))] = 1ul << (node % (8 * sizeof(long)));
+    return syscall(SYS_mbind, start, end - start, MPOL_PREFERRED_, mask,
+                   sizeof(mask) * 8, MPOL_MF_MOVE_) == 0;
+#else
+    (void)addr;
+    (void)len;
+    (void)node;
+    return false;
+#endif
+}
+
+int Numa::memory_node(void *addr)
+{
+#ifdef NUMA_LINUX
+    int  node = -1;
+
+    if (syscall(SYS_get_mempolicy, &node, nullptr, 0, addr,
+                MPOL_F_NODE_ | MPOL_F_ADDR_) != 0)
+        return -1;
+    return node;
+#else
+    (void)addr;
+    return -1;
+#endif
+}
+
+}
@@ -0,0 +1,90 @@
+/*
+ * Author:      Richard Cornwell (rich@sky-visions.com)
+ *
+ * Copyright (C) 2021 Richard Cornwell.
+ *
+ * This file may be distributed under the terms of the Q Public License
+ * as defined by Trolltech AS of Norway and appearing in the file
+ * LICENSE.QPL included in the packaging of this file.
+ *
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING
+ * THE WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL,
+ * INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING
+ * FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION
+ * WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+#pragma once
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+namespace core
+{
+
+/**
+ * @class Numa
+ * @author rich
+ * @date 18/10/26
+ * @file Numa.h
+ * @brief Host placement helpers: pinning threads to cores and placing
+ *     memory on NUMA nodes. On hosts without support the calls do
+ *     nothing and report failure, the simulation runs the same either
+ *     way, only slower.
+ */
+class Numa
+{
+public:
+    /**
+     * @brief Parse a core list such as "0-3,8,10-11".
+     * @param list Text to parse, empty gives an empty list.
+     * @return Core numbers in the order given. Throws SystemError if the
+     *     list is not valid.
+     */
+    static std::vector<int> parse_list(const std::string &list);
+
+    /**
+     * @brief Pin the calling thread to a set of cores.
+     * @param cores Cores to allow, empty allows all.
+     * @return false if the host does not support it or refused.
+     */
+    static bool pin_thread(const std::vector<int> &cores);
+
+    /**
+     * @brief Number of NUMA nodes, 1 if the host does not report any.
+     */
+    static int nodes();
+
+    /**
+     * @brief Cores belonging to a node.
+     */
+    static std::vector<int> node_cores(int node);
+
+    /**
+     * @brief Node a core belongs to, 0 if not known.
+     */
+    static int core_node(int core);
+
+    /**
+     * @brief Place the whole pages of a region on a node, moving any
+     *     already touched. The node is preferred, not required, so
+     *     allocation still succeeds if it fills.
+     * @param addr Start of region.
+     * @param len Length in bytes.
+     * @param node Node to place it on.
+     * @return false if the host does not support it or refused.
+     */
+    static bool bind_memory(void *addr, size_t len, int node);
+
+    /**
+     * @brief Node holding the page at addr, -1 if not known.
+     */
+    static int memory_node(void *addr);
+};
+
+}
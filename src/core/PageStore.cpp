@@ -0,0 +1,169 @@
+/*
+ * Author:      Richard Cornwell (rich@sky-visions.com)
+ *
+ * Copyright (C) 2021 Richard Cornwell.
+ *
+ * This file may be distributed under the terms of the Q Public License
+ * as defined by Trolltech AS of Norway and appearing in the file
+ * LICENSE.QPL included in the packaging of this file.
+ *
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING
+ * THE WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL,
+ * INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING
+ * FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION
+ * WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+#include "config.h"
+#include <stdlib.h>
+#include <cstring>
+#include <new>
+#include "PageStore.h"
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+namespace core
+{
+
+using namespace std;
+
+PageFrame::PageFrame(const void *src, size_t len, uint64_t hash) :
+    data(PageStore::alloc(len)), bytes(len), hash(hash)
+{
+    memcpy(data, src, len);
+}
+
+PageFrame::~PageFrame()
+{
+    PageStore::free(data, bytes);
+}
+
+uint64_t PageStore::hash(const void *data, size_t len)
+{
+    static const uint32_t  prime1 = 2654435761u;
+    static const uint32_t  prime2 = 2246822519u;
+    const uint8_t         *p = static_cast<const uint8_t *>(data);
+    uint32_t               lane[8];
+    size_t                 i;
+
+    for (int l = 0; l < 8; l++)
+        lane[l] = prime1 * (uint32_t)(l + 1);
+    // One xxHash32 round per lane for each 32 byte block.
+    for (i = 0; i + 32 <= len; i += 32) {
+        uint32_t  w[8];
+        memcpy(w, p + i, sizeof(w));
+        for (int l = 0; l < 8; l++) {
+            uint32_t  v = lane[l] + w[l] * prime2;
+            lane[l] = ((v << 13) | (v >> 19)) * prime1;
+        }
+    }
+    for (; i < len; i++)
+        lane[i & 7] = (lane[i & 7] ^ p[i]) * prime1;
+
+    uint64_t  h = len;
+    for (int l = 0; l < 8; l++) {
+        h = (h ^ lane[l]) * 0x9e3779b97f4a7c15ull;
+        h ^= h >> 29;
+    }
+    return (h != 0) ? h : 1;
+}
+
+shared_ptr<PageFrame> PageStore::share(const void *data, size_t len,
+                                       uint64_t hash, bool &found)
+{
+    lock_guard<mutex> lock(lock_);
+    auto  range = frames_.equal_range(hash);
+
+    for (auto it = range.first; it != range.second; ) {
+        shared_ptr<PageFrame>  frame = it->second.lock();
+        if (frame == nullptr) {
+            it = frames_.erase(it);
+            continue;
+        }
+        // Equal hashes only make it likely, compare to be sure.
+        if (frame->bytes == len && memcmp(frame->data, data, len) == 0) {
+            found = true;
+            return frame;
+        }
+        it++;
+    }
+    auto  frame = make_shared<PageFrame>(data, len, hash);
+    frames_.emplace(hash, frame);
+    found = false;
+    return frame;
+}
+
+void PageStore::prune()
+{
+    for (auto it = frames_.begin(); it != frames_.end(); ) {
+        if (it->second.expired())
+            it = frames_.erase(it);
+        else
+            it++;
+    }
+}
+
+size_t PageStore::frames()
+{
+    lock_guard<mutex> lock(lock_);
+    prune();
+    return frames_.size();
+}
+
+uint64_t PageStore::saved_bytes()
+{
+    lock_guard<mutex> lock(lock_);
+    uint64_t  saved = 0;
+
+    prune();
+    for (auto &entry : frames_) {
+        long  users = entry.second.use_count();
+        if (users > 1)
+            saved += (uint64_t)(users - 1) * page_bytes;
+    }
+    return saved;
+}
+
+void *PageStore::alloc(size_t len)
+{
+#ifdef HAVE_SYS_MMAN_H
+    void  *addr = mmap(nullptr, (len != 0) ? len : 1, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED)
+        throw bad_alloc();
+    return addr;
+#else
+    void  *addr = calloc((len != 0) ? len : 1, 1);
+    if (addr == nullptr)
+        throw bad_alloc();
+    return addr;
+#endif
+}
+
+void PageStore::free(void *addr, size_t len)
+{
+    if (addr == nullptr)
+        return;
+#ifdef HAVE_SYS_MMAN_H
+    munmap(addr, (len != 0) ? len : 1);
+#else
+    (void)len;
+    ::free(addr);
+#endif
+}
+
+void PageStore::discard(void *addr, size_t len)
+{
+#ifdef HAVE_SYS_MMAN_H
+    madvise(addr, len, MADV_DONTNEED);
+#else
+    memset(addr, 0, len);
+#endif
+}
+
+}
@@ -0,0 +1,121 @@
+/*
+ * Author:      Richard Cornwell (rich@sky-visions.com)
+ *
+ * Copyright (C) 2021 Richard Cornwell.
+ *
+ * This file may be distributed under the terms of the Q Public License
+ * as defined by Trolltech AS of Norway and appearing in the file
+ * LICENSE.QPL included in the packaging of this file.
+ *
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING
+ * THE WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL,
+ * INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING
+ * FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION
+ * WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace core
+{
+
+/**
+ * @brief A read only page of memory shared by every RAM holding the same
+ *     contents. It is freed when the last user writes to its copy.
+ */
+struct PageFrame {
+    PageFrame(const void *src, size_t len, uint64_t hash);
+    ~PageFrame();
+
+    PageFrame(const PageFrame&) = delete;
+
+    void       *data;
+    size_t      bytes;
+    uint64_t    hash;
+};
+
+/**
+ * @class PageStore
+ * @author rich
+ * @date 18/10/26
+ * @file PageStore.h
+ * @brief Content addressed store of shared pages. Many sessions booted
+ *     from the same image hold identical pages, each RAM hands its pages
+ *     that have stopped changing to share(), which returns the frame
+ *     already holding those bytes if there is one. Safe to use from any
+ *     thread.
+ */
+class PageStore
+{
+public:
+    /**
+     * @brief Size of a shared page, the host page size so a page given
+     *     up by a RAM is returned to the host.
+     */
+    static constexpr size_t page_bytes = 4096;
+
+    /**
+     * @brief Hash a block of memory. Eight lanes are hashed side by side
+     *     so the compiler can keep them in vector registers.
+     * @param data Block to hash.
+     * @param len Length in bytes.
+     * @return Hash, never 0.
+     */
+    static uint64_t hash(const void *data, size_t len);
+
+    /**
+     * @brief Find a frame holding the same bytes as data or make one.
+     * @param data Page contents.
+     * @param len Length in bytes.
+     * @param hash Value of hash() for data.
+     * @param found Set true if the frame was already held by others.
+     * @return Frame holding the contents.
+     */
+    std::shared_ptr<PageFrame> share(const void *data, size_t len,
+                                     uint64_t hash, bool &found);
+
+    /**
+     * @brief Number of frames in use.
+     */
+    size_t frames();
+
+    /**
+     * @brief Bytes of host memory saved, each frame counts once for
+     *     every user after the first.
+     */
+    uint64_t saved_bytes();
+
+    /**
+     * @brief Allocate zeroed host memory aligned to a page.
+     */
+    static void *alloc(size_t len);
+
+    /**
+     * @brief Free memory from alloc().
+     */
+    static void free(void *addr, size_t len);
+
+    /**
+     * @brief Give the whole pages of a region back to the host. They read
+     *     as zero until written.
+     */
+    static void discard(void *addr, size_t len);
+
+private:
+    void prune();
+
+    std::mutex                                  lock_;
+    std::unordered_multimap<uint64_t, std::weak_ptr<PageFrame>> frames_;
+};
+
+}
@@ -19,7 +19,12 @@
 
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <memory>
 #include "Memory.h"
+#include "PageStore.h"
 
 namespace emulator
 {
@@ -30,6 +35,11 @@ namespace emulator
  * @date 01/06/21
  * @file RAM.h
  * @brief RAM is a generic read-writable memory array.
+ *
+ *     Accesses go through a table with an entry per host page. A page
+ *     that merge_pages() finds has stopped changing is handed to a
+ *     PageStore and read from the shared frame, its own copy is given
+ *     back to the host. The first write to it copies the frame back.
  */
 template <typename T>
 class RAM : public Memory<T>
@@ -46,17 +56,195 @@ public:
     {
         this->size_ = size;
         this->base_ = base;
-        data_  = new T[size];
+        data_  = static_cast<T *>(core::PageStore::alloc(bytes()));
+        pages_ = (size + (1llu << page_shift) - 1) >> page_shift;
+        stamp_.reset(new std::atomic<uint64_t>[pages_]());
+        nframes_ = (size + frame_size - 1) >> frame_shift;
+        rtab_.reset(new T *[nframes_]);
+        wtab_.reset(new T *[nframes_]);
+        frames_.resize(nframes_);
+        hashes_.resize(nframes_);
+        joined_.resize(nframes_);
+        map_private();
     }
 
     virtual ~RAM() override
     {
-        if (data_)
-            delete[] data_;
+        core::PageStore::free(data_, bytes());
     }
 
     T        *data_;
 
+    virtual std::string getType() const override
+    {
+        return "RAM";
+    }
+
+    /**
+     * @brief Set when more than one CPU can reach this memory. Accesses
+     *     are then acquire loads and release stores, which on most hosts
+     *     are the same instructions as plain ones.
+     */
+    bool      shared_ = false;
+
+    virtual void setShared(bool shared) override
+    {
+        shared_ = shared;
+    }
+
+    virtual void setNode(int node) override
+    {
+        core::Numa::bind_memory(data_, bytes(), node);
+    }
+
+    /**
+     * @brief Save all of memory. The dirty map is left alone, a caller
+     *     that follows this with deltas takes core::dirty_epoch() first.
+     */
+    virtual void save(core::StateOut &out) override
+    {
+        out.put((uint64_t)this->size_);
+        put_range(out, 0, this->size_);
+    }
+
+    virtual void load(core::StateIn &in) override
+    {
+        if (in.get<uint64_t>() != this->size_)
+            throw core::State_error{"Saved memory size does not match"};
+        if (data_ == nullptr)
+            data_ = static_cast<T *>(core::PageStore::alloc(bytes()));
+        map_private();
+        in.get_bytes(data_, bytes());
+        mark_dirty();
+    }
+
+    /**
+     * @brief Pages are 1 << page_shift locations.
+     */
+    static constexpr unsigned page_shift = 10;
+
+    virtual unsigned pageShift() const override
+    {
+        return page_shift;
+    }
+
+    virtual void dirty_since(std::vector<uint64_t> &bits,
+                             uint64_t since) const override
+    {
+        bits.assign((pages_ + 63) / 64, 0);
+        for (size_t page = 0; page < pages_; page++) {
+            if (stamp_[page].load(std::memory_order_acquire) >= since)
+                bits[page >> 6] |= 1llu << (page & 63);
+        }
+    }
+
+    virtual void mark_dirty() override
+    {
+        uint64_t  now = core::dirty_clock().load(std::memory_order_relaxed);
+
+        for (size_t page = 0; page < pages_; page++)
+            stamp_[page].store(now, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Write the memory size and the number of pages written,
+     *     followed by the number and contents of each.
+     */
+    virtual void save_dirty(core::StateOut &out, uint64_t since) override
+    {
+        std::vector<uint64_t> bits;
+        std::vector<uint32_t> pages;
+
+        dirty_since(bits, since);
+        for (size_t page = 0; page < pages_; page++) {
+            if ((bits[page >> 6] & (1llu << (page & 63))) != 0)
+                pages.push_back((uint32_t)page);
+        }
+        out.put((uint64_t)this->size_);
+        out.put((uint32_t)pages.size());
+        for (auto page : pages) {
+            out.put(page);
+            put_range(out, (size_t)page << page_shift, pageLength(page));
+        }
+    }
+
+    virtual void load_dirty(core::StateIn &in) override
+    {
+        if (in.get<uint64_t>() != this->size_)
+            throw core::State_error{"Saved memory size does not match"};
+        if (data_ == nullptr)
+            throw core::State_error{"Memory has been released"};
+        uint32_t count = in.get<uint32_t>();
+        while (count-- != 0) {
+            size_t page = in.get<uint32_t>();
+            if (page >= pages_)
+                throw core::State_error{"Saved page out of range"};
+            get_range(in, page << page_shift, pageLength(page));
+            touch(page << page_shift);
+        }
+    }
+
+    virtual void release() override
+    {
+        core::PageStore::free(data_, bytes());
+        data_ = nullptr;
+        map_private();
+    }
+
+    /**
+     * @brief Host pages are 1 << frame_shift locations.
+     */
+    static constexpr size_t   frame_size = core::PageStore::page_bytes / sizeof(T);
+    static constexpr unsigned frame_shift = (sizeof(T) == 1) ? 12 :
+                                            (sizeof(T) == 2) ? 11 :
+                                            (sizeof(T) == 4) ? 10 : 9;
+    static constexpr size_t   frame_mask = frame_size - 1;
+
+    /**
+     * @brief Share the whole host pages that have not changed since the
+     *     last call. Memory reached by several CPU's is not shared. Call
+     *     it while no CPU is running.
+     */
+    virtual size_t merge_pages(core::PageStore &store) override
+    {
+        size_t  merged = 0;
+
+        if (shared_ || data_ == nullptr)
+            return 0;
+        for (size_t p = 0; p < (this->size_ >> frame_shift); p++) {
+            if (frames_[p] != nullptr)
+                continue;
+            T        *page = rtab_[p];
+            uint64_t  hash = core::PageStore::hash(page, core::PageStore::page_bytes);
+            // Wait for a page to look the same twice before sharing it.
+            if (hash != hashes_[p]) {
+                hashes_[p] = hash;
+                continue;
+            }
+            bool      found;
+            frames_[p] = store.share(page, core::PageStore::page_bytes, hash, found);
+            rtab_[p] = static_cast<T *>(frames_[p]->data);
+            wtab_[p] = nullptr;
+            core::PageStore::discard(page, core::PageStore::page_bytes);
+            joined_[p] = found;
+            shared_bytes_ += core::PageStore::page_bytes;
+            if (found)
+                saved_bytes_ += core::PageStore::page_bytes;
+            merged++;
+        }
+        return merged;
+    }
+
+    virtual uint64_t shared_bytes() const override
+    {
+        return shared_bytes_.load(std::memory_order_relaxed);
+    }
+
+    virtual uint64_t saved_bytes() const override
+    {
+        return saved_bytes_.load(std::memory_order_relaxed);
+    }
+
     /**
      * @brief Return the size of this chunk of memory.
      * @return size of memory 
@@ -75,7 +263,7 @@ public:
     {
         // Make sure in range and access it.
         if (index < this->size_) 
-            val = data_[index];
+            val = rtab_[index >> frame_shift][index & frame_mask];
         else
             throw Access_error{"Invalid memory location"};
     }
@@ -87,9 +275,10 @@ public:
      */
     virtual void Set(T val, size_t index) override
     {
-        if (index < this->size_)
-            data_[index] = val;
-        else
+        if (index < this->size_) {
+            writable(index >> frame_shift)[index & frame_mask] = val;
+            touch(index);
+        } else
             throw Access_error{"Invalid memory location"};
     }
 
@@ -104,7 +293,10 @@ public:
             val = 0;
             return false;
         }
-        val = data_[index];
+        if (shared_)
+            val = cell(index).load(std::memory_order_acquire);
+        else
+            val = rtab_[index >> frame_shift][index & frame_mask];
         return true;
     };
 
@@ -117,9 +309,167 @@ public:
     {
         if (index >= this->size_)
             return false;
-        data_[index] = val;
+        if (shared_)
+            cell(index).store(val, std::memory_order_release);
+        else
+            writable(index >> frame_shift)[index & frame_mask] = val;
+        touch(index);
         return true;
     };
+
+    /**
+     * @brief Copy a block out a host page at a time.
+     */
+    virtual size_t read_block(T *buf, size_t index, size_t n) override
+    {
+        if (index >= this->size_)
+            return 0;
+        n = std::min(n, this->size_ - index);
+        if (shared_)
+            return Memory<T>::read_block(buf, index, n);
+        for (size_t done = 0; done < n; ) {
+            size_t  at = index + done;
+            size_t  len = std::min(n - done, frame_size - (at & frame_mask));
+            std::memcpy(buf + done, &rtab_[at >> frame_shift][at & frame_mask],
+                        len * sizeof(T));
+            done += len;
+        }
+        return n;
+    }
+
+    /**
+     * @brief Copy a block in a host page at a time, marking each page
+     *     written.
+     */
+    virtual size_t write_block(const T *buf, size_t index, size_t n) override
+    {
+        if (index >= this->size_)
+            return 0;
+        n = std::min(n, this->size_ - index);
+        if (shared_ || n == 0)
+            return Memory<T>::write_block(buf, index, n);
+        for (size_t done = 0; done < n; ) {
+            size_t  at = index + done;
+            size_t  len = std::min(n - done, frame_size - (at & frame_mask));
+            std::memcpy(&writable(at >> frame_shift)[at & frame_mask],
+                        buf + done, len * sizeof(T));
+            done += len;
+        }
+        for (size_t p = index >> page_shift; p <= (index + n - 1) >> page_shift; p++)
+            touch(p << page_shift);
+        return n;
+    }
+
+private:
+    static_assert(sizeof(std::atomic<T>) == sizeof(T) &&
+                  std::atomic<T>::is_always_lock_free,
+                  "RAM cells must be usable as atomics");
+    static_assert(frame_size == (1llu << frame_shift),
+                  "RAM host page must be a power of 2 locations");
+
+    std::atomic<T> &cell(size_t index)
+    {
+        return *reinterpret_cast<std::atomic<T> *>(&data_[index]);
+    }
+
+    size_t bytes() const
+    {
+        return this->size_ * sizeof(T);
+    }
+
+    /**
+     * @brief Return where to write host page p, copying a shared frame
+     *     back first.
+     */
+    T *writable(size_t p)
+    {
+        T  *page = wtab_[p];
+
+        if (page == nullptr) {
+            page = data_ + (p << frame_shift);
+            std::memcpy(page, rtab_[p], core::PageStore::page_bytes);
+            rtab_[p] = page;
+            wtab_[p] = page;
+            shared_bytes_ -= core::PageStore::page_bytes;
+            if (joined_[p])
+                saved_bytes_ -= core::PageStore::page_bytes;
+            joined_[p] = false;
+            frames_[p].reset();
+            hashes_[p] = 0;
+        }
+        return page;
+    }
+
+    /**
+     * @brief Point every host page at this RAM's own copy.
+     */
+    void map_private()
+    {
+        for (size_t p = 0; p < nframes_; p++) {
+            rtab_[p] = (data_ != nullptr) ? data_ + (p << frame_shift) : nullptr;
+            wtab_[p] = rtab_[p];
+            frames_[p].reset();
+            hashes_[p] = 0;
+            joined_[p] = false;
+        }
+        shared_bytes_.store(0);
+        saved_bytes_.store(0);
+    }
+
+    void put_range(core::StateOut &out, size_t index, size_t len)
+    {
+        while (len != 0) {
+            size_t  n = std::min(len, frame_size - (index & frame_mask));
+            out.put_bytes(&rtab_[index >> frame_shift][index & frame_mask],
+                          n * sizeof(T));
+            index += n;
+            len -= n;
+        }
+    }
+
+    void get_range(core::StateIn &in, size_t index, size_t len)
+    {
+        while (len != 0) {
+            size_t  n = std::min(len, frame_size - (index & frame_mask));
+            in.get_bytes(&writable(index >> frame_shift)[index & frame_mask],
+                         n * sizeof(T));
+            index += n;
+            len -= n;
+        }
+    }
+
+    /**
+     * @brief Stamp the page holding index with the dirty clock. The value
+     *     is stored first so a look at the map never misses it. Only the
+     *     first write to a page in an epoch stores the stamp.
+     */
+    void touch(size_t index)
+    {
+        std::atomic<uint64_t> &stamp = stamp_[index >> page_shift];
+        uint64_t               now = core::dirty_clock().load(std::memory_order_relaxed);
+
+        if (stamp.load(std::memory_order_relaxed) != now)
+            stamp.store(now, std::memory_order_release);
+    }
+
+    size_t pageLength(size_t page) const
+    {
+        return std::min(this->size_ - (page << page_shift),
+                        (size_t)1 << page_shift);
+    }
+
+    size_t                                    pages_;
+    std::unique_ptr<std::atomic<uint64_t>[]>  stamp_;     // Epoch of last write.
+
+    // Host page table, a shared page has no write entry.
+    size_t                                    nframes_;
+    std::unique_ptr<T *[]>                    rtab_;
+    std::unique_ptr<T *[]>                    wtab_;
+    std::vector<std::shared_ptr<core::PageFrame>> frames_;
+    std::vector<uint64_t>                     hashes_;
+    std::vector<bool>                         joined_;
+    std::atomic<uint64_t>                     shared_bytes_{0};
+    std::atomic<uint64_t>                     saved_bytes_{0};
 };
 
 }
@@ -19,7 +19,10 @@
 
 #pragma once
 
+#include <vector>
+#include <cstring>
 #include "Memory.h"
+#include "SharedImage.h"
 
 namespace emulator
 {
@@ -52,12 +55,66 @@ class ROM : public Memory<T>
 
     virtual ~ROM() override
     {
-        if (data_)
+        if (data_ && !image_)
             delete[] data_;
     }
 
     T        *data_;
 
+    /**
+     * @brief Use the contents of a shared image in place of our own copy.
+     *     The image is mapped read only, so it can no longer be loaded
+     *     with Set().
+     * @param image Image at least as large as the ROM.
+     */
+    void map(std::shared_ptr<core::SharedImage> image)
+    {
+        if (image->size() < this->size_ * sizeof(T))
+            throw core::SystemError{"Image too small for ROM"};
+        if (!image_)
+            delete[] data_;
+        data_ = reinterpret_cast<T *>(const_cast<uint8_t *>(image->data()));
+        image_ = image;
+    }
+
+    /**
+     * @brief Return the image the ROM is mapped from, or nullptr.
+     */
+    std::shared_ptr<core::SharedImage> image() const
+    {
+        return image_;
+    }
+
+    virtual std::string getType() const override
+    {
+        return "ROM";
+    }
+
+    /**
+     * @brief Contents are saved too, a System rebuilt elsewhere has not
+     *     loaded them.
+     */
+    virtual void save(core::StateOut &out) override
+    {
+        out.put((uint64_t)this->size_);
+        out.put_bytes(data_, this->size_ * sizeof(T));
+    }
+
+    virtual void load(core::StateIn &in) override
+    {
+        if (in.get<uint64_t>() != this->size_)
+            throw core::State_error{"Saved memory size does not match"};
+        if (!image_) {
+            in.get_bytes(data_, this->size_ * sizeof(T));
+            return;
+        }
+        // A mapped image can not change, it only has to match.
+        std::vector<T>  saved(this->size_);
+        in.get_bytes(saved.data(), this->size_ * sizeof(T));
+        if (memcmp(saved.data(), data_, this->size_ * sizeof(T)) != 0)
+            throw core::State_error{"Saved ROM does not match its image"};
+    }
+
     /**
      * @brief Return the size of this chunk of memory.
      * @return size of memory 
@@ -88,6 +145,8 @@ class ROM : public Memory<T>
      */
     virtual void Set(T val, size_t index) override
     {
+        if (image_)
+            throw Access_error{"ROM is mapped from a shared image"};
         if (index < this->size_)
             data_[index] = val;
         else
@@ -119,6 +178,9 @@ class ROM : public Memory<T>
             return false;
         return true;
     };
+
+private:
+    std::shared_ptr<core::SharedImage>  image_;
 };
 
 }
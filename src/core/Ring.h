@@ -0,0 +1,173 @@
+/*
+ * Author:      Richard Cornwell (rich@sky-visions.com)
+ *
+ * Copyright (C) 2021 Richard Cornwell.
+ *
+ * This file may be distributed under the terms of the Q Public License
+ * as defined by Trolltech AS of Norway and appearing in the file
+ * LICENSE.QPL included in the packaging of this file.
+ *
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING
+ * THE WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL,
+ * INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING
+ * FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION
+ * WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+namespace core
+{
+
+/**
+ * @class SpscRing
+ * @author rich
+ * @date 18/10/26
+ * @file Ring.h
+ * @brief Fixed size ring with one producer thread and one consumer
+ *     thread. Neither side locks, each only writes its own index. The
+ *     indexes sit on separate cache lines so the two sides do not
+ *     contend.
+ */
+template <typename T, size_t N>
+class SpscRing
+{
+    static_assert(N != 0 && (N & (N - 1)) == 0, "Ring size must be a power of 2");
+
+public:
+    /**
+     * @brief Add one item, producer only.
+     * @return false if the ring is full.
+     */
+    bool push(const T &val)
+    {
+        uint32_t  head = head_.load(std::memory_order_relaxed);
+
+        if (head - tail_.load(std::memory_order_acquire) == N)
+            return false;
+        buf_[head & (N - 1)] = val;
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief Add as many items as fit, producer only.
+     * @return Number added.
+     */
+    size_t push(const T *data, size_t n)
+    {
+        uint32_t  head = head_.load(std::memory_order_relaxed);
+        size_t    room = N - (head - tail_.load(std::memory_order_acquire));
+
+        if (n > room)
+            n = room;
+        for (size_t i = 0; i < n; i++)
+            buf_[(head + i) & (N - 1)] = data[i];
+        head_.store(head + (uint32_t)n, std::memory_order_release);
+        return n;
+    }
+
+    /**
+     * @brief Look at the oldest item without removing it, consumer only.
+     * @return false if the ring is empty.
+     */
+    bool peek(T &val) const
+    {
+        uint32_t  tail = tail_.load(std::memory_order_relaxed);
+
+        if (head_.load(std::memory_order_acquire) == tail)
+            return false;
+        val = buf_[tail & (N - 1)];
+        return true;
+    }
+
+    /**
+     * @brief Copy up to n of the oldest items without removing them,
+     *     consumer only.
+     * @return Number copied.
+     */
+    size_t peek(T *data, size_t n) const
+    {
+        uint32_t  tail = tail_.load(std::memory_order_relaxed);
+        size_t    used = head_.load(std::memory_order_acquire) - tail;
+
+        if (n > used)
+            n = used;
+        for (size_t i = 0; i < n; i++)
+            data[i] = buf_[(tail + i) & (N - 1)];
+        return n;
+    }
+
+    /**
+     * @brief Remove the oldest item, consumer only.
+     * @return false if the ring is empty.
+     */
+    bool pop(T &val)
+    {
+        uint32_t  tail = tail_.load(std::memory_order_relaxed);
+
+        if (head_.load(std::memory_order_acquire) == tail)
+            return false;
+        val = buf_[tail & (N - 1)];
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief Remove up to n items, consumer only.
+     * @return Number removed.
+     */
+    size_t pop(T *data, size_t n)
+    {
+        uint32_t  tail = tail_.load(std::memory_order_relaxed);
+        size_t    used = head_.load(std::memory_order_acquire) - tail;
+
+        if (n > used)
+            n = used;
+        for (size_t i = 0; i < n; i++)
+            data[i] = buf_[(tail + i) & (N - 1)];
+        tail_.store(tail + (uint32_t)n, std::memory_order_release);
+        return n;
+    }
+
+    /**
+     * @brief Number of items held, exact only on the consumer or
+     *     producer side.
+     */
+    size_t size() const
+    {
+        // Tail first, the head can only have moved further on since.
+        uint32_t  tail = tail_.load(std::memory_order_acquire);
+        return head_.load(std::memory_order_acquire) - tail;
+    }
+
+    bool empty() const
+    {
+        return size() == 0;
+    }
+
+    bool full() const
+    {
+        return size() == N;
+    }
+
+    static constexpr size_t capacity()
+    {
+        return N;
+    }
+
+private:
+    alignas(64) std::atomic<uint32_t>  head_{0};    // Next slot to fill.
+    alignas(64) std::atomic<uint32_t>  tail_{0};    // Next slot to empty.
+    T                                  buf_[N];
+};
+
+}
@@ -0,0 +1,579 @@
+/*
+ * Author:      Richard Cornwell (rich@sky-visions.com)
+ *
+ * Copyright (C) 2021 Richard Cornwell.
+ *
+ * This file may be distributed under the terms of the Q Public License
+ * as defined by Trolltech AS of Norway and appearing in the file
+ * LICENSE.QPL included in the packaging of this file.
+ *
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING
+ * THE WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL,
+ * INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING
+ * FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION
+ * WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <stdio.h>
+#include "SessionHost.h"
+#include "Numa.h"
+
+namespace core
+{
+
+using namespace std;
+
+void Session::wake()
+{
+    SessionHost *host = host_.load();
+
+    wake_pending_.store(true);
+    State  s = State::parked;
+    if (host != nullptr && state_.compare_exchange_strong(s, State::queued)) {
+        host->active_++;
+        host->requeue(shared_from_this());
+    }
+}
+
+void Session::stop()
+{
+    stop_.store(true);
+    // A parked session can be finished now, a queued or running one
+    // finishes when its quantum ends.
+    State  s = State::parked;
+    state_.compare_exchange_strong(s, State::finished);
+}
+
+void Session::setLimits(const SessionLimits &limits)
+{
+    lock_guard<mutex> lock(lock_);
+    limits_ = limits;
+    if (limits_.weight == 0)
+        limits_.weight = 1;
+    credit_ = capacity();
+    refill_ = clock::now();
+}
+
+SessionLimits Session::getLimits() const
+{
+    lock_guard<mutex> lock(lock_);
+    return limits_;
+}
+
+SessionStats Session::stats() const
+{
+    SessionStats  st;
+
+    st.time = time_.load(memory_order_relaxed);
+    st.steps = steps_.load(memory_order_relaxed);
+    st.quanta = quanta_.load(memory_order_relaxed);
+    st.host_ns = host_ns_.load(memory_order_relaxed);
+    st.throttled = throttled_.load(memory_order_relaxed);
+    st.suspends = suspends_.load(memory_order_relaxed);
+    st.resume_ns = resume_ns_.load(memory_order_relaxed);
+    st.shared = system->shared_bytes();
+    st.saved = system->saved_bytes();
+    lock_guard<mutex> lock(lock_);
+    st.credit = credit_;
+    return st;
+}
+
+bool Session::admit(clock::time_point now, chrono::nanoseconds &delay)
+{
+    lock_guard<mutex> lock(lock_);
+
+    if (limits_.mips <= 0)
+        return true;
+    double  rate = limits_.mips * 1e6;    // Instructions per second.
+    chrono::duration<double> elapsed = now - refill_;
+    refill_ = now;
+    credit_ = min(credit_ + elapsed.count() * rate, capacity());
+    if (credit_ > 0)
+        return true;
+    // Sleep until the debt is paid off.
+    delay = chrono::nanoseconds((int64_t)(-credit_ / rate * 1e9) + 1000);
+    return false;
+}
+
+void Session::charge(const RunUsage &used, clock::duration host)
+{
+    time_.fetch_add(used.time, memory_order_relaxed);
+    steps_.fetch_add(used.steps, memory_order_relaxed);
+    quanta_.fetch_add(1, memory_order_relaxed);
+    host_ns_.fetch_add(chrono::duration_cast<chrono::nanoseconds>(host).count(),
+                       memory_order_relaxed);
+    lock_guard<mutex> lock(lock_);
+    if (limits_.mips > 0)
+        credit_ -= (double)used.steps;
+}
+
+SessionHost::SessionHost(size_t threads, uint64_t quantum, int nodes) :
+    quantum_(quantum), nodes_(nodes)
+{
+    if (threads == 0)
+        threads = thread::hardware_concurrency();
+    if (threads == 0)
+        threads = 1;
+    if (nodes_ <= 0)
+        nodes_ = Numa::nodes();
+    // Workers are dealt out to nodes in turn.
+    for (size_t i = 0; i < threads; i++) {
+        queues_.push_back(make_unique<RunQueue>());
+        worker_node_.push_back((int)(i % (size_t)nodes_));
+    }
+}
+
+SessionHost::~SessionHost()
+{
+    stop();
+    lock_guard<mutex> lock(lock_);
+    for (auto &s : sessions_) {
+        s->host_.store(nullptr);
+        s->system->setWake(nullptr);
+        // State files are private to this host.
+        if (s->suspended_.load())
+            remove(s->file_.c_str());
+    }
+}
+
+shared_ptr<Session> SessionHost::add(shared_ptr<System> sys, const string &name)
+{
+    auto  session = make_shared<Session>(sys, name);
+    weak_ptr<Session> weak = session;
+
+    session->host_.store(this);
+    session->id_ = next_id_.fetch_add(1);
+    int node = sys->node();
+    session->node_.store((node < nodes_) ? node : -1);
+    sys->setWake([weak]() {
+        if (auto s = weak.lock())
+            s->wake();
+    });
+    {
+        lock_guard<mutex> lock(lock_);
+        sessions_.push_back(session);
+    }
+    session->state_.store(Session::State::queued);
+    active_++;
+    requeue(session);
+    return session;
+}
+
+void SessionHost::start()
+{
+    stopping_.store(false);
+    for (size_t i = 0; i < queues_.size(); i++)
+        workers_.emplace_back(&SessionHost::worker, this, i);
+}
+
+void SessionHost::stop()
+{
+    {
+        lock_guard<mutex> lock(lock_);
+        stopping_.store(true);
+    }
+    work_.notify_all();
+    for (auto &w : workers_)
+        w.join();
+    workers_.clear();
+}
+
+void SessionHost::wake_after(shared_ptr<Session> session,
+                             chrono::nanoseconds delay)
+{
+    {
+        lock_guard<mutex> lock(lock_);
+        auto  when = clock::now() + delay;
+        timers_.push(Timer{when, session});
+        if (when.time_since_epoch().count() < next_timer_.load())
+            next_timer_.store(when.time_since_epoch().count());
+    }
+    // Let a sleeping worker recompute when it should wake.
+    work_.notify_one();
+}
+
+void SessionHost::wait_idle()
+{
+    unique_lock<mutex> lock(lock_);
+    idle_.wait(lock, [this]() {
+        return active_.load() == 0 && timers_.empty() && firing_ == 0;
+    });
+}
+
+vector<shared_ptr<Session>> SessionHost::sessions()
+{
+    lock_guard<mutex> lock(lock_);
+    return sessions_;
+}
+
+void SessionHost::report(ostream &out)
+{
+    static const char *states[] = { "queued", "running", "parked", "finished" };
+
+    for (auto &s : sessions()) {
+        SessionStats   st = s->stats();
+        SessionLimits  lim = s->getLimits();
+        double  mips = (st.host_ns == 0) ? 0.0 :
+                         (double)st.steps * 1000.0 / (double)st.host_ns;
+        out << left << setw(16) << s->getName() << right
+            << " " << setw(8) << states[(int)s->state()]
+            << " weight " << lim.weight
+            << " cap " << lim.mips
+            << " steps " << st.steps
+            << " time " << st.time
+            << " host " << st.host_ns
+            << " mips " << fixed << setprecision(2) << mips
+            << defaultfloat
+            << " throttled " << st.throttled
+            << " credit " << (int64_t)st.credit
+            << " shared " << st.shared / 1024 << "K"
+            << " saved " << st.saved / 1024 << "K" << endl;
+    }
+}
+
+void SessionHost::worker(size_t id)
+{
+    // Keep the worker on its node so sessions queued to it run near
+    // their memory.
+    if (nodes_ > 1)
+        Numa::pin_thread(Numa::node_cores(worker_node_[id]));
+    while (!stopping_.load()) {
+        // Timers must fire even when every worker is busy, or throttled
+        // sessions would never run again.
+        if (clock::now().time_since_epoch().count() >= next_timer_.load())
+            fire_timers();
+        auto  session = pop(id);
+        if (session) {
+            run(id, session);
+            continue;
+        }
+
+        // Nothing to run, sleep until there is work or the next timer
+        // expires.
+        unique_lock<mutex> lock(lock_);
+        if (timers_.empty())
+            idle_.notify_all();
+        auto  ready = [this]() {
+            return stopping_.load() || queued_.load() != 0 ||
+                   (!timers_.empty() && timers_.top().when <= clock::now());
+        };
+        // Wait only once, a new timer must send us round the loop again
+        // to pick up its deadline.
+        sleepers_++;
+        if (!ready()) {
+            if (timers_.empty())
+                work_.wait(lock);
+            else
+                work_.wait_until(lock, timers_.top().when);
+        }
+        sleepers_--;
+    }
+}
+
+void SessionHost::fire_timers()
+{
+    vector<shared_ptr<Session>> due;
+    unique_lock<mutex> lock(lock_);
+    auto  now = clock::now();
+
+    while (!timers_.empty() && timers_.top().when <= now) {
+        if (auto s = timers_.top().session.lock())
+            due.push_back(s);
+        timers_.pop();
+    }
+    next_timer_.store(timers_.empty() ? no_timer :
+                      timers_.top().when.time_since_epoch().count());
+    if (due.empty())
+        return;
+    firing_++;
+    lock.unlock();
+    for (auto &s : due)
+        s->wake();
+    lock.lock();
+    firing_--;
+    idle_.notify_all();
+}
+
+void SessionHost::push(size_t id, shared_ptr<Session> session)
+{
+    {
+        lock_guard<mutex> lock(queues_[id]->lock);
+        queues_[id]->queue.push_back(session);
+        queued_++;
+    }
+    if (sleepers_.load() != 0) {
+        { lock_guard<mutex> lock(lock_); }
+        work_.notify_one();
+    }
+}
+
+shared_ptr<Session> SessionHost::pop(size_t id)
+{
+    shared_ptr<Session>  session;
+
+    // Own queue first, oldest session first so they take turns.
+    {
+        RunQueue  &q = *queues_[id];
+        lock_guard<mutex> lock(q.lock);
+        if (!q.queue.empty()) {
+            session = q.queue.front();
+            q.queue.pop_front();
+            queued_--;
+            return session;
+        }
+    }
+    // Otherwise steal the newest session from another worker, one on the
+    // same node first.
+    for (int pass = 0; pass < 2; pass++) {
+        for (size_t i = 1; i < queues_.size(); i++) {
+            size_t  victim = (id + i) % queues_.size();
+            if ((worker_node_[victim] == worker_node_[id]) != (pass == 0))
+                continue;
+            RunQueue  &q = *queues_[victim];
+            lock_guard<mutex> lock(q.lock);
+            if (!q.queue.empty()) {
+                session = q.queue.back();
+                q.queue.pop_back();
+                queued_--;
+                steals_.fetch_add(1, memory_order_relaxed);
+                return session;
+            }
+        }
+    }
+    return session;
+}
+
+void SessionHost::run(size_t id, shared_ptr<Session> session)
+{
+    using State = Session::State;
+
+    auto  start = clock::now();
+    chrono::nanoseconds  delay{0};
+    session->state_.store(State::running);
+    session->parked_at_ = clock::time_point::max();
+    if (session->suspended_.load() && !resume(session)) {
+        session->state_.store(State::finished);
+        release();
+        return;
+    }
+    if (!session->stop_.load() && !session->admit(start, delay)) {
+        // Over its cap, park until it has earned enough credit. It is
+        // busy, not idle, so must not be suspended meanwhile.
+        session->throttled_.fetch_add(1, memory_order_relaxed);
+        wake_after(session, delay);
+        park(session, false);
+        return;
+    }
+    uint64_t  weight = session->getLimits().weight;
+    RunUsage  used = session->system->run_quantum(quantum_ * weight);
+    session->charge(used, clock::now() - start);
+    if (PageStore *store = session->merge_.exchange(nullptr))
+        session->system->merge_pages(*store);
+
+    if (session->stop_.load()) {
+        session->state_.store(State::finished);
+        release();
+        return;
+    }
+    if (session->system->idle() && !session->wake_pending_.exchange(false)) {
+        park(session, true);
+        return;
+    }
+    session->state_.store(State::queued);
+    // A session moved by rebalance() goes to a worker on its new node.
+    int  node = session->node();
+    if (node >= 0 && node != worker_node_[id])
+        requeue(session);
+    else
+        push(id, session);
+}
+
+void SessionHost::park(shared_ptr<Session> session, bool idle)
+{
+    using State = Session::State;
+    State  s = State::parked;
+
+    if (idle)
+        session->parked_at_ = clock::now();
+    session->state_.store(State::parked);
+    // A stop() or wake() that came while we held the session could not
+    // change its state, so act on it now. Whoever moves the session out
+    // of parked first wins.
+    if (session->stop_.load()) {
+        session->state_.compare_exchange_strong(s, State::finished);
+        release();
+        return;
+    }
+    if (session->wake_pending_.exchange(false) &&
+        session->state_.compare_exchange_strong(s, State::queued)) {
+        requeue(session);
+        return;
+    }
+    release();
+}
+
+size_t SessionHost::suspend_idle(const string &dir, clock::duration idle)
+{
+    using State = Session::State;
+    size_t  n = 0;
+    auto    now = clock::now();
+
+    for (auto &session : sessions()) {
+        State  s = State::parked;
+        if (session->suspended_.load())
+            continue;
+        // Hold the session as if running it, so no worker can.
+        if (!session->state_.compare_exchange_strong(s, State::running))
+            continue;
+        active_++;
+        if (session->parked_at_ <= now - idle && suspend(dir, session))
+            n++;
+        park(session, false);
+    }
+    return n;
+}
+
+size_t SessionHost::merge_pages(PageStore &store)
+{
+    using State = Session::State;
+    size_t  n = 0;
+
+    for (auto &session : sessions()) {
+        State  s = State::parked;
+        if (session->suspended_.load())
+            continue;
+        // Hold a parked session as if running it, others are merged by
+        // the worker that runs them.
+        if (!session->state_.compare_exchange_strong(s, State::running)) {
+            if (s != State::finished)
+                session->merge_.store(&store);
+            continue;
+        }
+        active_++;
+        n += session->system->merge_pages(store);
+        park(session, false);
+    }
+    return n;
+}
+
+bool SessionHost::suspend(const string &dir, shared_ptr<Session> session)
+{
+    string    name = dir + "/session-" + to_string(session->id_) + ".state";
+    ofstream  file(name, ios::out | ios::binary | ios::trunc);
+
+    if (!file.is_open())
+        return false;
+    try {
+        session->system->save(file);
+        file.close();
+        if (file.fail())
+            throw State_error{"Unable to write " + name};
+    } catch (const State_error &e) {
+        cerr << "Suspend " << session->getName() << ": " << e.get_message() << endl;
+        remove(name.c_str());
+        return false;
+    }
+    session->system->release();
+    session->file_ = name;
+    session->suspended_.store(true);
+    session->suspends_.fetch_add(1, memory_order_relaxed);
+    return true;
+}
+
+bool SessionHost::resume(shared_ptr<Session> session)
+{
+    auto      start = clock::now();
+    ifstream  file(session->file_, ios::in | ios::binary);
+
+    try {
+        if (!file.is_open())
+            throw State_error{"Unable to read " + session->file_};
+        session->system->restore(file);
+    } catch (const State_error &e) {
+        cerr << "Resume " << session->getName() << ": " << e.get_message() << endl;
+        return false;
+    }
+    file.close();
+    remove(session->file_.c_str());
+    session->suspended_.store(false);
+    session->resume_ns_.store(chrono::duration_cast<chrono::nanoseconds>(
+                              clock::now() - start).count(), memory_order_relaxed);
+    return true;
+}
+
+void SessionHost::requeue(shared_ptr<Session> session)
+{
+    size_t  n = queues_.size();
+    size_t  id = next_.fetch_add(1, memory_order_relaxed) % n;
+    int     node = session->node();
+
+    // Find the next worker on the session's node.
+    if (node >= 0) {
+        for (size_t i = 0; i < n; i++) {
+            if (worker_node_[(id + i) % n] == node) {
+                id = (id + i) % n;
+                break;
+            }
+        }
+    }
+    push(id, session);
+}
+
+size_t SessionHost::rebalance()
+{
+    vector<shared_ptr<Session>> list = sessions();
+    vector<uint64_t>  load(nodes_, 0);
+    vector<uint64_t>  used(list.size(), 0);
+    size_t            moved = 0;
+
+    if (nodes_ < 2)
+        return 0;
+    lock_guard<mutex> lock(balance_);
+    for (size_t i = 0; i < list.size(); i++) {
+        uint64_t  host = list[i]->host_ns_.load(memory_order_relaxed);
+        used[i] = host - list[i]->last_host_ns_;
+        list[i]->last_host_ns_ = host;
+        if (list[i]->node() >= 0)
+            load[list[i]->node()] += used[i];
+    }
+    for (size_t tries = 0; tries < list.size(); tries++) {
+        auto  hi = max_element(load.begin(), load.end()) - load.begin();
+        auto  lo = min_element(load.begin(), load.end()) - load.begin();
+        uint64_t  gap = load[hi] - load[lo];
+        // Move the busiest session that still narrows the gap.
+        size_t  best = list.size();
+        for (size_t i = 0; i < list.size(); i++) {
+            if (list[i]->node() != hi || list[i]->state() == Session::State::finished)
+                continue;
+            if (used[i] == 0 || used[i] >= gap)
+                continue;
+            if (best == list.size() || used[i] > used[best])
+                best = i;
+        }
+        if (best == list.size())
+            break;
+        list[best]->node_.store((int)lo);
+        list[best]->system->setNode((int)lo);
+        load[hi] -= used[best];
+        load[lo] += used[best];
+        moved++;
+    }
+    return moved;
+}
+
+void SessionHost::release()
+{
+    if (--active_ == 0) {
+        { lock_guard<mutex> lock(lock_); }
+        idle_.notify_all();
+    }
+}
+
+}
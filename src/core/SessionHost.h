@@ -0,0 +1,399 @@
+/*
+ * Author:      Richard Cornwell (rich@sky-visions.com)
+ *
+ * Copyright (C) 2021 Richard Cornwell.
+ *
+ * This file may be distributed under the terms of the Q Public License
+ * as defined by Trolltech AS of Norway and appearing in the file
+ * LICENSE.QPL included in the packaging of this file.
+ *
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING
+ * THE WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL,
+ * INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING
+ * FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION
+ * WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+#include "System.h"
+
+namespace core
+{
+
+class SessionHost;
+
+/**
+ * @brief Share of the host given to one session.
+ */
+struct SessionLimits {
+    uint32_t  weight = 1;    // Quanta run per turn relative to others.
+    double    mips = 0;      // Hard cap in million instructions per second,
+                             // 0 for no cap.
+    double    burst = 0;     // Seconds of unused time at the cap that may be
+                             // banked and spent above the cap.
+};
+
+/**
+ * @brief Accounting for one session.
+ */
+struct SessionStats {
+    uint64_t  time;          // Simulated nanoseconds.
+    uint64_t  steps;         // Instructions executed.
+    uint64_t  quanta;        // Quanta run.
+    uint64_t  host_ns;       // Host nanoseconds spent running it.
+    uint64_t  throttled;     // Times parked for being over its cap.
+    double    credit;        // Instructions that may run before the cap
+                             // applies, negative when over.
+    uint64_t  suspends;      // Times written out to disk.
+    uint64_t  resume_ns;     // Host time taken by the last resume.
+    uint64_t  shared;        // Bytes of memory read from shared pages.
+    uint64_t  saved;         // Bytes of host memory saved by sharing.
+};
+
+/**
+ * @class Session
+ * @author rich
+ * @date 18/10/26
+ * @file SessionHost.h
+ * @brief One System run by a SessionHost. A session is either waiting in
+ *     a run queue, running on one worker, parked, or finished.
+ */
+class Session : public std::enable_shared_from_this<Session>
+{
+public:
+    enum class State { queued, running, parked, finished };
+
+    Session(std::shared_ptr<System> sys, const std::string &name) :
+        system(sys), name_(name)
+    {
+    }
+
+    Session(const Session&) = delete;
+
+    /**
+     * @brief Make a parked session runnable again. Safe to call from any
+     *     thread, a wake that arrives while the session is running keeps
+     *     it from being parked at the end of the quantum.
+     */
+    void wake();
+
+    /**
+     * @brief Ask the session to finish at the end of its current quantum.
+     */
+    void stop();
+
+    State state() const
+    {
+        return state_.load();
+    }
+
+    const std::string& getName() const
+    {
+        return name_;
+    }
+
+    /**
+     * @brief Simulated time run so far in nanoseconds.
+     */
+    uint64_t time() const
+    {
+        return time_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Number of quanta run so far.
+     */
+    uint64_t quanta() const
+    {
+        return quanta_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Change the share given to this session, takes effect at the
+     *     next quantum. Any banked credit is reset to a full burst.
+     */
+    void setLimits(const SessionLimits &limits);
+
+    SessionLimits getLimits() const;
+
+    /**
+     * @brief Snapshot of accounting for monitoring.
+     */
+    SessionStats stats() const;
+
+    /**
+     * @brief True while the session's state is on disk.
+     */
+    bool suspended() const
+    {
+        return suspended_.load();
+    }
+
+    /**
+     * @brief NUMA node the session runs on, -1 for any.
+     */
+    int node() const
+    {
+        return node_.load(std::memory_order_relaxed);
+    }
+
+    std::shared_ptr<System>  system;
+
+private:
+    friend class SessionHost;
+    using clock = std::chrono::steady_clock;
+
+    // Shortest burst allowed, so a capped session can run whole quanta.
+    static constexpr double min_burst = 0.01;
+
+    double capacity() const
+    {
+        return limits_.mips * 1e6 * std::max(limits_.burst, min_burst);
+    }
+
+    bool admit(clock::time_point now, std::chrono::nanoseconds &delay);
+    void charge(const RunUsage &used, clock::duration host);
+
+    std::string              name_;
+    std::atomic<SessionHost *> host_{nullptr};
+    std::atomic<State>       state_{State::parked};
+    std::atomic<bool>        wake_pending_{false};
+    std::atomic<bool>        stop_{false};
+    std::atomic<uint64_t>    time_{0};
+    std::atomic<uint64_t>    quanta_{0};
+    std::atomic<uint64_t>    steps_{0};
+    std::atomic<uint64_t>    host_ns_{0};
+    std::atomic<uint64_t>    throttled_{0};
+    std::atomic<int>         node_{-1};
+    uint64_t                 last_host_ns_ = 0;   // At last rebalance.
+    std::atomic<uint64_t>    suspends_{0};
+    std::atomic<uint64_t>    resume_ns_{0};
+    std::atomic<PageStore *> merge_{nullptr};     // Merge after next quantum.
+
+    // Owned by whoever moved the session out of parked.
+    uint64_t                 id_ = 0;
+    clock::time_point        parked_at_{clock::time_point::max()};  // Went idle, max if busy.
+    std::atomic<bool>        suspended_{false};
+    std::string              file_;
+
+    // Guards limits and credit.
+    mutable std::mutex       lock_;
+    SessionLimits            limits_;
+    double                   credit_ = 0;
+    clock::time_point        refill_;
+};
+
+/**
+ * @class SessionHost
+ * @author rich
+ * @date 18/10/26
+ * @file SessionHost.h
+ * @brief Runs many Systems on a pool of worker threads.
+ *
+ *     Each worker has its own run queue. A worker takes sessions from the
+ *     front of its queue, runs one quantum of simulated time and puts the
+ *     session back on the end, so sessions on one worker are round
+ *     robin. A worker with an empty queue steals from the back of another
+ *     worker's queue. A session whose System is idle at the end of a
+ *     quantum is parked and uses no host time until it is woken by input
+ *     or a timer.
+ *
+ *     A session's weight multiplies its quantum, so on a busy host it
+ *     gets simulated time in proportion to its weight. A session with a
+ *     MIPS cap earns credit at its cap rate, up to its burst, and spends
+ *     one credit per instruction. When out of credit it is parked until
+ *     enough has been earned back.
+ */
+class SessionHost
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    /**
+     * @param threads Number of workers, 0 for one per host core.
+     * @param quantum Simulated nanoseconds run before switching session.
+     * @param nodes NUMA nodes to spread workers over, 0 for the number
+     *     the host has.
+     */
+    explicit SessionHost(size_t threads = 0, uint64_t quantum = 1000000,
+                         int nodes = 0);
+
+    ~SessionHost();
+
+    SessionHost(const SessionHost&) = delete;
+
+    /**
+     * @brief Add a System and make it runnable. The System should be
+     *     initialized and started.
+     * @param sys System to run.
+     * @param name Name for the session.
+     * @return Handle used to wake or stop the session.
+     */
+    std::shared_ptr<Session> add(std::shared_ptr<System> sys,
+                                 const std::string &name = "");
+
+    /**
+     * @brief Start the worker threads.
+     */
+    void start();
+
+    /**
+     * @brief Stop the worker threads. Sessions keep their state and will
+     *     continue if the host is started again.
+     */
+    void stop();
+
+    /**
+     * @brief Wake a session after a delay.
+     * @param session Session to wake.
+     * @param delay Host time to wait.
+     */
+    void wake_after(std::shared_ptr<Session> session,
+                    std::chrono::nanoseconds delay);
+
+    /**
+     * @brief Wait until no session can run: all are parked or finished
+     *     and no timers are pending.
+     */
+    void wait_idle();
+
+    size_t threads() const
+    {
+        return queues_.size();
+    }
+
+    uint64_t quantum() const
+    {
+        return quantum_;
+    }
+
+    /**
+     * @brief Number of sessions taken from another worker's queue.
+     */
+    uint64_t steals() const
+    {
+        return steals_.load(std::memory_order_relaxed);
+    }
+
+    int nodes() const
+    {
+        return nodes_;
+    }
+
+    /**
+     * @brief Move the busiest sessions from the most loaded node to the
+     *     least loaded, using host time used since the last call. A
+     *     session that is moved has its memory moved with it.
+     * @return Number of sessions moved.
+     */
+    size_t rebalance();
+
+    /**
+     * @brief Write sessions that have been parked for at least idle to
+     *     files in dir and free their memory. A suspended session is read
+     *     back when it is next woken, by input or a timer, before it runs.
+     * @param dir Directory to write state files in.
+     * @param idle Time a session must have been parked.
+     * @return Number of sessions suspended.
+     */
+    size_t suspend_idle(const std::string &dir, clock::duration idle);
+
+    /**
+     * @brief Share memory pages that have stopped changing between
+     *     sessions. Parked sessions are merged now, running ones by their
+     *     worker at the end of their next quantum. Meant to be called
+     *     from a background thread every few seconds, a page is only
+     *     shared once it looks the same on two calls.
+     * @param store Store of shared pages, must outlive the sessions.
+     * @return Number of pages newly shared by parked sessions.
+     */
+    size_t merge_pages(PageStore &store);
+
+    /**
+     * @brief Sessions currently held by the host.
+     */
+    std::vector<std::shared_ptr<Session>> sessions();
+
+    /**
+     * @brief Write one line of accounting per session.
+     * @param out Stream to write to.
+     */
+    void report(std::ostream &out);
+
+private:
+    friend class Session;
+
+    struct RunQueue {
+        std::mutex                              lock;
+        std::deque<std::shared_ptr<Session>>    queue;
+    };
+
+    struct Timer {
+        clock::time_point                       when;
+        std::weak_ptr<Session>                  session;
+
+        bool operator>(const Timer &other) const
+        {
+            return when > other.when;
+        }
+    };
+
+    void worker(size_t id);
+    void push(size_t id, std::shared_ptr<Session> session);
+    std::shared_ptr<Session> pop(size_t id);
+    void run(size_t id, std::shared_ptr<Session> session);
+    void requeue(std::shared_ptr<Session> session);
+    void release();
+    void fire_timers();
+    void park(std::shared_ptr<Session> session, bool idle);
+    bool suspend(const std::string &dir, std::shared_ptr<Session> session);
+    bool resume(std::shared_ptr<Session> session);
+
+    static constexpr clock::rep no_timer =
+                        std::numeric_limits<clock::rep>::max();
+
+    uint64_t                                    quantum_;
+    int                                         nodes_;
+    std::vector<std::unique_ptr<RunQueue>>      queues_;
+    std::vector<int>                            worker_node_;
+    std::vector<std::thread>                    workers_;
+    std::atomic<bool>                           stopping_{false};
+    std::atomic<size_t>                         next_{0};
+    std::atomic<uint64_t>                       next_id_{0};
+    std::atomic<size_t>                         queued_{0};   // In run queues.
+    std::atomic<size_t>                         active_{0};   // Queued or running.
+    std::atomic<size_t>                         sleepers_{0};
+    std::atomic<uint64_t>                       steals_{0};
+    std::atomic<clock::rep>                     next_timer_{no_timer};
+
+    std::mutex                                  balance_;
+
+    // Guards sleeping workers, timers and the session list.
+    std::mutex                                  lock_;
+    std::condition_variable                     work_;
+    std::condition_variable                     idle_;
+    size_t                                      firing_ = 0;
+    std::priority_queue<Timer, std::vector<Timer>,
+                        std::greater<Timer>>    timers_;
+    std::vector<std::shared_ptr<Session>>       sessions_;
+};
+
+}
@@ -0,0 +1,300 @@
+/*
+ * Author:      Richard Cornwell (rich@sky-visions.com)
+ *
+ * Copyright (C) 2021 Richard Cornwell.
+ *
+ * This file may be distributed under the terms of the Q Public License
+ * as defined by Trolltech AS of Norway and appearing in the file
+ * LICENSE.QPL included in the packaging of this file.
+ *
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING
+ * THE WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL,
+ * INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING
+ * FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION
+ * WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+#include "config.h"
+#include <cstring>
+#include <fstream>
+#include "SharedImage.h"
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+#if defined(HAVE_MEMFD_CREATE) && defined(HAVE_SYS_UN_H)
+#define SHARED_IMAGES
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#endif
+
+namespace core
+{
+
+using namespace std;
+
+SharedImage::~SharedImage()
+{
+#ifdef SHARED_IMAGES
+    if (mapped_)
+        munmap(data_, size_);
+    if (fd_ >= 0)
+        ::close(fd_);
+#endif
+    if (!mapped_)
+        delete[] data_;
+}
+
+void SharedImage::attach(int fd, size_t size)
+{
+#ifdef SHARED_IMAGES
+    void  *addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+
+    if (addr == MAP_FAILED) {
+        int  err = errno;
+        ::close(fd);
+        throw SystemError{string("Unable to map image: ") + strerror(err)};
+    }
+    data_ = static_cast<uint8_t *>(addr);
+    size_ = size;
+    fd_ = fd;
+    mapped_ = true;
+#else
+    (void)fd;
+    (void)size;
+#endif
+}
+
+shared_ptr<SharedImage> SharedImage::load(const string &path, size_t size)
+{
+    ifstream                 file(path, ios::in|ios::binary|ios::ate);
+    shared_ptr<SharedImage>  image(new SharedImage());
+    size_t                   len;
+
+    if (!file.is_open())
+        throw SystemError{"Unable to open image " + path};
+    len = (size_t)file.tellg();
+    if (size == 0)
+        size = len;
+    if (size == 0)
+        throw SystemError{"Image is empty: " + path};
+    if (len > size)
+        throw SystemError{"Image larger than " + to_string(size) + " bytes: " + path};
+    file.seekg(0, ios::beg);
+#ifdef SHARED_IMAGES
+    int    fd = memfd_create(path.c_str(), MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    void  *addr = MAP_FAILED;
+
+    if (fd < 0)
+        throw SystemError{string("Unable to create image: ") + strerror(errno)};
+    if (ftruncate(fd, (off_t)size) == 0)
+        addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        int  err = errno;
+        ::close(fd);
+        throw SystemError{string("Unable to create image: ") + strerror(err)};
+    }
+    file.read(static_cast<char *>(addr), len);
+    munmap(addr, size);
+    // The writable mapping is gone, seal the contents so no process can
+    // change or shrink them under a reader.
+    if (!file || fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW |
+                                        F_SEAL_WRITE | F_SEAL_SEAL) != 0) {
+        ::close(fd);
+        throw SystemError{"Unable to load image " + path};
+    }
+    image->attach(fd, size);
+#else
+    image->data_ = new uint8_t[size]();
+    image->size_ = size;
+    file.read(reinterpret_cast<char *>(image->data_), len);
+    if (!file)
+        throw SystemError{"Unable to load image " + path};
+#endif
+    return image;
+}
+
+shared_ptr<SharedImage> SharedImage::map(int fd)
+{
+#ifdef SHARED_IMAGES
+    shared_ptr<SharedImage>  image(new SharedImage());
+    struct stat              st;
+    int                      seals = fcntl(fd, F_GET_SEALS);
+    const int                need = F_SEAL_SHRINK | F_SEAL_WRITE;
+
+    // An image that could still be written or shrunk can not be trusted
+    // to stay put under the mapping.
+    if (seals < 0 || (seals & need) != need || fstat(fd, &st) != 0 ||
+        st.st_size <= 0) {
+        ::close(fd);
+        throw SystemError{"Received image is not sealed"};
+    }
+    image->attach(fd, (size_t)st.st_size);
+    return image;
+#else
+    (void)fd;
+    throw SystemError{"Shared images are not supported on this host"};
+#endif
+}
+
+shared_ptr<SharedImage> ImageSet::load(const string &name, const string &path,
+                                       size_t size)
+{
+    auto  image = SharedImage::load(path, size);
+
+    images[name] = image;
+    return image;
+}
+
+shared_ptr<SharedImage> ImageSet::find(const string &name) const
+{
+    auto  image = images.find(name);
+
+    if (image == images.end())
+        return nullptr;
+    return image->second;
+}
+
+#ifdef SHARED_IMAGES
+#ifdef MSG_NOSIGNAL
+static const int send_flags = MSG_NOSIGNAL;
+#else
+static const int send_flags = 0;
+#endif
+
+// Each image is sent as the length of its name carrying the descriptor,
+// followed by the name. A length of 0 ends the set.
+static void send_image(int fd, const string &name, int image_fd)
+{
+    uint32_t  len = (uint32_t)name.size();
+    iovec     iov{&len, sizeof(len)};
+    msghdr    msg{};
+    union {
+        char     buf[CMSG_SPACE(sizeof(int))];
+        cmsghdr  align;
+    } ctl;
+    ssize_t   n;
+
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (image_fd >= 0) {
+        memset(&ctl, 0, sizeof(ctl));
+        msg.msg_control = ctl.buf;
+        msg.msg_controllen = sizeof(ctl.buf);
+        cmsghdr  *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &image_fd, sizeof(int));
+    }
+    do {
+        n = ::sendmsg(fd, &msg, send_flags);
+    } while (n < 0 && errno == EINTR);
+    if (n != (ssize_t)sizeof(len))
+        throw SystemError{string("Unable to send image: ") + strerror(errno)};
+    for (size_t done = 0; done < name.size(); ) {
+        n = ::send(fd, name.data() + done, name.size() - done, send_flags);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            throw SystemError{string("Unable to send image: ") + strerror(errno)};
+        done += (size_t)n;
+    }
+}
+
+static bool read_all(int fd, char *data, size_t len)
+{
+    size_t  done = 0;
+
+    while (done < len) {
+        ssize_t  n = ::read(fd, data + done, len - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        done += (size_t)n;
+    }
+    return true;
+}
+#endif
+
+void ImageSet::send(int fd) const
+{
+#ifdef SHARED_IMAGES
+    for (auto &image : images) {
+        if (image.second->fd() < 0)
+            throw SystemError{"Image can not be shared: " + image.first};
+        send_image(fd, image.first, image.second->fd());
+    }
+    send_image(fd, "", -1);
+#else
+    (void)fd;
+    throw SystemError{"Shared images are not supported on this host"};
+#endif
+}
+
+ImageSet ImageSet::receive(int fd)
+{
+    ImageSet  set;
+#ifdef SHARED_IMAGES
+    for (;;) {
+        uint32_t  len = 0;
+        iovec     iov{&len, sizeof(len)};
+        msghdr    msg{};
+        union {
+            char     buf[CMSG_SPACE(sizeof(int))];
+            cmsghdr  align;
+        } ctl;
+        ssize_t   n;
+        int       image_fd = -1;
+
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = ctl.buf;
+        msg.msg_controllen = sizeof(ctl.buf);
+        do {
+            n = ::recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+        } while (n < 0 && errno == EINTR);
+        if (n <= 0)
+            throw SystemError{"Image set ended early"};
+        for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr;
+                      cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+                memcpy(&image_fd, CMSG_DATA(cmsg), sizeof(int));
+        }
+        // Take the descriptor before anything can fail, so it is closed.
+        shared_ptr<SharedImage>  image;
+        string                   name;
+        if (image_fd >= 0)
+            image = SharedImage::map(image_fd);
+        if (!read_all(fd, reinterpret_cast<char *>(&len) + n, sizeof(len) - n))
+            throw SystemError{"Image set ended early"};
+        if (len == 0) {
+            if (image)
+                throw SystemError{"Image without a name"};
+            break;
+        }
+        if (!image)
+            throw SystemError{"Image set is missing a descriptor"};
+        if (len > 4096)
+            throw SystemError{"Image name too long"};
+        name.resize(len);
+        if (!read_all(fd, &name[0], len))
+            throw SystemError{"Image set ended early"};
+        set.images[name] = image;
+    }
+#else
+    (void)fd;
+    throw SystemError{"Shared images are not supported on this host"};
+#endif
+    return set;
+}
+
+}
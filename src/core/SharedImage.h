@@ -0,0 +1,167 @@
+/*
+ * Author:      Richard Cornwell (rich@sky-visions.com)
+ *
+ * Copyright (C) 2021 Richard Cornwell.
+ *
+ * This file may be distributed under the terms of the Q Public License
+ * as defined by Trolltech AS of Norway and appearing in the file
+ * LICENSE.QPL included in the packaging of this file.
+ *
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING
+ * THE WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL,
+ * INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING
+ * FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION
+ * WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <map>
+#include <memory>
+#include <string>
+#include "SimError.h"
+
+namespace core
+{
+
+/**
+ * @class SharedImage
+ * @author rich
+ * @date 18/10/26
+ * @file SharedImage.h
+ * @brief A ROM or disk image held in a sealed memory file. A supervisor
+ *     loads each image once and passes the descriptor to its workers,
+ *     every process maps the same physical pages read only. On hosts
+ *     without memfd_create() the image is a private copy and can not be
+ *     passed on.
+ */
+class SharedImage
+{
+public:
+    ~SharedImage();
+
+    SharedImage(const SharedImage&) = delete;
+    SharedImage& operator=(const SharedImage&) = delete;
+
+    /**
+     * @brief Read a file into a new sealed image.
+     * @param path File to read.
+     * @param size Size of the image, the file is padded with zeros to
+     *     this size. 0 uses the size of the file.
+     * @return The image.
+     */
+    static std::shared_ptr<SharedImage> load(const std::string &path,
+                                             size_t size = 0);
+
+    /**
+     * @brief Map an image received from another process.
+     * @param fd Descriptor of a sealed image, owned by the image from now.
+     * @return The image.
+     */
+    static std::shared_ptr<SharedImage> map(int fd);
+
+    /**
+     * @brief Contents of the image, read only.
+     */
+    const uint8_t *data() const
+    {
+        return data_;
+    }
+
+    /**
+     * @brief Size of the image in bytes.
+     */
+    size_t size() const
+    {
+        return size_;
+    }
+
+    /**
+     * @brief Descriptor to pass to other processes, -1 if the image is
+     *     not shareable.
+     */
+    int fd() const
+    {
+        return fd_;
+    }
+
+private:
+    SharedImage() {}
+
+    void attach(int fd, size_t size);
+
+    uint8_t    *data_ = nullptr;
+    size_t      size_ = 0;
+    int         fd_ = -1;
+    bool        mapped_ = false;
+};
+
+/**
+ * @class ImageSet
+ * @author rich
+ * @date 18/10/26
+ * @file SharedImage.h
+ * @brief Named collection of shared images, passed from a supervisor to
+ *     a worker over a Unix socket.
+ */
+class ImageSet
+{
+public:
+    /**
+     * @brief Load a file and add it to the set.
+     * @param name Name workers find the image by.
+     * @param path File to read.
+     * @param size Size of image, see SharedImage::load().
+     * @return The image.
+     */
+    std::shared_ptr<SharedImage> load(const std::string &name,
+                                      const std::string &path,
+                                      size_t size = 0);
+
+    /**
+     * @brief Add an image to the set, replacing one of the same name.
+     */
+    void add(const std::string &name, std::shared_ptr<SharedImage> image)
+    {
+        images[name] = image;
+    }
+
+    /**
+     * @brief Find an image by name.
+     * @return The image or nullptr.
+     */
+    std::shared_ptr<SharedImage> find(const std::string &name) const;
+
+    /**
+     * @brief Number of images in the set.
+     */
+    size_t size() const
+    {
+        return images.size();
+    }
+
+    /**
+     * @brief Pass every image to the process at the other end of a
+     *     connected Unix socket.
+     * @param fd Connected socket.
+     */
+    void send(int fd) const;
+
+    /**
+     * @brief Receive a set sent by send().
+     * @param fd Connected socket.
+     * @return The images, mapped read only.
+     */
+    static ImageSet receive(int fd);
+
+private:
+    std::map<std::string, std::shared_ptr<SharedImage>> images;
+};
+
+}
@@ -42,5 +42,8 @@ private:
     std::string message;
 };
 
+// Raised by a System, its devices and host images.
+using SystemError = SimError<3>;
+
 }
 
@@ -0,0 +1,165 @@
+/*
+ * Author:      Richard Cornwell (rich@sky-visions.com)
+ *
+ * Copyright (C) 2021 Richard Cornwell.
+ *
+ * This file may be distributed under the terms of the Q Public License
+ * as defined by Trolltech AS of Norway and appearing in the file
+ * LICENSE.QPL included in the packaging of this file.
+ *
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING
+ * THE WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL,
+ * INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING
+ * FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION
+ * WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+#pragma once
+
+#include <stdint.h>
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <type_traits>
+#include "SimError.h"
+
+namespace core
+{
+
+using State_error = SimError<6>;
+
+/**
+ * @class StateOut
+ * @author rich
+ * @date 18/10/26
+ * @file State.h
+ * @brief Writes the saved state of simulation objects. Values are written
+ *     in host byte order, a state is only read back on the same kind of
+ *     host that wrote it.
+ */
+class StateOut
+{
+public:
+    explicit StateOut(std::ostream &os) : out(os) {}
+
+    template <typename T>
+    void put(const T &val)
+    {
+        static_assert(std::is_trivially_copyable<T>::value,
+                      "Only plain values can be saved");
+        out.write(reinterpret_cast<const char *>(&val), sizeof(T));
+    }
+
+    void put_bytes(const void *data, size_t len)
+    {
+        out.write(static_cast<const char *>(data), (std::streamsize)len);
+    }
+
+    /**
+     * @brief Write a string as its length followed by its characters.
+     */
+    void put_string(const std::string &str)
+    {
+        put((uint32_t)str.size());
+        put_bytes(str.data(), str.size());
+    }
+
+    /**
+     * @brief Write a four character section marker.
+     */
+    void tag(const char *name)
+    {
+        out.write(name, 4);
+    }
+
+    bool good() const
+    {
+        return out.good();
+    }
+
+private:
+    std::ostream &out;
+};
+
+/**
+ * @class StateIn
+ * @author rich
+ * @date 18/10/26
+ * @file State.h
+ * @brief Reads state written by StateOut. Throws State_error if the state
+ *     ends early or does not match what is expected.
+ */
+class StateIn
+{
+public:
+    explicit StateIn(std::istream &is) : in(is) {}
+
+    template <typename T>
+    T get()
+    {
+        static_assert(std::is_trivially_copyable<T>::value,
+                      "Only plain values can be restored");
+        T  val;
+        get_bytes(&val, sizeof(T));
+        return val;
+    }
+
+    template <typename T>
+    void get(T &val)
+    {
+        val = get<T>();
+    }
+
+    template <typename T, size_t N>
+    void get(T (&val)[N])
+    {
+        static_assert(std::is_trivially_copyable<T>::value,
+                      "Only plain values can be restored");
+        get_bytes(val, sizeof(val));
+    }
+
+    void get_bytes(void *data, size_t len)
+    {
+        in.read(static_cast<char *>(data), (std::streamsize)len);
+        if ((size_t)in.gcount() != len)
+            throw State_error{"Saved state is truncated"};
+    }
+
+    /**
+     * @brief Read a string written by put_string(). Strings are names,
+     *     anything longer than max_string is taken as a bad state.
+     */
+    std::string get_string()
+    {
+        uint32_t     len = get<uint32_t>();
+        if (len > max_string)
+            throw State_error{"Saved string is too long"};
+        std::string  str(len, '\0');
+        get_bytes(&str[0], len);
+        return str;
+    }
+
+    static constexpr uint32_t max_string = 4096;
+
+    /**
+     * @brief Read a section marker, throw if it is not the one expected.
+     */
+    void tag(const char *name)
+    {
+        char  buf[4];
+        get_bytes(buf, 4);
+        if (std::memcmp(buf, name, 4) != 0)
+            throw State_error{std::string("Expected state section ") +
+                              std::string(name, 4)};
+    }
+
+private:
+    std::istream &in;
+};
+
+}
@@ -17,8 +17,11 @@
  *
  */
 #include <algorithm>
+#include <thread>
 #include "System.h"
 #include "Core.h"
+#include "Numa.h"
+#include "State.h"
 
 namespace core
 {
@@ -35,6 +38,15 @@ void System::init()
         visit([](const auto& obj) {
             obj->init();
         }, cpu);
+        // Place the CPU's memory map on its node, before any memory is
+        // attached to it.
+        int node = cpuNode(cpu);
+        if (node >= 0) {
+            visit([node](const auto& obj) {
+                if (obj->sh_mem)
+                    obj->sh_mem->setNode(node);
+            }, cpu);
+        }
         string name = visit([](const auto& obj) {
             return obj->getName();
         }, cpu);
@@ -64,6 +76,8 @@ void System::init()
 
     // Next give each CPU it's memory.
     for(auto &mem : memories ) {
+        size_t users = 0;
+        int    node = -1;
         // See if this CPU matches the names vector.
         for (auto &cpu : cpus ) {
             // Grab name of this CPU.
@@ -73,8 +87,23 @@ void System::init()
             // If Memory belongs to this CPU, add it.
             if (findString(mem.cpu_names, name)) {
                 attachMemory(cpu, mem.mem);
+                users++;
+                if (node < 0)
+                    node = cpuNode(cpu);
             }
         }
+        // Keep memory on the node of the first CPU that uses it.
+        if (node >= 0) {
+            visit([node](const auto& obj) {
+                obj->setNode(node);
+            }, mem.mem);
+        }
+        // Memory seen by several CPU's must order its accesses.
+        if (users > 1) {
+            visit([](const auto& obj) {
+                obj->setShared(true);
+            }, mem.mem);
+        }
     }
 
     // Then give each CPU it's IO controllers.
@@ -153,6 +182,401 @@ void System::start()
 }
 
 
+void System::run()
+{
+    stop_.store(false);
+
+    // A single CPU needs no threads.
+    if (cpus.size() == 1) {
+        visit([this](const auto& obj) {
+            Numa::pin_thread(Numa::parse_list(obj->affinity));
+            while (obj->running && !stop_.load(memory_order_relaxed))
+                (void)obj->step();
+        }, cpus[0]);
+        return;
+    }
+
+    // Each thread counts itself in live if its CPU is still running at
+    // the end of the quantum. The last thread to reach the barrier
+    // decides whether to go round again.
+    atomic<size_t>  live{0};
+    bool            done = false;
+    Barrier         barrier(cpus.size(), [this, &live, &done]() {
+        done = live.load() == 0 || stop_.load();
+        live.store(0);
+    });
+    vector<thread>  threads;
+
+    for(auto &cpu : cpus ) {
+        threads.emplace_back([this, &cpu, &live, &done, &barrier]() {
+            visit([](const auto& obj) {
+                Numa::pin_thread(Numa::parse_list(obj->affinity));
+            }, cpu);
+            for (;;) {
+                bool running = visit([this](const auto& obj) {
+                    uint64_t  t = 0;
+                    while (obj->running && t < quantum) {
+                        uint64_t  s = obj->step();
+                        t += (s != 0) ? s : 1;
+                    }
+                    return obj->running;
+                }, cpu);
+                if (running)
+                    live++;
+                barrier.arrive_and_wait();
+                if (done)
+                    break;
+            }
+        });
+    }
+    for (auto &t : threads)
+        t.join();
+}
+
+// Saved state starts with this and a version number.
+static const char   state_magic[] = "TSSS";
+static const uint8_t state_version = 1;
+
+static const char   delta_magic[] = "TSSD";
+
+void System::save(ostream &os)
+{
+    write_state(os, nullptr);
+}
+
+void System::restore(istream &is)
+{
+    read_state(is, false);
+}
+
+void System::save_delta(ostream &os, uint64_t &since)
+{
+    uint64_t  next = dirty_epoch();
+
+    write_state(os, &since);
+    since = next;
+}
+
+void System::restore_delta(istream &is)
+{
+    read_state(is, true);
+}
+
+void System::write_state(ostream &os, const uint64_t *since)
+{
+    StateOut  out(os);
+
+    out.tag((since != nullptr) ? delta_magic : state_magic);
+    out.put(state_version);
+    out.tag("CPUS");
+    out.put((uint32_t)cpus.size());
+    for(auto &cpu : cpus ) {
+        visit([&out](const auto& obj) {
+            obj->save(out);
+        }, cpu);
+    }
+    out.tag("MEMS");
+    out.put((uint32_t)memories.size());
+    for(auto &mem : memories ) {
+        visit([&out, since](const auto& obj) {
+            if (since != nullptr)
+                obj->save_dirty(out, *since);
+            else
+                obj->save(out);
+        }, mem.mem);
+    }
+    out.tag("DEVS");
+    out.put((uint32_t)devices.size());
+    for(auto &dev : devices ) {
+        visit([&out](const auto& obj) {
+            obj->save(out);
+        }, dev.dev);
+    }
+    out.tag("END ");
+    if (!out.good())
+        throw State_error{"Unable to write state"};
+}
+
+void System::read_state(istream &is, bool delta)
+{
+    StateIn  in(is);
+
+    in.tag(delta ? delta_magic : state_magic);
+    if (in.get<uint8_t>() != state_version)
+        throw State_error{"Unknown state version"};
+    in.tag("CPUS");
+    if (in.get<uint32_t>() != cpus.size())
+        throw State_error{"Saved state has different CPUs"};
+    for(auto &cpu : cpus ) {
+        visit([&in](const auto& obj) {
+            obj->load(in);
+        }, cpu);
+    }
+    in.tag("MEMS");
+    if (in.get<uint32_t>() != memories.size())
+        throw State_error{"Saved state has different memory"};
+    for(auto &mem : memories ) {
+        visit([&in, delta](const auto& obj) {
+            if (delta)
+                obj->load_dirty(in);
+            else
+                obj->load(in);
+        }, mem.mem);
+    }
+    in.tag("DEVS");
+    if (in.get<uint32_t>() != devices.size())
+        throw State_error{"Saved state has different devices"};
+    for(auto &dev : devices ) {
+        visit([&in](const auto& obj) {
+            obj->load(in);
+        }, dev.dev);
+    }
+    in.tag("END ");
+}
+
+static void put_names(StateOut &out, const vector<string> &names)
+{
+    out.put((uint32_t)names.size());
+    for (auto &name : names)
+        out.put_string(name);
+}
+
+static vector<string> get_names(StateIn &in)
+{
+    vector<string>  names(in.get<uint32_t>());
+    for (auto &name : names)
+        name = in.get_string();
+    return names;
+}
+
+void System::save_layout(StateOut &out)
+{
+    out.tag("LAYO");
+    out.put_string(getType());
+    out.put((uint32_t)cpus.size());
+    for(auto &cpu : cpus ) {
+        visit([&out](const auto& obj) {
+            out.put_string(obj->getType());
+            out.put_string(obj->getName());
+        }, cpu);
+    }
+    out.put((uint32_t)memories.size());
+    for(auto &mem : memories ) {
+        visit([&out](const auto& obj) {
+            out.put_string(obj->getType());
+            out.put_string(obj->getName());
+            out.put((uint64_t)obj->getSize());
+            out.put((uint64_t)obj->getBase());
+        }, mem.mem);
+        put_names(out, mem.cpu_names);
+    }
+    // Controllers a CPU made for itself come back when it is init'ed.
+    uint32_t  ios = 0;
+    for(auto &io : io_ctrl ) {
+        if (!io.added)
+            ios++;
+    }
+    out.put(ios);
+    for(auto &io : io_ctrl ) {
+        if (io.added)
+            continue;
+        visit([&out](const auto& obj) {
+            out.put_string(obj->getType());
+            out.put_string(obj->getName());
+        }, io.io);
+        put_names(out, io.cpu_names);
+    }
+    out.put((uint32_t)devices.size());
+    for(auto &dev : devices ) {
+        visit([&out](const auto& obj) {
+            out.put_string(obj->getType());
+            out.put_string(obj->getName());
+            out.put((uint64_t)obj->getAddress());
+        }, dev.dev);
+        put_names(out, dev.io_names);
+    }
+    out.tag("END ");
+}
+
+shared_ptr<System> System::build(StateIn &in)
+{
+    in.tag("LAYO");
+    shared_ptr<System> sys = create(in.get_string());
+
+    for (uint32_t n = in.get<uint32_t>(); n != 0; n--) {
+        CPU_v   cpu = sys->create_cpu(in.get_string());
+        string  name = in.get_string();
+        visit([&name](const auto& obj) {
+            obj->setName(name);
+        }, cpu);
+        sys->addCpu(cpu);
+    }
+    for (uint32_t n = in.get<uint32_t>(); n != 0; n--) {
+        string    model = in.get_string();
+        string    name = in.get_string();
+        uint64_t  size = in.get<uint64_t>();
+        uint64_t  base = in.get<uint64_t>();
+        MEM_v     mem = sys->create_mem(model, size, base);
+        visit([&name](const auto& obj) {
+            obj->setName(name);
+        }, mem);
+        sys->addMemory(MemInfo{mem, get_names(in)});
+    }
+    for (uint32_t n = in.get<uint32_t>(); n != 0; n--) {
+        IO_v    io = sys->create_io(in.get_string());
+        string  name = in.get_string();
+        visit([&name](const auto& obj) {
+            obj->setName(name);
+        }, io);
+        sys->addIo(IOInfo{io, false, get_names(in)});
+    }
+    for (uint32_t n = in.get<uint32_t>(); n != 0; n--) {
+        DEV_v     dev = sys->create_dev(in.get_string());
+        string    name = in.get_string();
+        uint64_t  addr = in.get<uint64_t>();
+        visit([&name, addr](const auto& obj) {
+            obj->setName(name);
+            obj->setAddress(addr);
+        }, dev);
+        sys->addDevice(DevInfo{dev, get_names(in)});
+    }
+    in.tag("END ");
+    sys->init();
+    return sys;
+}
+
+void System::release()
+{
+    for(auto &mem : memories ) {
+        visit([](const auto& obj) {
+            obj->release();
+        }, mem.mem);
+    }
+}
+
+size_t System::merge_pages(PageStore &store)
+{
+    size_t  n = 0;
+
+    for(auto &mem : memories ) {
+        n += visit([&store](const auto& obj) {
+            return obj->merge_pages(store);
+        }, mem.mem);
+    }
+    return n;
+}
+
+uint64_t System::shared_bytes()
+{
+    uint64_t  n = 0;
+
+    for(auto &mem : memories ) {
+        n += visit([](const auto& obj) {
+            return obj->shared_bytes();
+        }, mem.mem);
+    }
+    return n;
+}
+
+uint64_t System::saved_bytes()
+{
+    uint64_t  n = 0;
+
+    for(auto &mem : memories ) {
+        n += visit([](const auto& obj) {
+            return obj->saved_bytes();
+        }, mem.mem);
+    }
+    return n;
+}
+
+int System::cpuNode(const CPU_v &cpu)
+{
+    return visit([](const auto& obj) {
+        if (obj->numa_node >= 0)
+            return obj->numa_node;
+        vector<int> cores = Numa::parse_list(obj->affinity);
+        if (cores.empty())
+            return -1;
+        return Numa::core_node(cores[0]);
+    }, cpu);
+}
+
+int System::node()
+{
+    for(auto &cpu : cpus ) {
+        int n = cpuNode(cpu);
+        if (n >= 0)
+            return n;
+    }
+    return -1;
+}
+
+void System::setNode(int node)
+{
+    for(auto &mem : memories ) {
+        visit([node](const auto& obj) {
+            obj->setNode(node);
+        }, mem.mem);
+    }
+    // Each CPU's own memory map.
+    for(auto &cpu : cpus ) {
+        visit([node](const auto& obj) {
+            if (obj->sh_mem)
+                obj->sh_mem->setNode(node);
+        }, cpu);
+    }
+}
+
+RunUsage System::run_quantum(uint64_t budget)
+{
+    RunUsage used{0, 0};
+
+    for(auto &cpu : cpus ) {
+        visit([budget, &used](const auto& obj) {
+            uint64_t  t = 0;
+            uint64_t  n = 0;
+            while (obj->running && t < budget) {
+                // Count a CPU that does not report time as one unit per
+                // step so the quantum still ends.
+                uint64_t  s = obj->step();
+                t += (s != 0) ? s : 1;
+                n++;
+            }
+            used.time += t;
+            used.steps += n;
+        }, cpu);
+    }
+    return used;
+}
+
+bool System::idle()
+{
+    bool  halted = true;
+
+    for(auto &cpu : cpus ) {
+        if (visit([](const auto& obj) { return obj->running; }, cpu))
+            halted = false;
+    }
+    if (halted)
+        return true;
+    for(auto &dev : devices ) {
+        if (visit([](const auto& obj) { return obj->waiting(); }, dev.dev))
+            return true;
+    }
+    return false;
+}
+
+void System::setWake(std::function<void()> wake)
+{
+    for(auto &dev : devices ) {
+        visit([&wake](const auto& obj) {
+            obj->wake = wake;
+        }, dev.dev);
+    }
+}
+
+
 void System::attachMemory(CPU_v & cpu, MEM_v &mem)
 {
     try {
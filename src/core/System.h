@@ -24,6 +24,8 @@
 #include <memory>
 #include <vector>
 #include <variant>
+#include <atomic>
+#include <functional>
 #include "SimError.h"
 #include "CPU.h"
 #include "IO.h"
@@ -37,9 +39,9 @@
     public: \
         systype##Factory() \
         { \
-            std::cout << "Registering: " #systype << "\n"; \
+            std::cerr << "Registering: " #systype << "\n"; \
             System::registerType(#systype, this); \
-            std::cout << "Registered" << "\n"; \
+            std::cerr << "Registered" << "\n"; \
         } \
         virtual std::shared_ptr<System>create() { \
             return std::make_shared<systype>(); \
@@ -51,7 +53,6 @@
 
 namespace core
 {
-using SystemError = SimError<3>;
 
 class System;
 
@@ -72,6 +73,11 @@ struct IOInfo {
     std::vector<std::string> cpu_names;
 };
 
+struct RunUsage {
+    uint64_t                 time;    // Simulated nanoseconds.
+    uint64_t                 steps;   // Instructions executed.
+};
+
 struct DevInfo {
     DEV_v                    dev;
     std::vector<std::string> io_names;
@@ -105,9 +111,132 @@ public:
 
     virtual void start();
 
+    /**
+     * @brief Run each CPU for up to budget nanoseconds of simulated time.
+     * @param budget Time each CPU may run before returning.
+     * @return Total simulated time and steps used by all CPU's.
+     */
+    virtual RunUsage run_quantum(uint64_t budget);
+
+    /**
+     * @brief Return true if there is nothing useful to run: every CPU is
+     *     halted, or a device reports the guest is waiting on it.
+     */
+    virtual bool idle();
+
+    /**
+     * @brief Give every device a function to call when input arrives.
+     * @param wake Function to call, may be called from any thread.
+     */
+    virtual void setWake(std::function<void()> wake);
+
    // virtual void shutdown();
-   // virtual void run();
-   // virtual void stop();
+
+    /**
+     * @brief Run until every CPU has stopped or stop() is called. With
+     *     more than one CPU each runs on its own thread. The CPUs run
+     *     quantum nanoseconds of simulated time then wait at a barrier
+     *     for each other, so their clocks never drift more than one
+     *     quantum apart.
+     */
+    virtual void run();
+
+    /**
+     * @brief Host NUMA node for a CPU: its numa option, else the node of
+     *     the first core in its affinity, else -1.
+     */
+    static int cpuNode(const CPU_v &cpu);
+
+    /**
+     * @brief Host NUMA node of the first CPU that has one, -1 if none.
+     */
+    int node();
+
+    /**
+     * @brief Move all memory to a host NUMA node.
+     * @param node Node to move to.
+     */
+    virtual void setNode(int node);
+
+    /**
+     * @brief Save the state of every CPU, memory and device. The System
+     *     must not be running.
+     * @param os Stream to write to.
+     */
+    virtual void save(std::ostream &os);
+
+    /**
+     * @brief Restore state written by save() into a System built the same
+     *     way. Throws State_error if it does not match.
+     * @param is Stream to read from.
+     */
+    virtual void restore(std::istream &is);
+
+    /**
+     * @brief Save CPU and device state with only the memory pages written
+     *     since epoch since. The System must not be running.
+     * @param os Stream to write to.
+     * @param since Value of core::dirty_epoch() taken before the save()
+     *     or save_delta() this follows, updated for the next delta.
+     */
+    virtual void save_delta(std::ostream &os, uint64_t &since);
+
+    /**
+     * @brief Apply a state written by save_delta() on top of the state
+     *     it followed.
+     * @param is Stream to read from.
+     */
+    virtual void restore_delta(std::istream &is);
+
+    /**
+     * @brief Write what the System is made of: its type and the model,
+     *     name and connections of every part. Options set when it was
+     *     configured are not included.
+     * @param out Where to write the layout.
+     */
+    virtual void save_layout(StateOut &out);
+
+    /**
+     * @brief Make a System from a layout written by save_layout(), using
+     *     the registered factories, and init it.
+     * @param in Where to read the layout.
+     * @return New System, ready for restore().
+     */
+    static std::shared_ptr<System> build(StateIn &in);
+
+    /**
+     * @brief Free memory storage after save(), restore() brings it back.
+     */
+    virtual void release();
+
+    /**
+     * @brief Share memory pages that have stopped changing through a
+     *     store. The System must not be running.
+     * @param store Store of shared pages.
+     * @return Number of pages newly shared.
+     */
+    virtual size_t merge_pages(PageStore &store);
+
+    /**
+     * @brief Bytes of memory read from shared pages. Safe to call while
+     *     running.
+     */
+    uint64_t shared_bytes();
+
+    /**
+     * @brief Bytes of memory saved by sharing. Safe to call while
+     *     running.
+     */
+    uint64_t saved_bytes();
+
+    /**
+     * @brief Make run() return at the end of the current quantum. Safe
+     *     to call from any thread.
+     */
+    virtual void stop()
+    {
+        stop_.store(true);
+    }
 
     // List all registered System model types.
     static
@@ -138,7 +267,7 @@ public:
 
     CPU_v& getCpu(size_t number)
     {
-        if (this->cpus.size() > number)
+        if (number >= this->cpus.size())
             throw SystemError{"Not defined"};
         return this->cpus.at(number);
     }
@@ -175,10 +304,22 @@ public:
 
     std::vector<DevInfo> devices;
 
+    /**
+     * @brief Simulated nanoseconds each CPU runs between barriers when
+     *     run() has more than one CPU.
+     */
+    uint64_t quantum = 10000;
+
     private:
 
+    std::atomic<bool> stop_{false};
+
     void attachMemory(CPU_v &cpu, MEM_v& mem);
 
+    void write_state(std::ostream &os, const uint64_t *since);
+
+    void read_state(std::istream &is, bool delta);
+
     void attachIO(CPU_v & cpu, IO_v & io);
 
     void attachDevice(IO_v & io, DEV_v & dev);
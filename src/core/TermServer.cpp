@@ -0,0 +1,517 @@
+/*
+ * Author:      Richard Cornwell (rich@sky-visions.com)
+ *
+ * Copyright (C) 2021 Richard Cornwell.
+ *
+ * This file may be distributed under the terms of the Q Public License
+ * as defined by Trolltech AS of Norway and appearing in the file
+ * LICENSE.QPL included in the packaging of this file.
+ *
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING
+ * THE WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL,
+ * INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING
+ * FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION
+ * WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+#include "config.h"
+#include <cstring>
+#include "TermServer.h"
+#ifdef HAVE_SYS_EPOLL_H
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+namespace core
+{
+
+using namespace std;
+
+// Telnet commands.
+static const uint8_t IAC = 255;
+static const uint8_t SB = 250;
+static const uint8_t SE = 240;
+static const uint8_t WILL = 251;
+static const uint8_t DONT = 254;
+static const uint8_t TELOPT_ECHO = 1;
+static const uint8_t TELOPT_SGA = 3;
+
+// States of the telnet input filter.
+enum {
+    tn_data, tn_iac, tn_option, tn_sub, tn_sub_iac, tn_cr
+};
+
+void TermLine::write(const char *data, size_t n)
+{
+    bool  half;
+
+    if (!connected())
+        return;
+    {
+        lock_guard<mutex> lock(lock_);
+        for (size_t i = 0; i < n; i++) {
+            if (out_.size() >= out_max) {
+                dropped_.fetch_add(n - i, memory_order_relaxed);
+                break;
+            }
+            out_.push_back(data[i]);
+            if (mode_ == Mode::telnet && (uint8_t)data[i] == IAC)
+                out_.push_back(data[i]);
+        }
+        half = out_.size() >= out_max / 2;
+    }
+    server->kick(half);
+}
+
+void TermLine::flush()
+{
+    if (connected())
+        server->kick(true);
+}
+
+void TermLine::receive(char *data, size_t n)
+{
+    size_t  out = 0;
+
+    if (mode_ == Mode::raw) {
+        input.notify_n(data, n);
+        return;
+    }
+    // Strip telnet commands, and the NUL or LF sent after a return.
+    for (size_t i = 0; i < n; i++) {
+        uint8_t  c = (uint8_t)data[i];
+        switch (telnet_state) {
+        case tn_cr:
+            telnet_state = tn_data;
+            if (c == 0 || c == '\n')
+                break;
+            /* Fall through */
+        case tn_data:
+            if (c == IAC) {
+                telnet_state = tn_iac;
+            } else {
+                data[out++] = (char)c;
+                if (c == '\r')
+                    telnet_state = tn_cr;
+            }
+            break;
+        case tn_iac:
+            if (c == IAC) {
+                data[out++] = (char)c;
+                telnet_state = tn_data;
+            } else if (c >= WILL && c <= DONT) {
+                telnet_state = tn_option;
+            } else if (c == SB) {
+                telnet_state = tn_sub;
+            } else {
+                telnet_state = tn_data;
+            }
+            break;
+        case tn_option:
+            telnet_state = tn_data;
+            break;
+        case tn_sub:
+            if (c == IAC)
+                telnet_state = tn_sub_iac;
+            break;
+        case tn_sub_iac:
+            telnet_state = (c == SE) ? tn_data : tn_sub;
+            break;
+        }
+    }
+    input.notify_n(data, out);
+}
+
+TermServer::~TermServer()
+{
+    stop();
+}
+
+size_t TermServer::lines()
+{
+    lock_guard<mutex> lock(lock_);
+    return lines_.size();
+}
+
+#ifdef HAVE_SYS_EPOLL_H
+// Listening sockets are tagged with their line number, connections with
+// the line number and the low bit set.
+static const uint64_t wake_tag = ~(uint64_t)0;
+
+static int listen_on(const string &address, TermLine::Mode &mode, int &port,
+                     string &path)
+{
+    string  rest;
+    int     fd;
+
+    if (address.compare(0, 7, "telnet:") == 0) {
+        mode = TermLine::Mode::telnet;
+        rest = address.substr(7);
+    } else if (address.compare(0, 4, "tcp:") == 0) {
+        mode = TermLine::Mode::raw;
+        rest = address.substr(4);
+    } else if (address.compare(0, 5, "unix:") == 0) {
+        sockaddr_un  addr{};
+        mode = TermLine::Mode::raw;
+        path = address.substr(5);
+        if (path.empty() || path.size() >= sizeof(addr.sun_path))
+            throw SystemError{"Bad socket path: " + address};
+        addr.sun_family = AF_UNIX;
+        memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0)
+            throw SystemError{string("Unable to create socket: ") + strerror(errno)};
+        (void)unlink(path.c_str());
+        if (::bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+            ::listen(fd, 4) != 0) {
+            int  err = errno;
+            close(fd);
+            throw SystemError{"Unable to listen on " + address + ": " + strerror(err)};
+        }
+        return fd;
+    } else {
+        throw SystemError{"Unknown terminal address: " + address};
+    }
+
+    // [host:]port
+    string       host = "127.0.0.1";
+    size_t       colon = rest.rfind(':');
+    sockaddr_in  addr{};
+    socklen_t    len = sizeof(addr);
+    int          one = 1;
+    char        *end;
+
+    if (colon != string::npos) {
+        host = rest.substr(0, colon);
+        rest = rest.substr(colon + 1);
+        if (host == "localhost")
+            host = "127.0.0.1";
+    }
+    long  num = strtol(rest.c_str(), &end, 10);
+    if (rest.empty() || *end != '\0' || num < 0 || num > 65535)
+        throw SystemError{"Bad port in " + address};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)num);
+    if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1)
+        throw SystemError{"Bad host in " + address};
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        throw SystemError{string("Unable to create socket: ") + strerror(errno)};
+    (void)setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (::bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+        ::listen(fd, 4) != 0 ||
+        getsockname(fd, reinterpret_cast<sockaddr *>(&addr), &len) != 0) {
+        int  err = errno;
+        close(fd);
+        throw SystemError{"Unable to listen on " + address + ": " + strerror(err)};
+    }
+    port = ntohs(addr.sin_port);
+    return fd;
+}
+#endif
+
+shared_ptr<TermLine> TermServer::bind(const string &address)
+{
+#ifdef HAVE_SYS_EPOLL_H
+    lock_guard<mutex>  lock(lock_);
+    TermLine::Mode     mode;
+    int                port = 0;
+    string             path;
+
+    if (thrd == nullptr) {
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (epoll_fd < 0 || wake_fd < 0)
+            throw SystemError{string("Unable to start terminal server: ") +
+                              strerror(errno)};
+        epoll_event  ev{};
+        ev.events = EPOLLIN;
+        ev.data.u64 = wake_tag;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev);
+        stop_ = false;
+        kicked_ = false;
+        urgent_ = false;
+        thrd = new thread(&TermServer::run, this);
+    }
+    int   fd = listen_on(address, mode, port, path);
+    auto  line = make_shared<TermLine>(this, address, mode);
+    line->listen_fd = fd;
+    line->port_ = port;
+    line->path_ = path;
+    line->index_ = lines_.size();
+    lines_.push_back(line);
+
+    epoll_event  ev{};
+    ev.events = EPOLLIN;
+    ev.data.u64 = (uint64_t)(lines_.size() - 1) << 1;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+    return line;
+#else
+    throw SystemError{"Terminal server is not supported on this host: " + address};
+#endif
+}
+
+void TermServer::stop()
+{
+#ifdef HAVE_SYS_EPOLL_H
+    {
+        lock_guard<mutex> lock(lock_);
+        if (thrd == nullptr)
+            return;
+        stop_ = true;
+    }
+    kick(true);
+    thrd->join();
+    delete thrd;
+    thrd = nullptr;
+    lock_guard<mutex> lock(lock_);
+    for (auto &line : lines_) {
+        hang_up(*line);
+        close(line->listen_fd);
+        line->listen_fd = -1;
+        if (!line->path_.empty())
+            (void)unlink(line->path_.c_str());
+    }
+    lines_.clear();
+    close(epoll_fd);
+    close(wake_fd);
+    epoll_fd = wake_fd = -1;
+#endif
+}
+
+void TermServer::kick(bool now)
+{
+#ifdef HAVE_SYS_EPOLL_H
+    bool  first = !kicked_.exchange(true);
+    bool  hurry = now && !urgent_.exchange(true);
+
+    // Only the first output of a tick, or the first urgent one, has to
+    // wake the server.
+    if (first || hurry) {
+        uint64_t  one = 1;
+        ssize_t   r = ::write(wake_fd, &one, sizeof(one));
+        (void)r;
+    }
+#else
+    (void)now;
+#endif
+}
+
+void TermServer::run()
+{
+#ifdef HAVE_SYS_EPOLL_H
+    using clock = chrono::steady_clock;
+    const int                max_events = 64;
+    epoll_event              events[max_events];
+    clock::time_point        deadline;
+    bool                     pending = false;
+
+    while (!stop_) {
+        int  timeout = -1;
+        if (pending) {
+            auto  left = chrono::duration_cast<chrono::milliseconds>(
+                              deadline - clock::now()).count();
+            timeout = (left > 0) ? (int)left + 1 : 0;
+        }
+        int  n = epoll_wait(epoll_fd, events, max_events, timeout);
+        for (int i = 0; i < n; i++) {
+            uint64_t  tag = events[i].data.u64;
+            if (tag == wake_tag) {
+                uint64_t  count;
+                ssize_t   r = ::read(wake_fd, &count, sizeof(count));
+                (void)r;
+                if (!pending) {
+                    deadline = clock::now() + out_tick;
+                    pending = true;
+                }
+                continue;
+            }
+            size_t  index = (size_t)(tag >> 1);
+            if ((tag & 1) == 0) {
+                accept_on(index);
+                continue;
+            }
+            shared_ptr<TermLine>  line;
+            {
+                lock_guard<mutex> lock(lock_);
+                line = lines_[index];
+            }
+            if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+                read_on(index);
+            if ((events[i].events & EPOLLOUT) && line->conn_fd >= 0)
+                flush_line(*line);
+        }
+        if (urgent_.exchange(false) ||
+            (pending && clock::now() >= deadline)) {
+            // Clear first, output queued while flushing asks again.
+            kicked_.store(false);
+            pending = false;
+            vector<shared_ptr<TermLine>>  all;
+            {
+                lock_guard<mutex> lock(lock_);
+                all = lines_;
+            }
+            for (auto &line : all)
+                flush_line(*line);
+        }
+    }
+#endif
+}
+
+void TermServer::accept_on(size_t index)
+{
+#ifdef HAVE_SYS_EPOLL_H
+    shared_ptr<TermLine>  line;
+    {
+        lock_guard<mutex> lock(lock_);
+        line = lines_[index];
+    }
+    int  fd = accept4(line->listen_fd, nullptr, nullptr,
+                      SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0)
+        return;
+    if (line->conn_fd >= 0) {
+        static const char busy[] = "Line busy\r\n";
+        ssize_t  r = ::write(fd, busy, sizeof(busy) - 1);
+        (void)r;
+        close(fd);
+        return;
+    }
+    if (line->path_.empty()) {
+        int  one = 1;
+        (void)setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    line->conn_fd = fd;
+    line->telnet_state = tn_data;
+    line->want_out = false;
+    line->unsent_.clear();
+    if (line->mode_ == TermLine::Mode::telnet) {
+        // Character at a time, the guest does the echoing.
+        static const uint8_t  opts[] = { IAC, WILL, TELOPT_ECHO,
+                                         IAC, WILL, TELOPT_SGA };
+        line->unsent_.assign(opts, opts + sizeof(opts));
+    }
+    epoll_event  ev{};
+    ev.events = EPOLLIN;
+    ev.data.u64 = ((uint64_t)index << 1) | 1;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+    line->connected_.store(true, memory_order_release);
+    flush_line(*line);
+#else
+    (void)index;
+#endif
+}
+
+void TermServer::read_on(size_t index)
+{
+#ifdef HAVE_SYS_EPOLL_H
+    shared_ptr<TermLine>  line;
+    char                  buf[4096];
+    {
+        lock_guard<mutex> lock(lock_);
+        line = lines_[index];
+    }
+    if (line->conn_fd < 0)
+        return;
+    ssize_t  n = ::read(line->conn_fd, buf, sizeof(buf));
+    if (n > 0) {
+        line->receive(buf, (size_t)n);
+    } else if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+        hang_up(*line);
+    }
+#else
+    (void)index;
+#endif
+}
+
+void TermServer::flush_line(TermLine &line)
+{
+#ifdef HAVE_SYS_EPOLL_H
+    {
+        lock_guard<mutex> lock(line.lock_);
+        if (!line.out_.empty()) {
+            size_t  room = TermLine::out_max - min(line.unsent_.size(),
+                                                   TermLine::out_max);
+            size_t  len = min(room, line.out_.size());
+            line.unsent_.insert(line.unsent_.end(), line.out_.begin(),
+                                line.out_.begin() + len);
+            if (len < line.out_.size())
+                line.dropped_.fetch_add(line.out_.size() - len,
+                                        memory_order_relaxed);
+            line.out_.clear();
+        }
+    }
+    if (line.conn_fd < 0) {
+        line.unsent_.clear();
+        return;
+    }
+    size_t  done = 0;
+    while (done < line.unsent_.size()) {
+        ssize_t  r = ::write(line.conn_fd, line.unsent_.data() + done,
+                             line.unsent_.size() - done);
+        if (r > 0) {
+            done += (size_t)r;
+        } else if (r < 0 && errno == EINTR) {
+            continue;
+        } else if (r < 0 && errno == EAGAIN) {
+            break;
+        } else {
+            hang_up(line);
+            return;
+        }
+    }
+    line.unsent_.erase(line.unsent_.begin(), line.unsent_.begin() + done);
+    // Ask to be told when a slow user can take the rest.
+    watch(line, !line.unsent_.empty());
+#else
+    (void)line;
+#endif
+}
+
+void TermServer::watch(TermLine &line, bool out)
+{
+#ifdef HAVE_SYS_EPOLL_H
+    if (line.want_out == out || line.conn_fd < 0)
+        return;
+    epoll_event  ev{};
+    ev.events = out ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+    ev.data.u64 = ((uint64_t)line.index_ << 1) | 1;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, line.conn_fd, &ev);
+    line.want_out = out;
+#else
+    (void)line;
+    (void)out;
+#endif
+}
+
+void TermServer::hang_up(TermLine &line)
+{
+#ifdef HAVE_SYS_EPOLL_H
+    if (line.conn_fd < 0)
+        return;
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, line.conn_fd, nullptr);
+    close(line.conn_fd);
+    line.conn_fd = -1;
+    line.connected_.store(false, memory_order_release);
+    line.unsent_.clear();
+    line.want_out = false;
+    lock_guard<mutex> lock(line.lock_);
+    line.out_.clear();
+#else
+    (void)line;
+#endif
+}
+
+}
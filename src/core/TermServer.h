@@ -0,0 +1,221 @@
+/*
+ * Author:      Richard Cornwell (rich@sky-visions.com)
+ *
+ * Copyright (C) 2021 Richard Cornwell.
+ *
+ * This file may be distributed under the terms of the Q Public License
+ * as defined by Trolltech AS of Norway and appearing in the file
+ * LICENSE.QPL included in the packaging of this file.
+ *
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING
+ * THE WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL,
+ * INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING
+ * FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION
+ * WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Console.h"
+#include "Event.h"
+
+namespace core
+{
+
+class TermServer;
+
+/**
+ * @class TermLine
+ * @author rich
+ * @date 18/10/26
+ * @file TermServer.h
+ * @brief One terminal line of a TermServer, bound to a listening port.
+ *     A device writes its output here and is handed what the user types
+ *     through the listeners added with addReadChar(). One user may be
+ *     connected at a time, others are told the line is busy.
+ */
+class TermLine
+{
+    friend TermServer;
+
+public:
+    enum class Mode {
+        raw,            // Bytes are passed as they are.
+        telnet          // Telnet commands are stripped.
+    };
+
+    /**
+     * @brief Most output held for a slow user, more is dropped.
+     */
+    static constexpr size_t out_max = 65536;
+
+    TermLine(TermServer *server, const std::string &address, Mode mode) :
+        server(server), address_(address), mode_(mode) {}
+
+    TermLine(const TermLine&) = delete;
+    TermLine& operator=(const TermLine&) = delete;
+
+    /**
+     * @brief Queue output for the user. Dropped when no one is connected.
+     *     It is written by the server thread at the next tick, or sooner
+     *     once half of out_max is queued.
+     */
+    void write(const char *data, size_t n);
+
+    /**
+     * @brief Write queued output now, called when the guest goes idle.
+     */
+    void flush();
+
+    /**
+     * @brief Add a listener for input, called on the server thread.
+     */
+    void addReadChar(Console_reader *rdr)
+    {
+        input.addListener(Delegate::bind<Console_reader,
+                          &Console_reader::recv_char,
+                          &Console_reader::recv_chars>(rdr));
+    }
+
+    /**
+     * @brief Whether a user is connected.
+     */
+    bool connected() const
+    {
+        return connected_.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief Bytes of output dropped because the user fell behind.
+     */
+    uint64_t dropped() const
+    {
+        return dropped_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Address the line was bound to.
+     */
+    const std::string &address() const
+    {
+        return address_;
+    }
+
+    /**
+     * @brief TCP port being listened on, useful when bound to port 0.
+     */
+    int port() const
+    {
+        return port_;
+    }
+
+private:
+    void receive(char *data, size_t n);
+
+    TermServer              *server;
+    std::string              address_;
+    Mode                     mode_;
+    Event                    input;
+    int                      listen_fd = -1;
+    int                      conn_fd = -1;
+    int                      port_ = 0;
+    size_t                   index_ = 0;        // Place in server.
+    std::string              path_;             // Unix socket to remove.
+    std::atomic<bool>        connected_{false};
+    std::atomic<uint64_t>    dropped_{0};
+    std::mutex               lock_;
+    std::vector<char>        out_;              // Queued by the device.
+    std::vector<char>        unsent_;           // Held by server thread.
+    int                      telnet_state = 0;
+    bool                     want_out = false;  // Waiting for EPOLLOUT.
+};
+
+/**
+ * @class TermServer
+ * @author rich
+ * @date 18/10/26
+ * @file TermServer.h
+ * @brief Terminal server giving each UART its own listening port. All
+ *     ports and connections are served by one thread from one epoll
+ *     loop, reads and writes are non-blocking and batched per tick.
+ *
+ *     Addresses are "telnet:[host:]port", "tcp:[host:]port" for a raw
+ *     connection, or "unix:path". The host defaults to 127.0.0.1.
+ */
+class TermServer
+{
+    friend TermLine;
+
+public:
+    /**
+     * @brief Longest time output is held before being written.
+     */
+    static constexpr std::chrono::milliseconds out_tick{10};
+
+    TermServer() {}
+
+    ~TermServer();
+
+    TermServer(const TermServer&) = delete;
+    TermServer& operator=(const TermServer&) = delete;
+
+    /**
+     * @brief Server shared by all devices of the process.
+     */
+    static TermServer* getInstance()
+    {
+        static TermServer instance;
+        return &instance;
+    }
+
+    /**
+     * @brief Listen on an address and return its line. The server thread
+     *     is started with the first line.
+     * @param address Address to listen on.
+     * @return The line.
+     */
+    std::shared_ptr<TermLine> bind(const std::string &address);
+
+    /**
+     * @brief Number of lines bound.
+     */
+    size_t lines();
+
+    /**
+     * @brief Stop the server thread and close every line.
+     */
+    void stop();
+
+private:
+    void kick(bool now);
+    void run();
+    void accept_on(size_t index);
+    void read_on(size_t index);
+    void flush_line(TermLine &line);
+    void hang_up(TermLine &line);
+    void watch(TermLine &line, bool out);
+
+    std::mutex                               lock_;
+    std::vector<std::shared_ptr<TermLine>>   lines_;
+    std::thread                             *thrd = nullptr;
+    int                                      epoll_fd = -1;
+    int                                      wake_fd = -1;
+    std::atomic<bool>                        kicked_{false};
+    std::atomic<bool>                        urgent_{false};
+    std::atomic<bool>                        stop_{false};
+};
+
+}
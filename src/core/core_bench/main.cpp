@@ -0,0 +1,352 @@
+/*
+ * Author:      Richard Cornwell (rich@sky-visions.com)
+ *
+ * Copyright (C) 2021 Richard Cornwell.
+ *
+ * This file may be distributed under the terms of the Q Public License
+ * as defined by Trolltech AS of Norway and appearing in the file
+ * LICENSE.QPL included in the packaging of this file.
+ *
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING
+ * THE WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL,
+ * INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING
+ * FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION
+ * WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+/*
+ * core_bench: measure the cost of the memory access path through the
+ * different Memory layerings and page sizes with a few access patterns.
+ */
+
+#include "config.h"
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <functional>
+#include "Memory.h"
+#include "RAM.h"
+#include "Options.h"
+#include "Core.h"
+#include "Bench.h"
+
+using namespace emulator;
+using namespace std;
+
+/**
+ * @brief One memory configuration under test. The top object is what the
+ *     CPU would hold as its memory pointer, the rest keeps the layers alive.
+ */
+struct MemConfig {
+    string                                name;
+    shared_ptr<Memory<uint8_t>>           top;
+    vector<shared_ptr<Memory<uint8_t>>>   parts;
+    size_t                                footprint;   // Bytes of tables.
+};
+
+/**
+ * @brief An access pattern, a list of addresses and whether each one is
+ *     a read or a write.
+ */
+struct Pattern {
+    string              name;
+    vector<uint16_t>    addr;
+    vector<uint8_t>     is_write;
+};
+
+static const size_t mem_size = 64 * 1024;
+
+/**
+ * @brief Build the memory configurations to test.
+ * @param pages List of MemArray chunk sizes.
+ */
+static vector<MemConfig> make_configs(const vector<size_t> &pages)
+{
+    vector<MemConfig>  configs;
+
+    // RAM accessed directly.
+    {
+        MemConfig  c;
+        auto ram = make_shared<RAM<uint8_t>>(mem_size, 0);
+        c.name = "RAM";
+        c.top = ram;
+        c.footprint = mem_size;
+        configs.push_back(c);
+    }
+
+    // MemFixed wrapping RAM, as used by the test harness.
+    {
+        MemConfig  c;
+        auto fixed = make_shared<MemFixed<uint8_t>>(mem_size, 0);
+        fixed->addMemory(make_shared<RAM<uint8_t>>(mem_size, 0));
+        c.name = "MemFixed/RAM";
+        c.top = fixed;
+        c.footprint = mem_size;
+        configs.push_back(c);
+    }
+
+    for (auto page : pages) {
+        // MemArray with one RAM covering the whole space.
+        {
+            MemConfig  c;
+            auto array = make_shared<MemArray<uint8_t>>(mem_size, page);
+            array->addMemory(make_shared<RAM<uint8_t>>(mem_size, 0));
+            c.name = "MemArray/RAM:" + to_string(page);
+            c.top = array;
+            c.footprint = mem_size + (mem_size / page) * sizeof(shared_ptr<Memory<uint8_t>>);
+            configs.push_back(c);
+        }
+
+        // MemArray with a separate RAM per page, page lookups go to
+        // different objects.
+        {
+            MemConfig  c;
+            auto array = make_shared<MemArray<uint8_t>>(mem_size, page);
+            for (size_t base = 0; base < mem_size; base += page)
+                array->addMemory(make_shared<RAM<uint8_t>>(page, base));
+            c.name = "MemArray/RAMxN:" + to_string(page);
+            c.top = array;
+            c.footprint = mem_size + (mem_size / page) *
+                          (sizeof(shared_ptr<Memory<uint8_t>>) + sizeof(RAM<uint8_t>));
+            configs.push_back(c);
+        }
+
+        // MemFixed over MemArray, full layering.
+        {
+            MemConfig  c;
+            auto fixed = make_shared<MemFixed<uint8_t>>(mem_size, 0);
+            auto array = make_shared<MemArray<uint8_t>>(mem_size, page);
+            array->addMemory(make_shared<RAM<uint8_t>>(mem_size, 0));
+            fixed->addMemory(array);
+            c.name = "MemFixed/MemArray/RAM:" + to_string(page);
+            c.top = fixed;
+            c.parts.push_back(array);
+            c.footprint = mem_size + (mem_size / page) * sizeof(shared_ptr<Memory<uint8_t>>);
+            configs.push_back(c);
+        }
+    }
+    return configs;
+}
+
+/**
+ * @brief Simple repeatable random number generator.
+ */
+static uint32_t xorshift(uint32_t &state)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+/**
+ * @brief Build access patterns of n accesses each.
+ */
+static vector<Pattern> make_patterns(size_t n)
+{
+    vector<Pattern>  pats(5);
+    uint32_t         seed = 0x12345678;
+
+    for (auto &p : pats) {
+        p.addr.resize(n);
+        p.is_write.assign(n, 0);
+    }
+
+    // Sequential reads through all of memory.
+    pats[0].name = "seq-read";
+    for (size_t i = 0; i < n; i++)
+        pats[0].addr[i] = (uint16_t)i;
+
+    // Sequential writes.
+    pats[1].name = "seq-write";
+    for (size_t i = 0; i < n; i++) {
+        pats[1].addr[i] = (uint16_t)i;
+        pats[1].is_write[i] = 1;
+    }
+
+    // Uniform random reads and writes.
+    pats[2].name = "random";
+    for (size_t i = 0; i < n; i++) {
+        pats[2].addr[i] = (uint16_t)xorshift(seed);
+        pats[2].is_write[i] = (xorshift(seed) & 3) == 0;
+    }
+
+    // Instruction fetch: 1 to 3 sequential bytes, with a jump to a
+    // nearby address every few instructions and a far one now and then.
+    pats[3].name = "fetch";
+    {
+        uint16_t  pc = 0x100;
+        size_t    i = 0;
+        while (i < n) {
+            int len = 1 + (xorshift(seed) % 3);
+            for (int j = 0; j < len && i < n; j++)
+                pats[3].addr[i++] = pc++;
+            uint32_t r = xorshift(seed);
+            if ((r & 7) == 0)
+                pc = (uint16_t)(pc + (int8_t)(r >> 8));
+            else if ((r & 0x3ff) == 1)
+                pc = (uint16_t)(r >> 16);
+        }
+    }
+
+    // Stack: push and pop pairs wandering in a small region.
+    pats[4].name = "stack";
+    {
+        uint16_t  sp = 0xf000;
+        size_t    i = 0;
+        while (i + 1 < n) {
+            if ((xorshift(seed) & 1) || sp >= 0xf000) {
+                sp -= 2;
+                pats[4].addr[i] = sp + 1;
+                pats[4].is_write[i++] = 1;
+                pats[4].addr[i] = sp;
+                pats[4].is_write[i++] = 1;
+            } else {
+                pats[4].addr[i++] = sp;
+                pats[4].addr[i++] = sp + 1;
+                sp += 2;
+            }
+            if (sp < 0xef00)
+                sp = 0xf000;
+        }
+        if (i < n)
+            pats[4].addr[i] = sp;
+    }
+    return pats;
+}
+
+/**
+ * @brief Run a pattern over memory, the same way the CPU would, through
+ *     a raw Memory pointer.
+ * @return Checksum of values read.
+ */
+static uint64_t run_pattern(Memory<uint8_t> *mem, const Pattern &pat)
+{
+    uint64_t  sum = 0;
+    uint8_t   val;
+    size_t    n = pat.addr.size();
+
+    for (size_t i = 0; i < n; i++) {
+        if (pat.is_write[i]) {
+            mem->write((uint8_t)i, pat.addr[i]);
+        } else {
+            mem->read(val, pat.addr[i]);
+            sum += val;
+        }
+    }
+    return sum;
+}
+
+int main(int argc, char **argv)
+{
+    option::OptionParser  op("Usage: core_bench [options] [config...]");
+    auto help_opt = op.add<option::OptionSwitch>("h", "help", "Show this help message");
+    auto list_opt = op.add<option::OptionSwitch>("L", "list", "List configurations and patterns");
+    auto warm_opt = op.add<option::OptionValue<int>>("w", "warmup", "Warmup runs", 1);
+    auto reps_opt = op.add<option::OptionValue<int>>("r", "reps", "Timed repetitions", 7);
+    auto size_opt = op.add<option::OptionValue<size_t>>("n", "accesses",
+                       "Accesses per run", 4*1024*1024);
+    auto page_opt = op.add<option::OptionValue<string>>("p", "pages",
+                       "MemArray page sizes", string("256,1024,4096,16384"));
+    auto pat_opt = op.add<option::OptionValue<string>>("t", "pattern",
+                       "Only run this pattern", string(""));
+    auto out_opt = op.add<option::OptionValue<string>>("o", "output",
+                       "Write JSON to file", string(""));
+
+    try {
+        op.parse(argc, argv);
+    } catch (std::exception &e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+    if (!op.unknown_options().empty()) {
+        cerr << "Unknown option: " << op.unknown_options()[0] << endl;
+        cerr << op.help() << endl;
+        return 1;
+    }
+    if (help_opt->is_set()) {
+        cout << op.help() << endl;
+        return 0;
+    }
+
+    vector<size_t>  pages;
+    stringstream    plist(page_opt->getValue());
+    string          item;
+    while (getline(plist, item, ',')) {
+        size_t page = strtoul(item.c_str(), nullptr, 0);
+        if (page == 0 || (page & (page - 1)) != 0 || page > mem_size) {
+            cerr << "Page size must be power of 2 up to " << mem_size << ": " << item << endl;
+            return 1;
+        }
+        pages.push_back(page);
+    }
+
+    vector<MemConfig> configs = make_configs(pages);
+    vector<Pattern>   patterns = make_patterns(size_opt->getValue());
+    if (list_opt->is_set()) {
+        for (auto &c : configs)
+            cout << c.name << endl;
+        for (auto &p : patterns)
+            cout << p.name << endl;
+        return 0;
+    }
+
+    core::PerfCounter          perf;
+    vector<core::BenchResult>  results;
+    const vector<string>      &only = op.non_option_args();
+    volatile uint64_t          sink = 0;
+    int                        warmup = warm_opt->getValue();
+    int                        reps = reps_opt->getValue();
+
+    if (!perf.valid())
+        cerr << "Hardware cache counters not available" << endl;
+    for (auto &c : configs) {
+        if (!findString(only, c.name))
+            continue;
+        for (auto &p : patterns) {
+            if (!pat_opt->getValue().empty() && pat_opt->getValue() != p.name)
+                continue;
+            core::BenchResult  res;
+            uint64_t           refs = 0;
+            uint64_t           misses = 0;
+            res.name = c.name + " " + p.name;
+            res.count = p.addr.size();
+            for (int i = 0; i < warmup + reps; i++) {
+                perf.start();
+                auto start = chrono::steady_clock::now();
+                sink += run_pattern(c.top.get(), p);
+                auto end = chrono::steady_clock::now();
+                perf.stop();
+                if (i < warmup)
+                    continue;
+                auto ns = chrono::duration_cast<chrono::nanoseconds>(end - start).count();
+                res.ns.add((double)ns / (double)res.count);
+                refs += perf.references();
+                misses += perf.misses();
+            }
+            res.extra["footprint_bytes"] = (double)c.footprint;
+            if (perf.valid() && reps > 0) {
+                res.extra["cache_refs_per_access"] = (double)refs / ((double)res.count * reps);
+                res.extra["cache_misses_per_access"] = (double)misses / ((double)res.count * reps);
+            }
+            cerr << res.name << ": " << res.ns.median() << " ns/access" << endl;
+            results.push_back(res);
+        }
+    }
+
+    if (out_opt->getValue().empty()) {
+        core::write_json(cout, "core_bench", results, "access");
+    } else {
+        ofstream out(out_opt->getValue());
+        if (!out.is_open()) {
+            cerr << "Unable to write " << out_opt->getValue() << endl;
+            return 1;
+        }
+        core::write_json(out, "core_bench", results, "access");
+    }
+    return 0;
+}
@@ -0,0 +1,65 @@
+/*
+ * Author:      Richard Cornwell (rich@sky-visions.com)
+ *
+ * Copyright (C) 2021 Richard Cornwell.
+ *
+ * This file may be distributed under the terms of the Q Public License
+ * as defined by Trolltech AS of Norway and appearing in the file
+ * LICENSE.QPL included in the packaging of this file.
+ *
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING
+ * THE WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL,
+ * INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING
+ * FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION
+ * WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+#include <iostream>
+#include <sstream>
+#include "Bench.h"
+#include "CppUTest/TestHarness.h"
+
+using namespace core;
+using namespace std;
+
+TEST_GROUP(Bench)
+{
+};
+
+TEST(Bench, Stats)
+{
+    BenchStats  stats;
+
+    CHECK_EQUAL(0.0, stats.median());
+    for (int i = 20; i > 0; i--)
+        stats.add((double)i);
+    CHECK_EQUAL(20u, stats.size());
+    CHECK_EQUAL(1.0, stats.min());
+    CHECK_EQUAL(20.0, stats.max());
+    CHECK_EQUAL(10.5, stats.mean());
+    CHECK_EQUAL(10.0, stats.median());
+    CHECK_EQUAL(19.0, stats.percentile(95.0));
+    CHECK_EQUAL(20.0, stats.percentile(100.0));
+    CHECK_EQUAL(1.0, stats.percentile(0.0));
+}
+
+TEST(Bench, Json)
+{
+    vector<BenchResult> results(1);
+    stringstream        out;
+
+    results[0].name = "test \"one\"";
+    results[0].count = 1000;
+    results[0].ns.add(10.0);
+    results[0].ns.add(20.0);
+    results[0].extra["cycles"] = 5.0;
+    write_json(out, "core", results);
+    string json = out.str();
+    CHECK(json.find("\"name\": \"test \\\"one\\\"\"") != string::npos);
+    CHECK(json.find("\"ns_per_insn\": { \"median\": 10.000, \"p95\": 20.000") != string::npos);
+    CHECK(json.find("\"mips\": { \"median\": 100.000, \"p95\": 50.000") != string::npos);
+    CHECK(json.find("\"cycles\": 5.000") != string::npos);
+}
@@ -108,7 +108,7 @@ public:
     virtual
     core::ConfigOptionParser options()
     {
-        core::ConfigOptionParser option("CPU options");
+        core::ConfigOptionParser option = CPU<uint32_t>::options();
         auto tim_opt = option.add<core::ConfigBool>("timer", "Optional timer", &timer);
         auto hom_opt = option.add<core::ConfigValue<int>>("home", "Home space offset", 0, &home);
         return option;
@@ -214,6 +214,18 @@ TEST(ConfigFile, CPUOptions2)
     CHECK_EQUAL(cpu->home, 055);
 }
 
+TEST(ConfigFile, CPUPlacement)
+{
+    core::ConfigFile conf;
+    string ist{"system test cpu s1:placed(affinity=\"0-1,3\",numa=1) "};
+    CHECK(conf(ist));
+    std::shared_ptr<emulator::CPU<uint32_t>> cpu =
+            std::get<shared_ptr<emulator::CPU<uint32_t>>>(conf.sys->cpus[0]);
+    CHECK_EQUAL(cpu->affinity, "0-1,3");
+    CHECK_EQUAL(cpu->numa_node, 1);
+    CHECK_EQUAL(core::System::cpuNode(conf.sys->cpus[0]), 1);
+}
+
 TEST(ConfigFile, CPUOptions3)
 {
     core::ConfigFile conf;
@@ -0,0 +1,121 @@
+/*
+ * Author:      Richard Cornwell (rich@sky-visions.com)
+ *
+ * Copyright (C) 2021 Richard Cornwell.
+ *
+ * This file may be distributed under the terms of the Q Public License
+ * as defined by Trolltech AS of Norway and appearing in the file
+ * LICENSE.QPL included in the packaging of this file.
+ *
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING
+ * THE WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL,
+ * INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING
+ * FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION
+ * WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+#include "config.h"
+#include <chrono>
+#include <string>
+#include <thread>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#endif
+#include "Console.h"
+#include "CppUTest/TestHarness.h"
+
+using namespace core;
+using namespace std;
+
+#ifdef HAVE_UNISTD_H
+// Read what the output thread has written so far, waiting up to ms for
+// the first of it.
+static string drain(int fd, int ms)
+{
+    string          text;
+    char            buf[4096];
+    struct pollfd   pfd{fd, POLLIN, 0};
+
+    while (poll(&pfd, 1, ms) > 0) {
+        ssize_t r = read(fd, buf, sizeof(buf));
+        if (r <= 0)
+            break;
+        text.append(buf, (size_t)r);
+        ms = 0;
+    }
+    return text;
+}
+
+TEST_GROUP(Console)
+{
+    int       fds[2];
+    Console  *con;
+
+    void setup()
+    {
+        CHECK_EQUAL(0, pipe(fds));
+        con = new Console();
+        con->start_output(fds[1]);
+    }
+
+    void teardown()
+    {
+        delete con;
+        close(fds[0]);
+        close(fds[1]);
+    }
+};
+
+TEST(Console, Batch)
+{
+    // Characters are held until the tick and written together.
+    auto start = chrono::steady_clock::now();
+    con->show_chars("abc", 3);
+    con->show_chars("def", 3);
+    string early = drain(fds[0], 0);
+    CHECK(early.empty() || chrono::steady_clock::now() - start >= Console::out_tick);
+    early += drain(fds[0], 1000);
+    STRCMP_EQUAL("abcdef", early.c_str());
+}
+
+TEST(Console, Flush)
+{
+    con->show_chars("xyz", 3);
+    con->flush();
+    STRCMP_EQUAL("xyz", drain(fds[0], 1000).c_str());
+}
+
+TEST(Console, Drain)
+{
+    // Output queued when stopping is written first.
+    string  text;
+    for (int i = 0; i < 1000; i++)
+        text += (char)('a' + i % 26);
+    con->show_chars(text.data(), text.size());
+    con->shutdown();
+    CHECK(text == drain(fds[0], 1000));
+}
+
+TEST(Console, Stuck)
+{
+    // A terminal that never takes output costs characters, not time,
+    // and does not hold up shutdown.
+    char    buf[4096] = {0};
+    while (write(fds[1], buf, sizeof(buf)) > 0);
+    string  text(3 * Console::out_size, 'x');
+    auto start = chrono::steady_clock::now();
+    con->show_chars(text.data(), text.size());
+    this_thread::sleep_for(Console::out_tick * 5);
+    con->show_chars(text.data(), text.size());
+    CHECK(chrono::steady_clock::now() - start < chrono::seconds(1));
+    CHECK(con->dropped() >= 4 * Console::out_size);
+    con->shutdown();
+    CHECK(chrono::steady_clock::now() - start < chrono::seconds(2));
+}
+#endif
@@ -0,0 +1,115 @@
+/*
+ * Author:      Richard Cornwell (rich@sky-visions.com)
+ *
+ * Copyright (C) 2021 Richard Cornwell.
+ *
+ * This file may be distributed under the terms of the Q Public License
+ * as defined by Trolltech AS of Norway and appearing in the file
+ * LICENSE.QPL included in the packaging of this file.
+ *
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING
+ * THE WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL,
+ * INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING
+ * FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION
+ * WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+
+#include "config.h"
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <stdio.h>
+#include "DiskImage.h"
+#include "CppUTest/TestHarness.h"
+
+using namespace core;
+using namespace std;
+
+TEST_GROUP(DiskImage)
+{
+    void setup()
+    {
+        ofstream  file("disk.img", ios::out|ios::binary);
+        for (int i = 0; i < 3 * 4096; i++)
+            file.put((char)(i * 5));
+    }
+
+    void teardown()
+    {
+        remove("disk.img");
+    }
+};
+
+TEST(DiskImage, ReadWrite)
+{
+    {
+        auto  image = DiskImage::open("disk.img", false);
+        CHECK_EQUAL(3u * 4096, image->size());
+        CHECK_FALSE(image->readOnly());
+        CHECK_EQUAL((uint8_t)(100 * 5), image->data()[100]);
+        memset(image->writable() + 4000, 0xaa, 200);
+        image->mark(4000, 200);
+        CHECK(image->dirty());
+        image->flush();
+        CHECK_FALSE(image->dirty());
+        image->writable()[9000] = 0x55;
+        image->mark(9000, 1);
+    }
+    // Everything written is in the file once the image is gone.
+    ifstream  file("disk.img", ios::in|ios::binary);
+    string    text((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+    CHECK_EQUAL((char)0xaa, text[4000]);
+    CHECK_EQUAL((char)0xaa, text[4199]);
+    CHECK_EQUAL((char)(4200 * 5), text[4200]);
+    CHECK_EQUAL((char)0x55, text[9000]);
+}
+
+TEST(DiskImage, Shared)
+{
+    auto  a = DiskImage::open("disk.img", true);
+    auto  b = DiskImage::open("disk.img", true);
+
+    // Read only mounts share one mapping and can't be written.
+    CHECK(a == b);
+    CHECK(a->writable() == nullptr);
+    a->mark(0, 10);
+    CHECK_FALSE(a->dirty());
+
+    // Nobody may write while it is mounted read only.
+    bool  thrown = false;
+    try {
+        DiskImage::open("disk.img", false);
+    } catch (SystemError &e) {
+        thrown = true;
+    }
+    CHECK(thrown);
+    a.reset();
+    b.reset();
+
+    // Nor mount it at all while it is being written.
+    auto  w = DiskImage::open("disk.img", false);
+    thrown = false;
+    try {
+        DiskImage::open("disk.img", true);
+    } catch (SystemError &e) {
+        thrown = true;
+    }
+    CHECK(thrown);
+}
+
+TEST(DiskImage, Errors)
+{
+    bool  thrown = false;
+    try {
+        DiskImage::open("no_such.img", true);
+    } catch (SystemError &e) {
+        thrown = true;
+    }
+    CHECK(thrown);
+}
@@ -39,6 +39,20 @@ class Event_test
         int val = *((int *)v);
         cerr << "Useless called " << val << endl;
     }
+
+    void count(void *v) {
+        calls++;
+        text += *((char *)v);
+    }
+
+    void burst(const char *data, size_t n) {
+        bursts++;
+        text.append(data, n);
+    }
+
+    int     calls = 0;
+    int     bursts = 0;
+    string  text;
 };
 
 TEST_GROUP(EventTest)
@@ -48,15 +62,73 @@ TEST_GROUP(EventTest)
 
 TEST(EventTest, Create) {
         Event_test* test = new Event_test();
-        EventCallback<Event_test>* callback = new
-            EventCallback<Event_test>(test, &Event_test::uselessFunction);
+        Delegate callback(test, &Event_test::uselessFunction);
         Event* ev = new Event();
         ev->addListener(callback);
         int v = 16;
         ev->notify((void *)&v);
 
-        delete callback;
         delete test;
         delete ev;
 }
 
+TEST(EventTest, Remove) {
+        Event_test  a;
+        Event_test  b;
+        Event       ev;
+        Delegate    da = Delegate::bind<Event_test, &Event_test::count>(&a);
+        Delegate    db(&b, &Event_test::count);
+        char        c = 'x';
+
+        ev.addListener(da);
+        ev.addListener(da);
+        ev.addListener(db);
+        CHECK_EQUAL(2u, ev.size());
+        ev.notify(&c);
+        ev.removeListener(da);
+        CHECK_EQUAL(1u, ev.size());
+        ev.notify(&c);
+        CHECK_EQUAL(1, a.calls);
+        CHECK_EQUAL(2, b.calls);
+        ev.removeListener(Delegate(&b, &Event_test::uselessFunction));
+        CHECK_EQUAL(1u, ev.size());
+        ev.removeListener(db);
+        CHECK_EQUAL(0u, ev.size());
+}
+
+TEST(EventTest, Burst) {
+        Event_test  a;
+        Event_test  b;
+        int         seen = 0;
+        Event       ev;
+
+        ev.addListener(Delegate::bind<Event_test, &Event_test::count,
+                                      &Event_test::burst>(&a));
+        ev.addListener(Delegate::bind<Event_test, &Event_test::count>(&b));
+        ev.addListener(Delegate::from([&seen](void *) { seen++; }));
+        ev.notify_n("hello", 5);
+        CHECK_EQUAL(1, a.bursts);
+        CHECK_EQUAL(0, a.calls);
+        STRCMP_EQUAL("hello", a.text.c_str());
+        CHECK_EQUAL(5, b.calls);
+        STRCMP_EQUAL("hello", b.text.c_str());
+        CHECK_EQUAL(5, seen);
+
+        ev.addListener(Delegate(&a, &Event_test::uselessFunction));
+        CHECK_THROWS(SystemError, ev.addListener(Delegate(&b, &Event_test::uselessFunction)));
+}
+
+
+TEST(EventTest, Capacity) {
+        Event_test            t[8];
+        BasicEvent<8>         ev;
+        char                  c = 'x';
+
+        for (auto &a : t)
+            ev.addListener(Delegate::bind<Event_test, &Event_test::count>(&a));
+        CHECK_EQUAL(8u, ev.size());
+        ev.notify(&c);
+        for (auto &a : t)
+            CHECK_EQUAL(1, a.calls);
+        CHECK_THROWS(SystemError, ev.addListener(Delegate(&t[0], &Event_test::uselessFunction)));
+}
@@ -0,0 +1,161 @@
+/*
+ * Author:      Richard Cornwell (rich@sky-visions.com)
+ *
+ * Copyright (C) 2021 Richard Cornwell.
+ *
+ * This file may be distributed under the terms of the Q Public License
+ * as defined by Trolltech AS of Norway and appearing in the file
+ * LICENSE.QPL included in the packaging of this file.
+ *
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING
+ * THE WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL,
+ * INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING
+ * FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION
+ * WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <stdio.h>
+#include "Expect.h"
+#include "CppUTest/TestHarness.h"
+
+using namespace core;
+using namespace std;
+
+TEST_GROUP(Expect)
+{
+    string  name = "expect_test.cap";
+
+    void teardown()
+    {
+        remove(name.c_str());
+    }
+
+    // Feed a string, return the index of the last match seen and where.
+    int feed(Matcher &m, const string &text, size_t &at)
+    {
+        int  last = -1;
+        for (size_t i = 0; i < text.size(); i++) {
+            int  r = m.feed((uint8_t)text[i]);
+            if (r >= 0) {
+                last = r;
+                at = i;
+            }
+        }
+        return last;
+    }
+};
+
+TEST(Expect, Matcher)
+{
+    Matcher   m;
+    size_t    at = 0;
+
+    CHECK_EQUAL(0, m.add("he"));
+    CHECK_EQUAL(1, m.add("she"));
+    CHECK_EQUAL(2, m.add("hers"));
+    m.build();
+    CHECK_EQUAL(3u, m.size());
+    CHECK_EQUAL(-1, feed(m, "xxsh", at));
+    // Match ending in the middle of a longer pattern.
+    CHECK_EQUAL(1, m.feed('e'));
+    CHECK_EQUAL(-1, m.feed('r'));
+    CHECK_EQUAL(2, m.feed('s'));
+    // Failure links carry partial matches across bytes.
+    m.reset();
+    CHECK_EQUAL(0, feed(m, "hhhhe", at));
+    CHECK_EQUAL(4u, at);
+    m.clear();
+    m.add("GB01>");
+    m.build();
+    CHECK_EQUAL(0, feed(m, "\r\nGB0GB01>", at));
+    CHECK_EQUAL(9u, at);
+}
+
+TEST(Expect, Script)
+{
+    Expect        ex;
+    istringstream in("# Log in\n"
+                     "timeout 100\n"
+                     "send \"user\\r\"\n"
+                     "expect \"Password:\" \"Login:\" timeout 50\n"
+                     "capture \"" + name + "\"\n"
+                     "send \"pw\" \"\\x0d\" # comment\n"
+                     "expect \"$ \"\n");
+    char          ch;
+    string        typed;
+
+    ex.parse(in);
+    ex.start(0);
+    while (ex.input(ch))
+        typed += ch;
+    CHECK_EQUAL(string("user\r"), typed);
+    // Nothing more is typed until the prompt shows up.
+    for (char c : string("Login"))
+        ex.output(c, 10);
+    CHECK_FALSE(ex.input(ch));
+    CHECK_FALSE(ex.expired(49));
+    ex.output(':', 20);
+    typed.clear();
+    while (ex.input(ch))
+        typed += ch;
+    CHECK_EQUAL(string("pw\r"), typed);
+    CHECK_FALSE(ex.done());
+    for (char c : string("ok\r\n$ "))
+        ex.output(c, 30);
+    CHECK(ex.done());
+    ex.close();
+
+    ifstream      cap(name, ios::binary);
+    stringstream  text;
+    text << cap.rdbuf();
+    CHECK_EQUAL(string("ok\r\n$ "), text.str());
+}
+
+TEST(Expect, Timeout)
+{
+    Expect        ex;
+    istringstream in("expect \"never\" timeout 1000\n");
+
+    ex.parse(in);
+    ex.start(500);
+    CHECK_FALSE(ex.expired(1499));
+    CHECK(ex.expired(1500));
+    CHECK(ex.failed());
+    CHECK_FALSE(ex.done());
+    CHECK(ex.error().find("line 1") != string::npos);
+}
+
+TEST(Expect, Errors)
+{
+    const char *bad[] = {
+        "bogus \"x\"\n",
+        "send\n",
+        "send \"unterminated\n",
+        "expect \"\"\n",
+        "send \"x\" timeout 5\n",
+        "timeout\n",
+        "timeout 0\n",
+        "expect \"x\" timeout 0\n",
+        "send \"\\q\"\n",
+    };
+
+    for (auto text : bad) {
+        Expect        ex;
+        istringstream in(text);
+        bool          thrown = false;
+        try {
+            ex.parse(in);
+        } catch (Script_error &e) {
+            thrown = true;
+        }
+        CHECK(thrown);
+    }
+}
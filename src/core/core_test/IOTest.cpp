@@ -0,0 +1,99 @@
+/*
+ * Author:      Richard Cornwell (rich@sky-visions.com)
+ *
+ * Copyright (C) 2021 Richard Cornwell.
+ *
+ * This file may be distributed under the terms of the Q Public License
+ * as defined by Trolltech AS of Norway and appearing in the file
+ * LICENSE.QPL included in the packaging of this file.
+ *
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING
+ * THE WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL,
+ * INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING
+ * FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION
+ * WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+#include <iostream>
+#include <memory>
+#include "CPU.h"
+#include "IO.h"
+#include "Device.h"
+#include "CppUTest/TestHarness.h"
+
+using namespace emulator;
+using namespace std;
+
+class TestDev : public Device<uint8_t>
+{
+public:
+    TestDev(size_t addr, size_t size) : size_(size)
+    {
+        setAddress(addr);
+    }
+
+    virtual size_t getSize() const override
+    {
+        return size_;
+    }
+
+    virtual bool input(uint8_t &val, size_t port) override
+    {
+        val = (uint8_t)port;
+        return true;
+    }
+
+    virtual bool output(uint8_t val, [[maybe_unused]]size_t port) override
+    {
+        last = val;
+        return true;
+    }
+
+    uint8_t last = 0;
+
+private:
+    size_t  size_;
+};
+
+TEST_GROUP(IOTest)
+{
+};
+
+TEST(IOTest, Ports)
+{
+    IO_map<uint8_t> io(16);
+    auto dev = make_shared<TestDev>(14, 2);
+    io.addDevice(dev);
+    uint8_t val = 0xff;
+    CHECK(io.input(val, 15));
+    CHECK_EQUAL(15, val);
+    CHECK(io.output(0x55, 14));
+    CHECK_EQUAL(0x55, dev->last);
+    CHECK_FALSE(io.input(val, 13));
+    CHECK_EQUAL(0, val);
+}
+
+TEST(IOTest, LastPort)
+{
+    // Port equal to the number of ports is out of range.
+    IO_map<uint8_t> io(16);
+    uint8_t val = 0xff;
+    CHECK_FALSE(io.input(val, 16));
+    CHECK_EQUAL(0, val);
+    CHECK_FALSE(io.output(val, 16));
+    CHECK_FALSE(io.status(val, 16));
+    CHECK_FALSE(io.command(val, 16));
+    // Devices starting at or running past the end are not added.
+    auto dev = make_shared<TestDev>(16, 1);
+    io.addDevice(dev);
+    CHECK(dev->getIO() == nullptr);
+    auto dev2 = make_shared<TestDev>(15, 2);
+    io.addDevice(dev2);
+    CHECK(dev2->getIO() == nullptr);
+    CHECK_FALSE(io.input(val, 15));
+    io.step();
+}
@@ -0,0 +1,115 @@
+/*
+ * Author:      Richard Cornwell (rich@sky-visions.com)
+ *
+ * Copyright (C) 2021 Richard Cornwell.
+ *
+ * This file may be distributed under the terms of the Q Public License
+ * as defined by Trolltech AS of Norway and appearing in the file
+ * LICENSE.QPL included in the packaging of this file.
+ *
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING
+ * THE WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL,
+ * INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING
+ * FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION
+ * WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+#include <iostream>
+#include <fstream>
+#include <stdio.h>
+#include "InputLog.h"
+#include "CppUTest/TestHarness.h"
+
+using namespace core;
+using namespace std;
+
+TEST_GROUP(InputLog)
+{
+    string  name = "input_log_test.log";
+
+    void teardown()
+    {
+        remove(name.c_str());
+    }
+};
+
+TEST(InputLog, RoundTrip)
+{
+    {
+        InputLog  log;
+        log.open(name);
+        log.record(5, 0, 'a');
+        log.record(5, 0, 'b');
+        log.record(300, 1, 0xff);
+        log.record(10000000000ull, 0, 03);
+        log.close(10000000001ull);
+    }
+    InputReplay  rep;
+    rep.open(name);
+    CHECK_FALSE(rep.due(4));
+    CHECK(rep.due(5));
+    InputEvent ev = rep.pop();
+    CHECK_EQUAL(5u, ev.count);
+    CHECK_EQUAL('a', ev.value);
+    ev = rep.pop();
+    CHECK_EQUAL(5u, ev.count);
+    CHECK_EQUAL('b', ev.value);
+    CHECK_FALSE(rep.due(299));
+    ev = rep.pop();
+    CHECK_EQUAL(300u, ev.count);
+    CHECK_EQUAL(1, ev.channel);
+    CHECK_EQUAL(0xff, ev.value);
+    ev = rep.pop();
+    CHECK_EQUAL(10000000000ull, ev.count);
+    CHECK_EQUAL(03, ev.value);
+    CHECK(rep.done());
+    CHECK_FALSE(rep.due(20000000000ull));
+    CHECK_EQUAL(10000000001ull, rep.end());
+}
+
+TEST(InputLog, Size)
+{
+    // Events a few thousand instructions apart take four bytes.
+    {
+        InputLog  log;
+        log.open(name);
+        for (int i = 1; i <= 100; i++)
+            log.record(i * 5000, 0, 'x');
+        log.close(500001);
+    }
+    ifstream  file(name, ios::in|ios::binary|ios::ate);
+    CHECK_EQUAL(5 + 100 * 4 + 2, (int)file.tellg());
+}
+
+TEST(InputLog, NoEnd)
+{
+    {
+        static const char data[] = { 'T', 'S', 'I', 'L', 1, 5, 0, 'a' };
+        ofstream  file(name, ios::out|ios::binary);
+        file.write(data, sizeof(data));
+    }
+    InputReplay  rep;
+    rep.open(name);
+    CHECK(rep.due(5));
+    rep.pop();
+    CHECK(rep.done());
+    CHECK_EQUAL(~0ull, rep.end());
+}
+
+TEST(InputLog, Errors)
+{
+    InputReplay  rep;
+    CHECK_THROWS(Log_error, rep.open("no_such_dir/no_such_file"));
+    {
+        ofstream  file(name, ios::out|ios::binary);
+        file << "NOTLOG";
+    }
+    InputReplay  rep2;
+    CHECK_THROWS(Log_error, rep2.open(name));
+    InputLog  log;
+    CHECK_THROWS(Log_error, log.open("no_such_dir/no_such_file"));
+}
@@ -254,3 +254,187 @@ TEST(MemoryTest, ROM)
     }
     CHECK_EQUAL(fail_count, 0);
 }
+
+TEST(MemoryTest, ArrayEdges)
+{
+    // Array whose size is not a multiple of the chunk size, with a region
+    // that runs past the end.
+    shared_ptr<Memory<uint8_t>> memctl = make_shared<MemArray<uint8_t>>(5000, 1024);
+    shared_ptr<Memory<uint8_t>> mem = make_shared<RAM<uint8_t>>(8 * 1024, 0);
+    memctl->addMemory(mem);
+    uint8_t val = 0xff;
+    CHECK(memctl->read(val, 0));
+    CHECK_EQUAL(0, val);
+    CHECK(memctl->write(0x12, 4999));
+    CHECK(memctl->read(val, 4999));
+    CHECK_EQUAL(0x12, val);
+    CHECK_FALSE(memctl->write(0x34, 5000));
+    CHECK_FALSE(memctl->read(val, 5000));
+    CHECK_THROWS(emulator::Access_error, memctl->Get(val, 5000));
+    // Region starting beyond the end is ignored.
+    memctl->addMemory(make_shared<RAM<uint8_t>>(1024, 8 * 1024));
+    CHECK(memctl->read(val, 4999));
+    CHECK_EQUAL(0x12, val);
+}
+
+TEST(MemoryTest, Dirty)
+{
+    // Pages written after an epoch are reported to each user holding it,
+    // looking does not clear them.
+    auto ram = make_shared<RAM<uint8_t>>(70 * 1024 + 10, 0);
+    vector<uint64_t> bits;
+    uint64_t since = core::dirty_epoch();
+    ram->dirty_since(bits, 1);
+    CHECK_EQUAL(2u, bits.size());
+    CHECK_EQUAL(0u, bits[0] | bits[1]);
+    CHECK(ram->write(1, 5));
+    CHECK(ram->write(2, 1023));
+    CHECK(ram->write(3, 3 * 1024));
+    ram->Set(4, 70 * 1024 + 9);
+    uint8_t val;
+    CHECK(ram->read(val, 2048));
+    uint64_t next = core::dirty_epoch();
+    ram->dirty_since(bits, since);
+    CHECK_EQUAL(0x9u, bits[0]);
+    CHECK_EQUAL(0x40u, bits[1]);
+    ram->dirty_since(bits, next);
+    CHECK_EQUAL(0u, bits[0] | bits[1]);
+    ram->dirty_since(bits, since);
+    CHECK_EQUAL(0x9u, bits[0]);
+    ram->mark_dirty();
+    ram->dirty_since(bits, next);
+    CHECK_EQUAL(~0ull, bits[0]);
+    CHECK_EQUAL(0x7fu, bits[1]);
+
+    // Only the written pages are saved and they apply to another copy.
+    since = core::dirty_epoch();
+    CHECK(ram->write(7, 65 * 1024 + 1));
+    CHECK(ram->write(8, 70 * 1024 + 9));
+    stringstream state;
+    core::StateOut out(state);
+    ram->save_dirty(out, since);
+    CHECK(state.str().size() < 2 * 1024 + 64);
+    auto copy = make_shared<RAM<uint8_t>>(70 * 1024 + 10, 0);
+    core::StateIn in(state);
+    copy->load_dirty(in);
+    copy->read(val, 65 * 1024 + 1);
+    CHECK_EQUAL(7, val);
+    copy->read(val, 70 * 1024 + 9);
+    CHECK_EQUAL(8, val);
+    copy->read(val, 5);
+    CHECK_EQUAL(0, val);
+}
+
+TEST(MemoryTest, ArrayDirty)
+{
+    // The array reports chunks, built from the pages of each module.
+    auto memctl = make_shared<MemArray<uint8_t>>(16 * 1024, 4096);
+    auto low = make_shared<RAM<uint8_t>>(8 * 1024, 0);
+    memctl->addMemory(low);
+    memctl->addMemory(make_shared<ROM<uint8_t>>(4 * 1024, 8 * 1024));
+    memctl->addMemory(make_shared<RAM<uint8_t>>(4 * 1024, 12 * 1024));
+    CHECK_EQUAL(12u, memctl->pageShift());
+    vector<uint64_t> bits;
+    uint64_t since = core::dirty_epoch();
+    memctl->dirty_since(bits, since);
+    CHECK_EQUAL(0u, bits[0]);
+    CHECK(memctl->write(1, 5 * 1024));
+    CHECK(memctl->write(1, 15 * 1024));
+    memctl->dirty_since(bits, since);
+    CHECK_EQUAL(0xau, bits[0]);
+    // The modules report their own pages.
+    low->dirty_since(bits, since);
+    CHECK_EQUAL(0x20u, bits[0]);
+}
+
+TEST(MemoryTest, Block)
+{
+    // Blocks cross host pages and modules; the ROM drops its part.
+    auto memctl = make_shared<MemArray<uint8_t>>(16 * 1024, 4096);
+    auto low = make_shared<RAM<uint8_t>>(8 * 1024, 0);
+    memctl->addMemory(low);
+    memctl->addMemory(make_shared<ROM<uint8_t>>(4 * 1024, 8 * 1024));
+    memctl->addMemory(make_shared<RAM<uint8_t>>(4 * 1024, 12 * 1024));
+    vector<uint8_t>  buf(6000);
+    vector<uint8_t>  back(6000);
+    for (size_t i = 0; i < buf.size(); i++)
+        buf[i] = (uint8_t)(i * 3);
+    vector<uint64_t> bits;
+    uint64_t since = core::dirty_epoch();
+    CHECK_EQUAL(6000u, memctl->write_block(buf.data(), 1000, 6000));
+    memctl->dirty_since(bits, since);
+    CHECK_EQUAL(0x3u, bits[0]);
+    uint8_t val;
+    memctl->read(val, 1000 + 4500);
+    CHECK_EQUAL((uint8_t)(4500 * 3), val);
+    CHECK_EQUAL(6000u, memctl->read_block(back.data(), 1000, 6000));
+    CHECK(buf == back);
+    CHECK_EQUAL(6000u, memctl->write_block(buf.data(), 7 * 1024, 6000));
+    memctl->read(val, 8 * 1024 + 10);
+    CHECK_EQUAL(0u, val);
+    CHECK_EQUAL(1024u, memctl->write_block(buf.data(), 15 * 1024, 6000));
+    CHECK_EQUAL(1024u, low->read_block(back.data(), 7 * 1024, 6000));
+    CHECK_EQUAL(buf[0], back[0]);
+}
+
+TEST(MemoryTest, SharePages)
+{
+    // Identical pages of two RAMs end up in one frame once they have
+    // stopped changing, and split again on write.
+    core::PageStore store;
+    auto a = make_shared<RAM<uint8_t>>(3 * 4096 + 100, 0);
+    auto b = make_shared<RAM<uint8_t>>(3 * 4096 + 100, 0);
+    for (size_t i = 0; i < 3 * 4096 + 100; i++) {
+        a->write((uint8_t)(i * 7 + i / 4096), i);
+        b->write((uint8_t)(i * 7 + i / 4096), i);
+    }
+    a->write(0xff, 4096 + 5);
+    CHECK_EQUAL(0u, a->merge_pages(store));
+    CHECK_EQUAL(3u, a->merge_pages(store));
+    CHECK_EQUAL(0u, b->merge_pages(store));
+    CHECK_EQUAL(3u, b->merge_pages(store));
+    CHECK_EQUAL(4u, store.frames());
+    CHECK_EQUAL(2u * 4096, store.saved_bytes());
+    CHECK_EQUAL(3u * 4096, b->shared_bytes());
+    CHECK_EQUAL(2u * 4096, b->saved_bytes());
+    CHECK_EQUAL(0u, a->saved_bytes());
+    uint8_t val;
+    b->read(val, 4096 + 5);
+    CHECK_EQUAL((uint8_t)((4096 + 5) * 7 + 1), val);
+    a->read(val, 4096 + 5);
+    CHECK_EQUAL(0xff, val);
+
+    // Writing splits only the page written.
+    b->write(0x55, 2 * 4096);
+    b->read(val, 2 * 4096);
+    CHECK_EQUAL(0x55, val);
+    a->read(val, 2 * 4096);
+    CHECK_EQUAL((uint8_t)(2 * 4096 * 7 + 2), val);
+    b->read(val, 2 * 4096 + 1);
+    CHECK_EQUAL((uint8_t)((2 * 4096 + 1) * 7 + 2), val);
+    CHECK_EQUAL(4096u, b->saved_bytes());
+    CHECK_EQUAL(4096u, store.saved_bytes());
+
+    // Saved state reads through the shared frames.
+    stringstream state;
+    core::StateOut out(state);
+    a->save(out);
+    auto c = make_shared<RAM<uint8_t>>(3 * 4096 + 100, 0);
+    core::StateIn in(state);
+    c->load(in);
+    for (size_t i = 0; i < 3 * 4096 + 100; i += 99) {
+        uint8_t v1, v2;
+        a->read(v1, i);
+        c->read(v2, i);
+        CHECK_EQUAL(v1, v2);
+    }
+    a.reset();
+    b.reset();
+    CHECK_EQUAL(0u, store.frames());
+
+    uint8_t page[4096] = {};
+    uint64_t h = core::PageStore::hash(page, sizeof(page));
+    CHECK(h != 0);
+    page[4095] = 1;
+    CHECK(h != core::PageStore::hash(page, sizeof(page)));
+}
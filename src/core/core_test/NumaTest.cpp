@@ -0,0 +1,147 @@
+/*
+ * Author:      Richard Cornwell (rich@sky-visions.com)
+ *
+ * Copyright (C) 2021 Richard Cornwell.
+ *
+ * This file may be distributed under the terms of the Q Public License
+ * as defined by Trolltech AS of Norway and appearing in the file
+ * LICENSE.QPL included in the packaging of this file.
+ *
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING
+ * THE WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL,
+ * INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING
+ * FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION
+ * WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+
+#include <iostream>
+#include <memory>
+#include <thread>
+#include "CPU.h"
+#include "RAM.h"
+#include "System.h"
+#include "SessionHost.h"
+#include "Numa.h"
+#include "CppUTest/TestHarness.h"
+
+using namespace emulator;
+using namespace core;
+using namespace std;
+
+// CPU that never halts, placed on a node.
+class NodeCpu : public CPU<uint8_t>
+{
+public:
+    NodeCpu(int node)
+    {
+        numa_node = node;
+        running = true;
+    }
+
+    virtual uint64_t step() override
+    {
+        return 100;
+    }
+};
+
+class NodeSystem : public System
+{
+public:
+    NodeSystem(int node)
+    {
+        addCpu(make_shared<NodeCpu>(node));
+        ram = make_shared<RAM<uint8_t>>(64 * 1024, 0);
+        addMemory(MemInfo{ram, {}});
+    }
+
+    virtual CPU_v create_cpu(const string &model) override
+    {
+        throw SystemError{"No cpu " + model};
+    }
+
+    virtual MEM_v create_mem(const string &model,
+                             [[maybe_unused]]const size_t size,
+                             [[maybe_unused]]const size_t base) override
+    {
+        throw SystemError{"No memory " + model};
+    }
+
+    virtual IO_v create_io(const string &model) override
+    {
+        throw SystemError{"No io " + model};
+    }
+
+    virtual DEV_v create_dev(const string &model) override
+    {
+        throw SystemError{"No device " + model};
+    }
+
+    shared_ptr<RAM<uint8_t>>  ram;
+};
+
+TEST_GROUP(Numa)
+{
+};
+
+TEST(Numa, ParseList)
+{
+    vector<int> cores = Numa::parse_list("0-3,8,10-11");
+    CHECK_EQUAL(7u, cores.size());
+    CHECK_EQUAL(3, cores[3]);
+    CHECK_EQUAL(8, cores[4]);
+    CHECK_EQUAL(11, cores[6]);
+    CHECK(Numa::parse_list("").empty());
+    CHECK_THROWS(SystemError, Numa::parse_list("3-1"));
+    CHECK_THROWS(SystemError, Numa::parse_list("a"));
+    CHECK_THROWS(SystemError, Numa::parse_list("1-"));
+    CHECK_THROWS(SystemError, Numa::parse_list("1x"));
+}
+
+TEST(Numa, Topology)
+{
+    CHECK(Numa::nodes() >= 1);
+    CHECK_EQUAL(0, Numa::core_node(0));
+    // Pinning to every core of node 0 always leaves somewhere to run.
+    thread t([]() {
+        Numa::pin_thread(Numa::node_cores(0));
+    });
+    t.join();
+}
+
+TEST(Numa, BindMemory)
+{
+    NodeSystem  sys(0);
+    sys.ram->data_[0] = 1;
+    sys.setNode(0);
+    // Only check where it went if the host lets us ask.
+    int node = Numa::memory_node(sys.ram->data_ + 32 * 1024);
+    if (node >= 0)
+        CHECK_EQUAL(0, node);
+}
+
+TEST(Numa, Rebalance)
+{
+    // Two placement groups, all sessions start on the first.
+    SessionHost  host(2, 10000, 2);
+    vector<shared_ptr<Session>> list;
+    for (int i = 0; i < 4; i++)
+        list.push_back(host.add(make_shared<NodeSystem>(0)));
+    CHECK_EQUAL(0, list[0]->node());
+    host.start();
+    this_thread::sleep_for(chrono::milliseconds(50));
+    size_t moved = host.rebalance();
+    host.stop();
+    CHECK(moved >= 1);
+    int on1 = 0;
+    for (auto &s : list) {
+        if (s->node() == 1)
+            on1++;
+    }
+    CHECK_EQUAL((int)moved, on1);
+    CHECK(on1 <= 2);
+}
@@ -0,0 +1,380 @@
+/*
+ * Author:      Richard Cornwell (rich@sky-visions.com)
+ *
+ * Copyright (C) 2021 Richard Cornwell.
+ *
+ * This file may be distributed under the terms of the Q Public License
+ * as defined by Trolltech AS of Norway and appearing in the file
+ * LICENSE.QPL included in the packaging of this file.
+ *
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING
+ * THE WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL,
+ * INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING
+ * FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION
+ * WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+
+#include <iostream>
+#include <memory>
+#include <atomic>
+#include <sstream>
+#include <thread>
+#include <fstream>
+#include "CPU.h"
+#include "RAM.h"
+#include "Device.h"
+#include "System.h"
+#include "SessionHost.h"
+#include "CppUTest/TestHarness.h"
+
+using namespace emulator;
+using namespace core;
+using namespace std;
+
+// CPU that takes 100ns per step and halts after limit steps. Each step
+// writes the low byte of the count to memory.
+class HostCpu : public CPU<uint8_t>
+{
+public:
+    virtual uint64_t step() override
+    {
+        mem->write((uint8_t)count, count & 0xfff);
+        if (++count >= limit)
+            running = false;
+        return 100;
+    }
+
+    uint64_t  count = 0;
+    uint64_t  limit = ~0ull;
+};
+
+class HostDev : public Device<uint8_t>
+{
+public:
+    virtual bool waiting() const override
+    {
+        return wait.load();
+    }
+
+    atomic<bool>  wait{false};
+};
+
+class HostSystem : public System
+{
+public:
+    HostSystem(uint64_t limit)
+    {
+        cpu = make_shared<HostCpu>();
+        cpu->limit = limit;
+        cpu->running = true;
+        dev = make_shared<HostDev>();
+        ram = make_shared<RAM<uint8_t>>(4096, 0);
+        cpu->addMemory(ram);
+        addCpu(cpu);
+        addMemory(MemInfo{ram, {}});
+        addDevice(DevInfo{dev, {}});
+    }
+
+    virtual CPU_v create_cpu(const string &model) override
+    {
+        throw SystemError{"No cpu " + model};
+    }
+
+    virtual MEM_v create_mem(const string &model,
+                             [[maybe_unused]]const size_t size,
+                             [[maybe_unused]]const size_t base) override
+    {
+        throw SystemError{"No memory " + model};
+    }
+
+    virtual IO_v create_io(const string &model) override
+    {
+        throw SystemError{"No io " + model};
+    }
+
+    virtual DEV_v create_dev(const string &model) override
+    {
+        throw SystemError{"No device " + model};
+    }
+
+    shared_ptr<HostCpu>        cpu;
+    shared_ptr<HostDev>        dev;
+    shared_ptr<RAM<uint8_t>>   ram;
+};
+
+TEST_GROUP(SessionHost)
+{
+};
+
+TEST(SessionHost, ManySessions)
+{
+    SessionHost  host(4, 10000);
+    vector<shared_ptr<HostSystem>> systems;
+    for (int i = 0; i < 200; i++) {
+        systems.push_back(make_shared<HostSystem>(5000 + i));
+        host.add(systems.back());
+    }
+    host.start();
+    host.wait_idle();
+    CHECK_EQUAL(4u, host.threads());
+    for (int i = 0; i < 200; i++)
+        CHECK_EQUAL(5000u + i, systems[i]->cpu->count);
+    for (auto &s : host.sessions()) {
+        CHECK(s->state() == Session::State::parked);
+        CHECK(s->quanta() >= 50);
+        CHECK_EQUAL(s->time(), 100 * static_pointer_cast<HostSystem>(s->system)->cpu->count);
+    }
+}
+
+TEST(SessionHost, WakeHalted)
+{
+    SessionHost  host(2, 10000);
+    auto sys = make_shared<HostSystem>(100);
+    auto session = host.add(sys);
+    host.start();
+    host.wait_idle();
+    CHECK_EQUAL(100u, sys->cpu->count);
+    // Still halted, wake only runs one quantum.
+    session->wake();
+    host.wait_idle();
+    CHECK_EQUAL(100u, sys->cpu->count);
+    sys->cpu->limit = 300;
+    sys->cpu->running = true;
+    session->wake();
+    host.wait_idle();
+    CHECK_EQUAL(300u, sys->cpu->count);
+}
+
+TEST(SessionHost, WaitInput)
+{
+    SessionHost  host(2, 10000);
+    auto sys = make_shared<HostSystem>(1000);
+    sys->dev->wait.store(true);
+    auto session = host.add(sys);
+    host.start();
+    host.wait_idle();
+    // Parked after its first quantum.
+    CHECK_EQUAL(100u, sys->cpu->count);
+    CHECK(session->state() == Session::State::parked);
+    sys->dev->wait.store(false);
+    sys->dev->wake();
+    host.wait_idle();
+    CHECK_EQUAL(1000u, sys->cpu->count);
+}
+
+TEST(SessionHost, Timer)
+{
+    SessionHost  host(1, 10000);
+    auto sys = make_shared<HostSystem>(100);
+    auto session = host.add(sys);
+    host.start();
+    host.wait_idle();
+    sys->cpu->limit = 200;
+    sys->cpu->running = true;
+    host.wake_after(session, chrono::milliseconds(2));
+    host.wait_idle();
+    CHECK_EQUAL(200u, sys->cpu->count);
+}
+
+TEST(SessionHost, Stop)
+{
+    SessionHost  host(2, 10000);
+    auto sys = make_shared<HostSystem>(~0ull);
+    auto session = host.add(sys);
+    host.start();
+    session->stop();
+    host.wait_idle();
+    CHECK(session->state() == Session::State::finished);
+    uint64_t count = sys->cpu->count;
+    session->wake();
+    host.wait_idle();
+    CHECK_EQUAL(count, sys->cpu->count);
+}
+
+TEST(SessionHost, Weights)
+{
+    SessionHost  host(1, 10000);
+    auto sys1 = make_shared<HostSystem>(~0ull);
+    auto sys3 = make_shared<HostSystem>(~0ull);
+    auto s1 = host.add(sys1, "one");
+    auto s3 = host.add(sys3, "three");
+    SessionLimits  lim;
+    lim.weight = 3;
+    s3->setLimits(lim);
+    host.start();
+    this_thread::sleep_for(chrono::milliseconds(20));
+    host.stop();
+    // One worker runs them in turn, 1 quantum against 3.
+    CHECK(s1->quanta() > 0);
+    uint64_t t1 = s1->time();
+    uint64_t t3 = s3->time();
+    CHECK(t3 >= 3 * t1 - 30000);
+    CHECK(t3 <= 3 * t1 + 30000);
+}
+
+TEST(SessionHost, MipsCap)
+{
+    SessionHost  host(2, 10000);
+    auto sys = make_shared<HostSystem>(~0ull);
+    auto fast = make_shared<HostSystem>(~0ull);
+    auto session = host.add(sys, "capped");
+    host.add(fast, "free");
+    SessionLimits  lim;
+    lim.mips = 1;
+    auto start = chrono::steady_clock::now();
+    session->setLimits(lim);
+    host.start();
+    this_thread::sleep_for(chrono::milliseconds(200));
+    host.stop();
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    SessionStats  st = session->stats();
+    // Elapsed time at 1 MIPS plus the initial 10ms of credit and one
+    // quantum.
+    CHECK(st.steps <= elapsed.count() * 1e6 + 10000 + 100);
+    CHECK(st.steps >= 50000);
+    CHECK(st.throttled > 0);
+    CHECK(fast->cpu->count > st.steps);
+    CHECK_EQUAL(st.time, 100 * st.steps);
+}
+
+TEST(SessionHost, Burst)
+{
+    SessionHost  host(1, 10000);
+    auto sys = make_shared<HostSystem>(~0ull);
+    auto session = host.add(sys, "burst");
+    SessionLimits  lim;
+    lim.mips = 1;
+    lim.burst = 0.1;
+    auto start = chrono::steady_clock::now();
+    session->setLimits(lim);
+    host.start();
+    this_thread::sleep_for(chrono::milliseconds(20));
+    host.stop();
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    // The banked 100000 instructions go first, then the cap applies.
+    uint64_t steps = session->stats().steps;
+    CHECK(steps >= 100000);
+    CHECK(steps <= elapsed.count() * 1e6 + 100000 + 100);
+    ostringstream  out;
+    host.report(out);
+    CHECK(out.str().find("burst") == 0);
+    CHECK(out.str().find("throttled") != string::npos);
+}
+
+TEST(SessionHost, Suspend)
+{
+    SessionHost  host(2, 10000);
+    auto sys = make_shared<HostSystem>(1000);
+    auto busy = make_shared<HostSystem>(~0ull);
+    sys->dev->wait.store(true);
+    auto session = host.add(sys, "idle");
+    auto other = host.add(busy, "busy");
+    host.start();
+    while (session->state() != Session::State::parked)
+        this_thread::yield();
+    CHECK_EQUAL(100u, sys->cpu->count);
+    CHECK_EQUAL(50, sys->ram->data_[50]);
+
+    // Not idle for long enough yet.
+    CHECK_EQUAL(0u, host.suspend_idle(".", chrono::hours(1)));
+    CHECK_EQUAL(1u, host.suspend_idle(".", chrono::seconds(0)));
+    CHECK(session->suspended());
+    CHECK(sys->ram->data_ == nullptr);
+    CHECK_FALSE(other->suspended());
+    CHECK(ifstream("./session-0.state").is_open());
+
+    // Input brings it back where it left off.
+    sys->dev->wait.store(false);
+    sys->dev->wake();
+    while (session->state() != Session::State::parked)
+        this_thread::yield();
+    CHECK_EQUAL(1000u, sys->cpu->count);
+    CHECK_FALSE(session->suspended());
+    CHECK_EQUAL(50, sys->ram->data_[50]);
+    CHECK_EQUAL((uint8_t)999, sys->ram->data_[999]);
+    SessionStats  st = session->stats();
+    CHECK_EQUAL(1u, st.suspends);
+    CHECK(st.resume_ns < 50000000);
+    CHECK_FALSE(ifstream("./session-0.state").is_open());
+    other->stop();
+    host.wait_idle();
+}
+
+TEST(SessionHost, SuspendCapped)
+{
+    // A session parked by its cap is busy, not idle, so stays in memory.
+    SessionHost  host(1, 10000);
+    auto sys = make_shared<HostSystem>(~0ull);
+    auto session = host.add(sys, "capped");
+    SessionLimits  lim;
+    lim.mips = 1;
+    session->setLimits(lim);
+    host.start();
+    int  parked = 0;
+    while (parked < 5) {
+        if (session->state() != Session::State::parked) {
+            this_thread::yield();
+            continue;
+        }
+        parked++;
+        CHECK_EQUAL(0u, host.suspend_idle(".", chrono::seconds(0)));
+        CHECK_FALSE(session->suspended());
+        while (session->state() == Session::State::parked)
+            this_thread::yield();
+    }
+    CHECK(session->stats().throttled >= 5);
+    CHECK_FALSE(ifstream("./session-0.state").is_open());
+    host.stop();
+}
+
+TEST(SessionHost, SharePages)
+{
+    SessionHost  host(2, 10000);
+    PageStore    store;
+    vector<shared_ptr<HostSystem>> systems;
+    for (int i = 0; i < 10; i++) {
+        systems.push_back(make_shared<HostSystem>(3000));
+        host.add(systems.back(), "s" + to_string(i));
+    }
+    auto busy = host.add(make_shared<HostSystem>(~0ull), "busy");
+    host.start();
+    while (true) {
+        size_t parked = 0;
+        for (auto &s : host.sessions())
+            parked += (s->state() == Session::State::parked);
+        if (parked == 10)
+            break;
+        this_thread::yield();
+    }
+    CHECK_EQUAL(0u, host.merge_pages(store));
+    CHECK_EQUAL(10u, host.merge_pages(store));
+    CHECK_EQUAL(9u * 4096, store.saved_bytes());
+    uint64_t saved = 0;
+    for (auto &s : host.sessions()) {
+        SessionStats st = s->stats();
+        if (s->getName() != "busy")
+            CHECK_EQUAL(4096u, st.shared);
+        saved += st.saved;
+    }
+    CHECK_EQUAL(9u * 4096, saved);
+    stringstream rep;
+    host.report(rep);
+    CHECK(rep.str().find("shared 4K saved 4K") != string::npos);
+    busy->stop();
+    host.wait_idle();
+    host.stop();
+
+    // A write gives the session its own copy back.
+    systems[3]->ram->write(0x12, 10);
+    uint8_t val;
+    systems[3]->ram->read(val, 10);
+    CHECK_EQUAL(0x12, val);
+    systems[4]->ram->read(val, 10);
+    CHECK_EQUAL(10, val);
+    CHECK_EQUAL(8u * 4096, store.saved_bytes());
+}
@@ -0,0 +1,115 @@
+/*
+ * Author:      Richard Cornwell (rich@sky-visions.com)
+ *
+ * Copyright (C) 2021 Richard Cornwell.
+ *
+ * This file may be distributed under the terms of the Q Public License
+ * as defined by Trolltech AS of Norway and appearing in the file
+ * LICENSE.QPL included in the packaging of this file.
+ *
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING
+ * THE WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL,
+ * INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING
+ * FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION
+ * WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+#include "config.h"
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <stdio.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_SYS_UN_H
+#include <sys/socket.h>
+#endif
+#include "ROM.h"
+#include "SharedImage.h"
+#include "CppUTest/TestHarness.h"
+
+using namespace emulator;
+using namespace core;
+using namespace std;
+
+TEST_GROUP(SharedImage)
+{
+    void setup()
+    {
+        ofstream  file("image.bin", ios::out|ios::binary);
+        for (int i = 0; i < 1280; i++)
+            file.put((char)(i * 3));
+    }
+
+    void teardown()
+    {
+        remove("image.bin");
+    }
+};
+
+TEST(SharedImage, Load)
+{
+    auto  image = SharedImage::load("image.bin", 2048);
+
+    CHECK_EQUAL(2048u, image->size());
+    CHECK_EQUAL(3 * 5, image->data()[5]);
+    CHECK_EQUAL(0, image->data()[1500]);
+    CHECK_THROWS(SystemError, SharedImage::load("image.bin", 1024));
+    CHECK_THROWS(SystemError, SharedImage::load("missing.bin"));
+
+    ROM<uint8_t>  rom(2048, 0xf800);
+    uint8_t       val;
+    rom.map(image);
+    CHECK(rom.read(val, 7));
+    CHECK_EQUAL(21, val);
+    CHECK_THROWS(Access_error, rom.Set(1, 7));
+    ROM<uint8_t>  big(4096, 0);
+    CHECK_THROWS(SystemError, big.map(image));
+}
+
+#if defined(HAVE_MEMFD_CREATE) && defined(HAVE_SYS_UN_H)
+TEST(SharedImage, Pass)
+{
+    ImageSet  images;
+    int       fds[2];
+
+    images.load("boot", "image.bin", 2048);
+    images.load("disk", "image.bin");
+    CHECK_EQUAL(2u, images.size());
+    // Sealed, nobody can write to it.
+    CHECK(::write(images.find("boot")->fd(), "x", 1) < 0);
+
+    CHECK_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    images.send(fds[0]);
+    ImageSet  got = ImageSet::receive(fds[1]);
+    close(fds[0]);
+    close(fds[1]);
+
+    CHECK_EQUAL(2u, got.size());
+    CHECK(got.find("missing") == nullptr);
+    auto  boot = got.find("boot");
+    auto  disk = got.find("disk");
+    CHECK_EQUAL(2048u, boot->size());
+    CHECK_EQUAL(1280u, disk->size());
+    CHECK(boot->data() != images.find("boot")->data());
+    CHECK(memcmp(images.find("boot")->data(), boot->data(), 2048) == 0);
+
+    // Two ROMs use one mapping, and a matching state loads.
+    ROM<uint8_t>  rom1(2048, 0);
+    ROM<uint8_t>  rom2(2048, 0);
+    rom1.map(boot);
+    rom2.map(boot);
+    CHECK(rom1.data_ == rom2.data_);
+    stringstream  buf;
+    StateOut      out(buf);
+    rom1.save(out);
+    StateIn       in(buf);
+    rom2.load(in);
+}
+#endif
@@ -0,0 +1,282 @@
+/*
+ * Author:      Richard Cornwell (rich@sky-visions.com)
+ *
+ * Copyright (C) 2021 Richard Cornwell.
+ *
+ * This file may be distributed under the terms of the Q Public License
+ * as defined by Trolltech AS of Norway and appearing in the file
+ * LICENSE.QPL included in the packaging of this file.
+ *
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING
+ * THE WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL,
+ * INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING
+ * FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION
+ * WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+
+#include <iostream>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <sstream>
+#include "CPU.h"
+#include "RAM.h"
+#include "System.h"
+#include "Core.h"
+#include "Checkpoint.h"
+#include "CppUTest/TestHarness.h"
+
+using namespace emulator;
+using namespace core;
+using namespace std;
+
+static const int ncpus = 4;
+
+// Simulated times of each CPU, so every CPU can check how far the others
+// have drifted.
+static atomic<uint64_t> cpu_time[ncpus];
+static atomic<bool>     cpu_halted[ncpus];
+
+// CPU 0 writes its step count to word 1 then word 0, the others read word
+// 0 then word 1. With ordered memory word 1 can never be behind word 0.
+class SyncCpu : public CPU<uint32_t>
+{
+public:
+    SyncCpu(int id, uint64_t limit) : id(id), limit(limit)
+    {
+        running = true;
+    }
+
+    virtual uint64_t step() override
+    {
+        count++;
+        if (id == 0) {
+            mem->write((uint32_t)count, 1);
+            mem->write((uint32_t)count, 0);
+        } else {
+            uint32_t a, b;
+            mem->read(a, 0);
+            mem->read(b, 1);
+            if (b < a)
+                misordered++;
+        }
+        time += 100;
+        cpu_time[id].store(time);
+        for (int i = 0; i < ncpus; i++) {
+            if (cpu_halted[i].load())
+                continue;
+            uint64_t other = cpu_time[i].load();
+            if (other + 10000 + 100 < time)
+                drift++;
+        }
+        if (count >= limit) {
+            running = false;
+            cpu_halted[id].store(true);
+        }
+        return 100;
+    }
+
+    int       id;
+    uint64_t  limit;
+    uint64_t  count = 0;
+    uint64_t  time = 0;
+    uint64_t  misordered = 0;
+    uint64_t  drift = 0;
+};
+
+class SyncSystem : public System
+{
+public:
+    virtual CPU_v create_cpu(const string &model) override
+    {
+        throw SystemError{"No cpu " + model};
+    }
+
+    virtual MEM_v create_mem(const string &model,
+                             [[maybe_unused]]const size_t size,
+                             [[maybe_unused]]const size_t base) override
+    {
+        throw SystemError{"No memory " + model};
+    }
+
+    virtual IO_v create_io(const string &model) override
+    {
+        throw SystemError{"No io " + model};
+    }
+
+    virtual DEV_v create_dev(const string &model) override
+    {
+        throw SystemError{"No device " + model};
+    }
+};
+
+TEST_GROUP(System)
+{
+};
+
+TEST(System, GetCpu)
+{
+    SyncSystem  sys;
+    sys.addCpu(make_shared<SyncCpu>(0, 1));
+    CHECK(sys.getCpu(0).index() == 2);
+    CHECK_THROWS(SystemError, sys.getCpu(1));
+}
+
+TEST(System, Barrier)
+{
+    const int      phases = 2000;
+    atomic<int>    arrived{0};
+    int            completed = 0;
+    int            bad = 0;
+    Barrier        barrier(ncpus, [&]() {
+        completed++;
+        if (arrived.load() != ncpus * completed)
+            bad++;
+    });
+    vector<thread> threads;
+    for (int i = 0; i < ncpus; i++) {
+        threads.emplace_back([&]() {
+            for (int p = 0; p < phases; p++) {
+                arrived++;
+                barrier.arrive_and_wait();
+            }
+        });
+    }
+    for (auto &t : threads)
+        t.join();
+    CHECK_EQUAL(phases, completed);
+    CHECK_EQUAL(0, bad);
+}
+
+TEST(System, RunShared)
+{
+    SyncSystem  sys;
+    auto ram = make_shared<RAM<uint32_t>>(16, 0);
+    ram->setShared(true);
+    vector<shared_ptr<SyncCpu>> cpu;
+    for (int i = 0; i < ncpus; i++) {
+        cpu_time[i].store(0);
+        cpu_halted[i].store(false);
+        cpu.push_back(make_shared<SyncCpu>(i, 200000 + 50000 * i));
+        cpu[i]->addMemory(ram);
+        sys.addCpu(cpu[i]);
+    }
+    sys.run();
+    for (int i = 0; i < ncpus; i++) {
+        CHECK_EQUAL(200000u + 50000 * i, cpu[i]->count);
+        CHECK_EQUAL(0u, cpu[i]->misordered);
+        CHECK_EQUAL(0u, cpu[i]->drift);
+    }
+}
+
+TEST(System, Stop)
+{
+    SyncSystem  sys;
+    auto ram = make_shared<RAM<uint32_t>>(16, 0);
+    for (int i = 0; i < 2; i++) {
+        cpu_halted[i].store(false);
+        auto c = make_shared<SyncCpu>(i, ~0ull);
+        c->addMemory(ram);
+        sys.addCpu(c);
+    }
+    thread stopper([&sys]() {
+        this_thread::sleep_for(chrono::milliseconds(10));
+        sys.stop();
+    });
+    sys.run();
+    stopper.join();
+    CHECK(visit([](const auto& obj) { return obj->running; }, sys.getCpu(0)));
+}
+
+TEST(System, SaveDelta)
+{
+    // A delta holds only the pages written since the full save.
+    SyncSystem  sys;
+    SyncSystem  copy;
+    auto ram = make_shared<RAM<uint32_t>>(64 * 1024, 0);
+    auto ram2 = make_shared<RAM<uint32_t>>(64 * 1024, 0);
+    sys.addCpu(make_shared<SyncCpu>(0, 1));
+    sys.addMemory(MemInfo{ram, {}});
+    copy.addCpu(make_shared<SyncCpu>(0, 1));
+    copy.addMemory(MemInfo{ram2, {}});
+    for (size_t i = 0; i < 64 * 1024; i += 100)
+        ram->write((uint32_t)i, i);
+    stringstream full;
+    uint64_t     since = dirty_epoch();
+    sys.save(full);
+    ram->write(0x1234, 5000);
+    ram->write(0x5678, 60000);
+    stringstream delta;
+    sys.save_delta(delta, since);
+    CHECK(delta.str().size() < full.str().size() / 16);
+    copy.restore(full);
+    copy.restore_delta(delta);
+    uint32_t val;
+    for (size_t i = 0; i < 64 * 1024; i += 100) {
+        ram->read(val, i);
+        uint32_t other;
+        ram2->read(other, i);
+        CHECK_EQUAL(val, other);
+    }
+    ram2->read(val, 60000);
+    CHECK_EQUAL(0x5678u, val);
+    CHECK_THROWS(State_error, copy.restore(delta));
+}
+
+TEST(System, DeltaAndCheckpoints)
+{
+    // Checkpoints, full saves and deltas on one RAM each see every page
+    // written since they last looked.
+    SyncSystem  sys;
+    SyncSystem  copy;
+    auto ram = make_shared<RAM<uint32_t>>(64 * 1024, 0);
+    auto ram2 = make_shared<RAM<uint32_t>>(64 * 1024, 0);
+    sys.addCpu(make_shared<SyncCpu>(0, 1));
+    sys.addMemory(MemInfo{ram, {}});
+    copy.addCpu(make_shared<SyncCpu>(0, 1));
+    copy.addMemory(MemInfo{ram2, {}});
+    Checkpoints<uint32_t, int>  points(1024 * 1024, 1);
+    stringstream full;
+    uint64_t     since = dirty_epoch();
+    sys.save(full);
+    points.take(0, 0, *ram);
+    ram->write(1, 5000);
+    points.take(1, 1, *ram);
+    CHECK_EQUAL(1u, points[1].pages.count(5000 >> 10));
+    ram->write(2, 60000);
+    stringstream delta1;
+    sys.save_delta(delta1, since);
+    ram->write(3, 30000);
+    stringstream other;
+    sys.save(other);
+    points.take(2, 2, *ram);
+    CHECK_EQUAL(2u, points[2].pages.size());
+    CHECK_EQUAL(1u, points[2].pages.count(60000 >> 10));
+    CHECK_EQUAL(1u, points[2].pages.count(30000 >> 10));
+    stringstream delta2;
+    sys.save_delta(delta2, since);
+    CHECK(delta2.str().size() < delta1.str().size() * 3 / 4);
+
+    copy.restore(full);
+    copy.restore_delta(delta1);
+    copy.restore_delta(delta2);
+    uint32_t val;
+    ram2->read(val, 5000);
+    CHECK_EQUAL(1u, val);
+    ram2->read(val, 60000);
+    CHECK_EQUAL(2u, val);
+    ram2->read(val, 30000);
+    CHECK_EQUAL(3u, val);
+
+    // Going back to checkpoint 1 undoes both later writes.
+    points.restore(1, *ram);
+    ram->read(val, 60000);
+    CHECK_EQUAL(0u, val);
+    ram->read(val, 30000);
+    CHECK_EQUAL(0u, val);
+}
@@ -0,0 +1,211 @@
+/*
+ * Author:      Richard Cornwell (rich@sky-visions.com)
+ *
+ * Copyright (C) 2021 Richard Cornwell.
+ *
+ * This file may be distributed under the terms of the Q Public License
+ * as defined by Trolltech AS of Norway and appearing in the file
+ * LICENSE.QPL included in the packaging of this file.
+ *
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING
+ * THE WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL,
+ * INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING
+ * FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION
+ * WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+#include "config.h"
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#ifdef HAVE_SYS_EPOLL_H
+#include <unistd.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+#include "TermServer.h"
+#include "CppUTest/TestHarness.h"
+
+using namespace core;
+using namespace std;
+
+#ifdef HAVE_SYS_EPOLL_H
+// Collects what a line hands to the device.
+struct TermInput {
+    static void recv(void *obj, void *ev)
+    {
+        TermInput *o = (TermInput *)obj;
+        lock_guard<mutex> lock(o->lock);
+        o->text += *(char *)ev;
+    }
+
+    static void burst(void *obj, const char *data, size_t n)
+    {
+        TermInput *o = (TermInput *)obj;
+        lock_guard<mutex> lock(o->lock);
+        o->text.append(data, n);
+        o->bursts++;
+    }
+
+    string wait_for(size_t len)
+    {
+        for (int i = 0; i < 200; i++) {
+            {
+                lock_guard<mutex> l(lock);
+                if (text.size() >= len)
+                    return text;
+            }
+            this_thread::sleep_for(chrono::milliseconds(5));
+        }
+        lock_guard<mutex> l(lock);
+        return text;
+    }
+
+    mutex           lock;
+    string          text;
+    int             bursts = 0;
+    Console_reader  reader{this, &recv, &burst};
+};
+
+static int tcp_connect(int port)
+{
+    sockaddr_in  addr{};
+    int          fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Read until len bytes have arrived or nothing more comes.
+static string read_some(int fd, size_t len)
+{
+    string  got;
+    char    buf[256];
+
+    while (got.size() < len) {
+        pollfd  pfd{fd, POLLIN, 0};
+        if (poll(&pfd, 1, 1000) <= 0)
+            break;
+        ssize_t  n = read(fd, buf, sizeof(buf));
+        if (n <= 0)
+            break;
+        got.append(buf, (size_t)n);
+    }
+    return got;
+}
+
+static bool wait_connected(TermLine &line, bool state)
+{
+    for (int i = 0; i < 200 && line.connected() != state; i++)
+        this_thread::sleep_for(chrono::milliseconds(5));
+    return line.connected() == state;
+}
+#endif
+
+TEST_GROUP(TermServer)
+{
+};
+
+#ifdef HAVE_SYS_EPOLL_H
+TEST(TermServer, Raw)
+{
+    TermServer  server;
+    TermInput   in;
+    auto        line = server.bind("tcp:127.0.0.1:0");
+
+    line->addReadChar(&in.reader);
+    CHECK(line->port() != 0);
+    // Nothing is queued while no one is connected.
+    line->write("lost", 4);
+    int  fd = tcp_connect(line->port());
+    CHECK(fd >= 0);
+    CHECK(wait_connected(*line, true));
+
+    // A second user is turned away.
+    int  busy = tcp_connect(line->port());
+    STRCMP_EQUAL("Line busy\r\n", read_some(busy, 11).c_str());
+    close(busy);
+
+    // Output written a character at a time arrives together.
+    const string  msg = "Hello\r\n";
+    for (char c : msg)
+        line->write(&c, 1);
+    STRCMP_EQUAL(msg.c_str(), read_some(fd, msg.size()).c_str());
+
+    CHECK_EQUAL(5, write(fd, "dir\r\n", 5));
+    STRCMP_EQUAL("dir\r\n", in.wait_for(5).c_str());
+    CHECK(in.bursts >= 1);
+
+    close(fd);
+    CHECK(wait_connected(*line, false));
+    CHECK_EQUAL(1u, server.lines());
+    CHECK_THROWS(SystemError, server.bind("serial:1"));
+    CHECK_THROWS(SystemError, server.bind("tcp:nohost:1"));
+}
+
+TEST(TermServer, Telnet)
+{
+    TermServer  server;
+    TermInput   in;
+    auto        line = server.bind("telnet:0");
+
+    line->addReadChar(&in.reader);
+    int  fd = tcp_connect(line->port());
+    CHECK(fd >= 0);
+    // Server offers to echo and suppress go ahead.
+    string  opts = read_some(fd, 6);
+    CHECK_EQUAL(6u, opts.size());
+    CHECK_EQUAL(255, (uint8_t)opts[0]);
+    CHECK_EQUAL(251, (uint8_t)opts[1]);
+    CHECK(wait_connected(*line, true));
+
+    // Commands and the NUL after return are stripped, IAC IAC is 255.
+    const char  keys[] = { 'a', '\377', '\375', '\003', 'b', '\r', '\0',
+                           '\377', '\372', '\030', '\001', '\377', '\360',
+                           '\377', '\377', 'c' };
+    CHECK_EQUAL((ssize_t)sizeof(keys), write(fd, keys, sizeof(keys)));
+    STRCMP_EQUAL("ab\r\377c", in.wait_for(5).c_str());
+
+    // 255 is doubled on output.
+    line->write("x\377y", 3);
+    line->flush();
+    string  got = read_some(fd, 4);
+    CHECK(got == string("x\377\377y"));
+    close(fd);
+}
+
+TEST(TermServer, Unix)
+{
+    TermServer  server;
+    TermInput   in;
+    auto        line = server.bind("unix:term.sock");
+    sockaddr_un addr{};
+    int         fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    line->addReadChar(&in.reader);
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, "term.sock");
+    CHECK_EQUAL(0, connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)));
+    CHECK(wait_connected(*line, true));
+    line->write("ok", 2);
+    STRCMP_EQUAL("ok", read_some(fd, 2).c_str());
+    close(fd);
+    server.stop();
+    CHECK(access("term.sock", F_OK) != 0);
+}
+#endif
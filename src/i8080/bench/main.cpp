@@ -0,0 +1,342 @@
+/*
+ * Author:      Richard Cornwell (rich@sky-visions.com)
+ *
+ * Copyright (C) 2021 Richard Cornwell.
+ *
+ * This file may be distributed under the terms of the Q Public License
+ * as defined by Trolltech AS of Norway and appearing in the file
+ * LICENSE.QPL included in the packaging of this file.
+ *
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING
+ * THE WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL,
+ * INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING
+ * FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION
+ * WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+/*
+ * ts-sim-bench: run the bundled CP/M exercisers and a few synthetic
+ * kernels through i8080_cpu and report timings as JSON.
+ */
+
+#include "config.h"
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#include "i8080_cpu.h"
+#include "i8080_stub.h"
+#include "RAM.h"
+#include "IO.h"
+#include "Device.h"
+#include "Options.h"
+#include "Core.h"
+#include "Bench.h"
+
+#ifndef BENCH_DIR
+#define BENCH_DIR "."
+#endif
+
+using namespace emulator;
+using namespace std;
+
+// Memory heavy: block copy with stack traffic.
+// 100: 061 000 360  lxi  sp,0f000h
+// 103: 041 000 020  lxi  h,1000h
+// 106: 021 000 040  lxi  d,2000h
+// 109: 001 000 010  lxi  b,0800h
+// 10c: 176          mov  a,m
+// 10d: 022          stax d
+// 10e: 305          push b
+// 10f: 301          pop  b
+// 110: 043          inx  h
+// 111: 023          inx  d
+// 112: 013          dcx  b
+// 113: 170          mov  a,b
+// 114: 261          ora  c
+// 115: 302 014 001  jnz  010ch
+// 118: 303 003 001  jmp  0103h
+static const uint8_t mem_kernel[] = {
+    0061, 0000, 0360, 0041, 0000, 0020, 0021, 0000, 0040,
+    0001, 0000, 0010, 0176, 0022, 0305, 0301, 0043, 0023,
+    0013, 0170, 0261, 0302, 0014, 0001, 0303, 0003, 0001
+};
+
+// Branch heavy: conditional jumps, calls and returns.
+// 100: 061 000 360  lxi  sp,0f000h
+// 103: 026 000      mvi  d,0
+// 105: 024          inr  d
+// 106: 172          mov  a,d
+// 107: 346 001      ani  1
+// 109: 312 022 001  jz   0112h
+// 10c: 315 040 001  call 0120h
+// 10f: 303 005 001  jmp  0105h
+// 112: 172          mov  a,d
+// 113: 346 002      ani  2
+// 115: 302 005 001  jnz  0105h
+// 118: 315 040 001  call 0120h
+// 11b: 303 005 001  jmp  0105h
+// 11e: 000 000      nop; nop
+// 120: 172          mov  a,d
+// 121: 017          rrc
+// 122: 330          rc
+// 123: 017          rrc
+// 124: 320          rnc
+// 125: 311          ret
+static const uint8_t branch_kernel[] = {
+    0061, 0000, 0360, 0026, 0000, 0024, 0172, 0346, 0001,
+    0312, 0022, 0001, 0315, 0040, 0001, 0303, 0005, 0001,
+    0172, 0346, 0002, 0302, 0005, 0001, 0315, 0040, 0001,
+    0303, 0005, 0001, 0000, 0000, 0172, 0017, 0330, 0017,
+    0320, 0311
+};
+
+// I/O heavy: read and write device ports.
+// 100: 061 000 360  lxi  sp,0f000h
+// 103: 006 000      mvi  b,0
+// 105: 333 020      in   10h
+// 107: 200          add  b
+// 108: 323 021      out  11h
+// 10a: 004          inr  b
+// 10b: 170          mov  a,b
+// 10c: 323 022      out  12h
+// 10e: 303 005 001  jmp  0105h
+static const uint8_t io_kernel[] = {
+    0061, 0000, 0360, 0006, 0000, 0333, 0020, 0200, 0323,
+    0021, 0004, 0170, 0323, 0022, 0303, 0005, 0001
+};
+
+/**
+ * @class bench_console
+ * @author rich
+ * @date 18/10/26
+ * @file main.cpp
+ * @brief Console output for the BDOS stub, discards output unless verbose.
+ */
+class bench_console : public Device<uint8_t>
+{
+public:
+    bool    verbose = false;
+
+    virtual bool output(uint8_t val, [[maybe_unused]]size_t port) override
+    {
+        if (verbose)
+            std::cerr << (char)val;
+        return true;
+    }
+};
+
+/**
+ * @class bench_port
+ * @author rich
+ * @date 18/10/26
+ * @file main.cpp
+ * @brief Three port data sink/source used by the I/O kernel.
+ */
+class bench_port : public Device<uint8_t>
+{
+public:
+    virtual size_t getSize() const override
+    {
+        return 3;
+    }
+
+    virtual bool input(uint8_t &val, [[maybe_unused]]size_t port) override
+    {
+        val = data++;
+        return true;
+    }
+
+    virtual bool output(uint8_t val, [[maybe_unused]]size_t port) override
+    {
+        data ^= val;
+        return true;
+    }
+
+    uint8_t data = 0;
+};
+
+/**
+ * @brief Description of one benchmark.
+ */
+struct Workload {
+    string          name;
+    cpu_model       model;
+    string          file;         // .COM image, or empty for a kernel.
+    const uint8_t  *code;
+    size_t          size;
+};
+
+static const Workload workloads[] = {
+    { "TST8080",  I8080, "TST8080.COM",  nullptr, 0 },
+    { "CPUTEST",  I8080, "CPUTEST.COM",  nullptr, 0 },
+    { "8080PRE",  I8080, "8080PRE.COM",  nullptr, 0 },
+    { "8080EXM",  I8080, "8080EXM.COM",  nullptr, 0 },
+    { "8080EXER", I8080, "8080EXER.COM", nullptr, 0 },
+    { "8085EX1",  I8085, "8085EX1.COM",  nullptr, 0 },
+    { "8085EXER", I8085, "8085EXER.COM", nullptr, 0 },
+    { "memory",   I8080, "", mem_kernel,    sizeof(mem_kernel) },
+    { "branch",   I8080, "", branch_kernel, sizeof(branch_kernel) },
+    { "io",       I8080, "", io_kernel,     sizeof(io_kernel) },
+};
+
+/**
+ * @brief Result of a single run.
+ */
+struct RunResult {
+    uint64_t   n_inst = 0;
+    uint64_t   sim_time = 0;
+    uint64_t   ns = 0;
+    bool       halted = false;
+};
+
+/**
+ * @brief Run one repetition of a workload on a freshly built machine.
+ *     Building the machine is not included in the time.
+ * @param image Program to load at 100h.
+ * @param limit Maximum number of instructions to execute.
+ * @param verbose Echo console output to stderr.
+ */
+template <cpu_model MOD>
+static RunResult run_once(const vector<uint8_t> &image, uint64_t limit, bool verbose)
+{
+    RunResult   res;
+    auto        mem = make_shared<MemFixed<uint8_t>>(64*1024, 0);
+    auto        io = make_shared<IO_map<uint8_t>>(256);
+    auto        con = make_shared<bench_console>();
+    auto        port = make_shared<bench_port>();
+    auto        cpu = make_unique<i8080_cpu<MOD>>();
+
+    mem->addMemory(make_shared<RAM<uint8_t>>(64 * 1024, 0));
+    for (size_t i = 0; i < image.size(); i++)
+        mem->Set(image[i], i + 0x100);
+    mem->Set(0166, 0);    // Inject halt opcode.
+    for (size_t i = 0; i < sizeof(bdos_stub); i++)
+        mem->Set(bdos_stub[i], i + 5);
+
+    con->verbose = verbose;
+    con->setAddress(2);
+    port->setAddress(0x10);
+    io->addDevice(con);
+    io->addDevice(port);
+    cpu->setMem(mem);
+    cpu->setIO(io);
+    cpu->start();
+    cpu->setPC(0x100);
+    cpu->running = true;
+
+    auto start = chrono::steady_clock::now();
+    while (cpu->running && res.n_inst < limit) {
+        res.sim_time += cpu->step();
+        res.n_inst++;
+    }
+    auto end = chrono::steady_clock::now();
+    res.halted = !cpu->running;
+    cpu->stop();
+    res.ns = chrono::duration_cast<chrono::nanoseconds>(end - start).count();
+    return res;
+}
+
+/**
+ * @brief Run warmups and repetitions of one workload.
+ */
+static bool run_workload(const Workload &work, const string &dir, int warmup,
+                         int reps, uint64_t limit, bool verbose,
+                         core::BenchResult &result)
+{
+    vector<uint8_t>  image;
+
+    if (work.code != nullptr) {
+        image.assign(work.code, work.code + work.size);
+    } else if (!load_com(dir + "/" + work.file, image)) {
+        cerr << "Unable to read " << dir << "/" << work.file << ", skipped" << endl;
+        return false;
+    }
+
+    auto run = (work.model == I8085) ? run_once<I8085> : run_once<I8080>;
+    RunResult res;
+    result.name = work.name;
+    for (int i = 0; i < warmup + reps; i++) {
+        res = run(image, limit, verbose && i == 0);
+        if (i < warmup || res.n_inst == 0)
+            continue;
+        result.ns.add((double)res.ns / (double)res.n_inst);
+    }
+    result.count = res.n_inst;
+    result.extra["sim_ns"] = (double)res.sim_time;
+    result.extra["halted"] = res.halted ? 1.0 : 0.0;
+    result.extra["cycle_ns"] = (res.sim_time == 0) ? 0.0 :
+                       (double)res.ns / ((double)res.sim_time / Tc);
+    cerr << work.name << ": " << res.n_inst << " instructions "
+         << result.ns.median() << " ns/insn" << endl;
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    option::OptionParser  op("Usage: ts-sim-bench [options] [workload...]");
+    auto help_opt = op.add<option::OptionSwitch>("h", "help", "Show this help message");
+    auto list_opt = op.add<option::OptionSwitch>("L", "list", "List workloads");
+    auto verb_opt = op.add<option::OptionSwitch>("v", "verbose", "Show guest console output");
+    auto warm_opt = op.add<option::OptionValue<int>>("w", "warmup", "Warmup runs", 1);
+    auto reps_opt = op.add<option::OptionValue<int>>("r", "reps", "Timed repetitions", 5);
+    auto lim_opt = op.add<option::OptionValue<uint64_t>>("l", "limit",
+                       "Maximum instructions per run", 100000000);
+    auto dir_opt = op.add<option::OptionValue<string>>("d", "dir",
+                       "Directory holding .COM files", string(BENCH_DIR));
+    auto out_opt = op.add<option::OptionValue<string>>("o", "output",
+                       "Write JSON to file", string(""));
+
+    try {
+        op.parse(argc, argv);
+    } catch (std::exception &e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+    if (!op.unknown_options().empty()) {
+        cerr << "Unknown option: " << op.unknown_options()[0] << endl;
+        cerr << op.help() << endl;
+        return 1;
+    }
+    if (help_opt->is_set()) {
+        cout << op.help() << endl;
+        return 0;
+    }
+    if (list_opt->is_set()) {
+        for (auto &work : workloads)
+            cout << work.name << endl;
+        return 0;
+    }
+
+    vector<core::BenchResult>  results;
+    const vector<string>      &only = op.non_option_args();
+    for (auto &work : workloads) {
+        if (!findString(only, work.name))
+            continue;
+        core::BenchResult res;
+        if (run_workload(work, dir_opt->getValue(), warm_opt->getValue(),
+                         reps_opt->getValue(), lim_opt->getValue(),
+                         verb_opt->is_set(), res))
+            results.push_back(res);
+    }
+
+    if (out_opt->getValue().empty()) {
+        core::write_json(cout, "ts-sim-bench", results);
+    } else {
+        ofstream out(out_opt->getValue());
+        if (!out.is_open()) {
+            cerr << "Unable to write " << out_opt->getValue() << endl;
+            return 1;
+        }
+        core::write_json(out, "ts-sim-bench", results);
+    }
+    return 0;
+}
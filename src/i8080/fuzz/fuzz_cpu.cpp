@@ -0,0 +1,114 @@
+/*
+ * Author:      Richard Cornwell (rich@sky-visions.com)
+ *
+ * Copyright (C) 2021 Richard Cornwell.
+ *
+ * This file may be distributed under the terms of the Q Public License
+ * as defined by Trolltech AS of Norway and appearing in the file
+ * LICENSE.QPL included in the packaging of this file.
+ *
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING
+ * THE WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL,
+ * INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING
+ * FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION
+ * WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+/*
+ * Fuzz target for the 8080 decoder. Each input is a short header and a
+ * program which is run on i8080_cpu and the reference model in lockstep.
+ * Any difference aborts, so the fuzzer saves the input that caused it.
+ *
+ * Input layout:
+ *   0      flags, bit 0 selects 8085, bits 1-2 select load address.
+ *   1-8    B C D E H L (M) A.
+ *   9      PSW.
+ *   10-11  SP, low byte first.
+ *   12-    program.
+ */
+
+#include "config.h"
+#include <iostream>
+#include <stdint.h>
+#include <stdlib.h>
+#include "i8080_cpu.h"
+#include "lockstep/i8080_ref.h"
+#include "lockstep/lockstep.h"
+
+using namespace emulator;
+using namespace std;
+
+/**
+ * @class fuzz_io
+ * @author rich
+ * @date 18/10/26
+ * @file fuzz_cpu.cpp
+ * @brief Ports for the fuzzer, inputs return a sequence that depends on
+ *     the port so IN instructions see varying data. All outputs accepted.
+ */
+class fuzz_io : public IO<uint8_t>
+{
+public:
+    virtual bool input(uint8_t &val, size_t port) override
+    {
+        val = (uint8_t)(port * 37 + count++);
+        return true;
+    }
+
+    virtual bool output([[maybe_unused]]uint8_t val, [[maybe_unused]]size_t port) override
+    {
+        return true;
+    }
+
+private:
+    uint8_t   count = 0;
+};
+
+// Load addresses, chosen to put code across a 4K page and the top of memory.
+static const uint16_t load_addr[4] = { 0x0000, 0x0ff8, 0x7ffc, 0xfff0 };
+
+// Header size in front of program.
+static const size_t header = 12;
+
+// Bound on instructions run for each input.
+static const uint64_t budget = 20000;
+
+template <cpu_model MOD>
+static void run_input(const uint8_t *data, size_t size)
+{
+    i8080_cpu<MOD>   cpu;
+    i8080_ref        ref(MOD);
+    Lockstep<i8080_cpu<MOD>, i8080_ref> lock(cpu, ref, make_shared<fuzz_io>());
+    uint16_t         addr = load_addr[(data[0] >> 1) & 3];
+
+    lock.load(data + header, size - header, addr);
+    // The 8085 V and K flags are not compared, the two models are known
+    // to differ on them.
+    if (MOD == I8085)
+        lock.psw_mask = SIGN|ZERO|AC|PAR|CARRY;
+    for (int i = 0; i < 8; i++)
+        cpu.regs[i] = data[1 + i];
+    cpu.PSW = (data[9] & 0xd5) | 2;
+    cpu.sp = data[10] | (data[11] << 8);
+    cpu.ie = false;
+    lock.start(addr);
+    if (!lock.run(budget)) {
+        cerr << lock.report;
+        abort();
+    }
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    if (size <= header)
+        return 0;
+    if (data[0] & 1)
+        run_input<I8085>(data, size);
+    else
+        run_input<I8080>(data, size);
+    return 0;
+}
@@ -0,0 +1,110 @@
+/*
+ * Author:      Richard Cornwell (rich@sky-visions.com)
+ *
+ * Copyright (C) 2021 Richard Cornwell.
+ *
+ * This file may be distributed under the terms of the Q Public License
+ * as defined by Trolltech AS of Norway and appearing in the file
+ * LICENSE.QPL included in the packaging of this file.
+ *
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING
+ * THE WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL,
+ * INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING
+ * FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION
+ * WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+/*
+ * Stand alone driver for the fuzz targets, used when the compiler has no
+ * libFuzzer. Files named on the command line are replayed, otherwise
+ * random inputs are generated from a seed. If a target aborts, the input
+ * being run is saved to crash-input so it can be replayed.
+ */
+
+#include "config.h"
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <csignal>
+#include <stdio.h>
+#include <vector>
+#include <stdint.h>
+#include "Options.h"
+
+using namespace std;
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+static const vector<uint8_t> *current;
+
+static void save_input([[maybe_unused]]int sig)
+{
+    FILE  *f = fopen("crash-input", "wb");
+    if (f != nullptr && current != nullptr) {
+        fwrite(current->data(), 1, current->size(), f);
+        fclose(f);
+    }
+    signal(SIGABRT, SIG_DFL);
+}
+
+int main(int argc, char **argv)
+{
+    option::OptionParser  op("Usage: fuzz [options] [input...]");
+    auto help_opt = op.add<option::OptionSwitch>("h", "help", "Show this help message");
+    auto runs_opt = op.add<option::OptionValue<uint64_t>>("r", "runs",
+                       "Number of random inputs to try", 10000);
+    auto seed_opt = op.add<option::OptionValue<uint64_t>>("s", "seed",
+                       "Seed for random inputs", 1);
+    auto len_opt = op.add<option::OptionValue<size_t>>("m", "max-len",
+                       "Maximum length of random inputs", 512);
+
+    try {
+        op.parse(argc, argv);
+    } catch (std::exception &e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+    if (!op.unknown_options().empty()) {
+        cerr << "Unknown option: " << op.unknown_options()[0] << endl;
+        cerr << op.help() << endl;
+        return 1;
+    }
+    if (help_opt->is_set()) {
+        cout << op.help() << endl;
+        return 0;
+    }
+
+    if (!op.non_option_args().empty()) {
+        for (auto &name : op.non_option_args()) {
+            ifstream  file(name, ios::in|ios::binary);
+            if (!file.is_open()) {
+                cerr << "Unable to read " << name << endl;
+                return 1;
+            }
+            vector<uint8_t> data((istreambuf_iterator<char>(file)),
+                                  istreambuf_iterator<char>());
+            cout << name << endl;
+            LLVMFuzzerTestOneInput(data.data(), data.size());
+        }
+        cout << op.non_option_args().size() << " inputs replayed" << endl;
+        return 0;
+    }
+
+    mt19937_64       gen(seed_opt->getValue());
+    vector<uint8_t>  data;
+    current = &data;
+    signal(SIGABRT, save_input);
+    for (uint64_t r = 0; r < runs_opt->getValue(); r++) {
+        data.resize(gen() % (len_opt->getValue() + 1));
+        for (auto &b : data)
+            b = (uint8_t)gen();
+        LLVMFuzzerTestOneInput(data.data(), data.size());
+    }
+    cout << runs_opt->getValue() << " random inputs run" << endl;
+    return 0;
+}
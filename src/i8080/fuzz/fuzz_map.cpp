@@ -0,0 +1,229 @@
+/*
+ * Author:      Richard Cornwell (rich@sky-visions.com)
+ *
+ * Copyright (C) 2021 Richard Cornwell.
+ *
+ * This file may be distributed under the terms of the Q Public License
+ * as defined by Trolltech AS of Norway and appearing in the file
+ * LICENSE.QPL included in the packaging of this file.
+ *
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING
+ * THE WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL,
+ * INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING
+ * FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION
+ * WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+/*
+ * Fuzz target for the memory and I/O maps. The input is decoded into a
+ * list of operations on a MemArray and an IO_map, and every result is
+ * checked against a plain model of what the maps should hold. Addresses
+ * are picked around chunk edges and the ends of each map.
+ *
+ * Input layout:
+ *   0      chunk size, 16 << (n % 9).
+ *   1-2    memory size, low byte first, 1 to 65536.
+ *   3      number of I/O ports, 1 to 256.
+ *   4-     operations, an opcode byte followed by two argument bytes.
+ */
+
+#include "config.h"
+#include <iostream>
+#include <vector>
+#include <stdint.h>
+#include <stdlib.h>
+#include "CPU.h"
+#include "Memory.h"
+#include "RAM.h"
+#include "IO.h"
+#include "Device.h"
+
+using namespace emulator;
+using namespace std;
+
+/**
+ * @class fuzz_dev
+ * @author rich
+ * @date 18/10/26
+ * @file fuzz_map.cpp
+ * @brief Device that answers inputs with its own number and remembers
+ *     the last output.
+ */
+class fuzz_dev : public Device<uint8_t>
+{
+public:
+    fuzz_dev(uint8_t id, size_t addr, size_t size) : id_(id), size_(size)
+    {
+        setAddress(addr);
+    }
+
+    virtual size_t getSize() const override
+    {
+        return size_;
+    }
+
+    virtual bool input(uint8_t &val, [[maybe_unused]]size_t port) override
+    {
+        val = id_;
+        return true;
+    }
+
+    virtual bool output(uint8_t val, [[maybe_unused]]size_t port) override
+    {
+        last = val;
+        return true;
+    }
+
+    uint8_t id() const
+    {
+        return id_;
+    }
+
+    uint8_t   last = 0;
+
+private:
+    uint8_t   id_;
+    size_t    size_;
+};
+
+static void fail(const char *what, size_t addr)
+{
+    cerr << what << " at " << hex << addr << endl;
+    abort();
+}
+
+/**
+ * @brief Expected contents of the memory map.
+ */
+struct mem_model {
+    struct region {
+        size_t           base;
+        vector<uint8_t>  data;
+    };
+
+    vector<region>  regions;
+    vector<int>     owner;       // Region covering each chunk, -1 for none.
+    size_t          size;
+    size_t          shift;
+
+    // Region holding addr, or nullptr.
+    region *find(size_t addr)
+    {
+        if (addr >= size || owner[addr >> shift] < 0)
+            return nullptr;
+        return &regions[owner[addr >> shift]];
+    }
+};
+
+// Pick an address near a chunk edge: chunk number and a signed offset.
+static size_t edge_addr(uint8_t chunk, uint8_t delta, size_t shift)
+{
+    return (size_t)(((long)chunk << shift) + (int8_t)delta) & 0x1ffff;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    if (size < 4)
+        return 0;
+
+    mem_model   model;
+    size_t      chunk = 16u << (data[0] % 9);
+    model.shift = 4 + (data[0] % 9);
+    model.size = (data[1] | (data[2] << 8)) + 1;
+    model.owner.assign((model.size + chunk - 1) >> model.shift, -1);
+    MemArray<uint8_t>    mem(model.size, chunk);
+
+    size_t               num_ports = data[3] + 1u;
+    IO_map<uint8_t>      io(num_ports);
+    vector<shared_ptr<fuzz_dev>> port_dev(num_ports);
+    vector<shared_ptr<fuzz_dev>> devs;
+
+    for (size_t i = 4; i + 2 < size; i += 3) {
+        uint8_t  op = data[i];
+        uint8_t  a = data[i + 1];
+        uint8_t  b = data[i + 2];
+
+        switch (op % 6) {
+        case 0: {   // Add RAM covering chunks a to a + n.
+            size_t  count = (op >> 3) % 16 + 1;
+            if (model.regions.size() >= 8)
+                break;
+            size_t  base = (size_t)a << model.shift;
+            mem.addMemory(make_shared<RAM<uint8_t>>(count << model.shift, base));
+            model.regions.push_back({base, vector<uint8_t>(count << model.shift, 0)});
+            for (size_t c = a; c < a + count && c < model.owner.size(); c++)
+                model.owner[c] = (int)model.regions.size() - 1;
+            break;
+        }
+        case 1: {   // Write near a chunk edge.
+            size_t  addr = edge_addr(a, b, model.shift);
+            auto    r = model.find(addr);
+            bool    ok = mem.write(op, addr);
+            if (ok != (r != nullptr))
+                fail("Memory write result wrong", addr);
+            if (r)
+                r->data[addr - r->base] = op;
+            break;
+        }
+        case 2: {   // Read near a chunk edge with read() and Get().
+            size_t  addr = edge_addr(a, b, model.shift);
+            auto    r = model.find(addr);
+            uint8_t val = 0xff;
+            bool    ok = mem.read(val, addr);
+            if (ok != (r != nullptr))
+                fail("Memory read result wrong", addr);
+            if (val != (r ? r->data[addr - r->base] : 0))
+                fail("Memory read value wrong", addr);
+            bool    thrown = false;
+            try {
+                mem.Get(val, addr);
+            } catch (Access_error &) {
+                thrown = true;
+            }
+            if (thrown != (r == nullptr))
+                fail("Memory Get result wrong", addr);
+            break;
+        }
+        case 3: {   // Attach a device at port a.
+            size_t  ports = (op >> 3) % 4 + 1;
+            if (devs.size() >= 16)
+                break;
+            auto    dev = make_shared<fuzz_dev>((uint8_t)devs.size() + 1, a, ports);
+            devs.push_back(dev);
+            io.addDevice(dev);
+            if (a < num_ports && a + ports <= num_ports) {
+                for (size_t p = a; p < a + ports; p++)
+                    port_dev[p] = dev;
+            }
+            break;
+        }
+        case 4: {   // Output, ports up to and just past the end.
+            size_t  port = (a + (op >> 3)) % (num_ports + 2);
+            bool    ok = io.output(b, port);
+            auto    dev = (port < num_ports) ? port_dev[port] : nullptr;
+            if (ok != (dev != nullptr))
+                fail("Port output result wrong", port);
+            if (dev && dev->last != b)
+                fail("Port output went to wrong device", port);
+            break;
+        }
+        case 5: {   // Input.
+            size_t  port = (a + (op >> 3)) % (num_ports + 2);
+            uint8_t val = 0xff;
+            bool    ok = io.input(val, port);
+            auto    dev = (port < num_ports) ? port_dev[port] : nullptr;
+            if (ok != (dev != nullptr))
+                fail("Port input result wrong", port);
+            if (val != (dev ? dev->id() : 0))
+                fail("Port input from wrong device", port);
+            break;
+        }
+        }
+    }
+    io.step();
+    return 0;
+}
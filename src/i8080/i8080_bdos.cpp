@@ -0,0 +1,612 @@
+/*
+ * Author:      Richard Cornwell (rich@sky-visions.com)
+ *
+ * Copyright (C) 2021 Richard Cornwell.
+ *
+ * This file may be distributed under the terms of the Q Public License
+ * as defined by Trolltech AS of Norway and appearing in the file
+ * LICENSE.QPL included in the packaging of this file.
+ *
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING
+ * THE WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL,
+ * INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING
+ * FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION
+ * WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include "i8080_bdos.h"
+
+namespace emulator
+{
+
+using namespace std;
+
+// FCB fields.
+#define FCB_DR     0      // Drive.
+#define FCB_NAME   1      // Name, 8 bytes.
+#define FCB_EXT    9      // Type, 3 bytes.
+#define FCB_EX     12     // Current extent.
+#define FCB_S2     14     // Extent high bits.
+#define FCB_RC     15     // Records in current extent.
+#define FCB_AL     16     // Allocation map, holds the host handle.
+#define FCB_CR     32     // Current record in extent.
+#define FCB_R0     33     // Random record, 3 bytes.
+
+#define CPM_EOF    0x1a
+
+//  base:   323 001     out  1
+//          311         ret
+//  base+3: 166         hlt      Warm boot.
+static const uint8_t bdos_entry[] = { 0323, 0001, 0311, 0166 };
+
+uint8_t i8080_bdos::get(uint16_t addr) const
+{
+    uint8_t  val;
+    mem->read(val, addr);
+    return val;
+}
+
+void i8080_bdos::put(uint16_t addr, uint8_t val)
+{
+    mem->write(val, addr);
+}
+
+void i8080_bdos::install(uint16_t base)
+{
+    uint16_t  boot = base + 3;
+
+    put(0, 0303);          // jmp boot
+    put(1, boot & 0xff);
+    put(2, boot >> 8);
+    put(3, 0);             // IOBYTE.
+    put(4, 0);             // Drive A, user 0.
+    put(5, 0303);          // jmp base
+    put(6, base & 0xff);
+    put(7, base >> 8);
+    for (size_t i = 0; i < sizeof(bdos_entry); i++)
+        put(base + i, bdos_entry[i]);
+    dma_ = 0x80;
+}
+
+void i8080_bdos::put_name(uint16_t fcb, const string &arg)
+{
+    size_t  pos = 0;
+
+    for (int i = 0; i < 16; i++)
+        put(fcb + i, (i >= FCB_NAME && i < FCB_EX) ? ' ' : 0);
+    if (arg.size() >= 2 && arg[1] == ':') {
+        put(fcb + FCB_DR, toupper((unsigned char)arg[0]) - 'A' + 1);
+        pos = 2;
+    }
+    // Name then type, * fills the rest of either with ?.
+    for (int field = FCB_NAME, len = 8; field <= FCB_EXT; field = FCB_EXT, len = 3) {
+        for (int i = 0; i < len && pos < arg.size() && arg[pos] != '.'; pos++) {
+            if (arg[pos] == '*') {
+                while (i < len)
+                    put(fcb + field + i++, '?');
+            } else {
+                put(fcb + field + i++, toupper((unsigned char)arg[pos]));
+            }
+        }
+        while (pos < arg.size() && arg[pos] != '.')
+            pos++;
+        pos++;
+        if (field == FCB_EXT)
+            break;
+    }
+}
+
+void i8080_bdos::setCommand(const vector<string> &args)
+{
+    string  tail;
+
+    for (auto &a : args)
+        tail += " " + a;
+    if (tail.size() > 127)
+        tail.resize(127);
+    put(0x80, (uint8_t)tail.size());
+    for (size_t i = 0; i < tail.size(); i++)
+        put(0x81 + i, toupper((unsigned char)tail[i]));
+    put(0x81 + tail.size(), 0);
+    put_name(0x6c, (args.size() > 1) ? args[1] : "");
+    put_name(0x5c, (args.size() > 0) ? args[0] : "");
+    put(0x5c + FCB_CR, 0);
+}
+
+bool i8080_bdos::loadProgram(const string &name)
+{
+    string   com = name;
+
+    if (com.find('.') == string::npos)
+        com += ".COM";
+    string   path = find(com);
+    if (path.empty())
+        return false;
+    ifstream  file(path, ios::in|ios::binary);
+    if (!file.is_open())
+        return false;
+    vector<char> image((istreambuf_iterator<char>(file)),
+                       istreambuf_iterator<char>());
+    uint16_t  top = get(6) | (get(7) << 8);
+    if (image.size() > (size_t)(top - 0x100))
+        return false;
+    mem->write_block((const uint8_t *)image.data(), 0x100, image.size());
+    return true;
+}
+
+void i8080_bdos::shutdown()
+{
+    for (auto &f : files_) {
+        if (f.second.dirty) {
+            ofstream  out(f.second.path, ios::out|ios::binary|ios::trunc);
+            out.write((const char *)f.second.data.data(), f.second.data.size());
+        }
+    }
+    files_.clear();
+    if (con_out)
+        con_out->flush();
+}
+
+bool i8080_bdos::output([[maybe_unused]]uint8_t val, size_t port)
+{
+    if (port != 1)
+        return false;
+    if (cpu_ == nullptr)
+        return true;
+    uint16_t  r = call(regs_[C], (regs_[D] << 8) | regs_[E]);
+    regs_[A] = regs_[L] = r & 0xff;
+    regs_[B] = regs_[H] = r >> 8;
+    return true;
+}
+
+string i8080_bdos::host_name(uint16_t fcb) const
+{
+    string  name;
+    string  ext;
+
+    for (int i = 0; i < 8; i++)
+        name += (char)(get(fcb + FCB_NAME + i) & 0x7f);
+    for (int i = 0; i < 3; i++)
+        ext += (char)(get(fcb + FCB_EXT + i) & 0x7f);
+    name.erase(name.find_last_not_of(' ') + 1);
+    ext.erase(ext.find_last_not_of(' ') + 1);
+    if (name.empty() || (name + ext).find_first_of("? /.") != string::npos)
+        return "";
+    return ext.empty() ? name : name + "." + ext;
+}
+
+// Host file whose name matches, ignoring case.
+string i8080_bdos::find(const string &name) const
+{
+    DIR     *d = opendir(dir_.c_str());
+    string   path;
+
+    if (d == nullptr)
+        return path;
+    while (struct dirent *ent = readdir(d)) {
+        string  entry = ent->d_name;
+        if (entry.size() == name.size() &&
+            equal(entry.begin(), entry.end(), name.begin(),
+                  [](char a, char b) { return toupper((unsigned char)a) ==
+                                              toupper((unsigned char)b); })) {
+            path = dir_ + "/" + entry;
+            break;
+        }
+    }
+    closedir(d);
+    return path;
+}
+
+// Does a host name fit the FCB, which may hold ? wild cards.
+bool i8080_bdos::match(uint16_t fcb, const string &name) const
+{
+    size_t  dot = name.find('.');
+    string  base = name.substr(0, dot);
+    string  ext = (dot == string::npos) ? "" : name.substr(dot + 1);
+
+    if (base.empty() || base.size() > 8 || ext.size() > 3 ||
+        ext.find('.') != string::npos)
+        return false;
+    base.resize(8, ' ');
+    ext.resize(3, ' ');
+    string  full = base + ext;
+    for (int i = 0; i < 11; i++) {
+        char  f = (char)(get(fcb + FCB_NAME + i) & 0x7f);
+        if (f != '?' && f != toupper((unsigned char)full[i]))
+            return false;
+    }
+    return true;
+}
+
+uint16_t i8080_bdos::open(uint16_t fcb, bool create)
+{
+    string    name = host_name(fcb);
+    HostFile  f;
+
+    if (name.empty())
+        return 0xff;
+    f.path = find(name);
+    if (create) {
+        if (f.path.empty())
+            f.path = dir_ + "/" + name;
+        ofstream  out(f.path, ios::out|ios::binary|ios::trunc);
+        if (!out.is_open())
+            return 0xff;
+    } else {
+        if (f.path.empty())
+            return 0xff;
+        ifstream  in(f.path, ios::in|ios::binary);
+        if (!in.is_open())
+            return 0xff;
+        f.data.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+    }
+    // Replace any file the FCB already had open.
+    release(get(fcb + FCB_AL) | (get(fcb + FCB_AL + 1) << 8));
+    uint16_t  h = next_handle_++;
+    if (next_handle_ == 0)
+        next_handle_ = 1;
+    files_[h] = std::move(f);
+    put(fcb + FCB_AL, h & 0xff);
+    put(fcb + FCB_AL + 1, h >> 8);
+    return 0;
+}
+
+void i8080_bdos::release(uint16_t handle)
+{
+    auto  it = files_.find(handle);
+
+    if (it == files_.end())
+        return;
+    if (it->second.dirty) {
+        ofstream  out(it->second.path, ios::out|ios::binary|ios::trunc);
+        out.write((const char *)it->second.data.data(), it->second.data.size());
+    }
+    files_.erase(it);
+}
+
+// File open on an FCB. A closed or copied FCB is opened again by name,
+// its position is in the FCB so nothing is lost.
+i8080_bdos::HostFile *i8080_bdos::file(uint16_t fcb)
+{
+    uint16_t  h = get(fcb + FCB_AL) | (get(fcb + FCB_AL + 1) << 8);
+    auto      it = files_.find(h);
+
+    if (it != files_.end()) {
+        size_t  slash = it->second.path.rfind('/');
+        string  host = it->second.path.substr(slash + 1);
+        if (match(fcb, host))
+            return &it->second;
+    }
+    if (open(fcb, false) != 0)
+        return nullptr;
+    h = get(fcb + FCB_AL) | (get(fcb + FCB_AL + 1) << 8);
+    return &files_[h];
+}
+
+uint16_t i8080_bdos::close(uint16_t fcb)
+{
+    uint16_t  h = get(fcb + FCB_AL) | (get(fcb + FCB_AL + 1) << 8);
+
+    if (files_.find(h) == files_.end())
+        return find(host_name(fcb)).empty() ? 0xff : 0;
+    release(h);
+    return 0;
+}
+
+uint16_t i8080_bdos::search(uint16_t fcb, bool first)
+{
+    if (first) {
+        found_.clear();
+        found_pos_ = 0;
+        search_fcb_ = fcb;
+        if (DIR *d = opendir(dir_.c_str())) {
+            while (struct dirent *ent = readdir(d)) {
+                struct stat  st;
+                string       entry = ent->d_name;
+                if (stat((dir_ + "/" + entry).c_str(), &st) == 0 &&
+                    S_ISREG(st.st_mode) && match(fcb, entry))
+                    found_.push_back(entry);
+            }
+            closedir(d);
+        }
+        sort(found_.begin(), found_.end());
+    }
+    if (found_pos_ >= found_.size())
+        return 0xff;
+
+    // Directory entry for the last extent, so its size is right.
+    string       entry = found_[found_pos_++];
+    struct stat  st;
+    uint32_t     recs = 0;
+    if (stat((dir_ + "/" + entry).c_str(), &st) == 0)
+        recs = (uint32_t)((st.st_size + record - 1) / record);
+    uint32_t     last = (recs == 0) ? 0 : recs - 1;
+    size_t       dot = entry.find('.');
+    string       base = entry.substr(0, dot);
+    string       ext = (dot == string::npos) ? "" : entry.substr(dot + 1);
+    base.resize(8, ' ');
+    ext.resize(3, ' ');
+    string       full = base + ext;
+    put(dma_, 0);
+    for (int i = 0; i < 11; i++)
+        put(dma_ + FCB_NAME + i, toupper((unsigned char)full[i]));
+    put(dma_ + FCB_EX, (last >> 7) & 0x1f);
+    put(dma_ + FCB_EX + 1, 0);
+    put(dma_ + FCB_S2, (last >> 12) & 0x3f);
+    put(dma_ + FCB_RC, (recs == 0) ? 0 : (last & 0x7f) + 1);
+    for (int i = FCB_AL; i < 32; i++)
+        put(dma_ + i, 0);
+    return 0;
+}
+
+uint16_t i8080_bdos::remove(uint16_t fcb)
+{
+    uint16_t  r = 0xff;
+
+    search(fcb, true);
+    for (auto &entry : found_) {
+        if (::remove((dir_ + "/" + entry).c_str()) == 0)
+            r = 0;
+    }
+    found_.clear();
+    return r;
+}
+
+uint16_t i8080_bdos::rename(uint16_t fcb)
+{
+    string  from = find(host_name(fcb));
+    string  to = host_name(fcb + 16);
+
+    if (from.empty() || to.empty())
+        return 0xff;
+    string  path = find(to);
+    if (path.empty())
+        path = dir_ + "/" + to;
+    return (::rename(from.c_str(), path.c_str()) == 0) ? 0 : 0xff;
+}
+
+uint32_t i8080_bdos::seq_record(uint16_t fcb)
+{
+    return ((uint32_t)(get(fcb + FCB_S2) & 0x3f) << 12) |
+           ((uint32_t)(get(fcb + FCB_EX) & 0x1f) << 7) |
+           get(fcb + FCB_CR);
+}
+
+void i8080_bdos::set_seq(uint16_t fcb, uint32_t rec)
+{
+    put(fcb + FCB_CR, rec & 0x7f);
+    put(fcb + FCB_EX, (rec >> 7) & 0x1f);
+    put(fcb + FCB_S2, (rec >> 12) & 0x3f);
+}
+
+uint32_t i8080_bdos::rand_record(uint16_t fcb)
+{
+    return get(fcb + FCB_R0) | (get(fcb + FCB_R0 + 1) << 8) |
+           ((uint32_t)get(fcb + FCB_R0 + 2) << 16);
+}
+
+void i8080_bdos::set_rand(uint16_t fcb, uint32_t rec)
+{
+    put(fcb + FCB_R0, rec & 0xff);
+    put(fcb + FCB_R0 + 1, (rec >> 8) & 0xff);
+    put(fcb + FCB_R0 + 2, (rec >> 16) & 0xff);
+}
+
+// Records in the current extent.
+void i8080_bdos::set_count(uint16_t fcb, const HostFile &f)
+{
+    uint32_t  recs = (uint32_t)((f.data.size() + record - 1) / record);
+    uint32_t  first = seq_record(fcb) & ~0x7fu;
+
+    put(fcb + FCB_RC, (recs <= first) ? 0 : min(recs - first, (uint32_t)record));
+}
+
+// Records wrap at the top of memory like byte accesses would.
+void i8080_bdos::to_dma(const uint8_t *buf)
+{
+    size_t  n = min(record, (size_t)0x10000 - dma_);
+
+    mem->write_block(buf, dma_, n);
+    if (n < record)
+        mem->write_block(buf + n, 0, record - n);
+}
+
+void i8080_bdos::from_dma(uint8_t *buf) const
+{
+    size_t  n = min(record, (size_t)0x10000 - dma_);
+
+    mem->read_block(buf, dma_, n);
+    if (n < record)
+        mem->read_block(buf + n, 0, record - n);
+}
+
+uint16_t i8080_bdos::read(uint16_t fcb, uint32_t rec)
+{
+    HostFile *f = file(fcb);
+    size_t    off = (size_t)rec * record;
+
+    if (f == nullptr)
+        return 9;
+    if (off >= f->data.size())
+        return 1;
+    size_t    n = min(record, f->data.size() - off);
+    uint8_t   buf[record];
+    copy(f->data.begin() + off, f->data.begin() + off + n, buf);
+    fill(buf + n, buf + record, CPM_EOF);
+    to_dma(buf);
+    return 0;
+}
+
+uint16_t i8080_bdos::write(uint16_t fcb, uint32_t rec)
+{
+    HostFile *f = file(fcb);
+    size_t    off = (size_t)rec * record;
+
+    if (f == nullptr)
+        return 9;
+    if (rec >= 0x10000)
+        return 6;
+    if (f->data.size() < off + record)
+        f->data.resize(off + record, 0);
+    from_dma(&f->data[off]);
+    f->dirty = true;
+    return 0;
+}
+
+void i8080_bdos::read_line(uint16_t buf)
+{
+    uint8_t  max = get(buf);
+    string   line;
+
+    if (!getline(*con_in, line))
+        line = "\032";
+    if (!line.empty() && line.back() == '\r')
+        line.pop_back();
+    if (line.size() > max)
+        line.resize(max);
+    *con_out << line << '\r';
+    put(buf + 1, (uint8_t)line.size());
+    for (size_t i = 0; i < line.size(); i++)
+        put(buf + 2 + i, (uint8_t)line[i]);
+}
+
+uint16_t i8080_bdos::call(uint8_t func, uint16_t de)
+{
+    uint8_t   e = de & 0xff;
+    uint16_t  r = 0;
+    int       ch;
+
+    switch (func) {
+    case 0:    // System reset.
+        if (cpu_)
+            cpu_->running = false;
+        break;
+    case 1:    // Console input, host lines end in CR.
+        ch = con_in->get();
+        r = (ch == EOF) ? CPM_EOF : (ch == '\n') ? '\r' : ch;
+        *con_out << (char)r;
+        break;
+    case 2:    // Console output.
+        *con_out << (char)(e & 0x7f);
+        break;
+    case 6:    // Direct console I/O.
+        if (e == 0xff) {
+            ch = con_in->get();
+            r = (ch == EOF) ? 0 : (ch == '\n') ? '\r' : ch;
+        } else if (e != 0xfe) {
+            *con_out << (char)e;
+        }
+        break;
+    case 9:    // Print string.
+        for (uint16_t a = de, n = 0; n < 0xffff && (ch = get(a)) != '$'; a++, n++)
+            *con_out << (char)ch;
+        break;
+    case 10:   // Read console buffer.
+        read_line(de);
+        break;
+    case 12:   // Version, CP/M 2.2.
+        r = 0x0022;
+        break;
+    case 13:   // Reset disk system.
+        dma_ = 0x80;
+        break;
+    case 15:   // Open file.
+        r = open(de, false);
+        if (r == 0) {
+            put(de + FCB_S2, 0);
+            set_count(de, *file(de));
+        }
+        break;
+    case 16:   // Close file.
+        r = close(de);
+        break;
+    case 17:   // Search for first.
+        r = search(de, true);
+        break;
+    case 18:   // Search for next.
+        r = search(search_fcb_, false);
+        break;
+    case 19:   // Delete file.
+        r = remove(de);
+        break;
+    case 20: { // Read sequential.
+        uint32_t rec = seq_record(de);
+        r = read(de, rec);
+        if (r == 0)
+            set_seq(de, rec + 1);
+        if (HostFile *f = file(de))
+            set_count(de, *f);
+        break;
+    }
+    case 21: { // Write sequential.
+        uint32_t rec = seq_record(de);
+        r = write(de, rec);
+        if (r == 0) {
+            set_seq(de, rec + 1);
+            set_count(de, *file(de));
+        }
+        break;
+    }
+    case 22:   // Make file.
+        r = open(de, true);
+        if (r == 0) {
+            put(de + FCB_S2, 0);
+            put(de + FCB_RC, 0);
+        }
+        break;
+    case 23:   // Rename file.
+        r = rename(de);
+        break;
+    case 24:   // Login vector, only A.
+        r = 0x0001;
+        break;
+    case 26:   // Set DMA address.
+        dma_ = de;
+        break;
+    case 33: { // Read random.
+        uint32_t rec = rand_record(de);
+        r = read(de, rec);
+        if (r == 0)
+            set_seq(de, rec);
+        break;
+    }
+    case 34:   // Write random.
+    case 40: { // Write random with zero fill.
+        uint32_t rec = rand_record(de);
+        r = write(de, rec);
+        if (r == 0)
+            set_seq(de, rec);
+        break;
+    }
+    case 35:   // Compute file size.
+        if (HostFile *f = file(de))
+            set_rand(de, (uint32_t)((f->data.size() + record - 1) / record));
+        else
+            r = 0xff;
+        break;
+    case 36:   // Set random record.
+        set_rand(de, seq_record(de));
+        break;
+    case 108:  // Get or set program return code.
+        if (de == 0xffff)
+            r = ret_code_;
+        else
+            ret_code_ = de;
+        break;
+    default:   // Drive, user and status calls have one answer.
+        break;
+    }
+    return r;
+}
+
+}
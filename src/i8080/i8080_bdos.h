@@ -0,0 +1,184 @@
+/*
+ * Author:      Richard Cornwell (rich@sky-visions.com)
+ *
+ * Copyright (C) 2021 Richard Cornwell.
+ *
+ * This file may be distributed under the terms of the Q Public License
+ * as defined by Trolltech AS of Norway and appearing in the file
+ * LICENSE.QPL included in the packaging of this file.
+ *
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING
+ * THE WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL,
+ * INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING
+ * FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION
+ * WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+#pragma once
+
+#include <stdint.h>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include "i8080_cpu.h"
+#include "IO.h"
+
+namespace emulator
+{
+
+/**
+ * @class i8080_bdos
+ * @author rich
+ * @date 18/10/26
+ * @file i8080_bdos.h
+ * @brief CP/M 2.2 BDOS emulated on the host, with files kept in a host
+ *     directory.
+ *
+ *     install() puts a stub at the top of memory that does an out to
+ *     port 1, the BDOS function in C and parameter in DE are handled here
+ *     and the result returned in A and HL. Each open file is read whole
+ *     into a buffer, records are copied between it and the DMA buffer and
+ *     the file is written back when closed. The host file handle is kept
+ *     in the allocation map of the FCB, which CP/M programs treat as
+ *     opaque. Every drive maps to the same directory. There is no BIOS
+ *     disk path, a warm boot halts the CPU.
+ */
+class i8080_bdos : public IO<uint8_t>
+{
+public:
+    static constexpr uint16_t default_base = 0xfe00;
+    static constexpr size_t   record = 128;
+
+    explicit i8080_bdos(const std::string &dir = ".") : dir_(dir)
+    {
+    }
+
+    virtual ~i8080_bdos()
+    {
+        shutdown();
+    }
+
+    virtual std::string getType() const override
+    {
+        return "BDOS";
+    }
+
+    /**
+     * @brief Set the CPU whose registers carry the calls, any model or
+     *     profiling policy.
+     */
+    template <class CPU_T>
+    void setCPU(CPU_T *cpu_v)
+    {
+        cpu_ = cpu_v;
+        regs_ = cpu_v->regs;
+    }
+
+    /**
+     * @brief Set up page zero and the BDOS entry in memory. Location 6
+     *     holds base, the top of memory programs may use.
+     * @param base Address of the BDOS entry.
+     */
+    void install(uint16_t base = default_base);
+
+    /**
+     * @brief Fill in the command tail and default FCBs.
+     * @param args Arguments after the program name.
+     */
+    void setCommand(const std::vector<std::string> &args);
+
+    /**
+     * @brief Load a .COM file from the host directory at 0100h.
+     * @return false if the program was not found.
+     */
+    bool loadProgram(const std::string &name);
+
+    virtual void init() override {};
+    virtual void start() override {};
+    virtual void reset() override {};
+    virtual void stop() override {};
+    virtual void step() override {};
+    virtual void run() override {};
+
+    /**
+     * @brief Write back any files left open.
+     */
+    virtual void shutdown() override;
+
+    virtual bool input(uint8_t &val, [[maybe_unused]]size_t port) override
+    {
+        val = 0;
+        return false;
+    }
+
+    virtual bool output(uint8_t val, size_t port) override;
+
+    /**
+     * @brief Run one BDOS function.
+     * @param func Function number, the C register.
+     * @param de Parameter, the DE register.
+     * @return Result, A is the low byte and HL the whole value.
+     */
+    uint16_t call(uint8_t func, uint16_t de);
+
+    /**
+     * @brief Program return code set with function 108, 0 if never set.
+     *     Values of FF00h and up mean the program failed.
+     */
+    uint16_t returnCode() const
+    {
+        return ret_code_;
+    }
+
+    std::istream   *con_in = &std::cin;
+    std::ostream   *con_out = &std::cout;
+
+private:
+    struct HostFile {
+        std::string           path;
+        std::vector<uint8_t>  data;
+        bool                  dirty = false;
+    };
+
+    std::string host_name(uint16_t fcb) const;
+    std::string find(const std::string &name) const;
+    bool match(uint16_t fcb, const std::string &name) const;
+    HostFile *file(uint16_t fcb);
+    uint16_t open(uint16_t fcb, bool create);
+    uint16_t close(uint16_t fcb);
+    void release(uint16_t handle);
+    uint16_t search(uint16_t fcb, bool first);
+    uint16_t remove(uint16_t fcb);
+    uint16_t rename(uint16_t fcb);
+    uint16_t read(uint16_t fcb, uint32_t rec);
+    uint16_t write(uint16_t fcb, uint32_t rec);
+    void to_dma(const uint8_t *buf);
+    void from_dma(uint8_t *buf) const;
+    uint32_t seq_record(uint16_t fcb);
+    void set_seq(uint16_t fcb, uint32_t rec);
+    uint32_t rand_record(uint16_t fcb);
+    void set_rand(uint16_t fcb, uint32_t rec);
+    void set_count(uint16_t fcb, const HostFile &f);
+    void read_line(uint16_t buf);
+    void put_name(uint16_t fcb, const std::string &arg);
+    uint8_t get(uint16_t addr) const;
+    void put(uint16_t addr, uint8_t val);
+
+    CPU<uint8_t>               *cpu_ = nullptr;
+    uint8_t                    *regs_ = nullptr;
+    std::string                 dir_;
+    uint16_t                    dma_ = 0x80;
+    uint16_t                    ret_code_ = 0;
+    uint16_t                    next_handle_ = 1;
+    std::map<uint16_t, HostFile> files_;
+    std::vector<std::string>    found_;
+    size_t                      found_pos_ = 0;
+    uint16_t                    search_fcb_ = 0;
+};
+
+}
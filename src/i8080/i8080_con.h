@@ -19,9 +19,20 @@
 
 #pragma once
 
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
 #include "Event.h"
 #include "Console.h"
+#include "TermServer.h"
 #include "Device.h"
+#include "InputLog.h"
+#include "Expect.h"
 
 #define DATA_PORT      0
 #define STATUS_PORT    1
@@ -106,22 +117,58 @@ public:
     {
     }
 
+    virtual auto getType() const -> std::string override
+    {
+        return "2651";
+    }
+
     virtual size_t getSize() const override
     {
         return 4;
     }
 
     virtual void init() {
+        // When replaying, input comes from the log and output goes
+        // straight to stdout, so no terminal is needed.
+        if (!replay_file.empty()) {
+            replay_.open(replay_file);
+            replaying_ = true;
+            return;
+        }
+        if (!record_file.empty())
+            log_.open(record_file);
+        // Headless, input and output are plain files and no thread runs.
+        // A script does the typing in place of an input file.
+        if (!script_file.empty()) {
+            expect_.load(script_file);
+            scripted_ = true;
+            input_file.clear();
+        }
+        if (scripted_ || !input_file.empty() || !output_file.empty()) {
+            open_batch();
+            if (scripted_)
+                expect_.start(steps_);
+            return;
+        }
+        // A line of the terminal server in place of the console.
+        if (!listen_addr.empty()) {
+            line_ = core::TermServer::getInstance()->bind(listen_addr);
+            line_->addReadChar(&reader_);
+            return;
+        }
         con = core::Console::getInstance();
         con->init();
         send_char = con->getSendChar();
-        core::Console_reader *rdr = new core::Console_reader(this, &recv_ch);
-        con->addReadChar(rdr);
+        con->addReadChar(&reader_);
     }
 
     virtual void shutdown()
     {
-        con->shutdown();
+        log_.close(steps_);
+        expect_.close();
+        close_batch();
+        if (con)
+            con->shutdown();
     }
 
     //virtual void start() {}
@@ -134,7 +181,38 @@ public:
         mode2_ = 0;
     }
     //virtual void stop() {}
-    //virtual void step() {}
+
+    /**
+     * @brief Called once per instruction. Characters typed are handed to
+     *     the guest here, so the instruction count at which each one was
+     *     seen can be recorded and replayed exactly.
+     */
+    virtual void step() override
+    {
+        steps_++;
+        if (scripted_) {
+            // Give up on a prompt that never came.
+            if (expect_.expired(steps_) || expect_.failed())
+                if (cpu)
+                    cpu->running = false;
+            return;
+        }
+        if (replaying_) {
+            replay_step();
+            return;
+        }
+        if (!waiting_.load(std::memory_order_acquire) || recv_full)
+            return;
+        char ch;
+        {
+            std::lock_guard<std::mutex> lock(lock_);
+            ch = pending_.front();
+            pending_.pop_front();
+            waiting_.store(!pending_.empty(), std::memory_order_release);
+        }
+        log_.record(steps_, 0, (uint8_t)ch);
+        deliver(ch);
+    }
     //virtual void run() {}
     //virtual void examine() {}
     //virtual void deposit() {}
@@ -150,8 +228,12 @@ public:
 
         case STATUS_PORT:
             val = status_;
+            if (!recv_full && batch_)
+                batch_step();
             if (recv_full)
                 val |= RxRDY;
+            else
+                count_poll();
             if (over_run)
                 val |= RxOVER;
             break;
@@ -180,7 +262,16 @@ public:
             // transmit character.
             //std::cout << val << std::flush;
             ch = (char)val;
-            send_char->notify((void *)&ch);
+            if (scripted_)
+                expect_.output(ch, steps_);
+            if (out_)
+                putc(ch, out_);
+            else if (line_)
+                line_->write(&ch, 1);
+            else if (send_char)
+                send_char->notify((void *)&ch);
+            else
+                std::cout << ch << std::flush;
             break;
         case STATUS_PORT:
             // Write syn1/syn2/dle characters.
@@ -216,40 +307,303 @@ public:
     core::ConfigOptionParser options()
     {
         core::ConfigOptionParser option("Device Options");
+        option.add<core::ConfigValue<std::string>>("record",
+                 "Record console input to file", "", &record_file);
+        option.add<core::ConfigValue<std::string>>("replay",
+                 "Replay console input from file", "", &replay_file);
+        option.add<core::ConfigValue<std::string>>("listen",
+                 "Serve terminal on telnet:[host:]port, tcp:[host:]port or unix:path",
+                 "", &listen_addr);
+        option.add<core::ConfigValue<std::string>>("input",
+                 "Run headless reading input from file, - for stdin",
+                 "", &input_file);
+        option.add<core::ConfigValue<std::string>>("output",
+                 "Run headless writing output to file, - for stdout",
+                 "", &output_file);
+        option.add<core::ConfigValue<std::string>>("script",
+                 "Run headless typing input from an expect script",
+                 "", &script_file);
         return option;
     }
 
+    virtual void save(core::StateOut &out) override
+    {
+        out.put(mode1_);
+        out.put(mode2_);
+        out.put(mode_ptr_);
+        out.put(cmd_);
+        out.put(status_);
+        out.put(recv_buff);
+        out.put(recv_full);
+        out.put(over_run);
+        out.put(steps_);
+        idle_.save(out);
+    }
+
+    virtual void load(core::StateIn &in) override
+    {
+        in.get(mode1_);
+        in.get(mode2_);
+        in.get(mode_ptr_);
+        in.get(cmd_);
+        in.get(status_);
+        in.get(recv_buff);
+        in.get(recv_full);
+        in.get(over_run);
+        in.get(steps_);
+        idle_.load(in);
+    }
+
+    /**
+     * @brief The guest is waiting on input when it has done nothing but
+     *     read an empty status register for a while.
+     */
+    virtual bool waiting() const override
+    {
+        return !replaying_ && idle_.idle() &&
+               !waiting_.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief File to record console input to, set before init.
+     */
+    std::string  record_file;
+
+    /**
+     * @brief File to replay console input from, set before init.
+     */
+    std::string  replay_file;
+
+    /**
+     * @brief Terminal server address to serve the port on instead of the
+     *     console, set before init.
+     */
+    std::string  listen_addr;
+
+    /**
+     * @brief File to read input from when headless, "-" for stdin. When
+     *     either this or output_file is set no terminal is used.
+     */
+    std::string  input_file;
+
+    /**
+     * @brief File to write output to when headless, "-" for stdout.
+     */
+    std::string  output_file;
+
+    /**
+     * @brief Expect script to drive the port from, runs headless.
+     */
+    std::string  script_file;
+
+    /**
+     * @brief Script running the port, check failed() after the run.
+     */
+    const core::Expect &script() const
+    {
+        return expect_;
+    }
+
+    /**
+     * @brief True once headless input has run out with the guest still
+     *     waiting for more, which is what stopped it.
+     */
+    bool input_ended() const
+    {
+        return input_ended_;
+    }
+
+    /**
+     * @brief Line of the terminal server, once bound.
+     */
+    std::shared_ptr<core::TermLine> line() const
+    {
+        return line_;
+    }
+
     void setCPU(shared_ptr<CPU<uint8_t>> cpu_)
     {
         cpu = cpu_;
     }
     shared_ptr<CPU<uint8_t>> cpu;
 
+    /**
+     * @brief Called from the console thread, queue the character for the
+     *     CPU thread to pick up in step().
+     */
     static void recv_ch(void *obj, void *ev)
     {
         char ch = *((char *)ev);
         i8080_2651 *o = (i8080_2651 *)obj;
+        std::lock_guard<std::mutex> lock(o->lock_);
+        o->pending_.push_back(ch);
+        o->waiting_.store(true, std::memory_order_release);
+        if (o->wake)
+            o->wake();
+    }
+
+    /**
+     * @brief Queue a burst of typed characters under one lock.
+     */
+    static void recv_burst(void *obj, const char *data, size_t n)
+    {
+        i8080_2651 *o = (i8080_2651 *)obj;
+        std::lock_guard<std::mutex> lock(o->lock_);
+        o->pending_.insert(o->pending_.end(), data, data + n);
+        o->waiting_.store(true, std::memory_order_release);
+        if (o->wake)
+            o->wake();
+    }
+
+    private:
+    // Read of an empty status register.
+    void count_poll()
+    {
+        // Guest is waiting for a key, show what it has written so far.
+        if (idle_.poll(steps_)) {
+            if (line_)
+                line_->flush();
+            else if (con)
+                con->flush();
+        }
+    }
+
+    void deliver(char ch)
+    {
+        idle_.reset();
         if (ch == 03) {
-            o->cpu->running = false;
+            if (cpu)
+                cpu->running = false;
             return;
         }
-        o->recv_buff = ch;
-        if (o->recv_full)
-            o->over_run = true;
-        o->recv_full = true;
+        recv_buff = ch;
+        if (recv_full)
+            over_run = true;
+        recv_full = true;
     }
 
-    private:
-    core::Console       *con;
-    core::Event         *send_char;
-    uint8_t     mode1_;
-    uint8_t     mode2_;
+    void replay_step()
+    {
+        while (replay_.due(steps_)) {
+            core::InputEvent ev = replay_.pop();
+            deliver((char)ev.value);
+        }
+        if (replay_.done() && steps_ >= replay_.end())
+            if (cpu)
+                cpu->running = false;
+    }
+
+    // Open the headless files, output through a large stdio buffer.
+    void open_batch()
+    {
+        batch_ = true;
+        in_buf_.resize(batch_size);
+        if (input_file == "-") {
+            in_fd_ = STDIN_FILENO;
+        } else if (!input_file.empty()) {
+            in_fd_ = ::open(input_file.c_str(), O_RDONLY);
+            if (in_fd_ < 0)
+                throw core::SystemError{"Unable to open input: " + input_file};
+        }
+        if (output_file.empty() || output_file == "-") {
+            out_ = stdout;
+        } else {
+            out_ = fopen(output_file.c_str(), "w");
+            if (out_ == nullptr)
+                throw core::SystemError{"Unable to open output: " + output_file};
+        }
+        setvbuf(out_, nullptr, _IOFBF, batch_size);
+    }
+
+    void close_batch()
+    {
+        if (in_fd_ > STDIN_FILENO)
+            ::close(in_fd_);
+        in_fd_ = -1;
+        if (out_ == stdout)
+            fflush(out_);
+        else if (out_)
+            fclose(out_);
+        out_ = nullptr;
+    }
+
+    // The guest found the receiver empty, hand it the next input
+    // character. Reads block, there is nothing else to do until input
+    // arrives, so write out what the guest has said first.
+    void batch_step()
+    {
+        char ch;
+        if (scripted_) {
+            if (expect_.input(ch)) {
+                log_.record(steps_, 0, (uint8_t)ch);
+                deliver(ch);
+            } else if (expect_.done()) {
+                stop_idle();
+            }
+            return;
+        }
+        if (in_pos_ == in_len_ && in_fd_ >= 0) {
+            fflush(out_);
+            ssize_t  n;
+            do {
+                n = ::read(in_fd_, in_buf_.data(), in_buf_.size());
+            } while (n < 0 && errno == EINTR);
+            in_pos_ = 0;
+            in_len_ = (n > 0) ? (size_t)n : 0;
+            if (n <= 0) {
+                if (in_fd_ > STDIN_FILENO)
+                    ::close(in_fd_);
+                in_fd_ = -1;
+            }
+        }
+        if (in_pos_ < in_len_) {
+            ch = in_buf_[in_pos_++];
+            log_.record(steps_, 0, (uint8_t)ch);
+            deliver(ch);
+            return;
+        }
+        stop_idle();
+    }
+
+    // Out of input, stop once the guest settles into waiting.
+    void stop_idle()
+    {
+        if (idle_.count() + 1 >= IdlePoll::limit && cpu) {
+            input_ended_ = true;
+            cpu->running = false;
+        }
+    }
+
+    core::Console       *con = nullptr;
+    core::Event         *send_char = nullptr;
+    std::shared_ptr<core::TermLine> line_;
+    core::Console_reader reader_{this, &recv_ch, &recv_burst};
+    core::InputLog      log_;
+    core::InputReplay   replay_;
+    uint64_t            steps_ = 0;
+    IdlePoll            idle_;
+    bool                replaying_ = false;
+    static constexpr size_t batch_size = 64 * 1024; // Headless buffers.
+    bool                batch_ = false;
+    bool                input_ended_ = false;
+    bool                scripted_ = false;
+    core::Expect        expect_;
+    int                 in_fd_ = -1;
+    std::vector<char>   in_buf_;
+    size_t              in_pos_ = 0;
+    size_t              in_len_ = 0;
+    FILE               *out_ = nullptr;
+    std::mutex          lock_;
+    std::deque<char>    pending_;
+    std::atomic<bool>   waiting_{false};
+    uint8_t     mode1_ = 0;
+    uint8_t     mode2_ = 0;
     bool        mode_ptr_ = false;
-    uint8_t     cmd_;
-    uint8_t     status_;
-    uint8_t     recv_buff;
-    bool        recv_full;
-    bool        over_run;
+    uint8_t     cmd_ = 0;
+    uint8_t     status_ = 0;
+    uint8_t     recv_buff = 0;
+    bool        recv_full = false;
+    bool        over_run = false;
 };
 
 }
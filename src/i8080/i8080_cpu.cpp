@@ -91,8 +91,8 @@ static uint8_t const flag_table[256] = {
     /* 37x */ SGN, SPF, SPF, SGN, SPF, SGN, SGN, SPF
 };
 
-template <cpu_model MOD>
-inline uint8_t i8080_cpu<MOD>::flag_gen(uint8_t v)
+template <cpu_model MOD, class PROF>
+inline uint8_t i8080_cpu<MOD, PROF>::flag_gen(uint8_t v)
 {
     if constexpr (MOD == I8085)
         return flag_table[v];
@@ -100,8 +100,8 @@ inline uint8_t i8080_cpu<MOD>::flag_gen(uint8_t v)
         return flag_table[v] | VFLG;
 }
 
-template <cpu_model MOD>
-inline void i8080_cpu<MOD>::o_add(uint8_t v)
+template <cpu_model MOD, class PROF>
+inline void i8080_cpu<MOD, PROF>::o_add(uint8_t v)
 {
     uint8_t   a = fetch_reg<A>();
     uint8_t   t = a + v;
@@ -117,8 +117,8 @@ inline void i8080_cpu<MOD>::o_add(uint8_t v)
     set_reg<A>(t);
 }
 
-template <cpu_model MOD>
-inline void i8080_cpu<MOD>::o_adc(uint8_t v)
+template <cpu_model MOD, class PROF>
+inline void i8080_cpu<MOD, PROF>::o_adc(uint8_t v)
 {
     uint8_t   a = fetch_reg<A>();
     uint8_t   c = PSW & CARRY;
@@ -135,8 +135,8 @@ inline void i8080_cpu<MOD>::o_adc(uint8_t v)
     set_reg<A>(t);
 }
 
-template <cpu_model MOD>
-inline void i8080_cpu<MOD>::o_sub(uint8_t v)
+template <cpu_model MOD, class PROF>
+inline void i8080_cpu<MOD, PROF>::o_sub(uint8_t v)
 {
     uint8_t   a = fetch_reg<A>();
     uint8_t   t;
@@ -157,8 +157,8 @@ inline void i8080_cpu<MOD>::o_sub(uint8_t v)
     set_reg<A>(t);
 }
 
-template <cpu_model MOD>
-inline void i8080_cpu<MOD>::o_sbb(uint8_t v)
+template <cpu_model MOD, class PROF>
+inline void i8080_cpu<MOD, PROF>::o_sbb(uint8_t v)
 {
     uint8_t   a = fetch_reg<A>();
     uint8_t   t;
@@ -180,8 +180,8 @@ inline void i8080_cpu<MOD>::o_sbb(uint8_t v)
     set_reg<A>(t);
 }
 
-template <cpu_model MOD>
-inline void i8080_cpu<MOD>::o_ana(uint8_t v)
+template <cpu_model MOD, class PROF>
+inline void i8080_cpu<MOD, PROF>::o_ana(uint8_t v)
 {
     uint8_t  a = fetch_reg<A>();
     uint8_t  t;
@@ -200,8 +200,8 @@ inline void i8080_cpu<MOD>::o_ana(uint8_t v)
     set_reg<A>(t);
 }
 
-template <cpu_model MOD>
-inline void i8080_cpu<MOD>::o_xra(uint8_t v)
+template <cpu_model MOD, class PROF>
+inline void i8080_cpu<MOD, PROF>::o_xra(uint8_t v)
 {
     uint8_t  t;
     uint8_t  a = fetch_reg<A>();
@@ -218,8 +218,8 @@ inline void i8080_cpu<MOD>::o_xra(uint8_t v)
     set_reg<A>(t);
 }
 
-template <cpu_model MOD>
-inline void i8080_cpu<MOD>::o_ora(uint8_t v)
+template <cpu_model MOD, class PROF>
+inline void i8080_cpu<MOD, PROF>::o_ora(uint8_t v)
 {
     uint8_t  a =fetch_reg<A>();
     uint8_t  t;
@@ -233,8 +233,8 @@ inline void i8080_cpu<MOD>::o_ora(uint8_t v)
     set_reg<A>(t);
 }
 
-template <cpu_model MOD>
-inline void i8080_cpu<MOD>::o_cmp(uint8_t v)
+template <cpu_model MOD, class PROF>
+inline void i8080_cpu<MOD, PROF>::o_cmp(uint8_t v)
 {
     uint8_t   a = fetch_reg<A>();
     uint8_t   t;
@@ -254,8 +254,8 @@ inline void i8080_cpu<MOD>::o_cmp(uint8_t v)
 
 }
 
-template <cpu_model MOD>
-inline void i8080_cpu<MOD>::o_daa()
+template <cpu_model MOD, class PROF>
+inline void i8080_cpu<MOD, PROF>::o_daa()
 {
     uint8_t   a = fetch_reg<A>();
     uint8_t   d = 0;
@@ -277,9 +277,9 @@ inline void i8080_cpu<MOD>::o_daa()
     set_reg<A>(t);
 }
 
-template <cpu_model MOD>
+template <cpu_model MOD, class PROF>
 template <reg_name R>
-inline void i8080_cpu<MOD>::o_inr()
+inline void i8080_cpu<MOD, PROF>::o_inr()
 {
     uint8_t r = fetch_reg<R>();
     uint8_t t = r + 1;
@@ -290,9 +290,9 @@ inline void i8080_cpu<MOD>::o_inr()
     set_reg<R>(t);
 }
 
-template <cpu_model MOD>
+template <cpu_model MOD, class PROF>
 template <reg_name R>
-inline void i8080_cpu<MOD>::o_dcr()
+inline void i8080_cpu<MOD, PROF>::o_dcr()
 {
     uint8_t   r = fetch_reg<R>();
     uint8_t   t = r + 0xff;
@@ -303,72 +303,72 @@ inline void i8080_cpu<MOD>::o_dcr()
     set_reg<R>(t);
 }
 
-template <cpu_model MOD>
-inline void i8080_cpu<MOD>::o_adi()
+template <cpu_model MOD, class PROF>
+inline void i8080_cpu<MOD, PROF>::o_adi()
 {
     uint8_t data;
     data = fetch();
     o_add(data);
 }
 
-template <cpu_model MOD>
-inline void i8080_cpu<MOD>::o_aci()
+template <cpu_model MOD, class PROF>
+inline void i8080_cpu<MOD, PROF>::o_aci()
 {
     uint8_t data;
     data = fetch();
     o_adc(data);
 }
 
-template <cpu_model MOD>
-inline void i8080_cpu<MOD>::o_sui()
+template <cpu_model MOD, class PROF>
+inline void i8080_cpu<MOD, PROF>::o_sui()
 {
     uint8_t data;
     data = fetch();
     o_sub(data);
 }
 
-template <cpu_model MOD>
-inline void i8080_cpu<MOD>::o_sbi()
+template <cpu_model MOD, class PROF>
+inline void i8080_cpu<MOD, PROF>::o_sbi()
 {
     uint8_t data;
     data = fetch();
     o_sbb(data);
 }
 
-template <cpu_model MOD>
-inline void i8080_cpu<MOD>::o_ani()
+template <cpu_model MOD, class PROF>
+inline void i8080_cpu<MOD, PROF>::o_ani()
 {
     uint8_t data;
     data = fetch();
     o_ana(data);
 }
 
-template <cpu_model MOD>
-inline void i8080_cpu<MOD>::o_xri()
+template <cpu_model MOD, class PROF>
+inline void i8080_cpu<MOD, PROF>::o_xri()
 {
     uint8_t data;
     data = fetch();
     o_xra(data);
 }
 
-template <cpu_model MOD>
-inline void i8080_cpu<MOD>::o_ori()
+template <cpu_model MOD, class PROF>
+inline void i8080_cpu<MOD, PROF>::o_ori()
 {
     uint8_t data;
     data = fetch();
     o_ora(data);
 }
 
-template <cpu_model MOD>
-inline void i8080_cpu<MOD>::o_cpi()
+template <cpu_model MOD, class PROF>
+inline void i8080_cpu<MOD, PROF>::o_cpi()
 {
     uint8_t data;
     data = fetch();
     o_cmp(data);
 }
 
-template <cpu_model MOD>
-void i8080_cpu<MOD>::o_rlc()
+template <cpu_model MOD, class PROF>
+void i8080_cpu<MOD, PROF>::o_rlc()
 {
     uint8_t  c;
     uint8_t  a = fetch_reg<A>();
@@ -378,8 +378,8 @@ void i8080_cpu<MOD>::o_rlc()
     set_reg<A>(a);
 }
 
-template <cpu_model MOD>
-void i8080_cpu<MOD>::o_rrc()
+template <cpu_model MOD, class PROF>
+void i8080_cpu<MOD, PROF>::o_rrc()
 {
     uint8_t c;
     uint8_t a = fetch_reg<A>();
@@ -394,8 +394,8 @@ void i8080_cpu<MOD>::o_rrc()
     }
 }
 
-template <cpu_model MOD>
-void i8080_cpu<MOD>::o_ral()
+template <cpu_model MOD, class PROF>
+void i8080_cpu<MOD, PROF>::o_ral()
 {
     uint8_t c;
     uint8_t a = fetch_reg<A>();
@@ -406,8 +406,8 @@ void i8080_cpu<MOD>::o_ral()
     PSW = (PSW & ~CARRY) | c;
 }
 
-template <cpu_model MOD>
-void i8080_cpu<MOD>::o_rar()
+template <cpu_model MOD, class PROF>
+void i8080_cpu<MOD, PROF>::o_rar()
 {
     uint8_t c;
     uint8_t a = fetch_reg<A>();
@@ -423,29 +423,29 @@ void i8080_cpu<MOD>::o_rar()
     }
 }
 
-template <cpu_model MOD>
-void i8080_cpu<MOD>::o_cma()
+template <cpu_model MOD, class PROF>
+void i8080_cpu<MOD, PROF>::o_cma()
 {
     uint8_t a = fetch_reg<A>();
     a ^= 0377;
     set_reg<A>(a);
 }
 
-template <cpu_model MOD>
-void i8080_cpu<MOD>::o_stc()
+template <cpu_model MOD, class PROF>
+void i8080_cpu<MOD, PROF>::o_stc()
 {
     PSW |= CARRY;
 }
 
-template <cpu_model MOD>
-void i8080_cpu<MOD>::o_cmc()
+template <cpu_model MOD, class PROF>
+void i8080_cpu<MOD, PROF>::o_cmc()
 {
     PSW ^= CARRY;
 }
 
-template <cpu_model MOD>
+template <cpu_model MOD, class PROF>
 template <reg_pair RP>
-void i8080_cpu<MOD>::o_lxi()
+void i8080_cpu<MOD, PROF>::o_lxi()
 {
     uint16_t addr;
 
@@ -453,9 +453,9 @@ void i8080_cpu<MOD>::o_lxi()
     setregpair<RP>(addr);
 }
 
-template <cpu_model MOD>
+template <cpu_model MOD, class PROF>
 template <reg_pair RP>
-void i8080_cpu<MOD>::o_dad()
+void i8080_cpu<MOD, PROF>::o_dad()
 {
     uint32_t t;
     t = (uint32_t)regpair<HL>() + (uint32_t)regpair<RP>();
@@ -465,9 +465,9 @@ void i8080_cpu<MOD>::o_dad()
         PSW |= CARRY;
 }
 
-template <cpu_model MOD>
+template <cpu_model MOD, class PROF>
 template <reg_pair RP>
-void i8080_cpu<MOD>::o_inx()
+void i8080_cpu<MOD, PROF>::o_inx()
 {
     uint16_t addr;
 
@@ -475,9 +475,9 @@ void i8080_cpu<MOD>::o_inx()
     setregpair<RP>(addr + 1);
 }
 
-template <cpu_model MOD>
+template <cpu_model MOD, class PROF>
 template <reg_pair RP>
-void i8080_cpu<MOD>::o_dcx()
+void i8080_cpu<MOD, PROF>::o_dcx()
 {
     uint16_t addr;
 
@@ -485,9 +485,9 @@ void i8080_cpu<MOD>::o_dcx()
     setregpair<RP>(addr - 1);
 }
 
-template <cpu_model MOD>
+template <cpu_model MOD, class PROF>
 template <reg_pair RP>
-void i8080_cpu<MOD>::o_stax()
+void i8080_cpu<MOD, PROF>::o_stax()
 {
     uint16_t addr;
 
@@ -495,8 +495,8 @@ void i8080_cpu<MOD>::o_stax()
     mem->write(regs[A], addr);
 }
 
-template <cpu_model MOD>
-void i8080_cpu<MOD>::o_lhld()
+template <cpu_model MOD, class PROF>
+void i8080_cpu<MOD, PROF>::o_lhld()
 {
     uint16_t addr;
 
@@ -505,17 +505,17 @@ void i8080_cpu<MOD>::o_lhld()
     setregpair<HL>(addr);
 }
 
-template <cpu_model MOD>
-void i8080_cpu<MOD>::o_shld()
+template <cpu_model MOD, class PROF>
+void i8080_cpu<MOD, PROF>::o_shld()
 {
     uint16_t addr;
     addr = fetch_addr();
     store_double(regpair<HL>(), addr);
 }
 
-template <cpu_model MOD>
+template <cpu_model MOD, class PROF>
 template <reg_pair RP>
-void i8080_cpu<MOD>::o_ldax()
+void i8080_cpu<MOD, PROF>::o_ldax()
 {
     uint16_t addr;
 
@@ -523,8 +523,8 @@ void i8080_cpu<MOD>::o_ldax()
     mem->read(regs[A], addr);
 }
 
-template <cpu_model MOD>
-void i8080_cpu<MOD>::o_sta()
+template <cpu_model MOD, class PROF>
+void i8080_cpu<MOD, PROF>::o_sta()
 {
     uint16_t addr;
 
@@ -532,8 +532,8 @@ void i8080_cpu<MOD>::o_sta()
     mem->write(regs[A], addr);
 }
 
-template <cpu_model MOD>
-void i8080_cpu<MOD>::o_lda()
+template <cpu_model MOD, class PROF>
+void i8080_cpu<MOD, PROF>::o_lda()
 {
     uint16_t addr;
     uint8_t data;
@@ -543,17 +543,19 @@ void i8080_cpu<MOD>::o_lda()
     regs[A] = data;
 }
 
-template <cpu_model MOD>
-void i8080_cpu<MOD>::o_rcc(int c)
+template <cpu_model MOD, class PROF>
+void i8080_cpu<MOD, PROF>::o_rcc(int c)
 {
     if (c) {
+        if constexpr (PROF::enabled)
+            profile.ret(sp);
         pc = pop();
         cycle_time += 6*Tc;
     }
 }
 
-template <cpu_model MOD>
-void i8080_cpu<MOD>::o_ccc(int c)
+template <cpu_model MOD, class PROF>
+void i8080_cpu<MOD, PROF>::o_ccc(int c)
 {
     uint16_t addr = fetch_addr();
 
@@ -561,11 +563,13 @@ void i8080_cpu<MOD>::o_ccc(int c)
         push(pc);
         pc = addr;
         cycle_time += 6*Tc;
+        if constexpr (PROF::enabled)
+            profile.call(addr, sp);
     }
 }
 
-template <cpu_model MOD>
-void i8080_cpu<MOD>::o_jcc(int c)
+template <cpu_model MOD, class PROF>
+void i8080_cpu<MOD, PROF>::o_jcc(int c)
 {
     uint16_t addr = fetch_addr();
 
@@ -575,9 +579,9 @@ void i8080_cpu<MOD>::o_jcc(int c)
     }
 }
 
-template <cpu_model MOD>
+template <cpu_model MOD, class PROF>
 template <reg_pair RP>
-void i8080_cpu<MOD>::o_pop()
+void i8080_cpu<MOD, PROF>::o_pop()
 {
     uint16_t addr;
 
@@ -585,35 +589,37 @@ void i8080_cpu<MOD>::o_pop()
     setregpair<RP>(addr);
 }
 
-template <cpu_model MOD>
+template <cpu_model MOD, class PROF>
 template <reg_pair RP>
-void i8080_cpu<MOD>::o_push()
+void i8080_cpu<MOD, PROF>::o_push()
 {
     uint16_t addr;
     addr = regpair<RP>();
     push(addr);
 }
 
-template <cpu_model MOD>
-void i8080_cpu<MOD>::o_call()
+template <cpu_model MOD, class PROF>
+void i8080_cpu<MOD, PROF>::o_call()
 {
     uint16_t addr;
 
     addr = fetch_addr();
     push(pc);
     pc = addr;
+    if constexpr (PROF::enabled)
+        profile.call(addr, sp);
 }
 
-template <cpu_model MOD>
-void i8080_cpu<MOD>::o_jmp()
+template <cpu_model MOD, class PROF>
+void i8080_cpu<MOD, PROF>::o_jmp()
 {
     uint16_t addr;
     addr = fetch_addr();
     pc = addr;
 }
 
-template <cpu_model MOD>
-void i8080_cpu<MOD>::o_xcht()
+template <cpu_model MOD, class PROF>
+void i8080_cpu<MOD, PROF>::o_xcht()
 {
     uint8_t data;
     uint8_t r;
@@ -623,13 +629,13 @@ void i8080_cpu<MOD>::o_xcht()
     mem->write(r, sp);
     set_reg<L>(data);
     r = fetch_reg<H>();
-    mem->read(data, sp+1);
-    mem->write(r, sp+1);
+    mem->read(data, (uint16_t)(sp + 1));
+    mem->write(r, (uint16_t)(sp + 1));
     set_reg<H>(data);
 }
 
-template <cpu_model MOD>
-void i8080_cpu<MOD>::o_xchg()
+template <cpu_model MOD, class PROF>
+void i8080_cpu<MOD, PROF>::o_xchg()
 {
     uint16_t addr;
 
@@ -638,75 +644,86 @@ void i8080_cpu<MOD>::o_xchg()
     setregpair<DE>(addr);
 }
 
-template <cpu_model MOD>
-void i8080_cpu<MOD>::o_out()
+template <cpu_model MOD, class PROF>
+void i8080_cpu<MOD, PROF>::o_out()
 {
     uint8_t    port;
     port = fetch();
     io->output(regs[A], port);
 }
 
-template <cpu_model MOD>
-void i8080_cpu<MOD>::o_ret()
+template <cpu_model MOD, class PROF>
+void i8080_cpu<MOD, PROF>::o_ret()
 {
+    if constexpr (PROF::enabled)
+        profile.ret(sp);
     pc = pop();
 }
 
-template <cpu_model MOD>
-void i8080_cpu<MOD>::o_pchl()
+template <cpu_model MOD, class PROF>
+void i8080_cpu<MOD, PROF>::o_pchl()
 {
     pc = regpair<HL>();
 }
 
-template <cpu_model MOD>
-void i8080_cpu<MOD>::o_sphl()
+template <cpu_model MOD, class PROF>
+void i8080_cpu<MOD, PROF>::o_sphl()
 {
     sp = regpair<HL>();
 }
 
-template <cpu_model MOD>
-void i8080_cpu<MOD>::o_in()
+template <cpu_model MOD, class PROF>
+void i8080_cpu<MOD, PROF>::o_in()
 {
     uint8_t data;
     data = fetch();
     io->input(regs[A], data);
 }
 
-template <cpu_model MOD>
-void i8080_cpu<MOD>::o_di()
+template <cpu_model MOD, class PROF>
+void i8080_cpu<MOD, PROF>::o_di()
 {
     ie = false;
 }
 
-template <cpu_model MOD>
-void i8080_cpu<MOD>::o_ei()
+template <cpu_model MOD, class PROF>
+void i8080_cpu<MOD, PROF>::o_ei()
 {
     ie = true;
 }
 
-template <cpu_model MOD>
-void i8080_cpu<MOD>::o_hlt()
+template <cpu_model MOD, class PROF>
+void i8080_cpu<MOD, PROF>::o_hlt()
 {
     running = false;
 }
 
-template <cpu_model MOD>
-void i8080_cpu<MOD>::o_nop()
+template <cpu_model MOD, class PROF>
+void i8080_cpu<MOD, PROF>::o_nop()
 {
 }
 
-template <cpu_model MOD>
-void i8080_cpu<MOD>::o_rim()
+template <cpu_model MOD, class PROF>
+void i8080_cpu<MOD, PROF>::o_rim()
 {
+    if constexpr (MOD == cpu_model::I8085) {
+        // No serial input or pending interrupts, just enable and masks.
+        regs[A] = (ie ? 0x08 : 0) | int_mask;
+    }
 }
 
-template <cpu_model MOD>
-void i8080_cpu<MOD>::o_sim()
+template <cpu_model MOD, class PROF>
+void i8080_cpu<MOD, PROF>::o_sim()
 {
+    if constexpr (MOD == cpu_model::I8085) {
+        // Mask set enable.
+        if (regs[A] & 0x08)
+            int_mask = regs[A] & 0x07;
+    }
 }
 
-template <cpu_model MOD>
-void i8080_cpu<MOD>::o_dsub()
+template <cpu_model MOD, class PROF>
+void i8080_cpu<MOD, PROF>::o_dsub()
 {
     if constexpr (MOD == cpu_model::I8085) {
         uint32_t  t;
@@ -718,8 +735,8 @@ void i8080_cpu<MOD>::o_dsub()
     }
 }
 
-template <cpu_model MOD>
-void i8080_cpu<MOD>::o_arhl()
+template <cpu_model MOD, class PROF>
+void i8080_cpu<MOD, PROF>::o_arhl()
 {
     if constexpr (MOD == cpu_model::I8085) {
         uint16_t t;
@@ -731,8 +748,8 @@ void i8080_cpu<MOD>::o_arhl()
     }
 }
 
-template <cpu_model MOD>
-void i8080_cpu<MOD>::o_rdel()
+template <cpu_model MOD, class PROF>
+void i8080_cpu<MOD, PROF>::o_rdel()
 {
     if constexpr (MOD == cpu_model::I8085) {
         uint16_t t;
@@ -740,14 +757,14 @@ void i8080_cpu<MOD>::o_rdel()
         t = regpair<DE>();
         PSW &= ~CARRY;
         if (t & 0x8000)
-            PSW |= t & CARRY;
+            PSW |= CARRY;
         t = (t << 1) | c;
         setregpair<DE>(t);
     }
 }
 
-template <cpu_model MOD>
-void i8080_cpu<MOD>::o_ldhi()
+template <cpu_model MOD, class PROF>
+void i8080_cpu<MOD, PROF>::o_ldhi()
 {
     if constexpr (MOD == cpu_model::I8085) {
         uint16_t t = regpair<HL>();
@@ -758,8 +775,8 @@ void i8080_cpu<MOD>::o_ldhi()
     }
 }
 
-template <cpu_model MOD>
-void i8080_cpu<MOD>::o_ldsi()
+template <cpu_model MOD, class PROF>
+void i8080_cpu<MOD, PROF>::o_ldsi()
 {
     if constexpr (MOD == cpu_model::I8085) {
         uint16_t t = regpair<SP>();
@@ -770,58 +787,80 @@ void i8080_cpu<MOD>::o_ldsi()
     }
 }
 
-template <cpu_model MOD>
-void i8080_cpu<MOD>::o_rstv()
+template <cpu_model MOD, class PROF>
+void i8080_cpu<MOD, PROF>::o_rstv()
 {
     if constexpr (MOD == cpu_model::I8085) {
         if (PSW & VFLG) {
             push(pc);
             pc = 0x40;
+            if constexpr (PROF::enabled)
+                profile.call(0x40, sp);
         }
+    } else {
+        // Undocumented 8080 alias of JMP.
+        cycle_time = ins_time[0303];
+        o_jmp();
     }
 }
 
-template <cpu_model MOD>
-void i8080_cpu<MOD>::o_shlx()
+template <cpu_model MOD, class PROF>
+void i8080_cpu<MOD, PROF>::o_shlx()
 {
     if constexpr (MOD == cpu_model::I8085) {
         uint16_t  data = regpair<HL>();
         uint16_t  addr = regpair<DE>();
 
         store_double(data, addr);
+    } else {
+        // Undocumented 8080 alias of RET.
+        cycle_time = ins_time[0311];
+        o_ret();
     }
 }
 
-template <cpu_model MOD>
-void i8080_cpu<MOD>::o_lhlx()
+template <cpu_model MOD, class PROF>
+void i8080_cpu<MOD, PROF>::o_lhlx()
 {
     if constexpr (MOD == cpu_model::I8085) {
         uint16_t  addr = regpair<DE>();
         uint16_t  data = fetch_double(addr);
 
         setregpair<HL>(data);
+    } else {
+        // Undocumented 8080 alias of CALL.
+        cycle_time = ins_time[0315];
+        o_call();
     }
 }
 
-template <cpu_model MOD>
-void i8080_cpu<MOD>::o_jnx5()
+template <cpu_model MOD, class PROF>
+void i8080_cpu<MOD, PROF>::o_jnx5()
 {
     if constexpr (MOD == cpu_model::I8085) {
         uint16_t addr = fetch_addr();
 
         if ((PSW & XFLG) == 0)
             pc = addr;
+    } else {
+        // Undocumented 8080 alias of CALL.
+        cycle_time = ins_time[0315];
+        o_call();
     }
 }
 
-template <cpu_model MOD>
-void i8080_cpu<MOD>::o_jx5()
+template <cpu_model MOD, class PROF>
+void i8080_cpu<MOD, PROF>::o_jx5()
 {
     if constexpr (MOD == cpu_model::I8085) {
         uint16_t addr = fetch_addr();
 
         if ((PSW & XFLG) != 0)
             pc = addr;
+    } else {
+        // Undocumented 8080 alias of CALL.
+        cycle_time = ins_time[0315];
+        o_call();
     }
 }
 
@@ -864,13 +903,15 @@ void i8080_cpu<MOD>::o_jx5()
 #define CCR(f,b) CC(f,OPR,b,0,cpu_model::I8080)
 #define CCJ(f,b) CC(f,ABS,b,0,cpu_model::I8080)
 #define CCC(f,b) CC(f,ABS,b,0,cpu_model::I8080)
-#define RSTX(b,n)      case b+(n<<3): push(pc); pc = (n << 3); break;
+#define RSTX(b,n)      case b+(n<<3): push(pc); pc = (n << 3); \
+    if constexpr (PROF::enabled) { profile.call(n << 3, sp); } \
+    break;
 #define RST(f,b) RSTX(b,0) RSTX(b,1) RSTX(b,2) RSTX(b,3) \
     RSTX(b,4) RSTX(b,5) RSTX(b,6) RSTX(b,7)
 #define INSN(name, type, base, model) type(name, base)
 
-template <cpu_model MOD>
-void i8080_cpu<MOD>::decode(uint8_t op)
+template <cpu_model MOD, class PROF>
+void i8080_cpu<MOD, PROF>::decode(uint8_t op)
 {
     uint8_t    data;
 
@@ -879,14 +920,17 @@ void i8080_cpu<MOD>::decode(uint8_t op)
     }
 }
 
-template <cpu_model MOD>
-uint64_t i8080_cpu<MOD>::step()
+template <cpu_model MOD, class PROF>
+uint64_t i8080_cpu<MOD, PROF>::step()
 {
     uint8_t   ir;
+    [[maybe_unused]] uint16_t opc = pc;
 
     ir = fetch();
     cycle_time = ins_time[ir];
     decode(ir);
+    if constexpr (PROF::enabled)
+        profile.count(opc, ir, cycle_time);
     io->step();
 
     return cycle_time;
@@ -949,8 +993,8 @@ struct opcode {
     { "", OPR, 0, I8080}
 };
 
-template <cpu_model MOD>
-string i8080_cpu<MOD>::disassemble(uint8_t ir, uint16_t addr, int &len)
+template <cpu_model MOD, class PROF>
+string i8080_cpu<MOD, PROF>::disassemble(uint8_t ir, uint16_t addr, int &len)
 {
     const struct opcode *op;
     stringstream temp;
@@ -1013,8 +1057,8 @@ string i8080_cpu<MOD>::disassemble(uint8_t ir, uint16_t addr, int &len)
     return temp.str();
 }
 
-template <cpu_model MOD>
-string i8080_cpu<MOD>::dumpregs(uint8_t regs[8])
+template <cpu_model MOD, class PROF>
+string i8080_cpu<MOD, PROF>::dumpregs(uint8_t regs[8])
 {
     int i;
     stringstream temp;
@@ -1028,8 +1072,8 @@ string i8080_cpu<MOD>::dumpregs(uint8_t regs[8])
     return temp.str();
 }
 
-template <cpu_model MOD>
-void emulator::i8080_cpu<MOD>::trace()
+template <cpu_model MOD, class PROF>
+void emulator::i8080_cpu<MOD, PROF>::trace()
 {
     string    temp;
     uint16_t  addr;
@@ -1048,8 +1092,58 @@ void emulator::i8080_cpu<MOD>::trace()
     cout << disassemble(ir, addr, len) << endl;
 }
 
+template <cpu_model MOD, class PROF>
+void emulator::i8080_cpu<MOD, PROF>::dump_profile(ostream &out, size_t top)
+{
+    if constexpr (PROF::enabled) {
+        uint64_t  total = profile.total_count();
+        uint64_t  cycles = profile.total_cycles();
+        int       len;
+
+        if (total == 0) {
+            out << "No instructions profiled" << endl;
+            return;
+        }
+        out << dec << "Instructions: " << total << " Time: " << cycles << endl;
+        out << "Opcode       count   pct      time   pct" << endl;
+        for (auto ir : profile.hot_ops(top)) {
+            out << oct << setfill('0') << setw(3) << (unsigned int)ir << " ";
+            string name = disassemble(ir, 0, len);
+            out << left << setfill(' ') << setw(6) <<
+                   name.substr(0, name.find(' ')) << right;
+            out << dec << setw(10) << profile.op_count[ir] << " ";
+            out << setw(5) << (profile.op_count[ir] * 100) / total << " ";
+            out << setw(10) << profile.op_cycles[ir] << " ";
+            out << setw(5) << (profile.op_cycles[ir] * 100) / cycles << endl;
+        }
+        out << "Address              count   pct  Instruction" << endl;
+        for (auto addr : profile.hot_spots(top)) {
+            uint8_t   ir;
+            uint8_t   t;
+            uint16_t  arg;
+
+            mem->read(ir, addr);
+            mem->read(t, (addr + 1) & 0xffff);
+            arg = t;
+            mem->read(t, (addr + 2) & 0xffff);
+            arg |= (t << 8);
+            out << hex << setfill('0') << setw(4) << addr << " ";
+            out << left << setfill(' ') << setw(12) << profile.symbol(addr) << right;
+            out << dec << setw(10) << profile.pc_count[addr] << " ";
+            out << setw(5) << (profile.pc_count[addr] * 100) / total << "  ";
+            out << disassemble(ir, arg, len) << endl;
+        }
+    } else {
+        out << "Profiling not enabled for " << getType() << endl;
+    }
+}
+
 template class i8080_cpu<I8080>;
 template class i8080_cpu<I8085>;
+template class i8080_cpu<I8080, i8080_profile>;
+template class i8080_cpu<I8085, i8080_profile>;
+template class i8080_cpu<I8080, i8080_callgraph>;
+template class i8080_cpu<I8085, i8080_callgraph>;
 }
 
 std::map<std::string, core::CPUFactory *> core::i8080::cpu_factories;
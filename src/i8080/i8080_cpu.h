@@ -25,6 +25,7 @@
 #include "CPU.h"
 #include "Memory.h"
 #include "ConfigOption.h"
+#include "i8080_profile.h"
 
 namespace emulator
 {
@@ -53,13 +54,22 @@ enum reg_pair {
 };
 
 
-template <enum cpu_model MOD>
+/**
+ * @class i8080_cpu
+ * @author rich
+ * @date 18/10/26
+ * @file i8080_cpu.h
+ * @brief Intel 8080/8085 CPU. MOD selects the model, PROF selects the
+ *     profiling policy run after each instruction, see i8080_profile.h.
+ */
+template <enum cpu_model MOD, class PROF = i8080_noprofile>
 class i8080_cpu : public CPU<uint8_t>
 {
 public:
     i8080_cpu()
     {
         page_size = 4096;
+        int_mask = 7;
     }
     virtual ~i8080_cpu()
     {
@@ -74,6 +84,7 @@ public:
 
     uint16_t  sp;
     bool      ie;
+    uint8_t   int_mask;                // 8085 RST 7.5, 6.5, 5.5 masks.
 
     uint8_t   regs[8];
     uint8_t   PSW;
@@ -84,11 +95,31 @@ public:
     virtual
     core::ConfigOptionParser options() override
     {
-        core::ConfigOptionParser option("CPU options");
+        core::ConfigOptionParser option = CPU<uint8_t>::options();
         auto page_opt = option.add<core::ConfigValue<int>>("pagesize", "address spacing", 0, &page_size);
         return option;
     }
 
+    virtual void save(core::StateOut &out) override
+    {
+        CPU<uint8_t>::save(out);
+        out.put(sp);
+        out.put(ie);
+        out.put(int_mask);
+        out.put(regs);
+        out.put(PSW);
+    }
+
+    virtual void load(core::StateIn &in) override
+    {
+        CPU<uint8_t>::load(in);
+        in.get(sp);
+        in.get(ie);
+        in.get(int_mask);
+        in.get(regs);
+        in.get(PSW);
+    }
+
 #define Tc 250
     int   ins_time[256] = {
         /*   0     1     2     3     4     5     6     7 */
@@ -426,6 +457,7 @@ public:
         pc = 0;
         PSW = 2;
         ie = false;
+        int_mask = 7;
         io->reset();
     };
 
@@ -447,6 +479,19 @@ public:
 
     string disassemble(uint8_t ir, uint16_t addr, int &len);
 
+    /**
+     * @brief Print the most used opcodes and addresses collected by the
+     *     profiling policy.
+     * @param out Stream to print to.
+     * @param top Number of entries in each table.
+     */
+    void dump_profile(std::ostream &out, size_t top = 20);
+
+    /**
+     * @brief Profile data, empty unless PROF is i8080_profile.
+     */
+    PROF      profile;
+
     string dumpregs(uint8_t regs[8]);
 };
 
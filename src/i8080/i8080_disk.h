@@ -0,0 +1,310 @@
+/*
+ * Author:      Richard Cornwell (rich@sky-visions.com)
+ *
+ * Copyright (C) 2021 Richard Cornwell.
+ *
+ * This file may be distributed under the terms of the Q Public License
+ * as defined by Trolltech AS of Norway and appearing in the file
+ * LICENSE.QPL included in the packaging of this file.
+ *
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING
+ * THE WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL,
+ * INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING
+ * FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION
+ * WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+#pragma once
+#include <array>
+#include <memory>
+#include <string>
+#include "Device.h"
+#include "DiskImage.h"
+
+namespace emulator
+{
+
+/**
+ * @class i8080_disk
+ * @author rich
+ * @date 18/10/26
+ * @file i8080_disk.h
+ * @brief DMA disk controller for up to four drives, floppy or hard disk
+ *     depending on the image mounted.
+ *
+ *     The guest loads unit, track, sector, DMA address and sector count
+ *     then writes a command. The whole transfer is done at once, copied
+ *     between the mapped image and guest memory a block at a time, and
+ *     status is ready when the command port is next read. Written sectors
+ *     are left in the host page cache and written back every flush_every
+ *     instructions without waiting, and in full at shutdown.
+ *
+ *     Ports, from the base address:
+ *         0  Command when written, status when read.
+ *         1  Unit.
+ *         2  Track, low byte.
+ *         3  Track, high byte.
+ *         4  Sector, from 0.
+ *         5  DMA address, low byte.
+ *         6  DMA address, high byte.
+ *         7  Sectors to transfer, 0 is taken as 1.
+ */
+class i8080_disk : public Device<uint8_t>
+{
+public:
+    // Commands.
+    static constexpr uint8_t cmd_read = 1;
+    static constexpr uint8_t cmd_write = 2;
+    static constexpr uint8_t cmd_flush = 3;
+
+    // Status bits.
+    static constexpr uint8_t st_error = 0x01;       // Command failed.
+    static constexpr uint8_t st_not_ready = 0x02;   // Nothing mounted.
+    static constexpr uint8_t st_protect = 0x04;     // Mounted read only.
+    static constexpr uint8_t st_range = 0x08;       // Beyond end of disk.
+
+    static constexpr int max_units = 4;
+
+    /**
+     * @brief Instructions between starting write back of dirty sectors.
+     */
+    static constexpr uint64_t flush_every = 1 << 20;
+
+    i8080_disk() : Device()
+    {
+    }
+
+    i8080_disk(const std::string &name) : Device(name)
+    {
+    }
+
+    virtual ~i8080_disk()
+    {
+    }
+
+    virtual auto getType() const -> std::string override
+    {
+        return "disk";
+    }
+
+    virtual size_t getSize() const override
+    {
+        return 8;
+    }
+
+    /**
+     * @brief Memory to transfer to, taken from the I/O controller at init
+     *     if not set.
+     */
+    void setMemory(std::shared_ptr<Memory<uint8_t>> mem)
+    {
+        mem_ = mem;
+    }
+
+    /**
+     * @brief Mount an image on a drive, throws SystemError if it can't
+     *     be mounted.
+     */
+    void mount(int unit, const std::string &path, bool ro)
+    {
+        units_.at((size_t)unit) = core::DiskImage::open(path, ro);
+    }
+
+    void unmount(int unit)
+    {
+        auto  &image = units_.at((size_t)unit);
+        if (image)
+            image->flush(true);
+        image.reset();
+    }
+
+    std::shared_ptr<core::DiskImage> image(int unit) const
+    {
+        return units_.at((size_t)unit);
+    }
+
+    virtual void init() override
+    {
+        if (!mem_ && io)
+            mem_ = io->getMemory();
+        for (int i = 0; i < max_units; i++) {
+            if (!mount_file[i].empty())
+                mount(i, mount_file[i], ro[i]);
+        }
+    }
+
+    virtual void shutdown() override
+    {
+        for (int i = 0; i < max_units; i++)
+            unmount(i);
+    }
+
+    virtual void reset() override
+    {
+        status_ = 0;
+    }
+
+    virtual void step() override
+    {
+        if (dirty_ && (++steps_ & (flush_every - 1)) == 0)
+            flush(false);
+    }
+
+    virtual bool input(uint8_t &val, size_t port) override
+    {
+        switch ((port - addr_) & 7) {
+        case 0: val = status_; break;
+        case 1: val = unit_; break;
+        case 2: val = track_ & 0xff; break;
+        case 3: val = track_ >> 8; break;
+        case 4: val = sector_; break;
+        case 5: val = dma_ & 0xff; break;
+        case 6: val = dma_ >> 8; break;
+        case 7: val = count_; break;
+        }
+        return true;
+    }
+
+    virtual bool output(uint8_t val, size_t port) override
+    {
+        switch ((port - addr_) & 7) {
+        case 0: command(val); break;
+        case 1: unit_ = val; break;
+        case 2: track_ = (track_ & 0xff00) | val; break;
+        case 3: track_ = (track_ & 0x00ff) | (val << 8); break;
+        case 4: sector_ = val; break;
+        case 5: dma_ = (dma_ & 0xff00) | val; break;
+        case 6: dma_ = (dma_ & 0x00ff) | (val << 8); break;
+        case 7: count_ = val; break;
+        }
+        return true;
+    }
+
+    virtual
+    core::ConfigOptionParser options() override
+    {
+        core::ConfigOptionParser option("Device Options");
+        option.add<core::ConfigValue<int>>("sectors",
+                 "Sectors per track", 26, &sectors);
+        option.add<core::ConfigValue<int>>("sectorsize",
+                 "Bytes per sector", 128, &sector_size);
+        for (int i = 0; i < max_units; i++) {
+            std::string  n = std::to_string(i);
+            option.add<core::ConfigValue<std::string>>("mount" + n,
+                     "Image to mount on drive " + n, "", &mount_file[i]);
+            option.add<core::ConfigBool>("ro" + n,
+                     "Mount drive " + n + " read only", &ro[i]);
+        }
+        return option;
+    }
+
+    /**
+     * @brief Registers are saved, the images are host side and are not.
+     */
+    virtual void save(core::StateOut &out) override
+    {
+        out.put(unit_);
+        out.put(track_);
+        out.put(sector_);
+        out.put(dma_);
+        out.put(count_);
+        out.put(status_);
+    }
+
+    virtual void load(core::StateIn &in) override
+    {
+        in.get(unit_);
+        in.get(track_);
+        in.get(sector_);
+        in.get(dma_);
+        in.get(count_);
+        in.get(status_);
+    }
+
+    /**
+     * @brief Geometry, set before the drives are used.
+     */
+    int          sectors = 26;
+    int          sector_size = 128;
+
+    /**
+     * @brief Image for each drive and whether it is read only, mounted
+     *     at init.
+     */
+    std::string  mount_file[max_units];
+    bool         ro[max_units] = {};
+
+private:
+    void command(uint8_t cmd)
+    {
+        switch (cmd) {
+        case cmd_read:
+        case cmd_write:
+            status_ = transfer(cmd == cmd_write);
+            break;
+        case cmd_flush:
+            flush(false);
+            status_ = 0;
+            break;
+        default:
+            status_ = st_error;
+            break;
+        }
+    }
+
+    uint8_t transfer(bool write)
+    {
+        if (unit_ >= max_units)
+            return st_error | st_not_ready;
+        auto  &image = units_[unit_];
+
+        if (!image || !mem_)
+            return st_error | st_not_ready;
+        if (sector_ >= sectors)
+            return st_error | st_range;
+        size_t  off = ((size_t)track_ * sectors + sector_) * sector_size;
+        size_t  len = (size_t)(count_ ? count_ : 1) * sector_size;
+        if (off + len > image->size())
+            return st_error | st_range;
+        if (!write) {
+            if (mem_->write_block(image->data() + off, dma_, len) != len)
+                return st_error | st_range;
+            return 0;
+        }
+        if (image->readOnly())
+            return st_error | st_protect;
+        if (mem_->read_block(image->writable() + off, dma_, len) != len)
+            return st_error | st_range;
+        image->mark(off, len);
+        dirty_ = true;
+        return 0;
+    }
+
+    void flush(bool wait)
+    {
+        for (auto &image : units_) {
+            if (image)
+                image->flush(wait);
+        }
+        dirty_ = false;
+    }
+
+    std::shared_ptr<Memory<uint8_t>>   mem_;
+    std::array<std::shared_ptr<core::DiskImage>, max_units> units_;
+    bool        dirty_ = false;
+    uint64_t    steps_ = 0;
+    uint8_t     unit_ = 0;
+    uint16_t    track_ = 0;
+    uint8_t     sector_ = 0;
+    uint16_t    dma_ = 0;
+    uint8_t     count_ = 0;
+    uint8_t     status_ = 0;
+};
+
+}
+
+REGISTER_DEVICE(i8080, disk)
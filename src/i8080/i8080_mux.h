@@ -0,0 +1,399 @@
+/*
+ * Author:      Richard Cornwell (rich@sky-visions.com)
+ *
+ * Copyright (C) 2021 Richard Cornwell.
+ *
+ * This file may be distributed under the terms of the Q Public License
+ * as defined by Trolltech AS of Norway and appearing in the file
+ * LICENSE.QPL included in the packaging of this file.
+ *
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING
+ * THE WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL,
+ * INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING
+ * FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION
+ * WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Console.h"
+#include "Device.h"
+#include "Ring.h"
+#include "TermServer.h"
+
+namespace emulator
+{
+
+/**
+ * @class i8080_mux
+ * @author rich
+ * @date 18/10/26
+ * @file i8080_mux.h
+ * @brief Serial multiplexer board with many lines, like the 8 and 16
+ *     port boards of time sharing systems. Each line has a data port
+ *     followed by a status port, all lines take one contiguous range.
+ *
+ *     Input and output of each line sit in small single producer,
+ *     single consumer rings, so the terminal server thread and the CPU
+ *     thread never lock against each other. Output is passed on to the
+ *     terminal lines for all ports at once every batch instructions, or
+ *     when the guest goes idle.
+ */
+class i8080_mux : public Device<uint8_t>
+{
+public:
+    // Status port bits.
+    static constexpr uint8_t tx_ready = 0x01;   // Room to send.
+    static constexpr uint8_t rx_ready = 0x02;   // Character waiting.
+    static constexpr uint8_t rx_over = 0x10;    // Input was lost.
+    static constexpr uint8_t carrier = 0x40;    // User connected.
+
+    /**
+     * @brief Instructions between passing output on.
+     */
+    static constexpr uint64_t batch = 1024;
+
+    /**
+     * @brief Most lines on one board.
+     */
+    static constexpr int max_lines = 128;
+
+    i8080_mux() : Device()
+    {
+    }
+
+    i8080_mux(const std::string &name) : Device(name)
+    {
+    }
+
+    virtual ~i8080_mux()
+    {
+    }
+
+    virtual auto getType() const -> std::string override
+    {
+        return "mux";
+    }
+
+    /**
+     * @brief Two ports per line.
+     */
+    virtual size_t getSize() const override
+    {
+        return 2 * (size_t)num_lines;
+    }
+
+    /**
+     * @brief Set the number of lines, before the device is added.
+     */
+    void setLines(int n)
+    {
+        num_lines = n;
+    }
+
+    int getLines() const
+    {
+        return num_lines;
+    }
+
+    virtual void init() override
+    {
+        if (num_lines < 1 || num_lines > max_lines)
+            throw core::SystemError{"Mux lines must be 1 to " +
+                                    std::to_string(max_lines)};
+        make_lines();
+        if (listen_addr.empty())
+            return;
+        for (int i = 0; i < num_lines; i++) {
+            Line  &l = *lines_[i];
+            l.term = core::TermServer::getInstance()->bind(line_address(i));
+            l.term->addReadChar(&l.reader);
+        }
+    }
+
+    virtual void reset() override
+    {
+        for (int i = 0; i < (int)lines_.size(); i++)
+            lines_[i]->over_run = false;
+    }
+
+    virtual void step() override
+    {
+        if ((++steps_ & (batch - 1)) == 0)
+            service();
+    }
+
+    virtual bool input(uint8_t &val, size_t port) override
+    {
+        size_t  index = (port - addr_) >> 1;
+
+        if (index >= lines_.size()) {
+            val = 0;
+            return false;
+        }
+        Line   &l = *lines_[index];
+        char    ch;
+        if (((port - addr_) & 1) == 0) {
+            // Data, oldest character typed. Input restored from a saved
+            // state was typed first.
+            if (l.held_pos < l.held.size())
+                val = (uint8_t)l.held[l.held_pos++];
+            else
+                val = l.in.pop(ch) ? (uint8_t)ch : 0;
+            idle_.reset();
+            return true;
+        }
+        val = 0;
+        if (!l.out.full())
+            val |= tx_ready;
+        if (l.pending())
+            val |= rx_ready;
+        else
+            count_poll();
+        if (l.over_run.exchange(false, std::memory_order_relaxed))
+            val |= rx_over;
+        if (!l.term || l.term->connected())
+            val |= carrier;
+        return true;
+    }
+
+    virtual bool output(uint8_t val, size_t port) override
+    {
+        size_t  index = (port - addr_) >> 1;
+
+        if (index >= lines_.size())
+            return false;
+        // Characters sent while the ring is full are lost, as on a UART
+        // written without checking it is ready.
+        if (((port - addr_) & 1) == 0)
+            (void)lines_[index]->out.push((char)val);
+        return true;
+    }
+
+    /**
+     * @brief Pass output of every line on to its terminal line. Called
+     *     from the CPU thread.
+     */
+    void service()
+    {
+        char  buf[out_size];
+
+        for (auto &lp : lines_) {
+            Line  &l = *lp;
+            if (!l.term || l.out.empty())
+                continue;
+            size_t  n = l.out.pop(buf, sizeof(buf));
+            l.term->write(buf, n);
+            l.sent = true;
+        }
+    }
+
+    /**
+     * @brief Hand characters to a line as the terminal server would.
+     *     Called from one producer thread per line.
+     * @return Number taken, the rest were lost.
+     */
+    size_t receive(int line, const char *data, size_t n)
+    {
+        Line   &l = *lines_.at((size_t)line);
+        size_t  done = l.in.push(data, n);
+
+        if (done < n)
+            l.over_run.store(true, std::memory_order_relaxed);
+        if (wake)
+            wake();
+        return done;
+    }
+
+    /**
+     * @brief Take output of a line not bound to the terminal server.
+     * @return Number of characters taken.
+     */
+    size_t take_output(int line, char *data, size_t n)
+    {
+        return lines_.at((size_t)line)->out.pop(data, n);
+    }
+
+    /**
+     * @brief Terminal line a port is served on, nullptr if not bound.
+     */
+    std::shared_ptr<core::TermLine> term(int line) const
+    {
+        return lines_.at((size_t)line)->term;
+    }
+
+    virtual
+    core::ConfigOptionParser options() override
+    {
+        core::ConfigOptionParser option("Device Options");
+        option.add<core::ConfigValue<int>>("lines",
+                 "Number of serial lines", 8, &num_lines);
+        option.add<core::ConfigValue<std::string>>("listen",
+                 "Serve line 0 on telnet:[host:]port, tcp:[host:]port or "
+                 "unix:path, later lines on the following ports or paths",
+                 "", &listen_addr);
+        return option;
+    }
+
+    virtual void save(core::StateOut &out) override
+    {
+        char  buf[out_size];
+
+        out.put((uint32_t)lines_.size());
+        out.put(steps_);
+        idle_.save(out);
+        for (auto &l : lines_) {
+            // Input still held from a load is older than the ring.
+            size_t  held = l->held.size() - l->held_pos;
+            size_t  n = l->in.peek(buf, std::min(in_size, held_size - held));
+            out.put((uint32_t)(held + n));
+            out.put_bytes(l->held.data() + l->held_pos, held);
+            out.put_bytes(buf, n);
+            n = l->out.peek(buf, out_size);
+            out.put((uint32_t)n);
+            out.put_bytes(buf, n);
+        }
+    }
+
+    virtual void load(core::StateIn &in) override
+    {
+        char  buf[out_size];
+
+        make_lines();
+        if (in.get<uint32_t>() != lines_.size())
+            throw core::State_error{"Saved mux has a different number of lines"};
+        in.get(steps_);
+        idle_.load(in);
+        for (auto &l : lines_) {
+            // The input ring belongs to the terminal server thread, which
+            // may already be passing on keys. Saved input is held apart
+            // and read before anything in the ring.
+            while (l->out.pop(buf, sizeof(buf)) != 0);
+            uint32_t  n = in.get<uint32_t>();
+            if (n > held_size)
+                throw core::State_error{"Saved mux input too long"};
+            l->held.resize(n);
+            in.get_bytes(&l->held[0], n);
+            l->held_pos = 0;
+            n = in.get<uint32_t>();
+            if (n > out_size)
+                throw core::State_error{"Saved mux output too long"};
+            in.get_bytes(buf, n);
+            l->out.push(buf, n);
+        }
+    }
+
+    /**
+     * @brief The guest is waiting on input when it has done nothing but
+     *     poll empty lines for a while.
+     */
+    virtual bool waiting() const override
+    {
+        if (!idle_.idle())
+            return false;
+        for (auto &l : lines_) {
+            if (l->pending())
+                return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Address of the first line, set before init.
+     */
+    std::string  listen_addr;
+
+private:
+    static constexpr size_t in_size = 64;
+    static constexpr size_t out_size = 256;
+    static constexpr size_t held_size = 2 * in_size;   // Restored input.
+
+    struct Line {
+        explicit Line(i8080_mux *mux) : mux(mux) {}
+
+        bool pending() const
+        {
+            return held_pos < held.size() || !in.empty();
+        }
+
+        core::SpscRing<char, in_size>    in;
+        core::SpscRing<char, out_size>   out;
+        std::string                      held;       // Restored input.
+        size_t                           held_pos = 0;
+        std::atomic<bool>                over_run{false};
+        bool                             sent = false;
+        i8080_mux                       *mux;
+        int                              index = 0;
+        std::shared_ptr<core::TermLine>  term;
+        core::Console_reader             reader{this, &recv_ch, &recv_burst};
+    };
+
+    static void recv_ch(void *obj, void *ev)
+    {
+        recv_burst(obj, (const char *)ev, 1);
+    }
+
+    // Called on the terminal server thread, the only producer.
+    static void recv_burst(void *obj, const char *data, size_t n)
+    {
+        Line  *l = (Line *)obj;
+        l->mux->receive(l->index, data, n);
+    }
+
+    void make_lines()
+    {
+        if ((int)lines_.size() == num_lines)
+            return;
+        lines_.clear();
+        for (int i = 0; i < num_lines; i++) {
+            lines_.emplace_back(new Line(this));
+            lines_.back()->index = i;
+        }
+    }
+
+    // Once the guest settles into polling empty lines pass the output
+    // on so the user sees the prompt.
+    void count_poll()
+    {
+        if (!idle_.poll(steps_))
+            return;
+        service();
+        for (auto &l : lines_) {
+            if (l->sent) {
+                l->term->flush();
+                l->sent = false;
+            }
+        }
+    }
+
+    // Ports follow on from line 0, Unix paths get the line number added.
+    std::string line_address(int i) const
+    {
+        if (listen_addr.compare(0, 5, "unix:") == 0)
+            return listen_addr + std::to_string(i);
+        size_t  colon = listen_addr.rfind(':');
+        if (colon == std::string::npos)
+            throw core::SystemError{"Bad mux address: " + listen_addr};
+        int     port = atoi(listen_addr.c_str() + colon + 1);
+        if (port == 0)
+            throw core::SystemError{"Mux needs a fixed port: " + listen_addr};
+        return listen_addr.substr(0, colon + 1) + std::to_string(port + i);
+    }
+
+    int                                  num_lines = 8;
+    std::vector<std::unique_ptr<Line>>   lines_;
+    uint64_t                             steps_ = 0;
+    IdlePoll                             idle_;
+};
+
+}
+
+REGISTER_DEVICE(i8080, mux)
@@ -0,0 +1,206 @@
+/*
+ * Author:      Richard Cornwell (rich@sky-visions.com)
+ *
+ * Copyright (C) 2021 Richard Cornwell.
+ *
+ * This file may be distributed under the terms of the Q Public License
+ * as defined by Trolltech AS of Norway and appearing in the file
+ * LICENSE.QPL included in the packaging of this file.
+ *
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING
+ * THE WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL,
+ * INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING
+ * FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION
+ * WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include "i8080_profile.h"
+
+namespace emulator
+{
+
+using namespace std;
+
+void i8080_profile::clear()
+{
+    for (int i = 0; i < 256; i++) {
+        op_count[i] = 0;
+        op_cycles[i] = 0;
+    }
+    for (size_t i = 0; i < 64*1024; i++) {
+        pc_count[i] = 0;
+    }
+}
+
+uint64_t i8080_profile::total_count() const
+{
+    uint64_t  total = 0;
+    for (int i = 0; i < 256; i++)
+        total += op_count[i];
+    return total;
+}
+
+uint64_t i8080_profile::total_cycles() const
+{
+    uint64_t  total = 0;
+    for (int i = 0; i < 256; i++)
+        total += op_cycles[i];
+    return total;
+}
+
+vector<uint8_t> i8080_profile::hot_ops(size_t n) const
+{
+    vector<uint8_t> ops;
+
+    for (int i = 0; i < 256; i++) {
+        if (op_count[i] != 0)
+            ops.push_back((uint8_t)i);
+    }
+    n = min(n, ops.size());
+    partial_sort(ops.begin(), ops.begin() + n, ops.end(),
+                 [this](uint8_t a, uint8_t b) {
+        return op_count[a] > op_count[b];
+    });
+    ops.resize(n);
+    return ops;
+}
+
+vector<uint16_t> i8080_profile::hot_spots(size_t n) const
+{
+    vector<uint16_t> addrs;
+
+    for (size_t i = 0; i < 64*1024; i++) {
+        if (pc_count[i] != 0)
+            addrs.push_back((uint16_t)i);
+    }
+    n = min(n, addrs.size());
+    partial_sort(addrs.begin(), addrs.begin() + n, addrs.end(),
+                 [this](uint16_t a, uint16_t b) {
+        return pc_count[a] > pc_count[b];
+    });
+    addrs.resize(n);
+    return addrs;
+}
+
+bool i8080_profile::load_sym(const string &name)
+{
+    ifstream file(name, ios::in|ios::binary);
+
+    if (!file.is_open())
+        return false;
+    load_sym(file);
+    return true;
+}
+
+size_t i8080_profile::load_sym(istream &is)
+{
+    string   text;
+    size_t   n = 0;
+
+    // Read whole file, stopping at control-Z.
+    getline(is, text, '\032');
+    // Treat all control characters as white space.
+    for (auto &c : text) {
+        if ((unsigned char)c < ' ')
+            c = ' ';
+    }
+    istringstream  in(text);
+    string         addr;
+    string         name;
+    while (in >> addr >> name) {
+        unsigned int  value;
+        stringstream  conv;
+        conv << hex << addr;
+        if (!(conv >> value) || value > 0xffff)
+            continue;
+        symbols[(uint16_t)value] = name;
+        n++;
+    }
+    return n;
+}
+
+string i8080_profile::symbol(uint16_t addr) const
+{
+    stringstream temp;
+    auto         sym = symbols.upper_bound(addr);
+
+    if (sym == symbols.begin()) {
+        temp << hex << setw(4) << setfill('0') << addr;
+        return temp.str();
+    }
+    sym--;
+    temp << sym->second;
+    if (addr != sym->first)
+        temp << "+" << hex << (addr - sym->first);
+    return temp.str();
+}
+
+void i8080_callgraph::clear()
+{
+    i8080_profile::clear();
+    nodes.clear();
+    children.clear();
+    stack.clear();
+    nodes.push_back(Node{0, 0, 0});
+    cur = 0;
+    pending = Pending::none;
+}
+
+void i8080_callgraph::enter()
+{
+    if (stack.size() >= max_depth) {
+        // Too deep, keep charging the current path but remember the
+        // frame so the matching return is found.
+        stack.push_back(Frame{cur, pend_sp});
+        return;
+    }
+    uint64_t  key = ((uint64_t)cur << 16) | pend_addr;
+    auto      child = children.find(key);
+    stack.push_back(Frame{cur, pend_sp});
+    if (child != children.end()) {
+        cur = child->second;
+    } else {
+        nodes.push_back(Node{pend_addr, cur, 0});
+        cur = (uint32_t)(nodes.size() - 1);
+        children[key] = cur;
+    }
+}
+
+void i8080_callgraph::leave()
+{
+    // A return whose stack pointer is below the top frame is a computed
+    // jump, not a return from the call.
+    if (stack.empty() || pend_sp < stack.back().sp)
+        return;
+    // Unwind any frames abandoned by the routine.
+    while (!stack.empty() && stack.back().sp <= pend_sp) {
+        cur = stack.back().node;
+        stack.pop_back();
+    }
+}
+
+void i8080_callgraph::write_collapsed(ostream &out) const
+{
+    vector<uint32_t> path;
+
+    for (uint32_t n = 0; n < nodes.size(); n++) {
+        if (nodes[n].self == 0)
+            continue;
+        path.clear();
+        for (uint32_t p = n; p != 0; p = nodes[p].parent)
+            path.push_back(p);
+        out << symbol(nodes[0].addr);
+        for (auto p = path.rbegin(); p != path.rend(); p++)
+            out << ";" << symbol(nodes[*p].addr);
+        out << " " << dec << nodes[n].self << endl;
+    }
+}
+
+}
@@ -0,0 +1,252 @@
+/*
+ * Author:      Richard Cornwell (rich@sky-visions.com)
+ *
+ * Copyright (C) 2021 Richard Cornwell.
+ *
+ * This file may be distributed under the terms of the Q Public License
+ * as defined by Trolltech AS of Norway and appearing in the file
+ * LICENSE.QPL included in the packaging of this file.
+ *
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING
+ * THE WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL,
+ * INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING
+ * FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION
+ * WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <istream>
+#include <ostream>
+
+namespace emulator
+{
+
+/**
+ * @class i8080_noprofile
+ * @author rich
+ * @date 18/10/26
+ * @file i8080_profile.h
+ * @brief Default profiling policy for i8080_cpu. All hooks are empty so
+ *     the compiler removes them from the dispatch loop.
+ */
+class i8080_noprofile
+{
+public:
+    static constexpr bool enabled = false;
+
+    inline void count([[maybe_unused]]uint16_t pc, [[maybe_unused]]uint8_t ir,
+                      [[maybe_unused]]int cycles) {}
+
+    inline void call([[maybe_unused]]uint16_t addr, [[maybe_unused]]uint16_t sp) {}
+
+    inline void ret([[maybe_unused]]uint16_t sp) {}
+};
+
+/**
+ * @class i8080_profile
+ * @author rich
+ * @date 18/10/26
+ * @file i8080_profile.h
+ * @brief Profiling policy for i8080_cpu. Keeps a count and cycle total for
+ *     each opcode and an execution count for every address.
+ */
+class i8080_profile
+{
+public:
+    static constexpr bool enabled = true;
+
+    i8080_profile() : pc_count(new uint64_t[64*1024])
+    {
+        clear();
+    }
+
+    /**
+     * @brief Called after each instruction is executed.
+     * @param pc Address of the instruction.
+     * @param ir Opcode executed.
+     * @param cycles Time taken by the instruction.
+     */
+    inline void count(uint16_t pc, uint8_t ir, int cycles)
+    {
+        op_count[ir]++;
+        op_cycles[ir] += cycles;
+        pc_count[pc]++;
+    }
+
+    /**
+     * @brief Called when a CALL or RST transfers control.
+     * @param addr Address being called.
+     * @param sp Stack pointer after return address was pushed.
+     */
+    inline void call([[maybe_unused]]uint16_t addr, [[maybe_unused]]uint16_t sp) {}
+
+    /**
+     * @brief Called when a RET is about to pop the return address.
+     * @param sp Stack pointer before return address is popped.
+     */
+    inline void ret([[maybe_unused]]uint16_t sp) {}
+
+    /**
+     * @brief Reset all counters to zero. Symbols are kept.
+     */
+    void clear();
+
+    /**
+     * @brief Total number of instructions counted.
+     */
+    uint64_t total_count() const;
+
+    /**
+     * @brief Total of cycle times counted.
+     */
+    uint64_t total_cycles() const;
+
+    /**
+     * @brief Return the most executed opcodes, highest first.
+     * @param n Maximum number of entries to return.
+     */
+    std::vector<uint8_t> hot_ops(size_t n) const;
+
+    /**
+     * @brief Return the most executed addresses, highest first.
+     * @param n Maximum number of entries to return.
+     */
+    std::vector<uint16_t> hot_spots(size_t n) const;
+
+    /**
+     * @brief Load symbols from a CP/M .SYM file.
+     *
+     * A .SYM file is a list of "hhhh NAME" pairs separated by white
+     * space, optionally terminated by a control-Z.
+     * @param name File to read.
+     * @return false if file could not be opened.
+     */
+    bool load_sym(const std::string &name);
+
+    /**
+     * @brief Load symbols from a stream in .SYM format.
+     * @param is Stream to read.
+     * @return Number of symbols read.
+     */
+    size_t load_sym(std::istream &is);
+
+    /**
+     * @brief Convert an address to the form NAME+offset using the closest
+     *     symbol at or below the address.
+     * @param addr Address to convert.
+     * @return Symbolic address, or hex address if no symbol found.
+     */
+    std::string symbol(uint16_t addr) const;
+
+    uint64_t                     op_count[256];
+    uint64_t                     op_cycles[256];
+    std::unique_ptr<uint64_t[]>  pc_count;
+    std::map<uint16_t, std::string> symbols;
+};
+
+/**
+ * @class i8080_callgraph
+ * @author rich
+ * @date 18/10/26
+ * @file i8080_profile.h
+ * @brief Profiling policy that also keeps a shadow call stack. Each
+ *     instruction's time is charged to the current call path, which can
+ *     be written in the collapsed stack format used by flamegraph tools.
+ */
+class i8080_callgraph : public i8080_profile
+{
+public:
+    i8080_callgraph()
+    {
+        clear();
+    }
+
+    inline void count(uint16_t pc, uint8_t ir, int cycles)
+    {
+        i8080_profile::count(pc, ir, cycles);
+        if (nodes.size() == 1 && nodes[0].self == 0)
+            nodes[0].addr = pc;
+        // Charge instruction to caller, then follow the call or return.
+        nodes[cur].self += cycles;
+        if (pending == Pending::call)
+            enter();
+        else if (pending == Pending::ret)
+            leave();
+        pending = Pending::none;
+    }
+
+    inline void call(uint16_t addr, uint16_t sp)
+    {
+        pending = Pending::call;
+        pend_addr = addr;
+        pend_sp = sp;
+    }
+
+    inline void ret(uint16_t sp)
+    {
+        pending = Pending::ret;
+        pend_sp = sp;
+    }
+
+    /**
+     * @brief Reset counters and call graph.
+     */
+    void clear();
+
+    /**
+     * @brief Write call paths in collapsed stack format:
+     *     "root;func1;func2 time" one line per path.
+     * @param out Stream to write to.
+     */
+    void write_collapsed(std::ostream &out) const;
+
+    /**
+     * @brief Number of distinct call paths seen.
+     */
+    size_t paths() const
+    {
+        return nodes.size();
+    }
+
+    /**
+     * @brief Limit on depth of shadow stack, deeper calls are charged to
+     *     the deepest path.
+     */
+    size_t max_depth = 256;
+
+private:
+    enum class Pending { none, call, ret };
+
+    struct Node {
+        uint16_t    addr;      // Entry point of routine.
+        uint32_t    parent;    // Index of calling path.
+        uint64_t    self;      // Time spent in this path.
+    };
+
+    struct Frame {
+        uint32_t    node;      // Path that made the call.
+        uint16_t    sp;        // Stack pointer holding return address.
+    };
+
+    void enter();
+    void leave();
+
+    std::vector<Node>            nodes;
+    std::map<uint64_t, uint32_t> children;
+    std::vector<Frame>           stack;
+    uint32_t                     cur = 0;
+    Pending                      pending = Pending::none;
+    uint16_t                     pend_addr = 0;
+    uint16_t                     pend_sp = 0;
+};
+
+}
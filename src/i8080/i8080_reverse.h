@@ -0,0 +1,264 @@
+/*
+ * Author:      Richard Cornwell (rich@sky-visions.com)
+ *
+ * Copyright (C) 2021 Richard Cornwell.
+ *
+ * This file may be distributed under the terms of the Q Public License
+ * as defined by Trolltech AS of Norway and appearing in the file
+ * LICENSE.QPL included in the packaging of this file.
+ *
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING
+ * THE WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL,
+ * INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING
+ * FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION
+ * WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+#pragma once
+
+#include <stdint.h>
+#include <set>
+#include <memory>
+#include "Checkpoint.h"
+
+namespace emulator
+{
+
+/**
+ * @brief CPU state saved in each checkpoint.
+ */
+struct i8080_state {
+    uint8_t   regs[8];
+    uint8_t   PSW;
+    uint16_t  sp;
+    uint16_t  pc;
+    bool      ie;
+    uint8_t   int_mask;
+    bool      running;
+};
+
+/**
+ * @class i8080_reverse
+ * @author rich
+ * @date 18/10/26
+ * @file i8080_reverse.h
+ * @brief Reverse execution for an i8080_cpu. Steps go through this object,
+ *     which takes a checkpoint of registers and changed memory pages every
+ *     interval of simulated time. Pages are those of the memory dirty
+ *     map. Going backwards restores the nearest earlier checkpoint and
+ *     runs forward again, with port input replayed so the result is the
+ *     same. The checkpoint interval grows as needed to stay within the
+ *     memory budget.
+ *
+ *     Stepping forward from an earlier point replays history until the
+ *     newest point is reached again, then the run carries on live.
+ */
+template <class CPU_T>
+class i8080_reverse
+{
+public:
+    /**
+     * @brief Attach to a CPU, its memory and I/O must already be set.
+     * @param cpu CPU to control.
+     * @param budget Bytes to use for checkpoints.
+     * @param interval Simulated time between checkpoints to start with.
+     */
+    i8080_reverse(CPU_T &cpu, size_t budget = 16*1024*1024,
+                  uint64_t interval = 10000000) :
+        points(budget, interval), cpu_(cpu)
+    {
+        mem_ = std::make_shared<TravelMem<uint8_t>>(cpu.getMem());
+        io_ = std::make_shared<TravelIO<uint8_t>>(cpu.io);
+        cpu.setMem(mem_);
+        cpu.setIO(io_);
+    }
+
+    /**
+     * @brief Execute one instruction.
+     * @return Time taken by instruction.
+     */
+    uint64_t step()
+    {
+        if (points.empty())
+            points.take(count_, save(), *mem_);
+        io_->now = count_;
+        io_->replay = count_ < head_;
+        uint64_t t = cpu_.step();
+        count_++;
+        if (count_ > head_) {
+            head_ = count_;
+            elapsed_ += t;
+            if (elapsed_ >= points.interval) {
+                points.take(count_, save(), *mem_);
+                elapsed_ = 0;
+            }
+        }
+        return t;
+    }
+
+    /**
+     * @brief Move to the point where count instructions had been run.
+     *     Moving past the newest point runs live.
+     */
+    void seek(uint64_t count)
+    {
+        if (count < count_)
+            rewind(points.find(count));
+        while (count_ < count)
+            step();
+    }
+
+    /**
+     * @brief Go back n instructions.
+     * @return false if already at the oldest point kept.
+     */
+    bool reverse_step(uint64_t n = 1)
+    {
+        uint64_t first = oldest();
+        if (count_ <= first)
+            return false;
+        seek((count_ - first > n) ? count_ - n : first);
+        return true;
+    }
+
+    /**
+     * @brief Go back to the last time the PC was at a breakpoint.
+     * @return false if none found, position is unchanged.
+     */
+    bool reverse_continue()
+    {
+        if (breakpoints.empty())
+            return false;
+        return search([this]() -> bool {
+            return breakpoints.count((uint16_t)cpu_.pc) != 0;
+        }, false);
+    }
+
+    /**
+     * @brief Go back to just before the last instruction that wrote addr.
+     * @return false if none found, position is unchanged.
+     */
+    bool last_write(size_t addr)
+    {
+        mem_->watching = true;
+        mem_->watch_addr = addr;
+        bool found = search([this]() -> bool {
+            bool hit = mem_->hit;
+            mem_->hit = false;
+            return hit;
+        }, true);
+        mem_->watching = false;
+        mem_->hit = false;
+        return found;
+    }
+
+    /**
+     * @brief Instructions executed to reach the current point.
+     */
+    uint64_t count() const
+    {
+        return count_;
+    }
+
+    /**
+     * @brief Newest point reached.
+     */
+    uint64_t head() const
+    {
+        return head_;
+    }
+
+    /**
+     * @brief Oldest point that can be returned to.
+     */
+    uint64_t oldest() const
+    {
+        return points.empty() ? count_ : points[0].count;
+    }
+
+    /**
+     * @brief Addresses reverse_continue stops at.
+     */
+    std::set<uint16_t>                  breakpoints;
+
+    Checkpoints<uint8_t, i8080_state>   points;
+
+private:
+    i8080_state save() const
+    {
+        i8080_state  s;
+        for (int i = 0; i < 8; i++)
+            s.regs[i] = cpu_.regs[i];
+        s.PSW = cpu_.PSW;
+        s.sp = cpu_.sp;
+        s.pc = (uint16_t)cpu_.pc;
+        s.ie = cpu_.ie;
+        s.int_mask = cpu_.int_mask;
+        s.running = cpu_.running;
+        return s;
+    }
+
+    void rewind(size_t idx)
+    {
+        const i8080_state &s = points[idx].state;
+        points.restore(idx, *mem_);
+        for (int i = 0; i < 8; i++)
+            cpu_.regs[i] = s.regs[i];
+        cpu_.PSW = s.PSW;
+        cpu_.sp = s.sp;
+        cpu_.pc = s.pc;
+        cpu_.ie = s.ie;
+        cpu_.int_mask = s.int_mask;
+        cpu_.running = s.running;
+        count_ = points[idx].count;
+    }
+
+    // Search backwards one checkpoint interval at a time for the last
+    // point where test() is true. If after is set test() is checked after
+    // each instruction and the point found is just before it.
+    template <class F>
+    bool search(F test, bool after)
+    {
+        uint64_t  start = count_;
+        uint64_t  end = count_;
+
+        while (end > oldest()) {
+            size_t    idx = points.find(end - 1);
+            uint64_t  found = 0;
+            bool      any = false;
+
+            rewind(idx);
+            while (count_ < end) {
+                if (!after && test()) {
+                    found = count_;
+                    any = true;
+                }
+                step();
+                if (after && test()) {
+                    found = count_ - 1;
+                    any = true;
+                }
+            }
+            if (any) {
+                seek(found);
+                return true;
+            }
+            end = points[idx].count;
+        }
+        seek(start);
+        return false;
+    }
+
+    CPU_T                                 &cpu_;
+    std::shared_ptr<TravelMem<uint8_t>>   mem_;
+    std::shared_ptr<TravelIO<uint8_t>>    io_;
+    uint64_t                              count_ = 0;
+    uint64_t                              head_ = 0;
+    uint64_t                              elapsed_ = 0;
+};
+
+}
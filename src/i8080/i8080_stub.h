@@ -0,0 +1,79 @@
+/*
+ * Author:      Richard Cornwell (rich@sky-visions.com)
+ *
+ * Copyright (C) 2021 Richard Cornwell.
+ *
+ * This file may be distributed under the terms of the Q Public License
+ * as defined by Trolltech AS of Norway and appearing in the file
+ * LICENSE.QPL included in the packaging of this file.
+ *
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING
+ * THE WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL,
+ * INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING
+ * FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION
+ * WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <fstream>
+
+namespace emulator
+{
+
+/**
+ * @brief Minimal CP/M BDOS for running the .COM test programs. Placed at
+ *     location 5, it handles console output (C=2) and print string (C=9)
+ *     by writing each character to port 2.
+ */
+//  5: 171         mov a,c
+//  6: 376 002     cpi 2
+// 10: 302 017 000 jnz .+4
+// 13: 173         mov a,e
+// 14: 323 002     out 2
+// 16: 311         ret
+// 17: 376 011     cpi 9
+// 21: 300         rnz
+// 22: 325         push d
+// 23: 032         ldax d
+// 24: 023         inx  d
+// 25: 376 044     cpi '$'
+// 27: 302 034 000 jnz .+2
+// 32: 321         pop  d
+// 33: 311         ret
+// 34: 323 002     out 2
+// 36: 303 023 000 jmp
+//
+static const uint8_t bdos_stub[] = {
+    0171, 0376, 0002, 0302, 0017, 0000, 0173, 0323, 0002,
+    0311, 0376, 0011, 0300, 0325, 0032, 0023, 0376, 0044,
+    0302, 0034, 0000, 0321, 0311, 0323, 0002, 0303, 0023, 0000
+};
+
+/**
+ * @brief Read a CP/M .COM file.
+ * @param name File to read.
+ * @param image Where to put contents.
+ * @return false if file could not be read.
+ */
+inline bool load_com(const std::string &name, std::vector<uint8_t> &image)
+{
+    std::ifstream file(name, std::ios::in|std::ios::binary|std::ios::ate);
+
+    if (!file.is_open())
+        return false;
+    size_t size = file.tellg();
+    image.resize(size);
+    file.seekg(0, std::ios::beg);
+    file.read((char *)image.data(), size);
+    return (bool)file;
+}
+
+}
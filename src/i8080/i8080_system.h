@@ -46,7 +46,8 @@ public:
         cout << "Class Type = " << this->getType() << endl;
     }
     
-    virtual size_t max_cpus() { return 1; }
+    // Multi-processor 8080 systems shared memory between several boards.
+    virtual size_t max_cpus() { return 8; }
     
 //    virtual void add_cpu(core::CPU_v cpu) {
  //       this->cpu = std::get<shared_ptr<emulator::CPU<uint8_t>>>(cpu);
@@ -0,0 +1,598 @@
+/*
+ * Author:      Richard Cornwell (rich@sky-visions.com)
+ *
+ * Copyright (C) 2021 Richard Cornwell.
+ *
+ * This file may be distributed under the terms of the Q Public License
+ * as defined by Trolltech AS of Norway and appearing in the file
+ * LICENSE.QPL included in the packaging of this file.
+ *
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING
+ * THE WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL,
+ * INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING
+ * FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION
+ * WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include "CPU.h"
+#include "Memory.h"
+#include "i8080_cpu.h"
+
+namespace emulator
+{
+
+/**
+ * @class i8080_ref
+ * @author rich
+ * @date 18/10/26
+ * @file i8080_ref.h
+ * @brief Small reference model of the 8080 and 8085, written from the
+ *     data sheets and separately from i8080_cpu, for use in lockstep
+ *     testing. It decodes the opcode by bit fields rather than tables and
+ *     makes no attempt to be fast. Register layout matches i8080_cpu so
+ *     state can be compared directly.
+ *
+ *     Undocumented 8085 behaviour follows the published descriptions:
+ *     V is two's complement overflow, K (XFLG) is S xor V for arithmetic
+ *     and is set when INX or DCX wrap.
+ */
+class i8080_ref : public CPU<uint8_t>
+{
+public:
+    explicit i8080_ref(cpu_model model = I8080) : model_(model)
+    {
+    }
+
+    virtual ~i8080_ref()
+    {
+    }
+
+    virtual std::string getType() const override
+    {
+        return (model_ == I8085) ? "I8085REF" : "I8080REF";
+    }
+
+    virtual bool noIO() const override
+    {
+        return true;
+    }
+
+    virtual void start() override
+    {
+        running = false;
+        if (io)
+            io->start();
+    }
+
+    virtual void reset() override
+    {
+        running = false;
+        pc = 0;
+        PSW = 2;
+        ie = false;
+        int_mask = 7;
+        if (io)
+            io->reset();
+    }
+
+    virtual void stop() override
+    {
+        running = false;
+        if (io)
+            io->stop();
+    }
+
+    /**
+     * @brief Execute one instruction.
+     * @return Time of instruction in nano seconds.
+     */
+    virtual uint64_t step() override;
+
+    uint8_t   regs[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+    uint8_t   PSW = 2;
+    uint16_t  sp = 0;
+    bool      ie = false;
+    uint8_t   int_mask = 7;
+
+private:
+    cpu_model model_;
+
+    bool is85() const
+    {
+        return model_ == I8085;
+    }
+
+    uint8_t rd(uint16_t addr)
+    {
+        uint8_t  v = 0;
+        mem->read(v, addr);
+        return v;
+    }
+
+    void wr(uint16_t addr, uint8_t v)
+    {
+        mem->write(v, addr);
+    }
+
+    uint8_t imm8()
+    {
+        uint8_t  v = rd((uint16_t)pc);
+        pc = (pc + 1) & 0xffff;
+        return v;
+    }
+
+    uint16_t imm16()
+    {
+        uint16_t lo = imm8();
+        return lo | ((uint16_t)imm8() << 8);
+    }
+
+    uint16_t rd16(uint16_t addr)
+    {
+        return rd(addr) | ((uint16_t)rd((uint16_t)(addr + 1)) << 8);
+    }
+
+    void wr16(uint16_t addr, uint16_t v)
+    {
+        wr(addr, v & 0xff);
+        wr((uint16_t)(addr + 1), v >> 8);
+    }
+
+    void push16(uint16_t v)
+    {
+        sp -= 2;
+        wr16(sp, v);
+    }
+
+    uint16_t pop16()
+    {
+        uint16_t v = rd16(sp);
+        sp += 2;
+        return v;
+    }
+
+    // Register by 3 bit field, 6 is memory at HL.
+    uint8_t get(int r)
+    {
+        return (r == 6) ? rd(pair(2)) : regs[r];
+    }
+
+    void put(int r, uint8_t v)
+    {
+        if (r == 6)
+            wr(pair(2), v);
+        else
+            regs[r] = v;
+    }
+
+    // Register pair by 2 bit field: BC, DE, HL, SP.
+    uint16_t pair(int p)
+    {
+        if (p == 3)
+            return sp;
+        return ((uint16_t)regs[p * 2] << 8) | regs[p * 2 + 1];
+    }
+
+    void set_pair(int p, uint16_t v)
+    {
+        if (p == 3) {
+            sp = v;
+        } else {
+            regs[p * 2] = v >> 8;
+            regs[p * 2 + 1] = v & 0xff;
+        }
+    }
+
+    static bool parity(uint8_t v)
+    {
+        int  n = 0;
+        for (; v != 0; v >>= 1)
+            n += v & 1;
+        return (n & 1) == 0;
+    }
+
+    // Sign, zero and parity, plus bit 1 which always reads as one on 8080.
+    uint8_t szp(uint8_t v) const
+    {
+        uint8_t f = 0;
+        if (v & 0x80)
+            f |= SIGN;
+        if (v == 0)
+            f |= ZERO;
+        if (parity(v))
+            f |= PAR;
+        if (model_ != I8085)
+            f |= VFLG;
+        return f;
+    }
+
+    // Add with carry in, set all flags.
+    uint8_t add8(uint8_t a, uint8_t b, int cin, bool borrow);
+    void alu(int op, uint8_t v);
+    bool cond(int c) const;
+    void daa();
+};
+
+inline uint8_t i8080_ref::add8(uint8_t a, uint8_t b, int cin, bool borrow)
+{
+    unsigned  r = (unsigned)a + (unsigned)b + cin;
+    uint8_t   res = r & 0xff;
+    bool      cy = r > 0xff;
+    bool      ov = ((~(a ^ b)) & (a ^ res) & 0x80) != 0;
+
+    PSW = szp(res);
+    if (((a & 0xf) + (b & 0xf) + cin) > 0xf)
+        PSW |= AC;
+    // Subtract is done as add of complement, carry out means no borrow.
+    if (cy != borrow)
+        PSW |= CARRY;
+    if (is85()) {
+        if (ov)
+            PSW |= VFLG;
+        if (ov != ((res & 0x80) != 0))
+            PSW |= XFLG;
+    }
+    return res;
+}
+
+inline void i8080_ref::alu(int op, uint8_t v)
+{
+    uint8_t  a = regs[A];
+    int      cy = PSW & CARRY;
+
+    switch (op) {
+    case 0: regs[A] = add8(a, v, 0, false); break;                 // ADD
+    case 1: regs[A] = add8(a, v, cy, false); break;                // ADC
+    case 2: regs[A] = add8(a, ~v & 0xff, 1, true); break;          // SUB
+    case 3: regs[A] = add8(a, ~v & 0xff, !cy, true); break;        // SBB
+    case 4:                                                        // ANA
+        regs[A] = a & v;
+        PSW = szp(regs[A]);
+        // 8080 sets AC from bit 3 of the operands, 8085 always sets it.
+        if (is85() || ((a | v) & 0x08) != 0)
+            PSW |= AC;
+        break;
+    case 5:                                                        // XRA
+        regs[A] = a ^ v;
+        PSW = szp(regs[A]);
+        break;
+    case 6:                                                        // ORA
+        regs[A] = a | v;
+        PSW = szp(regs[A]);
+        break;
+    case 7:                                                        // CMP
+        (void)add8(a, ~v & 0xff, 1, true);
+        break;
+    }
+}
+
+inline bool i8080_ref::cond(int c) const
+{
+    switch (c) {
+    case 0: return (PSW & ZERO) == 0;      // NZ
+    case 1: return (PSW & ZERO) != 0;      // Z
+    case 2: return (PSW & CARRY) == 0;     // NC
+    case 3: return (PSW & CARRY) != 0;     // C
+    case 4: return (PSW & PAR) == 0;       // PO
+    case 5: return (PSW & PAR) != 0;       // PE
+    case 6: return (PSW & SIGN) == 0;      // P
+    default: return (PSW & SIGN) != 0;     // M
+    }
+}
+
+inline void i8080_ref::daa()
+{
+    uint8_t  a = regs[A];
+    uint8_t  adj = 0;
+    bool     cy = (PSW & CARRY) != 0;
+
+    if ((PSW & AC) || (a & 0x0f) > 9)
+        adj = 0x06;
+    if (cy || (a >> 4) > 9 || ((a >> 4) >= 9 && (a & 0x0f) > 9)) {
+        adj |= 0x60;
+        cy = true;
+    }
+    uint8_t res = a + adj;
+    PSW = szp(res);
+    if (((a & 0x0f) + (adj & 0x0f)) > 0x0f)
+        PSW |= AC;
+    if (cy)
+        PSW |= CARRY;
+    regs[A] = res;
+}
+
+inline uint64_t i8080_ref::step()
+{
+    static const uint8_t cycles[256] = {
+         4, 10,  7,  5,  5,  5,  7,  4,  4, 10,  7,  5,  5,  5,  7,  4,
+         4, 10,  7,  5,  5,  5,  7,  4,  4, 10,  7,  5,  5,  5,  7,  4,
+         4, 10, 16,  5,  5,  5,  7,  4,  4, 10, 16,  5,  5,  5,  7,  4,
+         4, 10, 13,  5, 10, 10, 10,  4,  4, 10, 13,  5,  5,  5,  7,  4,
+         5,  5,  5,  5,  5,  5,  7,  5,  5,  5,  5,  5,  5,  5,  7,  5,
+         5,  5,  5,  5,  5,  5,  7,  5,  5,  5,  5,  5,  5,  5,  7,  5,
+         5,  5,  5,  5,  5,  5,  7,  5,  5,  5,  5,  5,  5,  5,  7,  5,
+         7,  7,  7,  7,  7,  7,  7,  7,  5,  5,  5,  5,  5,  5,  7,  5,
+         4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,
+         4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,
+         4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,
+         4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,
+         5, 10, 10, 10, 11, 11,  7, 11,  5, 10, 10, 10, 11, 17,  7, 11,
+         5, 10, 10, 10, 11, 11,  7, 11,  5, 10, 10, 10, 11, 17,  7, 11,
+         5, 10, 10, 18, 11, 11,  7, 11,  5,  5, 10,  4, 11, 17,  7, 11,
+         5, 10, 10,  4, 11, 11,  7, 11,  5,  5, 10,  4, 11, 17,  7, 11,
+    };
+    uint8_t   op = imm8();
+    int       x = op >> 6;         // Major group.
+    int       y = (op >> 3) & 7;   // Destination or condition.
+    int       z = op & 7;          // Source or sub group.
+    int       p = y >> 1;          // Register pair.
+    uint64_t  time = cycles[op];
+
+    switch (x) {
+    case 0:
+        switch (z) {
+        case 0:
+            if (!is85())
+                break;                         // NOP and aliases.
+            switch (y) {
+            case 1: {                          // DSUB
+                uint16_t  hl = pair(2);
+                uint16_t  bc = pair(0);
+                uint16_t  r = hl - bc;
+                PSW &= ~(CARRY|VFLG);
+                if (bc > hl)
+                    PSW |= CARRY;
+                if (((hl ^ bc) & (hl ^ r) & 0x8000) != 0)
+                    PSW |= VFLG;
+                set_pair(2, r);
+                break;
+            }
+            case 2: {                          // ARHL
+                uint16_t hl = pair(2);
+                PSW = (PSW & ~CARRY) | (hl & 1);
+                set_pair(2, (hl & 0x8000) | (hl >> 1));
+                break;
+            }
+            case 3: {                          // RDEL
+                uint16_t de = pair(1);
+                int      c = PSW & CARRY;
+                PSW = (PSW & ~CARRY) | (de >> 15);
+                set_pair(1, (uint16_t)((de << 1) | c));
+                break;
+            }
+            case 4:                            // RIM
+                regs[A] = (ie ? 0x08 : 0) | int_mask;
+                break;
+            case 6:                            // SIM
+                if (regs[A] & 0x08)
+                    int_mask = regs[A] & 0x07;
+                break;
+            case 5:                            // LDHI
+                set_pair(1, pair(2) + imm8());
+                break;
+            case 7:                            // LDSI
+                set_pair(1, sp + imm8());
+                break;
+            default:                           // NOP
+                break;
+            }
+            break;
+        case 1:
+            if ((y & 1) == 0) {                // LXI
+                set_pair(p, imm16());
+            } else {                           // DAD
+                uint32_t r = (uint32_t)pair(2) + pair(p);
+                PSW = (PSW & ~CARRY) | ((r >> 16) & 1);
+                set_pair(2, r & 0xffff);
+            }
+            break;
+        case 2:
+            switch (y) {
+            case 0: case 2: wr(pair(p), regs[A]); break;          // STAX
+            case 1: case 3: regs[A] = rd(pair(p)); break;         // LDAX
+            case 4: wr16(imm16(), pair(2)); break;                // SHLD
+            case 5: set_pair(2, rd16(imm16())); break;            // LHLD
+            case 6: wr(imm16(), regs[A]); break;                  // STA
+            case 7: regs[A] = rd(imm16()); break;                 // LDA
+            }
+            break;
+        case 3: {                              // INX, DCX
+            uint16_t r = pair(p) + (((y & 1) == 0) ? 1 : -1);
+            set_pair(p, r);
+            if (is85()) {
+                PSW &= ~XFLG;
+                if (r == (((y & 1) == 0) ? 0 : 0xffff))
+                    PSW |= XFLG;
+            }
+            break;
+        }
+        case 4:                                // INR
+        case 5: {                              // DCR
+            uint8_t  v = get(y);
+            uint8_t  r = (z == 4) ? v + 1 : v - 1;
+            bool     ov = (z == 4) ? (r == 0x80) : (r == 0x7f);
+            PSW = (PSW & CARRY) | szp(r);
+            if (z == 4 ? (r & 0x0f) == 0 : (r & 0x0f) != 0x0f)
+                PSW |= AC;
+            if (is85()) {
+                if (ov)
+                    PSW |= VFLG;
+                if (ov != ((r & 0x80) != 0))
+                    PSW |= XFLG;
+            }
+            put(y, r);
+            break;
+        }
+        case 6:                                // MVI
+            put(y, imm8());
+            break;
+        case 7: {
+            uint8_t a = regs[A];
+            int     c = PSW & CARRY;
+            switch (y) {
+            case 0: regs[A] = (a << 1) | (a >> 7); c = a >> 7; break;   // RLC
+            case 1: regs[A] = (a >> 1) | (a << 7); c = a & 1; break;    // RRC
+            case 2: regs[A] = (a << 1) | c; c = a >> 7; break;          // RAL
+            case 3: regs[A] = (a >> 1) | (c << 7); c = a & 1; break;    // RAR
+            case 4: daa(); c = PSW & CARRY; break;                      // DAA
+            case 5: regs[A] = ~a; break;                                // CMA
+            case 6: c = 1; break;                                       // STC
+            case 7: c = !c; break;                                      // CMC
+            }
+            PSW = (PSW & ~CARRY) | c;
+            break;
+        }
+        }
+        break;
+
+    case 1:
+        if (op == 0166)                        // HLT
+            running = false;
+        else
+            put(y, get(z));                    // MOV
+        break;
+
+    case 2:
+        alu(y, get(z));
+        break;
+
+    case 3:
+        switch (z) {
+        case 0:                                // Rcc
+            if (cond(y)) {
+                pc = pop16();
+                time += 6;
+            }
+            break;
+        case 1:
+            switch (y) {
+            case 0: case 2: case 4:            // POP rp
+                set_pair(p, pop16());
+                break;
+            case 6: {                          // POP PSW
+                uint16_t v = pop16();
+                regs[A] = v >> 8;
+                if (is85())
+                    PSW = v & (SIGN|ZERO|XFLG|AC|PAR|VFLG|CARRY);
+                else
+                    PSW = (v & (SIGN|ZERO|AC|PAR|CARRY)) | VFLG;
+                break;
+            }
+            case 1:                            // RET
+                pc = pop16();
+                break;
+            case 3:                            // SHLX, RET on 8080
+                if (is85())
+                    wr16(pair(1), pair(2));
+                else
+                    pc = pop16();
+                break;
+            case 5:                            // PCHL
+                pc = pair(2);
+                break;
+            case 7:                            // SPHL
+                sp = pair(2);
+                break;
+            }
+            break;
+        case 2:                                // Jcc
+            {
+                uint16_t addr = imm16();
+                if (cond(y))
+                    pc = addr;
+            }
+            break;
+        case 3:
+            switch (y) {
+            case 0:                            // JMP
+                pc = imm16();
+                break;
+            case 1:                            // RSTV, JMP on 8080
+                if (!is85()) {
+                    pc = imm16();
+                } else if (PSW & VFLG) {
+                    push16((uint16_t)pc);
+                    pc = 0x40;
+                }
+                break;
+            case 2:                            // OUT
+                io->output(regs[A], imm8());
+                break;
+            case 3:                            // IN
+                {
+                    uint8_t port = imm8();
+                    io->input(regs[A], port);
+                }
+                break;
+            case 4: {                          // XTHL
+                uint16_t t = rd16(sp);
+                wr16(sp, pair(2));
+                set_pair(2, t);
+                break;
+            }
+            case 5: {                          // XCHG
+                uint16_t t = pair(1);
+                set_pair(1, pair(2));
+                set_pair(2, t);
+                break;
+            }
+            case 6:                            // DI
+                ie = false;
+                break;
+            case 7:                            // EI
+                ie = true;
+                break;
+            }
+            break;
+        case 4:                                // Ccc
+            {
+                uint16_t addr = imm16();
+                if (cond(y)) {
+                    push16((uint16_t)pc);
+                    pc = addr;
+                    time += 6;
+                }
+            }
+            break;
+        case 5:
+            if ((y & 1) == 0) {                // PUSH
+                if (p == 3)
+                    push16(((uint16_t)regs[A] << 8) | PSW);
+                else
+                    push16(pair(p));
+            } else if (y == 1 || !is85()) {    // CALL and 8080 aliases
+                uint16_t addr = imm16();
+                push16((uint16_t)pc);
+                pc = addr;
+            } else {
+                uint16_t addr = (y == 5) ? 0 : imm16();
+                if (y == 5)                    // LHLX
+                    set_pair(2, rd16(pair(1)));
+                else if (((PSW & XFLG) != 0) == (y == 7))
+                    pc = addr;                 // JNK, JK
+            }
+            break;
+        case 6:
+            alu(y, imm8());
+            break;
+        case 7:                                // RST
+            push16((uint16_t)pc);
+            pc = y << 3;
+            break;
+        }
+        break;
+    }
+    if (io)
+        io->step();
+    return time * 250;
+}
+
+}
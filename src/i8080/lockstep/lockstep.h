@@ -0,0 +1,465 @@
+/*
+ * Author:      Richard Cornwell (rich@sky-visions.com)
+ *
+ * Copyright (C) 2021 Richard Cornwell.
+ *
+ * This file may be distributed under the terms of the Q Public License
+ * as defined by Trolltech AS of Norway and appearing in the file
+ * LICENSE.QPL included in the packaging of this file.
+ *
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING
+ * THE WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL,
+ * INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING
+ * FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION
+ * WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <deque>
+#include <memory>
+#include "Memory.h"
+#include "RAM.h"
+#include "IO.h"
+#include "i8080_cpu.h"
+
+namespace emulator
+{
+
+/**
+ * @class MemLog
+ * @author rich
+ * @date 18/10/26
+ * @file lockstep.h
+ * @brief Memory wrapper that passes all accesses to another memory
+ *     object and keeps a list of writes made with write().
+ */
+template <typename T>
+class MemLog : public Memory<T>
+{
+public:
+    explicit MemLog(std::shared_ptr<Memory<T>> mem) :
+        Memory<T>(mem->getSize(), mem->getBase()), mem_(mem)
+    {
+    }
+
+    virtual size_t getSize() const override
+    {
+        return mem_->getSize();
+    }
+
+    virtual void Get(T &val, size_t index) override
+    {
+        mem_->Get(val, index);
+    }
+
+    virtual void Set(T val, size_t index) override
+    {
+        mem_->Set(val, index);
+    }
+
+    virtual bool read(T &val, size_t index) override
+    {
+        return mem_->read(val, index);
+    }
+
+    virtual bool write(T val, size_t index) override
+    {
+        log.emplace_back(index, val);
+        return mem_->write(val, index);
+    }
+
+    std::vector<std::pair<size_t, T>>  log;
+
+private:
+    std::shared_ptr<Memory<T>>         mem_;
+};
+
+/**
+ * @class IOLog
+ * @author rich
+ * @date 18/10/26
+ * @file lockstep.h
+ * @brief I/O wrapper for lockstep runs. The leading CPU's wrapper passes
+ *     requests to the real devices and saves every input value. The
+ *     following CPU's wrapper has no devices and replays those values, so
+ *     both see the same input. Outputs are logged on both sides.
+ */
+template <typename T>
+class IOLog : public IO<T>
+{
+public:
+    IOLog(std::shared_ptr<IO<T>> io, std::shared_ptr<std::deque<T>> inputs) :
+        io_(io), inputs_(inputs)
+    {
+    }
+
+    virtual void start() override
+    {
+        if (io_)
+            io_->start();
+    }
+
+    virtual void step() override
+    {
+        if (io_)
+            io_->step();
+    }
+
+    virtual void stop() override
+    {
+        if (io_)
+            io_->stop();
+    }
+
+    virtual bool input(T &val, size_t port) override
+    {
+        bool  r = true;
+        if (io_) {
+            r = io_->input(val, port);
+            inputs_->push_back(val);
+        } else if (!inputs_->empty()) {
+            val = inputs_->front();
+            inputs_->pop_front();
+        } else {
+            val = 0;
+        }
+        return r;
+    }
+
+    virtual bool output(T val, size_t port) override
+    {
+        log.emplace_back(port, val);
+        if (io_)
+            return io_->output(val, port);
+        return true;
+    }
+
+    std::vector<std::pair<size_t, T>>  log;
+
+private:
+    std::shared_ptr<IO<T>>             io_;
+    std::shared_ptr<std::deque<T>>     inputs_;
+};
+
+/**
+ * @brief Register state compared between the two CPUs.
+ */
+struct lock_state {
+    uint8_t   regs[8];
+    uint8_t   PSW;
+    uint16_t  sp;
+    uint16_t  pc;
+    bool      running;
+};
+
+/**
+ * @class Lockstep
+ * @author rich
+ * @date 18/10/26
+ * @file lockstep.h
+ * @brief Run two 8080 CPU models on copies of the same memory and compare
+ *     registers, flags, stack pointer, program counter, memory writes and
+ *     port output after every instruction, or every block of instructions.
+ *
+ *     CPU_A leads and talks to the real I/O devices, it must be an
+ *     i8080_cpu since its disassembler is used for reports. CPU_B can be
+ *     any model with the same register layout, such as i8080_ref or
+ *     another i8080_cpu.
+ */
+template <class CPU_A, class CPU_B>
+class Lockstep
+{
+public:
+    /**
+     * @brief Connect two CPUs together, each gets its own 64K of RAM.
+     * @param a Leading CPU.
+     * @param b Following CPU.
+     * @param io I/O devices for leading CPU.
+     */
+    Lockstep(CPU_A &a, CPU_B &b, std::shared_ptr<IO<uint8_t>> io) : a_(a), b_(b)
+    {
+        inputs_ = std::make_shared<std::deque<uint8_t>>();
+        for (int i = 0; i < 2; i++) {
+            auto fixed = std::make_shared<MemFixed<uint8_t>>(64*1024, 0);
+            fixed->addMemory(std::make_shared<RAM<uint8_t>>(64*1024, 0));
+            mem_[i] = std::make_shared<MemLog<uint8_t>>(fixed);
+            io_[i] = std::make_shared<IOLog<uint8_t>>((i == 0) ? io : nullptr, inputs_);
+        }
+        a_.setMem(mem_[0]);
+        a_.setIO(io_[0]);
+        b_.setMem(mem_[1]);
+        b_.setIO(io_[1]);
+    }
+
+    /**
+     * @brief Memory seen by the leading CPU, for devices that need it.
+     */
+    std::shared_ptr<Memory<uint8_t>> memA() const
+    {
+        return mem_[0];
+    }
+
+    /**
+     * @brief Store a byte in both memories.
+     */
+    void poke(uint8_t val, uint16_t addr)
+    {
+        mem_[0]->Set(val, addr);
+        mem_[1]->Set(val, addr);
+    }
+
+    /**
+     * @brief Load a block of data into both memories.
+     */
+    void load(const uint8_t *data, size_t size, uint16_t addr)
+    {
+        for (size_t i = 0; i < size; i++)
+            poke(data[i], (uint16_t)(addr + i));
+    }
+
+    /**
+     * @brief Start both CPUs at pc. Register state of B is copied from A.
+     */
+    void start(uint16_t pc)
+    {
+        a_.start();
+        b_.start();
+        a_.setPC(pc);
+        copy_state();
+        a_.running = true;
+        b_.running = true;
+        count = 0;
+        divergences = 0;
+    }
+
+    /**
+     * @brief Run until halt, limit instructions or a divergence.
+     * @param limit Maximum number of instructions.
+     * @return true if no divergence was found.
+     */
+    bool run(uint64_t limit)
+    {
+        bool  ok = true;
+
+        while (a_.running && b_.running && count < limit) {
+            uint64_t n = std::min(block, limit - count);
+            for (uint64_t i = 0; i < n && a_.running; i++) {
+                remember();
+                a_.step();
+            }
+            for (uint64_t i = 0; i < n && b_.running; i++)
+                b_.step();
+            count += n;
+            if (!compare(n)) {
+                ok = false;
+                divergences++;
+                if (!keep_going || divergences >= max_divergences)
+                    break;
+                resync();
+            }
+        }
+        return ok;
+    }
+
+    /**
+     * @brief Mask of PSW bits to compare. Bits outside the mask are copied
+     *     from A to B after each check.
+     */
+    uint8_t      psw_mask = 0xff;
+
+    /**
+     * @brief Number of instructions to run on each CPU between checks.
+     */
+    uint64_t     block = 1;
+
+    /**
+     * @brief After a divergence copy A's state to B and carry on.
+     */
+    bool         keep_going = false;
+    int          max_divergences = 10;
+
+    uint64_t     count = 0;
+    int          divergences = 0;
+
+    /**
+     * @brief Description of the last divergence found.
+     */
+    std::string  report;
+
+private:
+    struct trace_entry {
+        uint16_t  pc;
+        uint8_t   ir[3];
+    };
+
+    template <class C>
+    static lock_state state(const C &cpu)
+    {
+        lock_state  s;
+        for (int i = 0; i < 8; i++)
+            s.regs[i] = cpu.regs[i];
+        s.PSW = cpu.PSW;
+        s.sp = cpu.sp;
+        s.pc = (uint16_t)cpu.pc;
+        s.running = cpu.running;
+        return s;
+    }
+
+    void copy_state()
+    {
+        for (int i = 0; i < 8; i++)
+            b_.regs[i] = a_.regs[i];
+        b_.PSW = a_.PSW;
+        b_.sp = a_.sp;
+        b_.pc = a_.pc;
+        b_.ie = a_.ie;
+        b_.int_mask = a_.int_mask;
+    }
+
+    // Save the instruction about to be executed by A.
+    void remember()
+    {
+        trace_entry  t;
+        t.pc = (uint16_t)a_.pc;
+        for (int i = 0; i < 3; i++)
+            mem_[0]->Get(t.ir[i], (uint16_t)(t.pc + i));
+        history_.push_back(t);
+        if (history_.size() > 8)
+            history_.pop_front();
+    }
+
+    // Copy A's memory and state to B after a divergence.
+    void resync()
+    {
+        uint8_t  v;
+        for (size_t i = 0; i < 64*1024; i++) {
+            mem_[0]->Get(v, i);
+            mem_[1]->Set(v, i);
+        }
+        copy_state();
+        b_.running = a_.running;
+        inputs_->clear();
+    }
+
+    std::string disasm(const trace_entry &t)
+    {
+        std::stringstream  out;
+        int                len;
+        uint16_t           addr = t.ir[1] | (t.ir[2] << 8);
+        std::string        text = a_.disassemble(t.ir[0], addr, len);
+
+        out << std::hex << std::setfill('0') << std::setw(4) << t.pc << ": ";
+        for (int i = 0; i < 3; i++) {
+            if (i < len)
+                out << std::setw(2) << (unsigned)t.ir[i] << " ";
+            else
+                out << "   ";
+        }
+        out << text;
+        return out.str();
+    }
+
+    static std::string dump(const char *name, const lock_state &s)
+    {
+        static const char  *reg_name = "BCDEHLMA";
+        std::stringstream   out;
+
+        out << name << ":" << std::hex << std::setfill('0');
+        for (int i = 0; i < 8; i++) {
+            if (i == M)
+                continue;
+            out << " " << reg_name[i] << "=" << std::setw(2) << (unsigned)s.regs[i];
+        }
+        out << " PSW=" << std::setw(2) << (unsigned)s.PSW;
+        out << " SP=" << std::setw(4) << s.sp;
+        out << " PC=" << std::setw(4) << s.pc;
+        out << (s.running ? "" : " halted");
+        return out.str();
+    }
+
+    template <typename L>
+    static std::string dump_log(const char *name, const L &log)
+    {
+        std::stringstream   out;
+
+        out << name << ":" << std::hex << std::setfill('0');
+        for (auto &w : log)
+            out << " " << std::setw(4) << w.first << "=" << std::setw(2) << (unsigned)w.second;
+        return out.str();
+    }
+
+    bool compare(uint64_t n)
+    {
+        lock_state  sa = state(a_);
+        lock_state  sb = state(b_);
+        std::string what;
+
+        for (int i = 0; i < 8; i++) {
+            if (i != M && sa.regs[i] != sb.regs[i])
+                what += std::string(" ") + "BCDEHLMA"[i];
+        }
+        if (((sa.PSW ^ sb.PSW) & psw_mask) != 0)
+            what += " PSW";
+        if (sa.sp != sb.sp)
+            what += " SP";
+        if (sa.pc != sb.pc)
+            what += " PC";
+        if (sa.running != sb.running)
+            what += " halt";
+        if (mem_[0]->log != mem_[1]->log)
+            what += " memory";
+        if (io_[0]->log != io_[1]->log)
+            what += " output";
+
+        if (what.empty()) {
+            // Keep flags that are not compared the same, so they do not
+            // show up later through PUSH PSW.
+            b_.PSW = (b_.PSW & psw_mask) | (a_.PSW & ~psw_mask);
+            mem_[0]->log.clear();
+            mem_[1]->log.clear();
+            io_[0]->log.clear();
+            io_[1]->log.clear();
+            return true;
+        }
+
+        std::stringstream  out;
+        out << "Divergence after " << std::dec << count << " instructions:" << what << std::endl;
+        if (n > 1)
+            out << "Within last " << n << " instructions" << std::endl;
+        for (auto &t : history_)
+            out << "  " << disasm(t) << std::endl;
+        out << dump("  A", sa) << std::endl;
+        out << dump("  B", sb) << std::endl;
+        out << dump_log("  A writes", mem_[0]->log) << std::endl;
+        out << dump_log("  B writes", mem_[1]->log) << std::endl;
+        if (io_[0]->log != io_[1]->log) {
+            out << dump_log("  A output", io_[0]->log) << std::endl;
+            out << dump_log("  B output", io_[1]->log) << std::endl;
+        }
+        report = out.str();
+        mem_[0]->log.clear();
+        mem_[1]->log.clear();
+        io_[0]->log.clear();
+        io_[1]->log.clear();
+        return false;
+    }
+
+    CPU_A                                   &a_;
+    CPU_B                                   &b_;
+    std::shared_ptr<MemLog<uint8_t>>        mem_[2];
+    std::shared_ptr<IOLog<uint8_t>>         io_[2];
+    std::shared_ptr<std::deque<uint8_t>>    inputs_;
+    std::deque<trace_entry>                 history_;
+};
+
+}
@@ -0,0 +1,195 @@
+/*
+ * Author:      Richard Cornwell (rich@sky-visions.com)
+ *
+ * Copyright (C) 2021 Richard Cornwell.
+ *
+ * This file may be distributed under the terms of the Q Public License
+ * as defined by Trolltech AS of Norway and appearing in the file
+ * LICENSE.QPL included in the packaging of this file.
+ *
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING
+ * THE WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL,
+ * INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING
+ * FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+ * NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION
+ * WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+/*
+ * i8080_lockstep: run the CP/M exercisers on i8080_cpu and the reference
+ * model side by side, and report where they first differ.
+ */
+
+#include "config.h"
+#include <iostream>
+#include <fstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include "i8080_cpu.h"
+#include "i8080_stub.h"
+#include "i8080_ref.h"
+#include "lockstep.h"
+#include "Options.h"
+#include "Core.h"
+
+#ifndef LOCKSTEP_DIR
+#define LOCKSTEP_DIR "."
+#endif
+
+using namespace emulator;
+using namespace std;
+
+/**
+ * @class lock_console
+ * @author rich
+ * @date 18/10/26
+ * @file main.cpp
+ * @brief Console for the BDOS stub, prints characters sent to port 2.
+ */
+class lock_console : public IO<uint8_t>
+{
+public:
+    bool    verbose = false;
+
+    virtual bool output(uint8_t val, size_t port) override
+    {
+        if (port != 2)
+            return false;
+        if (verbose)
+            cout << (char)val << flush;
+        return true;
+    }
+};
+
+struct Program {
+    string      file;
+    cpu_model   model;
+};
+
+static const Program programs[] = {
+    { "TST8080.COM",  I8080 },
+    { "8080PRE.COM",  I8080 },
+    { "CPUTEST.COM",  I8080 },
+    { "8080EXM.COM",  I8080 },
+    { "8080EXER.COM", I8080 },
+    { "8085EX1.COM",  I8085 },
+    { "8085EXER.COM", I8085 },
+};
+
+// Documented flags, the 8085 V and K flags are not compared unless asked.
+static const uint8_t doc_flags = SIGN|ZERO|AC|PAR|CARRY;
+
+template <cpu_model MOD>
+static bool run_program(const vector<uint8_t> &image, uint64_t limit,
+                        uint64_t block, int psw_mask, bool keep_going,
+                        bool verbose)
+{
+    i8080_cpu<MOD>   cpu;
+    i8080_ref        ref(MOD);
+    auto             con = make_shared<lock_console>();
+    Lockstep<i8080_cpu<MOD>, i8080_ref> lock(cpu, ref, con);
+
+    con->verbose = verbose;
+    lock.load(image.data(), image.size(), 0x100);
+    lock.poke(0166, 0);    // Inject halt opcode.
+    lock.load(bdos_stub, sizeof(bdos_stub), 5);
+    lock.block = block;
+    lock.keep_going = keep_going;
+    if (psw_mask >= 0)
+        lock.psw_mask = (uint8_t)psw_mask;
+    else if (MOD == I8085)
+        lock.psw_mask = doc_flags;
+    cpu.PSW = 2;
+    cpu.sp = 0;
+    cpu.ie = false;
+    for (auto &r : cpu.regs)
+        r = 0;
+    lock.start(0x100);
+
+    bool ok = lock.run(limit);
+    if (verbose)
+        cout << endl;
+    if (!ok)
+        cout << lock.report;
+    cout << lock.count << " instructions, " << lock.divergences
+         << " divergences";
+    if (cpu.running)
+        cout << ((lock.count >= limit) ? ", stopped at limit" : ", stopped");
+    cout << endl;
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    option::OptionParser  op("Usage: i8080_lockstep [options] [program.COM...]");
+    auto help_opt = op.add<option::OptionSwitch>("h", "help", "Show this help message");
+    auto verb_opt = op.add<option::OptionSwitch>("v", "verbose", "Show guest console output");
+    auto keep_opt = op.add<option::OptionSwitch>("k", "keep-going",
+                       "Resynchronize after a divergence and continue");
+    auto m85_opt = op.add<option::OptionSwitch>("5", "8085", "Run named programs as 8085");
+    auto blk_opt = op.add<option::OptionValue<uint64_t>>("b", "block",
+                       "Instructions between compares", 1);
+    auto lim_opt = op.add<option::OptionValue<uint64_t>>("l", "limit",
+                       "Maximum instructions per program", 100000000000ull);
+    auto psw_opt = op.add<option::OptionValue<int>>("p", "psw-mask",
+                       "PSW bits to compare, default all on 8080 and documented on 8085", -1);
+    auto dir_opt = op.add<option::OptionValue<string>>("d", "dir",
+                       "Directory holding .COM files", string(LOCKSTEP_DIR));
+
+    try {
+        op.parse(argc, argv);
+    } catch (std::exception &e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+    if (!op.unknown_options().empty()) {
+        cerr << "Unknown option: " << op.unknown_options()[0] << endl;
+        cerr << op.help() << endl;
+        return 1;
+    }
+    if (help_opt->is_set()) {
+        cout << op.help() << endl;
+        return 0;
+    }
+
+    vector<Program>  list;
+    for (auto &name : op.non_option_args()) {
+        Program p{name, m85_opt->is_set() ? I8085 : I8080};
+        for (auto &known : programs) {
+            if (stringCompare(known.file, name))
+                p.model = known.model;
+        }
+        list.push_back(p);
+    }
+    if (list.empty())
+        list.assign(begin(programs), end(programs));
+
+    int  failed = 0;
+    for (auto &prog : list) {
+        vector<uint8_t> image;
+        string          name = prog.file;
+        if (name.find('/') == string::npos)
+            name = dir_opt->getValue() + "/" + name;
+        if (!load_com(name, image)) {
+            cerr << "Unable to read " << name << endl;
+            failed++;
+            continue;
+        }
+        cout << prog.file << " (" << ((prog.model == I8085) ? "8085" : "8080") << ")" << endl;
+        bool ok;
+        if (prog.model == I8085)
+            ok = run_program<I8085>(image, lim_opt->getValue(), blk_opt->getValue(),
+                                    psw_opt->getValue(), keep_opt->is_set(),
+                                    verb_opt->is_set());
+        else
+            ok = run_program<I8080>(image, lim_opt->getValue(), blk_opt->getValue(),
+                                    psw_opt->getValue(), keep_opt->is_set(),
+                                    verb_opt->is_set());
+        if (!ok)
+            failed++;
+    }
+    return (failed == 0) ? 0 : 1;
+}
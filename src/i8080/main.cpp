@@ -20,8 +20,10 @@
 #include "config.h"
 #include <iostream>
 #include <fstream>
+#include <vector>
 #include <chrono>
 #include <variant>
+#include <type_traits>
 #include <stdio.h>
 #include <stdlib.h>
 #ifdef HAVE_UNISTD_H
@@ -31,9 +33,16 @@
 #include "i8080_system.h"
 #include "i8080_cpu.h"
 #include "i8080_con.h"
+#include "i8080_mux.h"
+#include "i8080_bdos.h"
+#include "i8080_disk.h"
 #include "RAM.h"
+#include "ROM.h"
 #include "IO.h"
+#include "Migration.h"
+#include "SharedImage.h"
 #include "ConfigOption.h"
+#include "Options.h"
 
 
 using namespace emulator;
@@ -64,13 +73,135 @@ void load_mem(string name, shared_ptr<Memory<uint8_t>> mem)
 }
 
 
-void test_system()
+/**
+ * @brief Load the images once and hand them to every worker that connects.
+ * @param path - Unix socket to listen on.
+ */
+void serve_images(const string &path)
+{
+    core::ImageSet  images;
+    int             sock;
+
+    images.load("gb01.bin", "gb01.bin", 2048);
+    sock = core::Migration::listen(path);
+    cerr << "Serving images on " << path << endl;
+    for (;;) {
+        int  conn = core::Migration::accept(sock);
+        try {
+            images.send(conn);
+        } catch (core::SystemError &e) {
+            cerr << e.get_message() << endl;
+        }
+        close(conn);
+    }
+}
+
+/**
+ * @brief Settings for test_system() and run_cpm() from the command line.
+ */
+struct RunOptions {
+    string  record;           // Record console input to file.
+    string  replay;           // Replay console input from file.
+    string  images;           // Socket to map images from.
+    string  listen;           // Address to serve the console on.
+    string  input;            // Headless console input.
+    string  output;           // Headless console output.
+    string  script;           // Expect script driving the console.
+    string  disk;             // Image to mount on drive 0.
+    bool    disk_ro = false;  // Mount it read only.
+    string  profile;          // Write hot spots here at exit.
+    string  flamegraph;       // Write collapsed call stacks here at exit.
+    string  sym;              // Symbols for the profile.
+};
+
+/**
+ * @brief Load the symbols for a profiled CPU before it runs.
+ */
+template <class CPU_T>
+void start_profile(CPU_T &cpu, const RunOptions &opts)
+{
+    if (!opts.sym.empty() && !cpu.profile.load_sym(opts.sym))
+        throw core::SystemError{"Unable to read symbols " + opts.sym};
+}
+
+/**
+ * @brief Write the profile of a CPU that has stopped.
+ */
+template <class CPU_T>
+void write_profile(CPU_T &cpu, const RunOptions &opts)
+{
+    if (!opts.profile.empty()) {
+        ofstream  out(opts.profile);
+        if (!out.is_open())
+            throw core::SystemError{"Unable to create " + opts.profile};
+        cpu.dump_profile(out, 40);
+    }
+    if constexpr (is_same_v<decltype(cpu.profile), i8080_callgraph>) {
+        if (!opts.flamegraph.empty()) {
+            ofstream  out(opts.flamegraph);
+            if (!out.is_open())
+                throw core::SystemError{"Unable to create " + opts.flamegraph};
+            cpu.profile.write_collapsed(out);
+        }
+    }
+}
+
+/**
+ * @brief Run a CP/M program with the BDOS emulated on the host, files
+ *     are in the current directory.
+ * @param program Name of the .COM file.
+ * @param args Arguments for the command tail.
+ * @param opts Profiling settings.
+ * @return 1 if the program set a failing return code, else 0.
+ */
+template <class PROF>
+int run_cpm(const string &program, const vector<string> &args,
+            const RunOptions &opts)
+{
+    auto                cpu = make_shared<i8080_cpu<I8080, PROF>>();
+    auto                mem = make_shared<MemFixed<uint8_t>>(64*1024, 0);
+    auto                bdos = make_shared<i8080_bdos>(".");
+
+    mem->addMemory(make_shared<RAM<uint8_t>>(64*1024, 0));
+    bdos->setCPU(cpu.get());
+    bdos->setMemory(mem);
+    cpu->setMem(mem);
+    cpu->setIO(bdos);
+    bdos->install();
+    if (!bdos->loadProgram(program))
+        throw core::SystemError{"Unable to load " + program};
+    bdos->setCommand(args);
+    // Return from the program goes to the warm boot at 0.
+    cpu->start();
+    cpu->sp = i8080_bdos::default_base - 2;
+    mem->write(0, cpu->sp);
+    mem->write(0, cpu->sp + 1);
+    cpu->setPC(0x100);
+    cpu->running = true;
+    if constexpr (PROF::enabled)
+        start_profile(*cpu, opts);
+    while (cpu->running)
+        cpu->step();
+    bdos->shutdown();
+    if constexpr (PROF::enabled)
+        write_profile(*cpu, opts);
+    return (bdos->returnCode() >= 0xff00) ? 1 : 0;
+}
+
+/**
+ * @brief Build and run the system, PROF picks the CPU's profiling policy.
+ * @return Exit status, when headless the A register at halt, or 0 if
+ *     input ran out while the guest waited for more. A script that fails
+ *     gives 1.
+ */
+template <class PROF>
+int test_system(const RunOptions &opts)
 {
 
     // Create top level system object.
     shared_ptr<core::System> sys = core::System::create("i8080");
     // Create CPU and some memory.
-    core::CPU_v      cpu_v = sys->create_cpu("I8080");
+    core::CPU_v      cpu_v;
     core::MEM_v      ram_v = sys->create_mem("RAM", 62*1024, 0);
     core::MEM_v      rom_v = sys->create_mem("ROM", 2048, 0xf800);
     core::DEV_v      con_v = sys->create_dev("2651");
@@ -78,9 +209,15 @@ void test_system()
     uint64_t         n_inst = 0;
     core::CmdHistory c_hist(sys);
 
+    // A profiled CPU is not one of the registered models.
+    if constexpr (PROF::enabled)
+        cpu_v = make_shared<i8080_cpu<I8080, PROF>>();
+    else
+        cpu_v = sys->create_cpu("I8080");
+
     // Get pointers to specific classes, to simplify things.
     shared_ptr<CPU<uint8_t>> cpu = get<shared_ptr<CPU<uint8_t>>>(cpu_v);
-    shared_ptr<i8080_cpu<I8080>> cpu_8 = dynamic_pointer_cast<i8080_cpu<I8080>>(cpu);
+    auto             cpu_8 = dynamic_pointer_cast<i8080_cpu<I8080, PROF>>(cpu);
     shared_ptr<Memory<uint8_t>> rom_m = get<shared_ptr<Memory<uint8_t>>>(rom_v);
     // Set up chunk size for memory access.
     cpu_8->page_size = 2048;
@@ -90,6 +227,14 @@ void test_system()
     shared_ptr<Device<uint8_t>> con = get<shared_ptr<Device<uint8_t>>>(con_v);
     shared_ptr<i8080_2651> con_m = dynamic_pointer_cast<i8080_2651>(con);
     con_m->setCPU(cpu);
+    con_m->record_file = opts.record;
+    con_m->replay_file = opts.replay;
+    con_m->listen_addr = opts.listen;
+    con_m->input_file = opts.input;
+    con_m->output_file = opts.output;
+    con_m->script_file = opts.script;
+    bool headless = !opts.input.empty() || !opts.output.empty() ||
+                    !opts.script.empty();
     // Set the names on the objects.
     core::MemInfo    ram_info{ram_v, {"cpu"}};
     core::MemInfo    rom_info{rom_v, {"cpu"}};
@@ -100,12 +245,34 @@ void test_system()
     sys->addMemory(ram_info);
     sys->addMemory(rom_info);
     sys->addDevice(con_info);
+    // Disk controller at 60h when there is something to mount.
+    if (!opts.disk.empty()) {
+        core::DEV_v  disk_v = sys->create_dev("disk");
+        auto         disk_m = dynamic_pointer_cast<i8080_disk>(
+                                  get<shared_ptr<Device<uint8_t>>>(disk_v));
+        disk_m->setAddress(0x60);
+        disk_m->mount_file[0] = opts.disk;
+        disk_m->ro[0] = opts.disk_ro;
+        sys->addDevice(core::DevInfo{disk_v, {}});
+    }
 
-    // Load rom with monitor.
-    load_mem("gb01.bin", rom_m);
+    // Load rom with monitor, or map the copy the supervisor holds.
+    if (opts.images.empty()) {
+        load_mem("gb01.bin", rom_m);
+    } else {
+        int             fd = core::Migration::connect(opts.images);
+        core::ImageSet  images = core::ImageSet::receive(fd);
+        close(fd);
+        auto            rom = dynamic_pointer_cast<ROM<uint8_t>>(rom_m);
+        auto            image = images.find("gb01.bin");
+        if (!image)
+            throw core::SystemError{"Supervisor has no gb01.bin"};
+        rom->map(image);
+    }
     // Final initialization.
     sys->init();
-    c_hist.init();
+    if (opts.replay.empty() && !headless)
+        c_hist.init();
     cpu->setPC(0xf800);
     sys->start();
     cpu->running = true;
@@ -113,22 +280,127 @@ void test_system()
     visit([](const auto& obj) {
         obj->Set(0166, 0);
     }, ram_v);
+    if constexpr (PROF::enabled)
+        start_profile(*cpu_8, opts);
 
     while(cpu->running) {
     //    cpu->trace();
         tim += cpu->step();
         n_inst++;
     }
-    cout << endl;
+    if (!headless)
+        cout << endl;
     cerr << "Stoping system " << endl;
     cpu->stop();
     cerr << "Shutting down system "<< endl;
     cpu->shutdown();
     cerr << "Exit" << endl;
+    if constexpr (PROF::enabled)
+        write_profile(*cpu_8, opts);
+    if (con_m->script().failed()) {
+        cerr << con_m->script().error() << endl;
+        return 1;
+    }
+    if (!headless || con_m->input_ended())
+        return 0;
+    return cpu_8->regs[A];
 }
 
 int main(int argc, char **argv)
 {
-    test_system();
-    return 0;
+    option::OptionParser  op("Usage: i8080 [options]");
+    auto help_opt = op.add<option::OptionSwitch>("h", "help", "Show this help message");
+    auto rec_opt = op.add<option::OptionValue<string>>("r", "record",
+                       "Record console input to file", "");
+    auto rep_opt = op.add<option::OptionValue<string>>("p", "replay",
+                       "Replay console input from file, no terminal is used", "");
+    auto serve_opt = op.add<option::OptionValue<string>>("s", "serve-images",
+                       "Load images once and serve them on a socket", "");
+    auto img_opt = op.add<option::OptionValue<string>>("i", "images",
+                       "Map images served on a socket instead of loading them", "");
+    auto lis_opt = op.add<option::OptionValue<string>>("l", "listen",
+                       "Serve the console on telnet:[host:]port, tcp:[host:]port or unix:path", "");
+    auto batch_opt = op.add<option::OptionSwitch>("b", "batch",
+                       "Run headless on stdin and stdout, exit with A at halt");
+    auto in_opt = op.add<option::OptionValue<string>>("I", "input",
+                       "Run headless reading console input from file", "");
+    auto out_opt = op.add<option::OptionValue<string>>("O", "output",
+                       "Run headless writing console output to file", "");
+    auto exp_opt = op.add<option::OptionValue<string>>("e", "script",
+                       "Run headless typing console input from an expect script", "");
+    auto mount_opt = op.add<option::OptionValue<string>>("m", "mount",
+                       "Mount a disk image on drive 0 of the disk controller", "");
+    auto ro_opt = op.add<option::OptionSwitch>("", "ro",
+                       "Mount the disk image read only, it may be shared");
+    auto cpm_opt = op.add<option::OptionValue<string>>("c", "cpm",
+                       "Run a CP/M program, the rest of the line is its arguments, files are in the current directory", "");
+    auto prof_opt = op.add<option::OptionValue<string>>("P", "profile",
+                       "Profile the guest, write the hot opcodes and addresses to file at exit", "");
+    auto flame_opt = op.add<option::OptionValue<string>>("F", "flamegraph",
+                       "Write guest call stacks in collapsed form for flamegraph.pl to file at exit", "");
+    auto sym_opt = op.add<option::OptionValue<string>>("S", "sym",
+                       "Name profiled addresses from a CP/M .SYM file", "");
+
+    try {
+        op.parse(argc, argv);
+    } catch (std::exception &e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+    if (!op.unknown_options().empty()) {
+        cerr << "Unknown option: " << op.unknown_options()[0] << endl;
+        cerr << op.help() << endl;
+        return 1;
+    }
+    if (help_opt->is_set()) {
+        cout << op.help() << endl;
+        return 0;
+    }
+    try {
+        if (!serve_opt->getValue().empty())
+            serve_images(serve_opt->getValue());
+        RunOptions  opts;
+        opts.record = rec_opt->getValue();
+        opts.replay = rep_opt->getValue();
+        opts.images = img_opt->getValue();
+        opts.listen = lis_opt->getValue();
+        opts.input = in_opt->getValue();
+        opts.output = out_opt->getValue();
+        opts.script = exp_opt->getValue();
+        opts.disk = mount_opt->getValue();
+        opts.disk_ro = ro_opt->is_set();
+        opts.profile = prof_opt->getValue();
+        opts.flamegraph = flame_opt->getValue();
+        opts.sym = sym_opt->getValue();
+        if (batch_opt->is_set()) {
+            if (opts.input.empty())
+                opts.input = "-";
+            if (opts.output.empty())
+                opts.output = "-";
+        }
+        // Call graph keeps the flat profile as well.
+        string  cpm = cpm_opt->getValue();
+        if (!opts.flamegraph.empty()) {
+            if (!cpm.empty())
+                return run_cpm<i8080_callgraph>(cpm, op.non_option_args(), opts);
+            return test_system<i8080_callgraph>(opts);
+        }
+        if (!opts.profile.empty()) {
+            if (!cpm.empty())
+                return run_cpm<i8080_profile>(cpm, op.non_option_args(), opts);
+            return test_system<i8080_profile>(opts);
+        }
+        if (!cpm.empty())
+            return run_cpm<i8080_noprofile>(cpm, op.non_option_args(), opts);
+        return test_system<i8080_noprofile>(opts);
+    } catch (core::Log_error &e) {
+        cerr << e.get_message() << endl;
+        return 1;
+    } catch (core::SystemError &e) {
+        cerr << e.get_message() << endl;
+        return 1;
+    } catch (core::Script_error &e) {
+        cerr << e.get_message() << endl;
+        return 1;
+    }
 }
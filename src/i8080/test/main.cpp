@@ -21,13 +21,28 @@
 #include <iostream>
 #include <fstream>
 #include <chrono>
+#include <thread>
 #include <stdio.h>
 #include <stdlib.h>
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
 #endif
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
 #include "i8080_system.h"
 #include "i8080_cpu.h"
+#include "i8080_stub.h"
+#include "lockstep/i8080_ref.h"
+#include "lockstep/lockstep.h"
+#include "i8080_reverse.h"
+#include "i8080_mux.h"
+#include "i8080_con.h"
+#include "i8080_bdos.h"
+#include "i8080_disk.h"
+#include "State.h"
+#include "Migration.h"
 #include "RAM.h"
 #include "IO.h"
 #include "ConfigOption.h"
@@ -48,11 +63,12 @@ string dir;
  * @file main.cpp
  * @brief BDOS emulator for test framework.
  */
-class bdos : public IO<uint8_t>
+template <class CPU_T>
+class bdos_t : public IO<uint8_t>
 {
 public:
 
-    i8080_cpu<I8080>              *cpu;
+    CPU_T                         *cpu;
     shared_ptr<MemFixed<uint8_t>>  mem;
 
     virtual void init() {};
@@ -77,7 +93,7 @@ public:
         if (port == 1) {
             switch(cpu->regs[C]) {
             case 9:   // output
-                addr = cpu->regpair<DE>();
+                addr = cpu->template regpair<DE>();
                 do {
                     mem->read(data, addr++);
                     // data = mem[addr++] & 0x7f;
@@ -102,6 +118,8 @@ private:
 
 };
 
+using bdos = bdos_t<i8080_cpu<I8080>>;
+
 //  5: 171         mov a,c
 //  6: 376 002     cpi 2
 // 10: 302 017 000 jnz .+4
@@ -401,6 +419,878 @@ TEST(CPU,TST8080)
     delete cpu;
 }
 
+TEST(CPU, Profile)
+{
+    uint64_t  tim = 0;
+    uint64_t  n_inst = 0;
+    i8080_cpu<I8080, i8080_profile> *cpu;
+    auto      io = std::make_shared<bdos_t<i8080_cpu<I8080, i8080_profile>>>();
+    std::shared_ptr<MemFixed<uint8_t>> mem = std::make_shared<MemFixed<uint8_t>>(64*1024, 0);
+    mem->addMemory(std::make_shared<RAM<uint8_t>>(64 * 1024, 0));
+
+    cpu = new i8080_cpu<I8080, i8080_profile>();
+    io->cpu = cpu;
+    io->mem = mem;
+    cpu->setMem(mem);
+    load_mem("TST8080.COM", mem);
+    cpu->setIO(io);
+    cpu->start();
+    cpu->setPC(0x100);
+    cpu->running = true;
+
+    mem->Set(0166, 0);    // Inject halt opcode.
+    for (size_t i = 0; i < sizeof(bdos_buffer); i++) {
+        mem->Set(bdos_buffer[i], i+5);
+    }
+
+    istringstream sym("0005 BDOS\t0100 START\r\n\032 0200 JUNK");
+    CHECK_EQUAL(2u, cpu->profile.load_sym(sym));
+
+    while(cpu->running) {
+        tim += cpu->step();
+        n_inst++;
+    }
+    cout << endl;
+    cpu->stop();
+    CHECK_EQUAL (cpu->pc, 1u);
+    // Every instruction and cycle should be accounted for.
+    CHECK_EQUAL(n_inst, cpu->profile.total_count());
+    CHECK_EQUAL(tim, cpu->profile.total_cycles());
+    // Halt at 0 is executed exactly once.
+    CHECK_EQUAL(1u, cpu->profile.pc_count[0]);
+    CHECK_EQUAL(1u, cpu->profile.op_count[0166]);
+    CHECK_EQUAL(string("BDOS+3"), cpu->profile.symbol(8));
+    CHECK_EQUAL(string("0004"), cpu->profile.symbol(4));
+    vector<uint16_t> spots = cpu->profile.hot_spots(10);
+    CHECK(spots.size() > 0);
+    CHECK(cpu->profile.pc_count[spots[0]] >= cpu->profile.pc_count[spots.back()]);
+    ostringstream  dump;
+    cpu->dump_profile(dump, 10);
+    CHECK_EQUAL(0u, dump.str().find("Instructions: " + to_string(n_inst)));
+    CHECK(dump.str().find("Address") != string::npos);
+    delete cpu;
+}
+
+TEST(CPU, CallGraph)
+{
+    uint64_t  tim = 0;
+    i8080_cpu<I8080, i8080_callgraph> *cpu;
+    auto      io = std::make_shared<bdos_t<i8080_cpu<I8080, i8080_callgraph>>>();
+    std::shared_ptr<MemFixed<uint8_t>> mem = std::make_shared<MemFixed<uint8_t>>(64*1024, 0);
+    mem->addMemory(std::make_shared<RAM<uint8_t>>(64 * 1024, 0));
+
+    cpu = new i8080_cpu<I8080, i8080_callgraph>();
+    io->cpu = cpu;
+    io->mem = mem;
+    cpu->setMem(mem);
+    load_mem("TST8080.COM", mem);
+    cpu->setIO(io);
+    cpu->start();
+    cpu->setPC(0x100);
+    cpu->running = true;
+
+    mem->Set(0166, 0);    // Inject halt opcode.
+    for (size_t i = 0; i < sizeof(bdos_buffer); i++) {
+        mem->Set(bdos_buffer[i], i+5);
+    }
+
+    istringstream sym("0005 BDOS 0100 START");
+    cpu->profile.load_sym(sym);
+
+    while(cpu->running) {
+        tim += cpu->step();
+    }
+    cout << endl;
+    cpu->stop();
+    CHECK_EQUAL (cpu->pc, 1u);
+    CHECK(cpu->profile.paths() > 1);
+
+    // Each line is "path time", times should add up to total run time.
+    stringstream  out;
+    string        line;
+    uint64_t      total = 0;
+    bool          bdos_call = false;
+    cpu->profile.write_collapsed(out);
+    while (getline(out, line)) {
+        size_t  sp = line.rfind(' ');
+        CHECK(sp != string::npos);
+        CHECK_EQUAL(0u, line.find("START"));
+        total += stoull(line.substr(sp + 1));
+        if (line.find(";BDOS ") != string::npos)
+            bdos_call = true;
+    }
+    CHECK_EQUAL(tim, total);
+    CHECK(bdos_call);
+    delete cpu;
+}
+
+/**
+ * @class quiet_io
+ * @author rich
+ * @date 18/10/26
+ * @file main.cpp
+ * @brief Accepts and discards all output.
+ */
+class quiet_io : public IO<uint8_t>
+{
+public:
+    virtual bool output([[maybe_unused]]uint8_t val, [[maybe_unused]]size_t port)
+    {
+        return true;
+    }
+};
+
+TEST(CPU, Lockstep)
+{
+    vector<uint8_t>  image;
+
+    CHECK(load_com("TST8080.COM", image));
+    // Both models should agree on every instruction.
+    {
+        i8080_cpu<I8080>  cpu;
+        i8080_ref         ref(I8080);
+        Lockstep<i8080_cpu<I8080>, i8080_ref> lock(cpu, ref, make_shared<quiet_io>());
+
+        lock.load(image.data(), image.size(), 0x100);
+        lock.poke(0166, 0);
+        lock.load(bdos_stub, sizeof(bdos_stub), 5);
+        cpu.PSW = 2;
+        lock.start(0x100);
+        CHECK(lock.run(1000000));
+        CHECK_EQUAL(0, lock.divergences);
+        CHECK_EQUAL(1u, cpu.pc);
+        CHECK_EQUAL(1u, ref.pc);
+    }
+    {
+        i8080_cpu<I8085>  cpu;
+        i8080_ref         ref(I8085);
+        Lockstep<i8080_cpu<I8085>, i8080_ref> lock(cpu, ref, make_shared<quiet_io>());
+
+        lock.load(image.data(), image.size(), 0x100);
+        lock.poke(0166, 0);
+        lock.load(bdos_stub, sizeof(bdos_stub), 5);
+        lock.psw_mask = SIGN|ZERO|AC|PAR|CARRY;
+        cpu.PSW = 2;
+        lock.start(0x100);
+        CHECK(lock.run(1000000));
+        CHECK_EQUAL(1u, cpu.pc);
+    }
+    // A difference in state should be found and reported.
+    {
+        i8080_cpu<I8080>  cpu;
+        i8080_ref         ref(I8080);
+        Lockstep<i8080_cpu<I8080>, i8080_ref> lock(cpu, ref, make_shared<quiet_io>());
+
+        lock.load(image.data(), image.size(), 0x100);
+        lock.poke(0166, 0);
+        lock.load(bdos_stub, sizeof(bdos_stub), 5);
+        cpu.PSW = 2;
+        lock.start(0x100);
+        CHECK(lock.run(10));
+        ref.regs[A] ^= 0x10;
+        CHECK_FALSE(lock.run(1000000));
+        CHECK_EQUAL(1, lock.divergences);
+        CHECK(lock.report.find("Divergence after 11 instructions: A") == 0);
+        cout << lock.report;
+    }
+}
+
+/**
+ * @class count_io
+ * @author rich
+ * @date 18/10/26
+ * @file main.cpp
+ * @brief Each input returns the next number, so a re-executed IN only gets
+ *     the same value if it is replayed.
+ */
+class count_io : public IO<uint8_t>
+{
+public:
+    virtual bool input(uint8_t &val, [[maybe_unused]]size_t port)
+    {
+        val = next++;
+        return true;
+    }
+
+    uint8_t next = 0x40;
+};
+
+// 100: 061 000 360  lxi  sp,0f000h
+// 103: 333 020      in   10h
+// 105: 062 000 040  sta  2000h
+// 108: 041 000 060  lxi  h,3000h
+// 10b: 167          mov  m,a
+// 10c: 043          inx  h
+// 10d: 074          inr  a
+// 10e: 302 013 001  jnz  010bh
+// 111: 305          push b
+// 112: 301          pop  b
+// 113: 303 003 001  jmp  0103h
+static const uint8_t reverse_prog[] = {
+    0061, 0000, 0360, 0333, 0020, 0062, 0000, 0040, 0041, 0000, 0060,
+    0167, 0043, 0074, 0302, 0013, 0001, 0305, 0301, 0303, 0003, 0001
+};
+
+TEST(CPU, Reverse)
+{
+    i8080_cpu<I8080>  cpu;
+    auto              fixed = make_shared<MemFixed<uint8_t>>(64*1024, 0);
+
+    fixed->addMemory(make_shared<RAM<uint8_t>>(64*1024, 0));
+    cpu.setMem(fixed);
+    cpu.setIO(make_shared<count_io>());
+    for (size_t i = 0; i < sizeof(reverse_prog); i++)
+        fixed->Set(reverse_prog[i], 0x100 + i);
+    cpu.PSW = 2;
+    cpu.sp = 0;
+    cpu.ie = false;
+    for (auto &r : cpu.regs)
+        r = 0;
+    cpu.setPC(0x100);
+    cpu.running = true;
+
+    // Small budget so checkpoints get thinned.
+    i8080_reverse<i8080_cpu<I8080>> rev(cpu, 96*1024, 20000);
+    vector<uint16_t>  pcs;
+    vector<uint8_t>   acc;
+    vector<uint8_t>   mem2000;
+    vector<uint8_t>   image(64*1024);
+    const uint64_t    total = 200000;
+    for (uint64_t i = 0; i < total; i++) {
+        pcs.push_back((uint16_t)cpu.pc);
+        acc.push_back(cpu.regs[A]);
+        uint8_t v;
+        fixed->Get(v, 0x2000);
+        mem2000.push_back(v);
+        rev.step();
+    }
+    for (size_t i = 0; i < image.size(); i++)
+        fixed->Get(image[i], i);
+    CHECK(rev.points.interval > 20000);
+    CHECK(rev.points.bytes() <= rev.points.budget);
+    CHECK_EQUAL(0u, rev.oldest());
+
+    // Step back and check registers and memory.
+    CHECK(rev.reverse_step());
+    CHECK_EQUAL(total - 1, rev.count());
+    CHECK_EQUAL(pcs[total - 1], cpu.pc);
+    CHECK_EQUAL(acc[total - 1], cpu.regs[A]);
+    uint64_t points[] = { 0, 1, 12345, 99999, 150000, 7 };
+    for (auto c : points) {
+        rev.seek(c);
+        CHECK_EQUAL(c, rev.count());
+        CHECK_EQUAL(pcs[c], cpu.pc);
+        CHECK_EQUAL(acc[c], cpu.regs[A]);
+        uint8_t v;
+        fixed->Get(v, 0x2000);
+        CHECK_EQUAL(mem2000[c], v);
+    }
+
+    // Back to the newest point, input must have been replayed.
+    rev.seek(total);
+    for (size_t i = 0; i < image.size(); i++) {
+        uint8_t v;
+        fixed->Get(v, i);
+        if (v != image[i])
+            FAIL("Memory differs after replay");
+    }
+
+    // Last write of 2000 is the STA at 105.
+    CHECK(rev.last_write(0x2000));
+    CHECK_EQUAL(0x105u, cpu.pc);
+    uint64_t last = total;
+    while (pcs[--last] != 0x105);
+    CHECK_EQUAL(last, rev.count());
+
+    // Last time at 111.
+    rev.breakpoints.insert(0x111);
+    CHECK(rev.reverse_continue());
+    while (pcs[--last] != 0x111);
+    CHECK_EQUAL(last, rev.count());
+    CHECK_EQUAL(0x111u, cpu.pc);
+    rev.breakpoints.clear();
+    rev.breakpoints.insert(0x200);
+    CHECK_FALSE(rev.reverse_continue());
+    CHECK_EQUAL(last, rev.count());
+    CHECK_FALSE(rev.last_write(0x4000));
+
+    // Running forward past the newest point goes live again.
+    rev.seek(total + 1000);
+    CHECK_EQUAL(total + 1000, rev.head());
+}
+
+TEST(CPU, SaveState)
+{
+    i8080_cpu<I8080>  cpu;
+    auto              fixed = make_shared<MemFixed<uint8_t>>(64*1024, 0);
+    auto              ram = make_shared<RAM<uint8_t>>(64*1024, 0);
+    auto              io = make_shared<count_io>();
+
+    fixed->addMemory(ram);
+    cpu.setMem(fixed);
+    cpu.setIO(io);
+    for (size_t i = 0; i < sizeof(reverse_prog); i++)
+        fixed->Set(reverse_prog[i], 0x100 + i);
+    cpu.PSW = 2;
+    cpu.sp = 0;
+    cpu.ie = false;
+    for (auto &r : cpu.regs)
+        r = 0;
+    cpu.setPC(0x100);
+    cpu.running = true;
+    for (int i = 0; i < 5000; i++)
+        cpu.step();
+
+    stringstream      state;
+    core::StateOut    out(state);
+    cpu.save(out);
+    ram->save(out);
+    uint8_t           next = io->next;
+
+    vector<uint16_t>  pcs;
+    vector<uint8_t>   acc;
+    for (int i = 0; i < 5000; i++) {
+        cpu.step();
+        pcs.push_back((uint16_t)cpu.pc);
+        acc.push_back(cpu.regs[A]);
+    }
+
+    // Scramble everything, then restore and run the same steps again.
+    ram->release();
+    cpu.sp = 0x1234;
+    cpu.PSW = 0;
+    cpu.setPC(0);
+    core::StateIn     in(state);
+    cpu.load(in);
+    ram->load(in);
+    io->next = next;
+    for (int i = 0; i < 5000; i++) {
+        cpu.step();
+        CHECK_EQUAL(pcs[i], cpu.pc);
+        CHECK_EQUAL(acc[i], cpu.regs[A]);
+    }
+    CHECK_THROWS(core::State_error, ram->load(in));
+}
+
+// Program for migration, keeps adding one to every location from 1000h
+// up so pages are written all the time.
+// 000: 041 000 020  lxi  h,1000h
+// 003: 064          inr  m
+// 004: 043          inx  h
+// 005: 174          mov  a,h
+// 006: 366 020      ori  10h
+// 010: 147          mov  h,a
+// 011: 303 003 000  jmp  0003h
+static const uint8_t migrate_prog[] = {
+    0041, 0000, 0020, 0064, 0043, 0174, 0366, 0020, 0147, 0303, 0003, 0000
+};
+
+static shared_ptr<i8080_cpu<I8080>> migrate_cpu(core::System &sys)
+{
+    return dynamic_pointer_cast<i8080_cpu<I8080>>(
+                get<shared_ptr<CPU<uint8_t>>>(sys.getCpu(0)));
+}
+
+TEST(CPU, Migrate)
+{
+    shared_ptr<core::System> src = core::System::create("i8080");
+    core::CPU_v      cpu_v = src->create_cpu("I8080");
+    core::MEM_v      ram_v = src->create_mem("RAM", 64*1024, 0);
+    visit([](const auto& obj) {
+        obj->setName("cpu");
+    }, cpu_v);
+    src->addCpu(cpu_v);
+    src->addMemory(core::MemInfo{ram_v, {"cpu"}});
+    src->init();
+    auto             cpu = migrate_cpu(*src);
+    for (size_t i = 0; i < sizeof(migrate_prog); i++)
+        cpu->mem->Set(migrate_prog[i], i);
+    cpu->setPC(0);
+    cpu->running = true;
+    src->run_quantum(1000000);
+
+    // Send it to a receiver on another thread, as another process would.
+    int              lfd = core::Migration::listen("migrate.sock");
+    shared_ptr<core::System> dst;
+    thread           target([lfd, &dst]() {
+        int  fd = core::Migration::accept(lfd);
+        dst = core::Migration::receive(fd);
+        close(fd);
+    });
+    int              fd = core::Migration::connect("migrate.sock");
+    core::Migration  mig(*src);
+    // Always resend so the running rounds are exercised.
+    mig.pause_bytes = 0;
+    mig.max_rounds = 4;
+    core::MigrateStats stats = mig.send(fd);
+    target.join();
+    close(fd);
+    close(lfd);
+    unlink("migrate.sock");
+    cout << "Migrated in " << stats.rounds << " rounds, " << stats.bytes
+         << " bytes, paused " << stats.downtime_ns / 1000 << " us" << endl;
+    CHECK_EQUAL(4u, stats.rounds);
+    CHECK(stats.final_bytes < 8192);
+
+    // Target must pick up exactly where the source paused.
+    auto             other = migrate_cpu(*dst);
+    for (int pass = 0; pass < 2; pass++) {
+        CHECK_EQUAL(cpu->pc, other->pc);
+        CHECK_EQUAL(cpu->regs[H], other->regs[H]);
+        CHECK_EQUAL(cpu->regs[L], other->regs[L]);
+        CHECK(other->running);
+        int bad = 0;
+        for (size_t a = 0; a < 64*1024; a++) {
+            uint8_t  v1, v2;
+            cpu->mem->read(v1, a);
+            other->mem->read(v2, a);
+            if (v1 != v2)
+                bad++;
+        }
+        CHECK_EQUAL(0, bad);
+        src->run_quantum(100000);
+        dst->run_quantum(100000);
+    }
+}
+
+// Echo program for the mux, adds one to each character typed on line 2.
+// 000: 333 025      in   15h
+// 002: 346 002      ani  2
+// 004: 312 000 000  jz   0
+// 007: 333 024      in   14h
+// 011: 074          inr  a
+// 012: 107          mov  b,a
+// 013: 333 025      in   15h
+// 015: 346 001      ani  1
+// 017: 312 013 000  jz   013h
+// 022: 170          mov  a,b
+// 023: 323 024      out  14h
+// 025: 303 000 000  jmp  0
+static const uint8_t mux_prog[] = {
+    0333, 0025, 0346, 0002, 0312, 0000, 0000, 0333, 0024, 0074, 0107,
+    0333, 0025, 0346, 0001, 0312, 0013, 0000, 0170, 0323, 0024, 0303,
+    0000, 0000
+};
+
+TEST(CPU, Mux)
+{
+    i8080_cpu<I8080>  cpu;
+    auto              ram = make_shared<RAM<uint8_t>>(64*1024, 0);
+    auto              io = make_shared<IO_map<uint8_t>>(256);
+    auto              mux = make_shared<i8080_mux>("mux");
+    char              buf[300];
+
+    mux->setLines(4);
+    mux->setAddress(0x10);
+    io->addDevice(mux);
+    io->init();
+    cpu.setMem(ram);
+    cpu.setIO(io);
+    for (size_t i = 0; i < sizeof(mux_prog); i++)
+        ram->Set(mux_prog[i], i);
+    cpu.setPC(0);
+    cpu.running = true;
+
+    CHECK_EQUAL(3u, mux->receive(2, "abc", 3));
+    for (int i = 0; i < 1000; i++)
+        cpu.step();
+    CHECK_EQUAL(3u, mux->take_output(2, buf, sizeof(buf)));
+    CHECK(memcmp(buf, "bcd", 3) == 0);
+    CHECK_EQUAL(0u, mux->take_output(1, buf, sizeof(buf)));
+    CHECK(mux->waiting());
+
+    // Input beyond the ring is lost and reported.
+    memset(buf, 'x', sizeof(buf));
+    CHECK_EQUAL(64u, mux->receive(1, buf, 100));
+    uint8_t  status;
+    io->input(status, 0x13);
+    CHECK_EQUAL(i8080_mux::rx_ready | i8080_mux::rx_over |
+                i8080_mux::tx_ready | i8080_mux::carrier, status);
+    io->input(status, 0x13);
+    CHECK_EQUAL(0, status & i8080_mux::rx_over);
+    CHECK_FALSE(mux->waiting());
+
+    // Pending input survives a save and load, and a key typed while
+    // loading is not lost but read after it.
+    stringstream      state;
+    core::StateOut    out(state);
+    mux->save(out);
+    uint8_t  ch;
+    for (int i = 0; i < 64; i++)
+        io->input(ch, 0x12);
+    CHECK_EQUAL(1u, mux->receive(1, "w", 1));
+    core::StateIn     in(state);
+    mux->load(in);
+    int      count = 0;
+    for (; count < 100; count++) {
+        io->input(status, 0x13);
+        if ((status & i8080_mux::rx_ready) == 0)
+            break;
+        io->input(ch, 0x12);
+    }
+    CHECK_EQUAL(65, count);
+    CHECK_EQUAL('w', ch);
+    CHECK_EQUAL(8u, mux->getSize());
+}
+
+TEST(CPU, MuxServe)
+{
+    auto              io = make_shared<IO_map<uint8_t>>(256);
+    auto              mux = make_shared<i8080_mux>("mux");
+    sockaddr_un       addr{};
+    int               fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    uint8_t           status = 0;
+    uint8_t           ch = 0;
+    char              buf[16];
+
+    // Each line is served on its own socket, mux.sock0 to mux.sock3.
+    mux->setLines(4);
+    mux->setAddress(0x20);
+    mux->listen_addr = "unix:mux.sock";
+    io->addDevice(mux);
+    io->init();
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, "mux.sock3");
+    CHECK_EQUAL(0, connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)));
+    for (int i = 0; i < 200 && !mux->term(3)->connected(); i++)
+        this_thread::sleep_for(chrono::milliseconds(5));
+    CHECK(mux->term(3)->connected());
+
+    CHECK_EQUAL(1, write(fd, "k", 1));
+    for (int i = 0; i < 200 && (status & i8080_mux::rx_ready) == 0; i++) {
+        this_thread::sleep_for(chrono::milliseconds(5));
+        io->input(status, 0x27);
+    }
+    io->input(ch, 0x26);
+    CHECK_EQUAL('k', ch);
+
+    io->output('o', 0x26);
+    io->output('k', 0x26);
+    mux->service();
+    mux->term(3)->flush();
+    CHECK_EQUAL(2, read(fd, buf, sizeof(buf)));
+    CHECK(memcmp(buf, "ok", 2) == 0);
+    close(fd);
+    core::TermServer::getInstance()->stop();
+}
+
+// Echo characters plus one until a q, then halt with 7 in A.
+// 000: 333 135      in   5dh
+// 002: 346 002      ani  2
+// 004: 312 000 000  jz   0
+// 007: 333 134      in   5ch
+// 011: 376 161      cpi  'q'
+// 013: 312 024 000  jz   024
+// 016: 074          inr  a
+// 017: 323 134      out  5ch
+// 021: 303 000 000  jmp  0
+// 024: 076 007      mvi  a,7
+// 026: 166          hlt
+static const uint8_t batch_prog[] = {
+    0333, 0135, 0346, 0002, 0312, 0000, 0000, 0333, 0134, 0376, 0161,
+    0312, 0024, 0000, 0074, 0323, 0134, 0303, 0000, 0000, 0076, 0007,
+    0166
+};
+
+struct BatchRun {
+    string    out;        // What the guest wrote.
+    uint8_t   a;          // A register when it stopped.
+    bool      ended;      // Input ran out.
+    bool      failed;     // Script failed.
+};
+
+static BatchRun run_batch(const string &input, bool script = false)
+{
+    auto              cpu = make_shared<i8080_cpu<I8080>>();
+    auto              ram = make_shared<RAM<uint8_t>>(64*1024, 0);
+    auto              io = make_shared<IO_map<uint8_t>>(256);
+    auto              con = make_shared<i8080_2651>("con");
+    BatchRun          run;
+
+    ofstream("batch.in", ios::binary) << input;
+    con->setAddress(0x5c);
+    con->setCPU(cpu);
+    if (script)
+        con->script_file = "batch.in";
+    else
+        con->input_file = "batch.in";
+    con->output_file = "batch.out";
+    io->addDevice(con);
+    io->init();
+    cpu->setMem(ram);
+    cpu->setIO(io);
+    for (size_t i = 0; i < sizeof(batch_prog); i++)
+        ram->Set(batch_prog[i], i);
+    cpu->setPC(0);
+    cpu->running = true;
+    for (int i = 0; i < 100000 && cpu->running; i++)
+        cpu->step();
+    con->shutdown();
+    run.a = cpu->regs[A];
+    run.ended = con->input_ended();
+    run.failed = con->script().failed();
+    ifstream          in("batch.out", ios::binary);
+    stringstream      out;
+    out << in.rdbuf();
+    run.out = out.str();
+    unlink("batch.in");
+    unlink("batch.out");
+    return run;
+}
+
+TEST(CPU, Batch)
+{
+    // Halting gives the guest's status.
+    BatchRun  run = run_batch("abcq");
+    CHECK_EQUAL(string("bcd"), run.out);
+    CHECK_EQUAL(7, run.a);
+    CHECK_FALSE(run.ended);
+
+    // Running out of input stops the guest once it waits for more.
+    run = run_batch("ab");
+    CHECK_EQUAL(string("bc"), run.out);
+    CHECK(run.ended);
+}
+
+TEST(CPU, Script)
+{
+    BatchRun  run = run_batch("send \"ab\"\n"
+                              "expect \"bc\"\n"
+                              "capture \"batch.cap\"\n"
+                              "send \"xy\"\n"
+                              "expect \"yz\"\n"
+                              "send \"q\"\n", true);
+    CHECK_EQUAL(string("bcyz"), run.out);
+    CHECK_EQUAL(7, run.a);
+    CHECK_FALSE(run.failed);
+    ifstream      cap("batch.cap", ios::binary);
+    stringstream  text;
+    text << cap.rdbuf();
+    CHECK_EQUAL(string("yz"), text.str());
+    unlink("batch.cap");
+
+    // A prompt that never comes stops the run.
+    run = run_batch("send \"a\"\nexpect \"zz\" timeout 5000\n", true);
+    CHECK_EQUAL(string("b"), run.out);
+    CHECK(run.failed);
+    CHECK_FALSE(run.ended);
+
+    // So does the end of the script, once the guest waits again.
+    run = run_batch("send \"a\"\nexpect \"b\"\n", true);
+    CHECK_FALSE(run.failed);
+    CHECK(run.ended);
+}
+
+// Put a file name in an FCB.
+static void set_fcb(shared_ptr<Memory<uint8_t>> mem, uint16_t fcb,
+                    const char *name)
+{
+    for (int i = 0; i < 36; i++)
+        mem->write(0, fcb + i);
+    for (int i = 0; i < 11; i++)
+        mem->write(name[i], fcb + 1 + i);
+}
+
+TEST(CPU, Bdos)
+{
+    auto              mem = make_shared<RAM<uint8_t>>(64*1024, 0);
+    i8080_bdos        bdos("bdos_dir");
+    stringstream      con;
+    uint8_t           data;
+
+    mkdir("bdos_dir", 0755);
+    {
+        ofstream  f("bdos_dir/hello.txt", ios::binary);
+        for (int i = 0; i < 200; i++)
+            f.put((char)i);
+    }
+    bdos.setMemory(mem);
+    bdos.con_out = &con;
+    bdos.install();
+    mem->read(data, 7);
+    CHECK_EQUAL(0xfe, data);
+
+    // Read back a host file, the last record is padded with ^Z.
+    set_fcb(mem, 0x5c, "HELLO   TXT");
+    CHECK_EQUAL(0, bdos.call(15, 0x5c));
+    mem->read(data, 0x5c + 15);
+    CHECK_EQUAL(2, data);
+    CHECK_EQUAL(0, bdos.call(20, 0x5c));
+    mem->read(data, 0x80 + 127);
+    CHECK_EQUAL(127, data);
+    CHECK_EQUAL(0, bdos.call(20, 0x5c));
+    mem->read(data, 0x80 + 71);
+    CHECK_EQUAL(199, data);
+    mem->read(data, 0x80 + 72);
+    CHECK_EQUAL(0x1a, data);
+    CHECK_EQUAL(1, bdos.call(20, 0x5c));
+    CHECK_EQUAL(0, bdos.call(16, 0x5c));
+
+    // Random access, then the size.
+    mem->write(1, 0x5c + 33);
+    CHECK_EQUAL(0, bdos.call(33, 0x5c));
+    mem->read(data, 0x80);
+    CHECK_EQUAL(128, data);
+    CHECK_EQUAL(0, bdos.call(35, 0x5c));
+    mem->read(data, 0x5c + 33);
+    CHECK_EQUAL(2, data);
+
+    // Write a new file through a different DMA buffer.
+    set_fcb(mem, 0x5c, "OUT     DAT");
+    CHECK_EQUAL(0, bdos.call(22, 0x5c));
+    CHECK_EQUAL(0, bdos.call(26, 0x1000));
+    for (int r = 0; r < 3; r++) {
+        for (int i = 0; i < 128; i++)
+            mem->write((uint8_t)(r + i), 0x1000 + i);
+        CHECK_EQUAL(0, bdos.call(21, 0x5c));
+    }
+    CHECK_EQUAL(0, bdos.call(16, 0x5c));
+    {
+        ifstream  f("bdos_dir/OUT.DAT", ios::binary|ios::ate);
+        CHECK_EQUAL(384, (int)f.tellg());
+    }
+
+    // Search with wild cards, the entry lands in the DMA buffer.
+    set_fcb(mem, 0x5c, "????????TXT");
+    CHECK_EQUAL(0, bdos.call(17, 0x5c));
+    mem->read(data, 0x1000 + 1);
+    CHECK_EQUAL('H', data);
+    mem->read(data, 0x1000 + 15);
+    CHECK_EQUAL(2, data);
+    CHECK_EQUAL(0xff, bdos.call(18, 0x5c));
+
+    // Rename and delete.
+    set_fcb(mem, 0x5c, "OUT     DAT");
+    for (int i = 0; i < 11; i++)
+        mem->write("NEW     DAT"[i], 0x5c + 17 + i);
+    CHECK_EQUAL(0, bdos.call(23, 0x5c));
+    set_fcb(mem, 0x5c, "OUT     DAT");
+    CHECK_EQUAL(0xff, bdos.call(15, 0x5c));
+    set_fcb(mem, 0x5c, "????????DAT");
+    CHECK_EQUAL(0, bdos.call(19, 0x5c));
+    CHECK_EQUAL(0xff, bdos.call(17, 0x5c));
+
+    // Console output and the return code.
+    mem->write('h', 0x2000);
+    mem->write('i', 0x2001);
+    mem->write('$', 0x2002);
+    bdos.call(9, 0x2000);
+    bdos.call(2, '!');
+    CHECK_EQUAL(string("hi!"), con.str());
+    bdos.call(108, 0xff00);
+    CHECK_EQUAL(0xff00, bdos.call(108, 0xffff));
+
+    bdos.shutdown();
+    unlink("bdos_dir/hello.txt");
+    rmdir("bdos_dir");
+}
+
+TEST(CPU, BdosRun)
+{
+    auto              cpu = make_shared<i8080_cpu<I8080>>();
+    auto              mem = make_shared<MemFixed<uint8_t>>(64*1024, 0);
+    auto              bdos = make_shared<i8080_bdos>(".");
+    stringstream      con;
+
+    mem->addMemory(make_shared<RAM<uint8_t>>(64*1024, 0));
+    bdos->setCPU(cpu.get());
+    bdos->setMemory(mem);
+    bdos->con_out = &con;
+    cpu->setMem(mem);
+    cpu->setIO(bdos);
+    bdos->install();
+    CHECK(bdos->loadProgram("tst8080"));
+    cpu->start();
+    cpu->setPC(0x100);
+    cpu->running = true;
+    for (int i = 0; i < 10000000 && cpu->running; i++)
+        cpu->step();
+    CHECK_FALSE(cpu->running);
+    CHECK(con.str().find("CPU IS OPERATIONAL") != string::npos);
+}
+
+// Load the disk registers and give a command.
+static uint8_t disk_cmd(shared_ptr<IO_map<uint8_t>> io, uint8_t cmd,
+                        int unit, int track, int sector, int dma, int count)
+{
+    uint8_t  status;
+
+    io->output(unit, 0x61);
+    io->output(track & 0xff, 0x62);
+    io->output(track >> 8, 0x63);
+    io->output(sector, 0x64);
+    io->output(dma & 0xff, 0x65);
+    io->output(dma >> 8, 0x66);
+    io->output(count, 0x67);
+    io->output(cmd, 0x60);
+    io->input(status, 0x60);
+    return status;
+}
+
+TEST(CPU, Disk)
+{
+    auto              ram = make_shared<RAM<uint8_t>>(64*1024, 0);
+    auto              io = make_shared<IO_map<uint8_t>>(256);
+    auto              disk = make_shared<i8080_disk>("disk");
+    uint8_t           val;
+
+    {
+        // 8 inch single density floppy.
+        ofstream  f("disk0.img", ios::binary);
+        for (int i = 0; i < 77 * 26 * 128; i++)
+            f.put((char)(i / 128));
+    }
+    disk->setAddress(0x60);
+    disk->setMemory(ram);
+    disk->mount_file[0] = "disk0.img";
+    disk->mount_file[1] = "disk0.img";
+    disk->ro[0] = true;
+    disk->ro[1] = true;
+    io->addDevice(disk);
+    io->init();
+    CHECK(disk->image(0) == disk->image(1));
+
+    // Track 2 sector 3 is sector 55, three of them land at 1000h.
+    CHECK_EQUAL(0, disk_cmd(io, i8080_disk::cmd_read, 0, 2, 3, 0x1000, 3));
+    ram->read(val, 0x1000);
+    CHECK_EQUAL(55, val);
+    ram->read(val, 0x1000 + 2 * 128 + 127);
+    CHECK_EQUAL(57, val);
+    ram->read(val, 0x1000 + 3 * 128);
+    CHECK_EQUAL(0, val);
+
+    // Errors.
+    CHECK_EQUAL(i8080_disk::st_error | i8080_disk::st_protect,
+                disk_cmd(io, i8080_disk::cmd_write, 0, 0, 0, 0x1000, 1));
+    CHECK_EQUAL(i8080_disk::st_error | i8080_disk::st_range,
+                disk_cmd(io, i8080_disk::cmd_read, 0, 0, 26, 0x1000, 1));
+    CHECK_EQUAL(i8080_disk::st_error | i8080_disk::st_range,
+                disk_cmd(io, i8080_disk::cmd_read, 0, 76, 25, 0x1000, 2));
+    CHECK_EQUAL(i8080_disk::st_error | i8080_disk::st_not_ready,
+                disk_cmd(io, i8080_disk::cmd_read, 2, 0, 0, 0x1000, 1));
+    // Units past the last do not wrap onto mounted ones.
+    CHECK_EQUAL(i8080_disk::st_error | i8080_disk::st_not_ready,
+                disk_cmd(io, i8080_disk::cmd_read, 4, 0, 0, 0x1000, 1));
+    CHECK_EQUAL(i8080_disk::st_error | i8080_disk::st_not_ready,
+                disk_cmd(io, i8080_disk::cmd_read, 5, 0, 0, 0x1000, 1));
+
+    // Write through a read write mount and read back from the file.
+    disk->shutdown();
+    disk->mount(0, "disk0.img", false);
+    for (int i = 0; i < 256; i++)
+        ram->write(0xe5, 0x2000 + i);
+    CHECK_EQUAL(0, disk_cmd(io, i8080_disk::cmd_write, 0, 1, 0, 0x2000, 2));
+    for (uint64_t i = 0; i < i8080_disk::flush_every; i++)
+        disk->step();
+    CHECK_FALSE(disk->image(0)->dirty());
+    disk->shutdown();
+    ifstream  f("disk0.img", ios::binary);
+    f.seekg(26 * 128 + 255);
+    CHECK_EQUAL(0xe5, f.get());
+    CHECK_EQUAL(28, f.get());
+    unlink("disk0.img");
+}
+
 // run all tests
 int main(int argc, char **argv)
 {